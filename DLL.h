@@ -22,10 +22,15 @@
 #ifndef __LEGACY_DLL_H
 #define __LEGACY_DLL_H
 
+#include "LegacyScaler.h"
+
 void DDrawJoin();
 void DDrawForceDirty();
 void DDrawShowFPS(bool on);
 void DDrawShowFrameTime(bool on);
+void DDrawShowFrameStats(bool on);
+bool DDrawDumpFrameStats(const char* basename);
+void DDrawSetScaleFilter(ScaleFilter filter);
 void DDrawAcquireGdiObjects();
 void DDrawReleaseGdiObjects();
 void DDrawSignalInitComplete();
@@ -34,9 +39,10 @@ void DDrawSetBltOffset(int x, int y);
 bool DDrawInitHooks();
 void DDrawDeInitHooks();
 
+void Win32DumpMessageStats();
+void Win32DumpMessageTrace();
 HWND Win32GetClientHWND();
-POINT Win32LockClientSize();
-void Win32UnlockClientSize();
+POINT Win32GetClientSize(int& integerScale);
 bool Win32SetThreadCount(int nthreads);
 bool Win32InitHooks();
 void Win32DeInitHooks();
@@ -22,21 +22,27 @@
 #include "LegacyWindow.h"
 
 #include <DbgHelp.h>
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
 
 #include "DLL.h"
+#include "LegacyLog.h"
 #include "LegacyTypedefs.h"
 #include "MinHookpp.h"
 
 // ================================================================================================
 
-std::ofstream s_log;
+AsyncLog s_log;
 
 // ================================================================================================
 
 static LONG WINAPI HandleException(EXCEPTION_POINTERS* info)
 {
+    // Nobody is coming back to write the log out later.
+    s_log.synchronous();
     s_log << "Oh fiddlesticks. There was a an unhandled exception." << std::endl;
+    Win32DumpMessageTrace();
+    Win32DumpMessageStats();
 
     // Hopefully things aren't too corrupted for this to work...
     MINIDUMP_EXCEPTION_INFORMATION dump_info;
@@ -64,7 +70,12 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
     switch (fdwReason) {
     case DLL_PROCESS_ATTACH:
     {
-        s_log.open("legacy_window.log", std::ios::out);
+        // The binary log is smaller and cheaper to write, but needs legacy_logdecode to read.
+        const char* format = std::getenv("LEGACY_LOG");
+        if (format && strcmp(format, "binary") == 0)
+            s_log.open("legacy_window.blog", e_logBinary);
+        else
+            s_log.open("legacy_window.log");
         s_log << "Legacy of Time - Windowed Hook" << std::endl << std::endl;
 
         // The really old VC++ runtime seems to install a handler that silently exits.
@@ -103,6 +114,10 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
             s_log << MH_StatusToString(status) << std::endl;
         }
 
+        // The writer thread is already gone if the process is exiting, so there's nothing to join.
+        // If we're just being unloaded, it has to be joined so none of it runs after we're gone.
+        if (lpvReserved != nullptr)
+            s_log.detachWriter();
         s_log.close();
         break;
     }
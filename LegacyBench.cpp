@@ -0,0 +1,2260 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LegacyCursorCache.h"
+#include "LegacyEvent.h"
+#include "LegacyFrameStats.h"
+#include "LegacyLog.h"
+#include "LegacyMessageStats.h"
+#include "LegacyMessageTrace.h"
+#include "LegacyOverlay.h"
+#include "LegacyPipeline.h"
+#include "LegacyPixels.h"
+#include "LegacyPresent.h"
+#include "LegacyRegion.h"
+#include "LegacyScaler.h"
+#include "LegacyStageTiming.h"
+#include "LegacySurfaceHost.h"
+#include "LegacyTileHash.h"
+#include "LegacyTrace.h"
+#include "LegacyTripleBuffer.h"
+#include "LegacyViewTransform.h"
+#include "LegacyWorkers.h"
+#include "LegacyWorkload.h"
+
+#ifdef LEGACY_PIXELS_X86
+#   ifdef _MSC_VER
+#       include <intrin.h>
+#   else
+#       include <x86intrin.h>
+#   endif
+#endif
+
+// ================================================================================================
+
+typedef bool(*FBenchmark)();
+
+struct _Benchmark
+{
+    const char* m_name;
+    FBenchmark m_func;
+};
+
+constexpr size_t FRAME_WIDTH = 640;
+constexpr size_t FRAME_HEIGHT = 480;
+constexpr size_t PIXEL_COUNT = FRAME_WIDTH * FRAME_HEIGHT;
+
+// Keep this in sync with s_gameResolutionOptions in LegacyWin32.cpp
+static const Rect s_outputSizes[] = {
+    { 0, 0, 640, 480 },
+    { 0, 0, 800, 600 },
+    { 0, 0, 1024, 768 },
+    { 0, 0, 1280, 980 },
+    { 0, 0, 1400, 1050 },
+    { 0, 0, 1600, 1200 },
+    { 0, 0, 1920, 1440 },
+    { 0, 0, 2048, 1536 },
+    { 0, 0, 3200, 2400 },
+};
+
+// ================================================================================================
+
+static uint32_t BenchRandom()
+{
+    static uint32_t s_state = 0x1BADB002;
+    s_state ^= s_state << 13;
+    s_state ^= s_state >> 17;
+    s_state ^= s_state << 5;
+    return s_state;
+}
+
+// ================================================================================================
+
+template<typename Func>
+static double BenchMeasure(Func func, size_t iterations = 200)
+{
+    // Best-of-N is much more stable than the mean on a noisy box.
+    double best = 1e30;
+    for (size_t i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(end - start).count();
+        if (elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+// ================================================================================================
+
+template<typename Func>
+static double BenchMeasureCycles(Func func, size_t iterations = 200)
+{
+#ifdef LEGACY_PIXELS_X86
+    uint64_t best = ~0ULL;
+    for (size_t i = 0; i < iterations; ++i) {
+        uint64_t start = __rdtsc();
+        func();
+        uint64_t elapsed = __rdtsc() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    return (double)best;
+#else
+    return 0.0;
+#endif
+}
+
+// ================================================================================================
+
+static bool BenchConvert()
+{
+    size_t count;
+    const PixelConverter* converters = PixelsGetConverters(count);
+
+    // Every kernel must match the reference for all possible input pixels. Run the whole range
+    // at a few misalignments so that the vector bodies and the scalar tails both get exercised.
+    std::vector<uint16_t> allPixels(65536 + 32);
+    std::vector<uint32_t> expected(65536 + 32);
+    std::vector<uint32_t> actual(65536 + 32);
+    bool ok = true;
+    for (size_t offset = 0; offset < 16; ++offset) {
+        for (size_t i = 0; i < 65536; ++i)
+            allPixels[offset + i] = (uint16_t)i;
+        PixelsConvertScalar(expected.data() + offset, allPixels.data() + offset, 65536 - offset);
+
+        for (size_t j = 0; j < count; ++j) {
+            std::fill(actual.begin(), actual.end(), 0xDEADBEEF);
+            converters[j].m_convert(actual.data() + offset, allPixels.data() + offset, 65536 - offset);
+            if (memcmp(actual.data() + offset, expected.data() + offset,
+                       (65536 - offset) * sizeof(uint32_t)) != 0 ||
+                actual[offset + 65536 - offset] != 0xDEADBEEF) {
+                printf("convert: %s MISMATCH at offset %zu\n", converters[j].m_name, offset);
+                ok = false;
+            }
+        }
+    }
+    if (!ok)
+        return false;
+    printf("convert: %zu kernels bit-exact over all 65536 inputs\n", count);
+
+    std::vector<uint16_t> src(PIXEL_COUNT);
+    std::vector<uint32_t> dst(PIXEL_COUNT);
+
+    // The table based converters are sensitive to how much the input repeats, so measure both
+    // noise and something closer to actual game graphics.
+    for (int pattern = 0; pattern < 2; ++pattern) {
+        for (size_t i = 0; i < PIXEL_COUNT; ++i)
+            src[i] = pattern == 0 ? (uint16_t)BenchRandom() : (uint16_t)((i / 7) ^ (BenchRandom() >> 28));
+
+        for (size_t j = 0; j < count; ++j) {
+            auto func = [&]() { converters[j].m_convert(dst.data(), src.data(), PIXEL_COUNT); };
+            double elapsed = BenchMeasure(func);
+            double cycles = BenchMeasureCycles(func);
+            printf("convert: %-6s %-8s %8.3f us/frame %8.1f Mpx/s %6.3f cycles/px\n",
+                   pattern == 0 ? "noise" : "game", converters[j].m_name, elapsed * 1e6,
+                   (PIXEL_COUNT / elapsed) / 1e6, cycles / PIXEL_COUNT);
+        }
+    }
+    printf("convert: selected %s\n", PixelsSelectConverter().m_name);
+    return true;
+}
+
+// ================================================================================================
+
+static Rect BenchRandomRect(int maxSize)
+{
+    int w = 1 + (int)(BenchRandom() % maxSize);
+    int h = 1 + (int)(BenchRandom() % maxSize);
+    int x = (int)(BenchRandom() % (FRAME_WIDTH + 32)) - 16;
+    int y = (int)(BenchRandom() % (FRAME_HEIGHT + 32)) - 16;
+    return { x, y, x + w, y + h };
+}
+
+// ================================================================================================
+
+static bool BenchRegion()
+{
+    // Sanity check: whatever merging happens, every pixel that was added must still be covered.
+    std::vector<uint8_t> added(PIXEL_COUNT);
+    std::vector<uint8_t> covered(PIXEL_COUNT);
+    for (int round = 0; round < 500; ++round) {
+        DirtyRegion region{ FRAME_WIDTH, FRAME_HEIGHT };
+        std::fill(added.begin(), added.end(), 0);
+        std::fill(covered.begin(), covered.end(), 0);
+
+        size_t nrects = 1 + (BenchRandom() % 64);
+        for (size_t i = 0; i < nrects; ++i) {
+            Rect rect = BenchRandomRect(round % 2 ? 48 : 200).intersect(region.extent());
+            region.add(rect);
+            for (int y = rect.top; y < rect.bottom; ++y)
+                for (int x = rect.left; x < rect.right; ++x)
+                    added[y * FRAME_WIDTH + x] = 1;
+        }
+        for (const Rect& rect : region)
+            for (int y = rect.top; y < rect.bottom; ++y)
+                for (int x = rect.left; x < rect.right; ++x)
+                    covered[y * FRAME_WIDTH + x] = 1;
+        for (size_t i = 0; i < PIXEL_COUNT; ++i) {
+            if (added[i] && !covered[i]) {
+                printf("region: LOST DAMAGE in round %d\n", round);
+                return false;
+            }
+        }
+    }
+    printf("region: coverage preserved over 500 random rounds\n");
+
+    // Now, how much does merging cost as the game throws more rects at us per frame?
+    for (size_t nrects : { 1, 4, 16, 64, 256, 1024 }) {
+        for (int maxSize : { 32, 128 }) {
+            std::vector<Rect> rects(nrects);
+            for (Rect& rect : rects)
+                rect = BenchRandomRect(maxSize);
+
+            size_t resultCount = 0;
+            uint32_t resultArea = 0;
+            double elapsed = BenchMeasure([&]() {
+                DirtyRegion region{ FRAME_WIDTH, FRAME_HEIGHT };
+                for (const Rect& rect : rects)
+                    region.add(rect);
+                resultCount = region.size();
+                resultArea = region.area();
+            }, 100);
+            printf("region: %5zu rects up to %3dpx: %9.3f us (%6.1f ns/rect) -> %2zu rects, %5.1f%% of frame\n",
+                   nrects, maxSize, elapsed * 1e6, (elapsed * 1e9) / nrects, resultCount,
+                   (resultArea * 100.0) / PIXEL_COUNT);
+        }
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchTileHash()
+{
+    // The hashes are compared against each other, so every implementation must agree.
+    std::vector<uint16_t> frame(PIXEL_COUNT);
+    for (size_t i = 0; i < PIXEL_COUNT; ++i)
+        frame[i] = (uint16_t)BenchRandom();
+    const FHashTile hashers[] = {
+        TileHashScalar,
+#ifdef LEGACY_PIXELS_X86
+        TileHashSSE2,
+        (PixelsDetectCPU() & e_cpuAVX2) ? TileHashAVX2 : TileHashSSE2,
+#endif
+    };
+    for (int tileSize : { 16, 32, 64, 128 }) {
+        for (int y = 0; y + tileSize <= (int)FRAME_HEIGHT; y += 37) {
+            uint64_t expected = TileHashScalar(frame.data() + y * FRAME_WIDTH, FRAME_WIDTH, tileSize, tileSize);
+            for (FHashTile hasher : hashers) {
+                if (hasher(frame.data() + y * FRAME_WIDTH, FRAME_WIDTH, tileSize, tileSize) != expected) {
+                    printf("tilehash: implementations DISAGREE\n");
+                    return false;
+                }
+            }
+        }
+    }
+    printf("tilehash: all implementations agree\n");
+
+    // Hashing the tile rows out of order on the pool must come to the same conclusion.
+    {
+        WorkerPool workers{ 3 };
+        TileHasher serial{ FRAME_WIDTH, FRAME_HEIGHT, 64 }, pooled{ FRAME_WIDTH, FRAME_HEIGHT, 64 };
+        std::vector<uint16_t> changing = frame;
+        for (size_t round = 0; round < 50; ++round) {
+            for (size_t i = 0; i < 16; ++i)
+                changing[BenchRandom() % PIXEL_COUNT] ^= 1;
+            DirtyRegion a{ FRAME_WIDTH, FRAME_HEIGHT }, b{ FRAME_WIDTH, FRAME_HEIGHT };
+            a.addAll();
+            b.addAll();
+            serial.filter(changing.data(), FRAME_WIDTH, a);
+            pooled.filter(changing.data(), FRAME_WIDTH, b, &workers);
+            if (a.area() != b.area()) {
+                printf("tilehash: pooled filter DISAGREES\n");
+                return false;
+            }
+        }
+    }
+
+    // Now pit hashing against just converting everything. The scenarios are the full frame
+    // being re-reported with nothing changed (idle menus), a cursor-sized change, and a tenth
+    // of the screen changing. Keep in mind that this only counts the conversion -- every tile
+    // thrown away here also skips the upload and the StretchBlt, which cost far more.
+    const PixelConverter& converter = PixelsSelectConverter();
+    std::vector<uint32_t> dst(PIXEL_COUNT);
+    double fullConvert = BenchMeasure([&]() {
+        converter.m_convert(dst.data(), frame.data(), PIXEL_COUNT);
+    });
+    printf("tilehash: baseline full-frame %s convert %8.3f us\n", converter.m_name, fullConvert * 1e6);
+
+    struct { const char* m_name; Rect m_change; } scenarios[] = {
+        { "idle", { 0, 0, 0, 0 } },
+        { "cursor", { 300, 200, 332, 232 } },
+        { "10%", { 0, 0, 640, 48 } },
+    };
+    for (int tileSize : { 16, 32, 64, 128 }) {
+        for (const auto& scenario : scenarios) {
+            TileHasher hasher{ FRAME_WIDTH, FRAME_HEIGHT, tileSize };
+            DirtyRegion damage{ FRAME_WIDTH, FRAME_HEIGHT };
+            damage.addAll();
+            hasher.filter(frame.data(), FRAME_WIDTH, damage);
+
+            size_t nhashed = 0;
+            uint32_t converted = 0;
+            double elapsed = BenchMeasure([&]() {
+                for (int y = scenario.m_change.top; y < scenario.m_change.bottom; ++y)
+                    for (int x = scenario.m_change.left; x < scenario.m_change.right; ++x)
+                        frame[y * FRAME_WIDTH + x] ^= 0x0821;
+                damage.addAll();
+                nhashed = hasher.filter(frame.data(), FRAME_WIDTH, damage);
+                converted = damage.area();
+                for (const Rect& rect : damage)
+                    PixelsConvertRect(converter.m_convert, dst.data(), FRAME_WIDTH, frame.data(),
+                                      FRAME_WIDTH, rect);
+            });
+            printf("tilehash: %3dpx tiles %-6s hashed %4zu tiles, converted %6u px, %8.3f us (%5.1f%% of full convert)\n",
+                   tileSize, scenario.m_name, nhashed, converted, elapsed * 1e6,
+                   (elapsed * 100.0) / fullConvert);
+        }
+    }
+    return true;
+}
+
+// ================================================================================================
+
+struct _StressFrame
+{
+    std::vector<uint32_t> m_pixels;
+    DirtyRegion m_damage{ 64, 64 };
+    uint32_t m_sequence{ 0 };
+};
+
+static bool BenchTripleBuffer()
+{
+    // First, hammer the raw handoff. Every frame is filled with its sequence number, so a torn
+    // frame or one handed back out of order is easy to spot.
+    {
+        constexpr uint32_t FRAMES = 200000;
+        TripleBuffer<_StressFrame> buffer;
+        for (size_t i = 0; i < 3; ++i)
+            buffer[i].m_pixels.resize(4096);
+
+        bool ok = true;
+        uint32_t received = 0;
+        auto begin = std::chrono::high_resolution_clock::now();
+        std::thread consumer([&]() {
+            uint32_t last = 0;
+            while (last != FRAMES) {
+                if (!buffer.take()) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                const _StressFrame& frame = buffer.front();
+                for (uint32_t pixel : frame.m_pixels)
+                    ok &= pixel == frame.m_sequence;
+                ok &= frame.m_sequence > last;
+                last = frame.m_sequence;
+                received++;
+            }
+        });
+
+        uint32_t dropped = 0;
+        for (uint32_t seq = 1; seq <= FRAMES; ++seq) {
+            _StressFrame& frame = buffer.back();
+            std::fill(frame.m_pixels.begin(), frame.m_pixels.end(), seq);
+            frame.m_sequence = seq;
+            dropped += buffer.publish() ? 1 : 0;
+        }
+        consumer.join();
+
+        std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - begin;
+        printf("triplebuffer: %u frames in %.3f ms (%.0f frames/s), consumer saw %u, %u dropped\n",
+               FRAMES, elapsed.count() * 1e3, FRAMES / elapsed.count(), received, dropped);
+        if (!ok || received + dropped != FRAMES) {
+            printf("triplebuffer: ERROR: torn or out of order frames!\n");
+            return false;
+        }
+    }
+
+    // Now check that partial updates plus the damage carried along with dropped frames are
+    // enough for the consumer to keep an exact copy of what the producer drew.
+    {
+        constexpr uint32_t FRAMES = 20000;
+        TripleBuffer<_StressFrame> buffer;
+        for (size_t i = 0; i < 3; ++i)
+            buffer[i].m_pixels.resize(64 * 64);
+        std::vector<uint32_t> truth(64 * 64, 0);
+        std::vector<uint32_t> screen(64 * 64, ~0U);
+
+        auto copyRect = [](std::vector<uint32_t>& dst, const std::vector<uint32_t>& src, const Rect& rect) {
+            for (int y = rect.top; y < rect.bottom; ++y)
+                memcpy(&dst[y * 64 + rect.left], &src[y * 64 + rect.left], rect.width() * sizeof(uint32_t));
+        };
+        auto present = [&]() {
+            const _StressFrame& frame = buffer.front();
+            for (const Rect& rect : frame.m_damage)
+                copyRect(screen, frame.m_pixels, rect);
+            return screen == frame.m_pixels;
+        };
+
+        bool ok = true;
+        std::atomic<bool> finished{ false };
+        std::thread consumer([&]() {
+            while (!finished) {
+                if (buffer.take())
+                    ok &= present();
+                else
+                    std::this_thread::yield();
+            }
+        });
+
+        BufferedDamage bufferedDamage{ 64, 64 };
+        DirtyRegion damage{ 64, 64 };
+        DirtyRegion redraw{ 64, 64 };
+        damage.addAll();
+        for (uint32_t seq = 1; seq <= FRAMES; ++seq) {
+            for (const Rect& rect : damage)
+                for (int y = rect.top; y < rect.bottom; ++y)
+                    std::fill_n(&truth[y * 64 + rect.left], rect.width(), seq);
+
+            _StressFrame& frame = buffer.back();
+            bufferedDamage.prepare(buffer.backIndex(), damage, redraw);
+            for (const Rect& rect : redraw)
+                copyRect(frame.m_pixels, truth, rect);
+            bufferedDamage.publish(buffer.pending(), damage, frame.m_damage);
+            buffer.publish();
+
+            damage.clear();
+            for (uint32_t i = BenchRandom() % 4; i > 0; --i) {
+                int x = BenchRandom() % 56, y = BenchRandom() % 56;
+                damage.add({ x, y, x + 1 + (int)(BenchRandom() % 8), y + 1 + (int)(BenchRandom() % 8) });
+            }
+        }
+        finished = true;
+        consumer.join();
+        if (buffer.take())
+            ok &= present();
+
+        printf("triplebuffer: partial updates %s\n", ok && screen == truth ? "match" : "DO NOT match");
+        if (!ok || screen != truth)
+            return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static void BenchPrintLatencies(const char* bench, const char* name, std::vector<double>& latencies)
+{
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))] * 1e6;
+    };
+    printf("%s: %-14s p50 %9.1f us, p90 %9.1f us, p99 %9.1f us, max %9.1f us\n",
+           bench, name, percentile(0.5), percentile(0.9), percentile(0.99), latencies.back() * 1e6);
+}
+
+// ================================================================================================
+
+static bool BenchWakeup()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    // Measures how long it takes from the game dirtying the surface to the draw thread actually
+    // running. Each round trip waits for the worker to go back to sleep before signaling again,
+    // so every sample is a real wakeup and not a signal that was already sitting there.
+    constexpr size_t EVENT_ROUNDS = 5000;
+    std::vector<double> latencies;
+    latencies.reserve(EVENT_ROUNDS);
+    {
+        Event wake, done;
+        std::atomic<Clock::rep> signaledAt{ 0 };
+        std::atomic<bool> quit{ false };
+        std::thread worker([&]() {
+            while (1) {
+                wake.wait();
+                if (quit)
+                    break;
+                Clock::rep now = Clock::now().time_since_epoch().count();
+                latencies.push_back(std::chrono::duration<double>(Clock::duration(now - signaledAt)).count());
+                done.signal();
+            }
+        });
+
+        for (size_t i = 0; i < EVENT_ROUNDS; ++i) {
+            // Give the worker a chance to actually block.
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+            signaledAt = Clock::now().time_since_epoch().count();
+            wake.signal();
+            done.wait();
+        }
+        quit = true;
+        wake.signal();
+        worker.join();
+    }
+    BenchPrintLatencies("wakeup", "event", latencies);
+
+    // For comparison, this is what the old Sleep(5) polling loop did.
+    constexpr size_t POLL_ROUNDS = 100;
+    latencies.clear();
+    {
+        Event done;
+        std::atomic<Clock::rep> signaledAt{ 0 };
+        std::atomic<bool> dirty{ false }, quit{ false };
+        std::thread worker([&]() {
+            while (!quit) {
+                if (dirty.exchange(false)) {
+                    Clock::rep now = Clock::now().time_since_epoch().count();
+                    latencies.push_back(std::chrono::duration<double>(Clock::duration(now - signaledAt)).count());
+                    done.signal();
+                } else {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                }
+            }
+        });
+
+        for (size_t i = 0; i < POLL_ROUNDS; ++i) {
+            std::this_thread::sleep_for(std::chrono::microseconds(BenchRandom() % 5000));
+            signaledAt = Clock::now().time_since_epoch().count();
+            dirty = true;
+            done.wait();
+        }
+        quit = true;
+        worker.join();
+    }
+    BenchPrintLatencies("wakeup", "sleep(5) poll", latencies);
+
+    // An idle wait must not wake up on its own, and a timed wait must actually time out.
+    Event idle;
+    auto begin = Clock::now();
+    bool signaled = idle.wait(20);
+    std::chrono::duration<double> elapsed = Clock::now() - begin;
+    if (signaled || elapsed.count() < 0.019) {
+        printf("wakeup: ERROR: timed wait returned early!\n");
+        return false;
+    }
+    idle.signal();
+    idle.signal();
+    if (!idle.wait(0) || idle.wait(0)) {
+        printf("wakeup: ERROR: event is not auto-reset!\n");
+        return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+template<typename SetDirty, typename Consume>
+static void BenchContendFlags(const char* name, SetDirty setDirty, Consume consume)
+{
+    // One thread plays the game, marking the surface dirty as fast as it can, while the other
+    // plays the capture thread and keeps consuming it. Only the game side is timed.
+    constexpr size_t MARKS = 2000000;
+    std::atomic<bool> quit{ false };
+    size_t consumed = 0;
+    std::thread consumer([&]() {
+        while (!quit)
+            consumed += consume() ? 1 : 0;
+    });
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < MARKS; ++i)
+        setDirty();
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - begin;
+    quit = true;
+    consumer.join();
+
+    printf("flags: %-7s %6.1f ns per set-dirty, %zu consumed\n",
+           name, (elapsed.count() * 1e9) / MARKS, consumed);
+}
+
+// ================================================================================================
+
+static bool BenchFlags()
+{
+    constexpr uint32_t DIRTY = (1<<0);
+    constexpr uint32_t FORCE = (1<<7);
+
+    {
+        std::mutex mut;
+        uint32_t flags = 0;
+        BenchContendFlags("mutex",
+            [&]() {
+                std::lock_guard<std::mutex> _(mut);
+                flags |= DIRTY;
+            },
+            [&]() {
+                std::lock_guard<std::mutex> _(mut);
+                bool dirty = flags & DIRTY;
+                flags &= ~(DIRTY | FORCE);
+                return dirty;
+            });
+    }
+
+    {
+        std::atomic<uint32_t> flags{ 0 };
+        BenchContendFlags("atomic",
+            [&]() { flags.fetch_or(DIRTY, std::memory_order_release); },
+            [&]() {
+                return (flags.fetch_and(~(DIRTY | FORCE), std::memory_order_acq_rel) & DIRTY) != 0;
+            });
+    }
+
+    // Make sure consuming the dirty bits never eats anything else.
+    std::atomic<uint32_t> flags{ (1<<4) | DIRTY | FORCE };
+    uint32_t prev = flags.fetch_and(~(DIRTY | FORCE));
+    if (prev != ((1<<4) | DIRTY | FORCE) || flags != (1<<4)) {
+        printf("flags: ERROR: dirty consumption clobbered other flags!\n");
+        return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchScale()
+{
+    std::vector<uint32_t> src(PIXEL_COUNT);
+    for (uint32_t& pixel : src)
+        pixel = PixelsConvertOne(BenchRandom() & 0xFFFF);
+
+    // All of the blend kernels have to agree exactly.
+    {
+        std::vector<uint32_t> expected(1024), actual(1024);
+        for (uint32_t weight = 0; weight < 256; weight += 17) {
+            ScaleBlendRowsScalar(expected.data(), src.data(), src.data() + 5000, weight, 1021);
+#ifdef LEGACY_PIXELS_X86
+            uint32_t cpu = PixelsDetectCPU();
+            for (FBlendRows blend : { ScaleBlendRowsSSE2, ScaleBlendRowsAVX2 }) {
+                if (blend == ScaleBlendRowsAVX2 && !(cpu & e_cpuAVX2))
+                    continue;
+                blend(actual.data(), src.data(), src.data() + 5000, weight, 1021);
+                if (memcmp(expected.data(), actual.data(), 1021 * sizeof(uint32_t)) != 0) {
+                    printf("scale: ERROR: blend kernels disagree at weight %u!\n", weight);
+                    return false;
+                }
+            }
+#endif
+        }
+    }
+
+    WorkerPool workers;
+    Scaler scaler;
+    std::vector<uint32_t> full, partial;
+    for (const Rect& size : s_outputSizes) {
+        int width = size.width(), height = size.height();
+        full.resize(width * height);
+        partial.resize(width * height);
+
+        for (int filter = 0; filter < e_scaleFilterCount; ++filter) {
+            scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, width, height, (ScaleFilter)filter);
+            const Rect output{ 0, 0, width, height };
+
+            double serial = BenchMeasure([&]() {
+                scaler.scale(full.data(), width, src.data(), FRAME_WIDTH, output);
+            }, 20);
+            double threaded = BenchMeasure([&]() {
+                scaler.scale(partial.data(), width, src.data(), FRAME_WIDTH, output, workers);
+            }, 20);
+            printf("scale: %4dx%-4d %-14s %8.3f ms, %8.3f ms on %zu threads (%6.1f Mpx/s)\n",
+                   width, height, ScaleFilterName((ScaleFilter)filter), serial * 1e3,
+                   threaded * 1e3, workers.size(), (width * height) / (threaded * 1e6));
+            if (full != partial) {
+                printf("scale: ERROR: threaded output differs!\n");
+                return false;
+            }
+
+            // Only rescaling the mapped damage has to give the same result as doing it all.
+            for (size_t i = 0; i < 8; ++i) {
+                Rect damage = BenchRandomRect(96).intersect({ 0, 0, (int)FRAME_WIDTH, (int)FRAME_HEIGHT });
+                for (int y = damage.top; y < damage.bottom; ++y)
+                    for (int x = damage.left; x < damage.right; ++x)
+                        src[y * FRAME_WIDTH + x] = BenchRandom() & 0xFFFFFF;
+                scaler.scale(partial.data(), width, src.data(), FRAME_WIDTH, scaler.mapRect(damage));
+            }
+            scaler.scale(full.data(), width, src.data(), FRAME_WIDTH, output);
+            if (full != partial) {
+                printf("scale: ERROR: mapped damage misses output pixels!\n");
+                return false;
+            }
+        }
+    }
+
+    // Make sure the bands stitch together even if there are more workers than CPUs.
+    {
+        WorkerPool crowd{ 7 };
+        scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, 1400, 1050, e_scaleSharpBilinear);
+        full.resize(1400 * 1050);
+        partial.resize(1400 * 1050);
+        for (size_t i = 0; i < 50; ++i) {
+            scaler.scale(full.data(), 1400, src.data(), FRAME_WIDTH, { 0, 0, 1400, 1050 });
+            scaler.scale(partial.data(), 1400, src.data(), FRAME_WIDTH, { 0, 0, 1400, 1050 }, crowd);
+            if (full != partial) {
+                printf("scale: ERROR: threaded output differs with %zu threads!\n", crowd.size());
+                return false;
+            }
+            src[BenchRandom() % PIXEL_COUNT] ^= 0xFFFFFF;
+        }
+    }
+
+    // Nearest neighbor at exactly 2x is plain pixel doubling.
+    scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, FRAME_WIDTH * 2, FRAME_HEIGHT * 2, e_scaleNearest);
+    full.resize(PIXEL_COUNT * 4);
+    scaler.scale(full.data(), FRAME_WIDTH * 2, src.data(), FRAME_WIDTH, { 0, 0, FRAME_WIDTH * 2, FRAME_HEIGHT * 2 });
+    for (size_t y = 0; y < FRAME_HEIGHT * 2; ++y) {
+        for (size_t x = 0; x < FRAME_WIDTH * 2; ++x) {
+            if (full[y * FRAME_WIDTH * 2 + x] != src[(y / 2) * FRAME_WIDTH + (x / 2)]) {
+                printf("scale: ERROR: nearest 2x is not pixel doubling!\n");
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchInteger()
+{
+    std::vector<uint32_t> src(PIXEL_COUNT);
+    for (uint32_t& pixel : src)
+        pixel = PixelsConvertOne(BenchRandom() & 0xFFFF);
+
+    Scaler generic, replicate;
+    std::vector<uint32_t> expected, actual;
+    for (int factor = 2; factor <= 5; ++factor) {
+        int width = FRAME_WIDTH * factor, height = FRAME_HEIGHT * factor;
+        const Rect output{ 0, 0, width, height };
+        expected.resize(width * height);
+        actual.resize(width * height);
+
+        generic.configure(FRAME_WIDTH, FRAME_HEIGHT, width, height, e_scaleBilinear);
+        double bilinear = BenchMeasure([&]() {
+            generic.scale(expected.data(), width, src.data(), FRAME_WIDTH, output);
+        }, 20);
+        generic.configure(FRAME_WIDTH, FRAME_HEIGHT, width, height, e_scaleNearest);
+        double nearest = BenchMeasure([&]() {
+            generic.scale(expected.data(), width, src.data(), FRAME_WIDTH, output);
+        }, 20);
+        replicate.configure(FRAME_WIDTH, FRAME_HEIGHT, width, height, e_scaleBilinear, factor);
+        double integer = BenchMeasure([&]() {
+            replicate.scale(actual.data(), width, src.data(), FRAME_WIDTH, output);
+        }, 20);
+
+        printf("integer: %dx (%4dx%-4d) replicate %7.3f ms, nearest %7.3f ms (%4.2fx), bilinear %7.3f ms (%4.2fx)\n",
+               factor, width, height, integer * 1e3, nearest * 1e3, nearest / integer,
+               bilinear * 1e3, bilinear / integer);
+        if (expected != actual) {
+            printf("integer: ERROR: %dx replication differs from nearest neighbor!\n", factor);
+            return false;
+        }
+
+        // Redrawing a rect that doesn't line up with the fat pixels must still be exact.
+        std::fill(actual.begin(), actual.end(), 0);
+        for (int y = 0; y < height; y += 97)
+            replicate.scale(actual.data(), width, src.data(), FRAME_WIDTH, { 3, y, width - 1, y + 97 });
+        replicate.scale(actual.data(), width, src.data(), FRAME_WIDTH, { 0, 0, 3, height });
+        replicate.scale(actual.data(), width, src.data(), FRAME_WIDTH, { width - 1, 0, width, height });
+        if (expected != actual) {
+            printf("integer: ERROR: %dx partial redraw differs!\n", factor);
+            return false;
+        }
+    }
+
+    // The sizes that are almost a multiple get letterboxed.
+    for (const Rect& size : s_outputSizes) {
+        int factor = ScaleIntegerFactor(FRAME_WIDTH, FRAME_HEIGHT, size.width(), size.height());
+        printf("integer: %4dx%-4d -> %s", size.width(), size.height(), factor ? "" : "filtered\n");
+        if (!factor)
+            continue;
+
+        int width = size.width(), height = size.height();
+        replicate.configure(FRAME_WIDTH, FRAME_HEIGHT, width, height, e_scaleBilinear, factor);
+        actual.assign(width * height, 0xDEADBEEF);
+        replicate.scale(actual.data(), width, src.data(), FRAME_WIDTH, { 0, 0, width, height });
+
+        int offsetX = (width - (int)FRAME_WIDTH * factor) / 2;
+        int offsetY = (height - (int)FRAME_HEIGHT * factor) / 2;
+        printf("%dx, letterbox %dx%d\n", factor, offsetX, offsetY);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int sx = x - offsetX, sy = y - offsetY;
+                bool inside = sx >= 0 && sy >= 0 && sx < (int)FRAME_WIDTH * factor && sy < (int)FRAME_HEIGHT * factor;
+                uint32_t want = inside ? src[(sy / factor) * FRAME_WIDTH + (sx / factor)] : 0;
+                if (actual[y * width + x] != want) {
+                    printf("integer: ERROR: letterboxed %dx%d is wrong at %d,%d!\n", width, height, x, y);
+                    return false;
+                }
+            }
+        }
+    }
+
+    // Sharp bilinear is bilinear on top of an integer prescale. The scaler folds the prescale
+    // into its tables; see how that stacks up against actually doing it in two passes.
+    for (const Rect& size : s_outputSizes) {
+        int width = size.width(), height = size.height();
+        int factor = std::max(1, std::min(width / (int)FRAME_WIDTH, height / (int)FRAME_HEIGHT));
+        if (factor < 2)
+            continue;
+
+        int preWidth = FRAME_WIDTH * factor, preHeight = FRAME_HEIGHT * factor;
+        std::vector<uint32_t> prescaled(preWidth * preHeight);
+        Scaler second;
+        replicate.configure(FRAME_WIDTH, FRAME_HEIGHT, preWidth, preHeight, e_scaleNearest, factor);
+        second.configure(preWidth, preHeight, width, height, e_scaleBilinear);
+        generic.configure(FRAME_WIDTH, FRAME_HEIGHT, width, height, e_scaleSharpBilinear);
+        expected.resize(width * height);
+        actual.resize(width * height);
+
+        double folded = BenchMeasure([&]() {
+            generic.scale(expected.data(), width, src.data(), FRAME_WIDTH, { 0, 0, width, height });
+        }, 20);
+        double twoPass = BenchMeasure([&]() {
+            replicate.scale(prescaled.data(), preWidth, src.data(), FRAME_WIDTH, { 0, 0, preWidth, preHeight });
+            second.scale(actual.data(), width, prescaled.data(), preWidth, { 0, 0, width, height });
+        }, 20);
+        printf("integer: sharp bilinear %4dx%-4d folded %7.3f ms, %dx prescale + bilinear %7.3f ms\n",
+               width, height, folded * 1e3, factor, twoPass * 1e3);
+        if (expected != actual) {
+            printf("integer: ERROR: prescaled sharp bilinear differs!\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchFused()
+{
+    std::vector<uint16_t> src(PIXEL_COUNT);
+    for (uint16_t& pixel : src)
+        pixel = (uint16_t)BenchRandom();
+    std::vector<uint32_t> converted(PIXEL_COUNT);
+    const PixelConverter& converter = PixelsSelectConverter();
+
+    // The multi-pass pipeline converts the whole frame to 32bpp and then scales that. The fused
+    // one converts each source row as the scaler asks for it. Memory traffic is what each
+    // pipeline has to read and write at a minimum, not counting the scaler's row cache.
+    Scaler scaler;
+    std::vector<uint32_t> expected, actual;
+    for (const Rect& size : s_outputSizes) {
+        int width = size.width(), height = size.height();
+        const Rect output{ 0, 0, width, height };
+        expected.resize(width * height);
+        actual.resize(width * height);
+
+        int factor = ScaleIntegerFactor(FRAME_WIDTH, FRAME_HEIGHT, width, height);
+        for (int mode = e_scaleBilinear; mode <= e_scaleFilterCount; ++mode) {
+            if (mode == e_scaleFilterCount && !factor)
+                continue;
+            ScaleFilter filter = mode == e_scaleFilterCount ? e_scaleNearest : (ScaleFilter)mode;
+            scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, width, height, filter,
+                             mode == e_scaleFilterCount ? factor : 0);
+
+            double multi = BenchMeasure([&]() {
+                converter.m_convert(converted.data(), src.data(), PIXEL_COUNT);
+                scaler.scale(expected.data(), width, converted.data(), FRAME_WIDTH, output);
+            }, 20);
+            double fused = BenchMeasure([&]() {
+                scaler.scale(actual.data(), width, src.data(), FRAME_WIDTH, converter.m_convert, output);
+            }, 20);
+
+            double outputBytes = (double)width * height * sizeof(uint32_t);
+            double multiBytes = (PIXEL_COUNT * (sizeof(uint16_t) + 2 * sizeof(uint32_t))) + outputBytes;
+            double fusedBytes = (PIXEL_COUNT * sizeof(uint16_t)) + outputBytes;
+            char name[32];
+            if (mode == e_scaleFilterCount)
+                snprintf(name, sizeof(name), "%dx Integer", factor);
+            else
+                snprintf(name, sizeof(name), "%s", ScaleFilterName(filter));
+            printf("fused: %4dx%-4d %-14s multi-pass %7.3f ms (%5.1f MB, %5.2f GB/s), fused %7.3f ms (%5.1f MB, %5.2f GB/s), %4.2fx\n",
+                   width, height, name, multi * 1e3, multiBytes / 1e6, multiBytes / (multi * 1e9),
+                   fused * 1e3, fusedBytes / 1e6, fusedBytes / (fused * 1e9), multi / fused);
+            if (expected != actual) {
+                printf("fused: ERROR: fused output differs from multi-pass!\n");
+                return false;
+            }
+        }
+    }
+
+    // Partial redraws go through the same path, so check a few odd rects against the full frame.
+    WorkerPool workers;
+    scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, 1400, 1050, e_scaleSharpBilinear);
+    expected.resize(1400 * 1050);
+    actual.resize(1400 * 1050);
+    scaler.scale(actual.data(), 1400, src.data(), FRAME_WIDTH, converter.m_convert, { 0, 0, 1400, 1050 });
+    for (size_t i = 0; i < 16; ++i) {
+        Rect damage = BenchRandomRect(128).intersect({ 0, 0, (int)FRAME_WIDTH, (int)FRAME_HEIGHT });
+        for (int y = damage.top; y < damage.bottom; ++y)
+            for (int x = damage.left; x < damage.right; ++x)
+                src[y * FRAME_WIDTH + x] = (uint16_t)BenchRandom();
+        scaler.scale(actual.data(), 1400, src.data(), FRAME_WIDTH, converter.m_convert,
+                     scaler.mapRect(damage), workers);
+    }
+    converter.m_convert(converted.data(), src.data(), PIXEL_COUNT);
+    scaler.scale(expected.data(), 1400, converted.data(), FRAME_WIDTH, { 0, 0, 1400, 1050 });
+    if (expected != actual) {
+        printf("fused: ERROR: fused partial redraw differs!\n");
+        return false;
+    }
+
+    // And how the tile shape plays out at the biggest size.
+    scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, 3200, 2400, e_scaleBilinear);
+    actual.resize(3200 * 2400);
+    static const int s_tileSizes[][2] = {
+        { Scaler::DEFAULT_TILE_WIDTH, Scaler::DEFAULT_TILE_HEIGHT },
+        { 1024, 64 }, { 512, 32 }, { 256, 32 }, { 128, 16 },
+    };
+    for (const auto& tileSize : s_tileSizes) {
+        scaler.setTileSize(tileSize[0], tileSize[1]);
+        double elapsed = BenchMeasure([&]() {
+            scaler.scale(actual.data(), 3200, src.data(), FRAME_WIDTH, converter.m_convert, { 0, 0, 3200, 2400 });
+        }, 20);
+        printf("fused: 3200x2400 Bilinear %4dx%-2d tiles %7.3f ms\n", tileSize[0], tileSize[1], elapsed * 1e3);
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchWorkers()
+{
+    // What it costs to hand a frame's worth of bands to the pool when the bands themselves do
+    // nothing at all. This is the floor under every parallel stage.
+    for (int threads : { 0, 1, 3, 7 }) {
+        WorkerPool workers{ threads };
+        size_t bands = workers.size() * 2;
+        double pooled = BenchMeasure([&]() { workers.run(bands, [](size_t) {}); }, 2000);
+
+        // For comparison, spinning up a thread per band every frame.
+        double spawned = BenchMeasure([&]() {
+            std::vector<std::thread> spawn;
+            for (size_t i = 1; i < bands; ++i)
+                spawn.emplace_back([]() {});
+            for (std::thread& thread : spawn)
+                thread.join();
+        }, 200);
+        printf("workers: %zu threads, %2zu bands  %8.2f us dispatch, %8.2f us spawn\n",
+               workers.size(), bands, pooled * 1e6, spawned * 1e6);
+    }
+
+    // Several submitters hammering one oversubscribed pool must each get all of their own bands
+    // run exactly once, and nobody else's.
+    WorkerPool crowd{ 7, true };
+    constexpr size_t SUBMITTERS = 3;
+    constexpr size_t ROUNDS = 500;
+    std::atomic<bool> ok{ true };
+    std::vector<std::thread> submitters;
+    for (size_t i = 0; i < SUBMITTERS; ++i) {
+        submitters.emplace_back([&, i]() {
+            std::vector<std::atomic<uint32_t>> hits(64);
+            for (size_t round = 0; round < ROUNDS; ++round) {
+                size_t count = 1 + ((round * (i + 1)) % hits.size());
+                crowd.run(count, [&](size_t idx) { hits[idx].fetch_add(1, std::memory_order_relaxed); });
+                for (size_t idx = 0; idx < hits.size(); ++idx) {
+                    if (hits[idx].exchange(0) != (idx < count ? 1U : 0U))
+                        ok = false;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : submitters)
+        thread.join();
+    if (!ok) {
+        printf("workers: ERROR: bands were lost or run twice!\n");
+        return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+// Stands in for the game: a sprite bouncing around an otherwise static screen.
+class _BenchHost : public PipelineHost
+{
+    std::vector<uint16_t> m_source;
+    Rect m_sprite{ 0, 0, 64, 64 };
+    int m_dx{ 7 };
+    int m_dy{ 5 };
+    bool m_first{ true };
+    bool m_paced;
+    std::atomic<uint32_t> m_wanted{ 0 };
+    uint32_t m_grabbed{ 0 };
+    std::atomic<uint32_t> m_presented{ 0 };
+    std::mutex m_latencyMut;
+
+    void moveSprite()
+    {
+        if (m_sprite.left + m_dx < 0 || m_sprite.right + m_dx > (int)FRAME_WIDTH)
+            m_dx = -m_dx;
+        if (m_sprite.top + m_dy < 0 || m_sprite.bottom + m_dy > (int)FRAME_HEIGHT)
+            m_dy = -m_dy;
+        m_sprite = { m_sprite.left + m_dx, m_sprite.top + m_dy, m_sprite.right + m_dx,
+                     m_sprite.bottom + m_dy };
+    }
+
+public:
+    PipelineView m_view{ 1920, 1440, e_scaleBilinear, 0 };
+    std::atomic<const OverlayAtlas*> m_overlay{ nullptr };
+    std::vector<double> m_latencies;
+    std::vector<PipelineClock::time_point> m_presentTimes;
+    Event m_presentedEvent;
+
+    _BenchHost(bool paced, uint32_t frames)
+        : m_source(PIXEL_COUNT), m_paced(paced), m_wanted(paced ? 0 : frames)
+    {
+        for (uint16_t& pixel : m_source)
+            pixel = (uint16_t)BenchRandom();
+    }
+
+    const uint16_t* source() const { return m_source.data(); }
+    uint32_t presented() const { return m_presented; }
+    void want() { m_wanted++; }
+
+    PipelineGrab grab(uint16_t* frame, DirtyRegion& damage, bool& /*force*/) override
+    {
+        if (m_grabbed == m_wanted)
+            return e_grabIdle;
+        m_grabbed++;
+
+        damage.clear();
+        if (m_first) {
+            damage.addAll();
+            m_first = false;
+        }
+
+        // Smear the sprite into its new spot. Every pixel it covers changes value, so the tile
+        // hasher can't throw any of it away.
+        Rect before = m_sprite;
+        moveSprite();
+        uint16_t ink = (uint16_t)BenchRandom();
+        for (int y = m_sprite.top; y < m_sprite.bottom; ++y)
+            for (int x = m_sprite.left; x < m_sprite.right; ++x)
+                m_source[y * FRAME_WIDTH + x] += ink | 1;
+        damage.add(before.unite(m_sprite));
+
+        for (const Rect& rect : damage)
+            PipelineCopyRect(frame, FRAME_WIDTH * sizeof(uint16_t), m_source.data(),
+                             FRAME_WIDTH * sizeof(uint16_t), sizeof(uint16_t), rect);
+        return e_grabFrame;
+    }
+
+    PipelineView view() override { return m_view; }
+
+    const OverlayAtlas* overlay(OverlayText& text) override
+    {
+        // Something that changes width from frame to frame, like the real thing.
+        const OverlayAtlas* atlas = m_overlay;
+        if (atlas) {
+            text.print(0, e_overlayLeft, "FT: %u", BenchRandom() % 100000);
+            text.print(0, e_overlayRight, "FPS: %u", m_presented.load());
+        }
+        return atlas;
+    }
+
+    void endPresent(const OutputFrame& frame, PipelineClock::duration frameTime) override
+    {
+        {
+            std::lock_guard<std::mutex> _(m_latencyMut);
+            m_latencies.push_back(std::chrono::duration<double>(frameTime).count());
+            m_presentTimes.push_back(PipelineClock::now());
+        }
+        m_presented = frame.m_sequence;
+        m_presentedEvent.signal();
+    }
+};
+
+// ================================================================================================
+
+static bool BenchPipeline()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    // The whole thing, capture to present, with the presents going nowhere. Flooding it shows
+    // the throughput and how many frames get dropped along the way. Pacing it one frame at a
+    // time shows the latency of a single frame going all the way through.
+    constexpr uint32_t FRAMES = 300;
+    std::ostream nullLog{ nullptr };
+    WorkerPool workers;
+    OverlayAtlas atlas;
+    atlas.buildDefault(32);
+    for (bool paced : { false, true }) {
+        _BenchHost host{ paced, FRAMES };
+        host.m_overlay = &atlas;
+        MemoryBackend backend;
+        auto begin = Clock::now();
+        {
+            Pipeline pipeline{ host, nullLog };
+            pipeline.start(backend, workers);
+            if (paced) {
+                for (uint32_t i = 0; i < FRAMES; ++i) {
+                    host.want();
+                    pipeline.wake();
+                    while (host.presented() != i + 1)
+                        host.m_presentedEvent.wait();
+                }
+            } else {
+                pipeline.wake();
+                while (host.presented() != FRAMES)
+                    host.m_presentedEvent.wait();
+            }
+
+            // One more frame with the overlay turned off, which has to clean up after it.
+            host.m_overlay = nullptr;
+            host.want();
+            pipeline.wake();
+            while (host.presented() != FRAMES + 1)
+                host.m_presentedEvent.wait();
+            pipeline.stop();
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - begin;
+
+        printf("pipeline: %s %ux%u %s backend, %3llu of %u frames presented, %7.1f fps, %5.1f Mpx presented\n",
+               paced ? "paced  " : "flooded", host.m_view.m_width, host.m_view.m_height, backend.name(),
+               (unsigned long long)backend.framesPresented(), FRAMES, FRAMES / elapsed.count(),
+               backend.pixelsPresented() / 1e6);
+        BenchPrintLatencies("pipeline", paced ? "paced" : "flooded", host.m_latencies);
+
+        // Whatever got dropped along the way, the screen must end up showing the last frame.
+        Scaler scaler;
+        scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, host.m_view.m_width, host.m_view.m_height,
+                         host.m_view.m_filter);
+        std::vector<uint32_t> expected((size_t)host.m_view.m_width * host.m_view.m_height);
+        scaler.scale(expected.data(), host.m_view.m_width, host.source(), FRAME_WIDTH,
+                     PixelsSelectConverter().m_convert, { 0, 0, host.m_view.m_width, host.m_view.m_height });
+        if (backend.screenWidth() != host.m_view.m_width || backend.screenHeight() != host.m_view.m_height ||
+            memcmp(backend.screen(), expected.data(), expected.size() * sizeof(uint32_t)) != 0) {
+            printf("pipeline: ERROR: the screen does not match the last frame!\n");
+            return false;
+        }
+    }
+
+    // Switching from filtered to a letterboxed integer scale at the same size keeps the screen
+    // around, so the bars have to be redrawn or they'd go on showing the filtered frame.
+    _BenchHost host{ true, 0 };
+    host.m_view = { 1280, 980, e_scaleBilinear, 0 };
+    MemoryBackend backend;
+    Pipeline pipeline{ host, nullLog };
+    pipeline.start(backend, workers);
+    host.want();
+    pipeline.wake();
+    while (host.presented() != 1)
+        host.m_presentedEvent.wait();
+    int width = host.m_view.m_width, height = host.m_view.m_height;
+    size_t filled = std::count_if(backend.screen(), backend.screen() + (size_t)width * 10,
+                                  [](uint32_t pixel) { return pixel != 0; });
+
+    host.m_view.m_integerScale = 2;
+    host.want();
+    pipeline.wake();
+    while (host.presented() != 2)
+        host.m_presentedEvent.wait();
+    pipeline.stop();
+
+    Scaler scaler;
+    scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, width, height, e_scaleBilinear, 2);
+    std::vector<uint32_t> expected((size_t)width * height, 0xDEADBEEF);
+    scaler.scale(expected.data(), width, host.source(), FRAME_WIDTH, PixelsSelectConverter().m_convert,
+                 { 0, 0, width, height });
+    bool bars = std::all_of(expected.begin(), expected.begin() + (size_t)width * 10,
+                            [](uint32_t pixel) { return pixel == 0; });
+    printf("pipeline: filtered to 2x letterboxed at %dx%d, %zu of %d bar pixels filled beforehand\n", width,
+           height, filled, width * 10);
+    if (filled == 0 || !bars || memcmp(backend.screen(), expected.data(), expected.size() * sizeof(uint32_t)) != 0) {
+        printf("pipeline: ERROR: the letterbox still shows the last filtered frame!\n");
+        return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchPacing()
+{
+    // First, the scheduler by itself on a fake clock. The game dirties the surface every 3ms
+    // for a second, the capture takes 1ms, and every sleep oversleeps by up to 1.5ms like a
+    // coarse OS timer would. Spinning moves the clock on 10us at a time.
+    constexpr auto MS = std::chrono::milliseconds(1);
+    constexpr auto SPIN_STEP = std::chrono::microseconds(10);
+    auto simulate = [&](double hz, SchedulerClock::duration stall, std::vector<SchedulerClock::time_point>& frames,
+                        FrameScheduler& scheduler) {
+        SchedulerClock::time_point t{ std::chrono::seconds(1) };
+        SchedulerClock::time_point end = t + std::chrono::seconds(1);
+        SchedulerClock::time_point nextDamage = t;
+        auto now = [&t, SPIN_STEP]() { t += SPIN_STEP; return t; };
+        auto sleep = [&t](SchedulerClock::duration timeout) {
+            t += timeout + std::chrono::microseconds(BenchRandom() % 1500);
+            return true;
+        };
+        scheduler.setRate(hz);
+        while (t < end) {
+            bool waited = !scheduler.due(t);
+            if (waited)
+                SchedulerWaitUntil(scheduler, now, sleep);
+            if (t < nextDamage) {
+                t = nextDamage;
+                continue;
+            }
+            scheduler.frameStarted(t, waited);
+            frames.push_back(t);
+
+            // Everything up to now goes out with this frame. Partway through, the game goes
+            // quiet for a while.
+            while (nextDamage <= t)
+                nextDamage += 3 * MS;
+            if (frames.size() == 20)
+                nextDamage += stall;
+            t += MS;
+        }
+    };
+
+    for (double hz : { 0.0, 30.0, 60.0, 144.0 }) {
+        std::vector<SchedulerClock::time_point> frames;
+        FrameScheduler scheduler;
+        simulate(hz, 100 * MS, frames, scheduler);
+
+        // Never two frames closer together than the interval, give or take a late start.
+        SchedulerClock::duration shortest = std::chrono::hours(1);
+        for (size_t i = 1; i < frames.size(); ++i)
+            shortest = std::min(shortest, frames[i] - frames[i - 1]);
+        const SchedulerStats& stats = scheduler.stats();
+        std::chrono::duration<double, std::micro> worst = stats.m_maxJitter;
+        std::chrono::duration<double, std::micro> closest = shortest;
+        printf("pacing: virtual %5.1f Hz  %3zu frames, %3u held back, closest %8.1f us, worst jitter %5.1f us\n",
+               hz, frames.size(), stats.m_pacedFrames, closest.count(), worst.count());
+
+        // A second with 100ms of silence in it.
+        size_t expected = hz > 0.0 ? (size_t)(hz * 0.9) : 300;
+        SchedulerClock::duration interval = std::chrono::duration_cast<SchedulerClock::duration>(
+            std::chrono::duration<double>(hz > 0.0 ? 1.0 / hz : 0.0));
+        if (hz > 0.0 && (shortest + SPIN_STEP < interval || frames.size() > (size_t)hz + 1 || frames.size() + 2 < expected)) {
+            printf("pacing: ERROR: the %.1f Hz cap was not kept!\n", hz);
+            return false;
+        }
+        if (stats.m_maxJitter > SPIN_STEP) {
+            printf("pacing: ERROR: missed a deadline by more than a spin step!\n");
+            return false;
+        }
+    }
+
+    // Now for real: the whole pipeline, with the game drawing as fast as it can.
+    constexpr uint32_t FRAMES = 60;
+    std::ostream nullLog{ nullptr };
+    WorkerPool workers;
+    for (double hz : { 60.0, 120.0 }) {
+        _BenchHost host{ false, FRAMES };
+        host.m_view = { (int)FRAME_WIDTH, (int)FRAME_HEIGHT, e_scaleNearest, 0 };
+        MemoryBackend backend;
+        {
+            Pipeline pipeline{ host, nullLog };
+            pipeline.setPresentRate(hz);
+            pipeline.start(backend, workers);
+            pipeline.wake();
+            while (host.presented() != FRAMES)
+                host.m_presentedEvent.wait();
+            pipeline.stop();
+        }
+
+        std::vector<double> jitter;
+        for (size_t i = 1; i < host.m_presentTimes.size(); ++i) {
+            std::chrono::duration<double> interval = host.m_presentTimes[i] - host.m_presentTimes[i - 1];
+            jitter.push_back(std::abs(interval.count() - (1.0 / hz)));
+        }
+        std::chrono::duration<double> elapsed = host.m_presentTimes.back() - host.m_presentTimes.front();
+        printf("pacing: pipeline %5.1f Hz %3zu frames in %6.1f ms (%5.1f Hz)\n", hz,
+               host.m_presentTimes.size(), elapsed.count() * 1e3,
+               (host.m_presentTimes.size() - 1) / elapsed.count());
+        BenchPrintLatencies("pacing", "interval jitter", jitter);
+        if (elapsed.count() < ((FRAMES - 1) / hz) * 0.95) {
+            printf("pacing: ERROR: presented faster than %.1f Hz!\n", hz);
+            return false;
+        }
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchFrameStats()
+{
+    // Every value has to land in a bucket that holds it and is no wider than 1/16th of it.
+    std::vector<uint32_t> values;
+    for (uint32_t us = 0; us < (1 << 16); ++us)
+        values.push_back(us);
+    for (size_t i = 0; i < 100000; ++i)
+        values.push_back(BenchRandom() >> (BenchRandom() % 32));
+    values.push_back(UINT32_MAX);
+    for (uint32_t us : values) {
+        size_t bucket = FrameHistogram::bucketOf(us);
+        uint32_t low = FrameHistogram::bucketLow(bucket);
+        uint32_t high = FrameHistogram::bucketHigh(bucket);
+        if (bucket >= FrameHistogram::BUCKETS || us < low || us > high ||
+            (high - low) > (low / FrameHistogram::SUB_BUCKETS)) {
+            printf("framestats: ERROR: %u us landed in bucket %zu [%u, %u]\n", us, bucket, low, high);
+            return false;
+        }
+    }
+
+    // Mostly smooth 60 Hz with a sprinkling of hitches and the occasional real stall. The
+    // percentiles may only ever be a bucket's width worse than the real thing.
+    constexpr size_t FRAMES = 200000;
+    std::vector<uint32_t> frameTimes(FRAMES);
+    for (uint32_t& us : frameTimes) {
+        us = 16000 + (BenchRandom() % 1500);
+        if (BenchRandom() % 100 == 0)
+            us += 10000 + (BenchRandom() % 30000);
+        if (BenchRandom() % 5000 == 0)
+            us += 250000;
+    }
+    FrameStats stats;
+    SchedulerClock::time_point now{ std::chrono::seconds(1) };
+    double elapsed = BenchMeasure([&]() {
+        for (uint32_t us : frameTimes) {
+            stats.record(std::chrono::microseconds(us), now);
+            now += std::chrono::microseconds(us);
+        }
+    }, 1);
+    printf("framestats: record %6.1f ns per frame\n", (elapsed * 1e9) / FRAMES);
+
+    std::vector<uint32_t> sorted = frameTimes;
+    std::sort(sorted.begin(), sorted.end());
+    FrameSummary lifetime = stats.lifetime();
+    struct { const char* m_name; double m_fraction; uint32_t m_actual; } checks[] = {
+        { "p50", 0.5, lifetime.m_p50 },
+        { "p90", 0.9, lifetime.m_p90 },
+        { "p99", 0.99, lifetime.m_p99 },
+        { "p99.9", 0.999, lifetime.m_p999 },
+        { "max", 1.0, lifetime.m_max },
+    };
+    for (const auto& check : checks) {
+        uint32_t exact = sorted[std::min(FRAMES - 1, (size_t)std::ceil(check.m_fraction * FRAMES) - 1)];
+        printf("framestats: %-5s exact %7u us, histogram %7u us\n", check.m_name, exact, check.m_actual);
+        if (check.m_actual < exact || check.m_actual > exact + (exact / FrameHistogram::SUB_BUCKETS) + 1) {
+            printf("framestats: ERROR: %s is off!\n", check.m_name);
+            return false;
+        }
+    }
+    if (lifetime.m_frames != FRAMES) {
+        printf("framestats: ERROR: lost some frames!\n");
+        return false;
+    }
+
+    // The recent numbers only cover the last few seconds, and a long quiet spell clears them.
+    FrameSummary recent = stats.recent();
+    stats.record(std::chrono::microseconds(5000), now + std::chrono::seconds(30));
+    FrameSummary after = stats.recent();
+    printf("framestats: recent window %u frames, %u after a quiet spell\n", recent.m_frames, after.m_frames);
+    if (recent.m_frames == 0 || recent.m_frames > 60 * 6 || after.m_frames != 1 || after.m_p99 != 5000) {
+        printf("framestats: ERROR: the rolling windows did not roll!\n");
+        return false;
+    }
+
+    // Everything in the CSV adds back up to the lifetime count.
+    std::stringstream csv;
+    stats.writeCSV(csv);
+    std::string line;
+    std::getline(csv, line);
+    uint64_t total = 0;
+    while (std::getline(csv, line)) {
+        unsigned low, high, count, recentCount;
+        if (sscanf(line.c_str(), "%u,%u,%u,%u", &low, &high, &count, &recentCount) != 4)
+            break;
+        total += count;
+    }
+    if (total != FRAMES + 1) {
+        printf("framestats: ERROR: CSV has %llu frames in it!\n", (unsigned long long)total);
+        return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchStages()
+{
+    // What a stage timer costs. This is paid a handful of times per frame.
+    StageTimes times;
+    constexpr size_t TIMERS = 100000;
+    double elapsed = BenchMeasure([&]() {
+        for (size_t i = 0; i < TIMERS; ++i) {
+            StageTimer timer{ times, e_stageHash };
+        }
+    }, 1);
+    printf("stages: %5.1f ns per stage timer\n", (elapsed * 1e9) / TIMERS);
+
+    // The counter has to agree with the clock about how long something took.
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    times.reset();
+    {
+        StageTimer timer{ times, e_stageScale };
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    StageSummary slept = times.summary(e_stageScale);
+    printf("stages: %.1f cycles per us, a 20ms sleep took %.1f us\n", times.cyclesPerMicrosecond(),
+           slept.m_lastUs);
+    if (slept.m_samples != 1 || slept.m_lastUs < 19000.0 || slept.m_lastUs > 200000.0) {
+        printf("stages: ERROR: the stage timer can't tell time!\n");
+        return false;
+    }
+
+    // Then where the time goes for a real run through the pipeline.
+    std::ostream nullLog{ nullptr };
+    WorkerPool workers;
+    _BenchHost host{ false, 200 };
+    MemoryBackend backend;
+    Pipeline pipeline{ host, nullLog };
+    pipeline.start(backend, workers);
+    pipeline.wake();
+    while (host.presented() != 200)
+        host.m_presentedEvent.wait();
+    pipeline.stop();
+    for (int i = 0; i < e_stageCount; ++i) {
+        StageSummary summary = pipeline.stageTimes().summary((PipelineStage)i);
+        if (summary.m_samples == 0)
+            continue;
+        printf("stages: %ux%u %-8s %4llu samples, mean %8.1f us, max %8.1f us\n", host.m_view.m_width,
+               host.m_view.m_height, StageName((PipelineStage)i), (unsigned long long)summary.m_samples,
+               summary.m_meanUs, summary.m_maxUs);
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchOverlay()
+{
+    // Every blend kernel has to match the scalar one exactly.
+    constexpr size_t COUNT = 4099;
+    std::vector<uint32_t> pixels(COUNT);
+    std::vector<uint8_t> alpha(COUNT);
+    for (size_t i = 0; i < COUNT; ++i) {
+        pixels[i] = BenchRandom() & 0xFFFFFF;
+        alpha[i] = (i % 3) ? (uint8_t)BenchRandom() : (uint8_t)((i % 2) ? 255 : 0);
+    }
+    std::vector<uint32_t> expected = pixels;
+    OverlayBlendScalar(expected.data(), alpha.data(), COUNT, 0xFCEC03);
+#ifdef LEGACY_PIXELS_X86
+    if (PixelsDetectCPU() & e_cpuSSE2) {
+        std::vector<uint32_t> actual = pixels;
+        OverlayBlendSSE2(actual.data(), alpha.data(), COUNT, 0xFCEC03);
+        if (actual != expected) {
+            printf("overlay: ERROR: the SSE2 blend does not match the scalar one!\n");
+            return false;
+        }
+    }
+#endif
+
+    OverlayAtlas atlas;
+    auto start = std::chrono::steady_clock::now();
+    atlas.buildDefault(35);
+    std::chrono::duration<double, std::micro> build = std::chrono::steady_clock::now() - start;
+    printf("overlay: built a %dpx atlas in %.1f us\n", atlas.height(), build.count());
+
+    OverlayText text;
+    text.m_color = 0xFCEC03;
+    text.print(0, e_overlayLeft, "FT: 0.0166s");
+    text.print(0, e_overlayRight, "FPS: 60 AVG: 59");
+    text.print(1, e_overlayLeft, "lock: 0.01 copy: 0.20 hash: 0.05 scale: 1.91 present: 0.80 overlay: 0.02 ms");
+    text.print(2, e_overlayLeft, "p50: 16.6 p90: 16.8 p99: 17.9 p99.9: 33.2 max: 41.0 ms");
+
+    // Drawing and putting things back should cost the same no matter how big the window is.
+    FOverlayBlend blend = OverlaySelectBlend();
+    for (const Rect& size : s_outputSizes) {
+        std::vector<uint32_t> frame((size_t)size.width() * size.height());
+        for (uint32_t& pixel : frame)
+            pixel = BenchRandom() & 0xFFFFFF;
+        std::vector<uint32_t> original = frame;
+
+        OverlayCompositor compositor;
+        DirtyRegion damage{ size.width(), size.height() };
+        compositor.draw(0, &atlas, text, frame.data(), size.width(), size.height(), false, damage);
+        compositor.restore(0, frame.data(), size.width());
+        if (damage.empty() || frame != original) {
+            printf("overlay: ERROR: %dx%d wasn't put back the way it was!\n", size.width(), size.height());
+            return false;
+        }
+
+        double elapsed = BenchMeasure([&]() {
+            compositor.restore(0, frame.data(), size.width());
+            compositor.draw(0, &atlas, text, frame.data(), size.width(), size.height(), false, damage);
+        });
+        printf("overlay: %4dx%-4d %s %7.1f us per frame\n", size.width(), size.height(),
+               blend == OverlayBlendScalar ? "scalar" : "sse2  ", elapsed * 1e6);
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchTrace()
+{
+    // Play the game at the recorder: mostly small locked writes with the odd full screen GDI
+    // redraw, like the real thing. Whatever the reader rebuilds must match what was written.
+    constexpr uint32_t EVENTS = 2000;
+    const char* path = "legacy_bench.trace";
+    std::ostream nullLog{ nullptr };
+    std::vector<uint16_t> surface(PIXEL_COUNT);
+    for (uint16_t& pixel : surface)
+        pixel = (uint16_t)BenchRandom();
+
+    std::vector<TraceEvent> events;
+    std::vector<double> costs;
+    {
+        TraceRecorder recorder{ nullLog };
+        if (!recorder.open(path, FRAME_WIDTH, FRAME_HEIGHT)) {
+            printf("trace: ERROR: couldn't create %s\n", path);
+            return false;
+        }
+        recorder.record(e_traceSnapshot, { 0, 0, (int)FRAME_WIDTH, (int)FRAME_HEIGHT }, surface.data(),
+                        FRAME_WIDTH * sizeof(uint16_t));
+        events.push_back(e_traceSnapshot);
+
+        for (uint32_t i = 0; i < EVENTS; ++i) {
+            bool gdi = (i % 100) == 99;
+            Rect full{ 0, 0, (int)FRAME_WIDTH, (int)FRAME_HEIGHT };
+            Rect rect = gdi ? full : BenchRandomRect(128).intersect(full);
+            if (rect.empty())
+                rect = { 0, 0, 1, 1 };
+            TraceEvent begin = gdi ? e_traceGetDC : e_traceLock;
+            TraceEvent end = gdi ? e_traceReleaseDC : ((i % 3) ? e_traceUnlock : e_traceBltFast);
+            if (end != e_traceBltFast) {
+                recorder.record(begin, rect);
+                events.push_back(begin);
+            }
+
+            // Only some of the pixels actually change, the way a sprite moves over a background.
+            uint16_t ink = (uint16_t)BenchRandom() | 1;
+            Rect sprite{ rect.left + (rect.width() / 4), rect.top + (rect.height() / 4),
+                         rect.right - (rect.width() / 4), rect.bottom - (rect.height() / 4) };
+            for (int y = sprite.top; y < sprite.bottom; ++y)
+                for (int x = sprite.left; x < sprite.right; ++x)
+                    surface[(y * FRAME_WIDTH) + x] += ink;
+
+            const uint16_t* pixels = surface.data() + (rect.top * FRAME_WIDTH) + rect.left;
+            auto start = std::chrono::steady_clock::now();
+            recorder.record(end, rect, pixels, FRAME_WIDTH * sizeof(uint16_t));
+            costs.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            events.push_back(end);
+        }
+        recorder.close();
+        printf("trace: %u records, %.1f MB of pixels recorded in %.1f MB\n", recorder.records(),
+               recorder.rawBytes() / 1e6, recorder.fileBytes() / 1e6);
+    }
+    BenchPrintLatencies("trace", "record", costs);
+
+    TraceReader reader{ nullLog };
+    if (!reader.open(path)) {
+        printf("trace: ERROR: couldn't read %s back\n", path);
+        return false;
+    }
+    bool ok = reader.records() == events.size();
+    TraceRecord record;
+    size_t count = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (ok && reader.next(record))
+        ok = count < events.size() && record.m_event == events[count++];
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (!ok || count != events.size() || memcmp(reader.surface(), surface.data(), surface.size() * sizeof(uint16_t)) != 0) {
+        printf("trace: ERROR: the replayed surface does not match the recorded one!\n");
+        std::remove(path);
+        return false;
+    }
+    printf("trace: replayed %zu records in %.1f ms\n", count, elapsed.count() * 1e3);
+
+    // Now all the way through the pipeline, the way legacy_replay does it. Whatever it drops
+    // along the way, the screen has to end up showing the last thing written.
+    PipelineView view{ 1280, 960, e_scaleBilinear, 0 };
+    SurfaceHost host{ view };
+    WorkerPool workers;
+    MemoryBackend backend;
+    Pipeline pipeline{ host, nullLog };
+    host.attach(&pipeline);
+    pipeline.start(backend, workers);
+    reader.rewind();
+    start = std::chrono::steady_clock::now();
+    SurfaceHostReplay(reader, host, 0.0, nullptr);
+    host.waitIdle(50);
+    pipeline.stop();
+    elapsed = std::chrono::steady_clock::now() - start;
+    std::remove(path);
+
+    Scaler scaler;
+    scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, view.m_width, view.m_height, view.m_filter);
+    std::vector<uint32_t> expected((size_t)view.m_width * view.m_height);
+    scaler.scale(expected.data(), view.m_width, surface.data(), FRAME_WIDTH, PixelsSelectConverter().m_convert,
+                 { 0, 0, view.m_width, view.m_height });
+    if (memcmp(backend.screen(), expected.data(), expected.size() * sizeof(uint32_t)) != 0) {
+        printf("trace: ERROR: the pipeline's screen does not match the end of the trace!\n");
+        return false;
+    }
+    printf("trace: replayed through the pipeline in %.1f ms, %u frames presented\n", elapsed.count() * 1e3,
+           host.frameStats().lifetime().m_frames);
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchWorkload()
+{
+    // Each of the synthetic scenarios through the whole pipeline at the game's own pace. Mostly
+    // for the numbers, but the screen still has to match the surface once things settle down.
+    std::ostream nullLog{ nullptr };
+    PipelineView view{ 1280, 960, e_scaleBilinear, 0 };
+    WorkerPool workers;
+    bool ok = true;
+    for (int i = 0; i < e_workloadCount; ++i) {
+        WorkloadScenario scenario = (WorkloadScenario)i;
+        SurfaceHost host{ view };
+        MemoryBackend backend;
+        Pipeline pipeline{ host, nullLog };
+        host.attach(&pipeline);
+        pipeline.setPresentRate(60.0);
+        pipeline.start(backend, workers);
+
+        WorkloadGenerator workload{ host, scenario };
+        std::clock_t cpuStart = std::clock();
+        auto start = std::chrono::steady_clock::now();
+        workload.run(std::chrono::milliseconds(750));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double cpu = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+        host.waitIdle(50);
+        pipeline.stop();
+        host.attach(nullptr);
+
+        std::vector<uint16_t> surface(FRAME_WIDTH * FRAME_HEIGHT);
+        PipelineCopyRect(surface.data(), FRAME_WIDTH * sizeof(uint16_t), host.lock(), SurfaceHost::surfacePitch(),
+                         sizeof(uint16_t), { 0, 0, FRAME_WIDTH, FRAME_HEIGHT });
+        host.unlock();
+        Scaler scaler;
+        scaler.configure(FRAME_WIDTH, FRAME_HEIGHT, view.m_width, view.m_height, view.m_filter);
+        std::vector<uint32_t> expected((size_t)view.m_width * view.m_height);
+        scaler.scale(expected.data(), view.m_width, surface.data(), FRAME_WIDTH, PixelsSelectConverter().m_convert,
+                     { 0, 0, view.m_width, view.m_height });
+        if (memcmp(backend.screen(), expected.data(), expected.size() * sizeof(uint32_t)) != 0) {
+            printf("workload: ERROR: %s left the screen out of date!\n", WorkloadName(scenario));
+            ok = false;
+        }
+
+        FrameSummary frames = host.frameStats().lifetime();
+        printf("workload: %-10s %6llu calls %8.1f Mpx/s written %6.1f fps presented, p50 %6.2f ms, "
+               "p99 %6.2f ms, %5.1f%% CPU\n",
+               WorkloadName(scenario), (unsigned long long)workload.calls(),
+               workload.pixels() / elapsed.count() / 1e6, frames.m_frames / elapsed.count(),
+               frames.m_p50 / 1000.0, frames.m_p99 / 1000.0, 100.0 * cpu / elapsed.count());
+    }
+    return ok;
+}
+
+// ================================================================================================
+
+static bool BenchLog()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    // What a log line costs the thread that writes it, which is what the game feels. Every tenth
+    // line is long enough to need several slots, like the OutputDebugString spew.
+    constexpr uint32_t MESSAGES = 20000;
+    constexpr uint32_t THREADS = 4;
+    const char* path = "legacy_bench.log";
+    const char* binaryPath = "legacy_bench.blog";
+    const std::string padding(150, '.');
+    auto logLine = [&padding](std::ostream& log, uint32_t thread, uint32_t i) {
+        log << "BenchLog: thread " << thread << " message " << i << " "
+            << ((i % 10) == 0 ? padding.c_str() : "x") << std::endl;
+    };
+    const char* siteFormat = "BenchLog: thread %u message %u %s";
+
+    // Checks that every line made it out whole and in order, or was owned up to as dropped.
+    auto verify = [&](const char* name, uint32_t threads, uint32_t sent) {
+        std::ifstream file(path);
+        std::vector<int64_t> last(threads, -1);
+        uint64_t lines = 0, dropped = 0;
+        bool ok = true;
+        for (std::string line; std::getline(file, line); ) {
+            unsigned long long count;
+            unsigned thread, i;
+            if (sscanf(line.c_str(), "NOTICE: %llu log messages were dropped", &count) == 1) {
+                dropped += count;
+            } else if (sscanf(line.c_str(), "BenchLog: thread %u message %u", &thread, &i) == 2 &&
+                       thread < threads && (int64_t)i > last[thread]) {
+                std::ostringstream expected;
+                logLine(expected, thread, i);
+                ok &= expected.str() == line + "\n";
+                last[thread] = i;
+                lines++;
+            } else {
+                ok = false;
+            }
+        }
+        file.close();
+        std::remove(path);
+        printf("log: %-14s %llu lines written, %llu dropped\n", name, (unsigned long long)lines,
+               (unsigned long long)dropped);
+        if (!ok || lines + dropped != sent) {
+            printf("log: ERROR: %s lost or mangled messages!\n", name);
+            return false;
+        }
+        return true;
+    };
+
+    // Turns a binary log back into the text it would have been.
+    auto decode = [&](std::vector<LogEntry>* entries) {
+        std::ostream nullLog{ nullptr };
+        LogReader reader{ nullLog };
+        if (!reader.open(binaryPath))
+            return false;
+        std::ofstream text(path, std::ios::out | std::ios::binary);
+        LogEntry entry;
+        while (reader.next(entry)) {
+            text << entry.m_text;
+            if (entries)
+                entries->push_back(entry);
+        }
+        return true;
+    };
+    auto fileSize = [](const char* name) {
+        std::ifstream file(name, std::ios::in | std::ios::binary | std::ios::ate);
+        return file.is_open() ? (uint64_t)file.tellg() : 0;
+    };
+
+    // The old way, a std::ofstream flushed by every std::endl.
+    std::vector<double> costs;
+    costs.reserve(MESSAGES);
+    {
+        std::ofstream log(path, std::ios::out);
+        for (uint32_t i = 0; i < MESSAGES; ++i) {
+            auto start = Clock::now();
+            logLine(log, 0, i);
+            costs.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+        }
+    }
+    BenchPrintLatencies("log", "ofstream", costs);
+    uint64_t textBytes = fileSize(path);
+    if (!verify("ofstream", 1, MESSAGES))
+        return false;
+
+    // Through the ring, either streamed or from a call site, and either as text or binary. The
+    // game logs in bursts rather than a firehose, so give the writer a moment now and then. The
+    // sites get a bucket deep enough to never run dry, since this is about the cost of the ones
+    // that do get logged.
+    for (int mode = 0; mode < 3; ++mode) {
+        static const char* names[] = { "async stream", "async site", "async binary" };
+        LogSite site{ __FILE__, __LINE__, MESSAGES, 1 };
+        costs.clear();
+        {
+            AsyncLog log;
+            log.open(mode == 2 ? binaryPath : path, mode == 2 ? e_logBinary : e_logText);
+            for (uint32_t i = 0; i < MESSAGES; ++i) {
+                auto start = Clock::now();
+                if (mode == 0)
+                    logLine(log, 0, i);
+                else
+                    log.print(site, siteFormat, 0u, i, (i % 10) == 0 ? padding.c_str() : "x");
+                costs.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+                if ((i % 200) == 199)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        BenchPrintLatencies("log", names[mode], costs);
+        if (mode == 2) {
+            uint64_t binaryBytes = fileSize(binaryPath);
+            bool decoded = decode(nullptr);
+            std::remove(binaryPath);
+            printf("log: %-14s %.1f KB of text in %.1f KB\n", names[mode], textBytes / 1024.0, binaryBytes / 1024.0);
+            if (!decoded) {
+                printf("log: ERROR: couldn't read the binary log back\n");
+                return false;
+            }
+        }
+        if (!verify(names[mode], 1, MESSAGES))
+            return false;
+    }
+
+    // An error storm from one site: only a bucket's worth gets through, each of the rest costs
+    // next to nothing, and the first line after the bucket refills owns up to all of them.
+    constexpr uint32_t STORM = 1000;
+    costs.clear();
+    {
+        LogSite site{ __FILE__, __LINE__ };
+        AsyncLog log;
+        log.open(binaryPath, e_logBinary);
+        for (uint32_t i = 0; i < STORM; ++i) {
+            auto start = Clock::now();
+            log.print(site, "BenchLog: storm 0x%08x", i);
+            costs.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000 / LOG_SITE_RATE + 50));
+        log.print(site, "BenchLog: storm 0x%08x", STORM);
+    }
+    BenchPrintLatencies("log", "storm", costs);
+    std::vector<LogEntry> entries;
+    bool decoded = decode(&entries);
+    std::remove(binaryPath);
+    std::remove(path);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "BenchLog: storm 0x%08x (%u more suppressed)\n", STORM, STORM - LOG_SITE_BURST);
+    printf("log: %-14s %zu of %u lines written\n", "storm", entries.size(), STORM + 1);
+    if (!decoded || entries.size() != LOG_SITE_BURST + 1 || entries.back().m_text != expected) {
+        printf("log: ERROR: the rate limit let the wrong lines through\n");
+        return false;
+    }
+
+    // Everybody at once, flat out. Drops are allowed here, but they have to be counted.
+    std::vector<std::vector<double>> threadCosts(THREADS);
+    {
+        AsyncLog log;
+        log.open(path);
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < THREADS; ++t) {
+            threads.emplace_back([&, t]() {
+                threadCosts[t].reserve(MESSAGES / THREADS);
+                for (uint32_t i = 0; i < MESSAGES / THREADS; ++i) {
+                    auto start = Clock::now();
+                    logLine(log, t, i);
+                    threadCosts[t].push_back(std::chrono::duration<double>(Clock::now() - start).count());
+                }
+            });
+        }
+        for (std::thread& thread : threads)
+            thread.join();
+    }
+    costs.clear();
+    for (const std::vector<double>& samples : threadCosts)
+        costs.insert(costs.end(), samples.begin(), samples.end());
+    BenchPrintLatencies("log", "async x4", costs);
+    return verify("async x4", THREADS, MESSAGES);
+}
+
+// ================================================================================================
+
+// A handful of the real ones, out of order, so the table has some sorting to do.
+static constexpr MessageNames<7> s_benchMessageNames{ { {
+    { 0x0200, "WM_MOUSEMOVE" },
+    { 0x0001, "WM_CREATE" },
+    { 0x0113, "WM_TIMER" },
+    { 0x0020, "WM_SETCURSOR" },
+    { 0x0084, "WM_NCHITTEST" },
+    { 0x001C, "WM_ACTIVATEAPP" },
+    { 0x000F, "WM_PAINT" },
+} } };
+static_assert(s_benchMessageNames.unique(), "duplicate message in the bench table");
+static_assert(s_benchMessageNames.find(0x0001) && s_benchMessageNames.find(0x0200), "sorted lookup failed");
+static_assert(!s_benchMessageNames.find(0x0002), "sorted table found a message that isn't there");
+
+static bool BenchMessages()
+{
+    using Clock = std::chrono::high_resolution_clock;
+
+    // What the debug WndProc used to do for every message, against just recording it.
+    constexpr uint32_t MESSAGES = 20000;
+    const char* path = "legacy_bench_messages.log";
+    auto name = [](uint32_t message) { return s_benchMessageNames.find(message); };
+    auto message = [](uint32_t i) { return (i % 3) == 0 ? 0x0200u : ((i % 3) == 1 ? 0x0084u : 0x0400u + i); };
+
+    std::vector<double> costs;
+    costs.reserve(MESSAGES);
+    {
+        std::ofstream log(path, std::ios::out);
+        for (uint32_t i = 0; i < MESSAGES; ++i) {
+            auto start = Clock::now();
+            const char* known = name(message(i));
+            log << "WndProc: Forwarded ";
+            if (known)
+                log << known << " ";
+            else
+                log << "0x" << std::hex << message(i) << " ";
+            log << std::hex << "wParam: 0x" << i << " lParam: 0x" << (i * 7) << " Result: 0x" << 0 << std::endl;
+            costs.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+        }
+    }
+    std::remove(path);
+    BenchPrintLatencies("messages", "ofstream", costs);
+
+    MessageTrace trace;
+    trace.enable(MESSAGE_TRACE_MIN_RECORDS);
+    costs.clear();
+    for (uint32_t i = 0; i < MESSAGES; ++i) {
+        auto start = Clock::now();
+        trace.record(e_messageWndProc, message(i), i, i * 7, 0);
+        costs.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    BenchPrintLatencies("messages", "trace", costs);
+
+    // Only the newest ones survive, in order, and they come back with their names.
+    std::vector<MessageRecord> records = trace.snapshot();
+    bool ok = records.size() == MESSAGE_TRACE_MIN_RECORDS;
+    for (size_t i = 0; ok && i < records.size(); ++i) {
+        uint32_t expected = MESSAGES - MESSAGE_TRACE_MIN_RECORDS + (uint32_t)i;
+        ok = records[i].m_wParam == expected && records[i].m_message == message(expected);
+    }
+    std::ostringstream dump;
+    ok &= trace.dump(dump, [](uint32_t message) { return s_benchMessageNames.find(message); }) == records.size();
+    char unknown[16];
+    snprintf(unknown, sizeof(unknown), " 0x%04x ", records.back().m_message);
+    std::string text = dump.str();
+    ok &= text.find(" WM_MOUSEMOVE ") != std::string::npos && text.find(" WM_NCHITTEST ") != std::string::npos;
+    ok &= name(records.back().m_message) || text.find(unknown) != std::string::npos;
+    if (!ok) {
+        printf("messages: ERROR: the trace didn't keep the newest messages in order\n");
+        return false;
+    }
+
+    // Several threads at once get a ring each, and the snapshot merges them back by time.
+    constexpr uint32_t THREADS = 4;
+    MessageTrace threaded;
+    threaded.enable(MESSAGES);
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&threaded, t]() {
+            for (uint32_t i = 0; i < MESSAGES / THREADS; ++i)
+                threaded.record(e_messageRemoved, 0x0200, t, i);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    records = threaded.snapshot();
+    std::vector<int64_t> last(THREADS, -1);
+    ok = records.size() == MESSAGES;
+    for (size_t i = 0; ok && i < records.size(); ++i) {
+        const MessageRecord& record = records[i];
+        ok = record.m_wParam < THREADS && (int64_t)record.m_lParam == last[record.m_wParam] + 1 &&
+             (i == 0 || records[i - 1].m_time <= record.m_time);
+        if (ok)
+            last[record.m_wParam] = (int64_t)record.m_lParam;
+    }
+    printf("messages: %u threads recorded %zu messages into %zu rings\n", THREADS, records.size(), (size_t)THREADS);
+    if (!ok) {
+        printf("messages: ERROR: the merged trace is out of order or missing messages\n");
+        return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchMessageStats()
+{
+    // Messages land in their own slot below WM_USER and are lumped together by range above it.
+    bool ok = MessageStatsSlot(0x0200) == 0x0200 && MessageStatsSlot(0x0400) == e_messageRangeUser &&
+              MessageStatsSlot(0x7FFF) == e_messageRangeUser && MessageStatsSlot(0x8000) == e_messageRangeApp &&
+              MessageStatsSlot(0xC123) == e_messageRangeRegistered &&
+              MessageStatsSlot(0x10000) == e_messageRangeOther;
+    ok &= MessageStats::bucketOf(0) == 0 && MessageStats::bucketOf(1) == 1 && MessageStats::bucketOf(3) == 2 &&
+          MessageStats::bucketOf(4) == 3 && MessageStats::bucketOf(UINT64_MAX) == MESSAGE_STATS_BUCKETS - 1;
+    if (!ok) {
+        printf("wmstats: ERROR: messages or times went into the wrong slot\n");
+        return false;
+    }
+
+    // What it costs to count every message the WndProc sees, once the counter is calibrated.
+    MessageStats stats;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    constexpr uint32_t MESSAGES = 200000;
+    double elapsed = BenchMeasure([&]() {
+        for (uint32_t i = 0; i < MESSAGES; ++i)
+            stats.record((i % 3) == 0 ? 0x0200u : 0x0084u + (i & 0x3FF), 500 + (i & 0xFF));
+    }, 1);
+    printf("wmstats: %5.1f ns per message recorded\n", (elapsed * 1e9) / MESSAGES);
+
+    // Some made up timings: lots of quick mouse moves, a few slow paints, and timers in between.
+    stats.reset();
+    stats.setStallThreshold(10);
+    double scale = stats.cyclesPerMicrosecond();
+    uint32_t stalls = 0;
+    for (uint32_t i = 0; i < 1000; ++i)
+        stalls += stats.record(0x0200, (uint64_t)(scale * 1.0));
+    for (uint32_t i = 0; i < 100; ++i)
+        stalls += stats.record(0x0113, (uint64_t)(scale * 100.0));
+    for (uint32_t i = 0; i < 10; ++i)
+        stalls += stats.record(0x000F, (uint64_t)(scale * (i < 5 ? 2000.0 : 20000.0)));
+    stats.record(0x0401, (uint64_t)scale);
+
+    std::vector<MessageSummary> top = stats.top(3);
+    ok = top.size() == 3 && top[0].m_slot == 0x000F && top[1].m_slot == 0x0113 && top[2].m_slot == 0x0200;
+    ok = ok && top[0].m_calls == 10 && top[1].m_calls == 100 && top[2].m_calls == 1000;
+    ok = ok && std::abs(top[1].m_meanUs - 100.0) < 5.0 && top[1].m_p50Us > 99.0 && top[1].m_p50Us <= 200.0;
+    ok = ok && top[0].m_p99Us > 19000.0 && top[0].m_maxUs > 19000.0 && top[0].m_maxUs < 21000.0;
+    ok = ok && stalls == 5 && stats.stalls() == 5 && top[0].m_stalls == 5 && top[1].m_stalls == 0;
+    if (!ok) {
+        printf("wmstats: ERROR: the top offenders don't add up\n");
+        return false;
+    }
+
+    std::ostringstream table;
+    ok = stats.write(table, [](uint32_t message) { return s_benchMessageNames.find(message); }, 8) == 4;
+    std::string text = table.str();
+    ok &= text.find("WM_PAINT ") < text.find("WM_TIMER ") && text.find("WM_TIMER ") < text.find("WM_MOUSEMOVE ");
+    ok &= text.find("WM_USER+ ") != std::string::npos;
+    printf("%s", text.c_str());
+    if (!ok) {
+        printf("wmstats: ERROR: the table is missing messages or out of order\n");
+        return false;
+    }
+
+    // And a real one, timed with the counter like the WndProc does.
+    uint64_t start = StageReadCycles();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    if (!stats.record(0x0113, StageReadCycles() - start)) {
+        printf("wmstats: ERROR: a 20ms message didn't count as a stall\n");
+        return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchViewTransform()
+{
+    // The fixed point scale has to land exactly where the old divisions did, including a little
+    // way outside the window on either side, for every size the menu offers and then some.
+    static const int32_t sizes[][2] = {
+        { 640, 480 }, { 800, 600 }, { 1024, 768 }, { 1152, 864 }, { 1280, 980 }, { 1400, 1050 },
+        { 1600, 1200 }, { 1920, 1440 }, { 2048, 1536 }, { 3200, 2400 }, { 3840, 2160 }, { 7, 3 },
+    };
+    for (const auto& size : sizes) {
+        ViewTransform view = ViewTransform::make(size[0], size[1]);
+        for (int32_t x = -size[0]; x < size[0] * 2; ++x) {
+            if (view.toGameX(x) != (x * VIEW_GAME_WIDTH) / size[0]) {
+                printf("view: ERROR: %dx%d puts x %d at %d instead of %d\n", size[0], size[1], x, view.toGameX(x),
+                       (x * VIEW_GAME_WIDTH) / size[0]);
+                return false;
+            }
+        }
+        for (int32_t y = -size[1]; y < size[1] * 2; ++y) {
+            if (view.toGameY(y) != (y * VIEW_GAME_HEIGHT) / size[1]) {
+                printf("view: ERROR: %dx%d puts y %d at %d instead of %d\n", size[0], size[1], y, view.toGameY(y),
+                       (y * VIEW_GAME_HEIGHT) / size[1]);
+                return false;
+            }
+        }
+    }
+
+    // What a mouse message pays to get translated, before and after.
+    constexpr int32_t POINTS = 1000000;
+    ViewTransformCell cell{ ViewTransform::make(1600, 1200) };
+    volatile int32_t width = 1600, height = 1200;
+    int64_t sink = 0;
+    double divided = BenchMeasure([&]() {
+        for (int32_t i = 0; i < POINTS; ++i)
+            sink += ((i & 1023) * 640) / width + ((i & 1023) * 480) / height;
+    }, 3);
+    double scaled = BenchMeasure([&]() {
+        for (int32_t i = 0; i < POINTS; ++i) {
+            ViewTransform view = cell.load();
+            sink += view.toGameX(i & 1023) + view.toGameY(i & 1023);
+        }
+    }, 3);
+    printf("view: %5.2f ns per point divided, %5.2f ns loaded and scaled (%lld)\n", (divided * 1e9) / POINTS,
+           (scaled * 1e9) / POINTS, (long long)(sink & 1));
+
+    // Readers hammering away while the resolution flips back and forth must only ever see one
+    // whole transform or the other.
+    ViewTransform a = ViewTransform::make(800, 600), b = ViewTransform::make(2560, 1920, 4);
+    cell.publish(a);
+    std::atomic<bool> done{ false };
+    std::atomic<uint64_t> torn{ 0 }, reads{ 0 };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; ++i) {
+        readers.emplace_back([&]() {
+            uint64_t count = 0, bad = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                ViewTransform view = cell.load();
+                const ViewTransform& expected = view.m_width == a.m_width ? a : b;
+                bad += view.m_height != expected.m_height || view.m_integerScale != expected.m_integerScale ||
+                       view.m_toGameX != expected.m_toGameX || view.m_toGameY != expected.m_toGameY;
+                count++;
+            }
+            reads.fetch_add(count);
+            torn.fetch_add(bad);
+        });
+    }
+    for (int i = 0; i < 200000; ++i)
+        cell.publish((i & 1) ? a : b);
+    done = true;
+    for (std::thread& reader : readers)
+        reader.join();
+    printf("view: %llu reads across %u publishes, %llu torn\n", (unsigned long long)reads.load(),
+           cell.version(), (unsigned long long)torn.load());
+    if (torn.load() != 0 || cell.version() != 200001) {
+        printf("view: ERROR: a reader saw half of a resolution change\n");
+        return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static bool BenchCursorCache()
+{
+    // Nothing, then a fresh position, then the same one once it's too old, and never anything
+    // outside the client area or after it's been thrown away.
+    CursorCache cache;
+    int32_t x = -1, y = -1;
+    bool ok = cache.lookup(x, y, 1000, 640, 480) == e_cursorEmpty;
+    cache.update(100, 200, 1000);
+    ok &= cache.lookup(x, y, 1010, 640, 480) == e_cursorHit && x == 100 && y == 200;
+    ok &= cache.lookup(x, y, 1000 + CURSOR_CACHE_MAX_AGE_MS, 640, 480) == e_cursorStale;
+    cache.update(-5, 10, 1000);
+    ok &= cache.lookup(x, y, 1000, 640, 480) == e_cursorOutside;
+    cache.update(10, -7, 1000);
+    ok &= cache.lookup(x, y, 1000, 640, 480) == e_cursorOutside;
+    cache.update(639, 479, 1000);
+    ok &= cache.lookup(x, y, 1000, 640, 480) == e_cursorHit && x == 639 && y == 479;
+    ok &= cache.lookup(x, y, 1000, 600, 480) == e_cursorOutside;
+    cache.invalidate();
+    ok &= cache.lookup(x, y, 1000, 640, 480) == e_cursorEmpty;
+
+    // The clock wrapping around shouldn't make a fresh position look ancient.
+    cache.update(1, 2, 0xFFFFFFF0);
+    ok &= cache.lookup(x, y, 0x00000010, 640, 480) == e_cursorHit && x == 1 && y == 2;
+    cache.setMaxAge(0);
+    ok &= cache.lookup(x, y, 0x00000010, 640, 480) == e_cursorStale;
+
+    CursorCacheStats stats = cache.stats();
+    ok &= stats.m_updates == 5 && stats.m_lookups[e_cursorHit] == 3 && stats.m_lookups[e_cursorEmpty] == 2 &&
+          stats.m_lookups[e_cursorStale] == 2 && stats.m_lookups[e_cursorOutside] == 3;
+    if (!ok) {
+        printf("cursor: ERROR: the cache handed out the wrong position\n");
+        return false;
+    }
+
+    // A message that sat in the queue is as old as when it was posted, not when we got to it.
+    cache.setMaxAge(CURSOR_CACHE_MAX_AGE_MS);
+    cache.update(5, 6, 1000);
+    ok = cache.lookup(x, y, 1000 + CURSOR_CACHE_MAX_AGE_MS * 2, 640, 480) == e_cursorStale;
+    if (!ok) {
+        printf("cursor: ERROR: a message that waited in the queue was taken as fresh\n");
+        return false;
+    }
+
+    // Panning: the game polls at 1kHz while the mouse reports at 125Hz for a second, then the
+    // game keeps polling for another second without pumping any messages. Every miss is a
+    // GetCursorPos and a ScreenToClient, and once the messages stop, every poll has to be one.
+    cache.invalidate();
+    cache.resetStats();
+    uint32_t moving = 0, still = 0;
+    for (uint32_t now = 0; now < 2000; ++now) {
+        if (now < 1000 && (now % 8) == 0)
+            cache.update(now % 640, 240, now);
+        if (cache.lookup(x, y, now, 640, 480) == e_cursorHit)
+            (now < 1000 ? moving : still)++;
+    }
+    printf("cursor: %u of 1000 polls served from the cache while moving, %u after the messages stopped\n",
+           moving, still);
+    if (moving < 990 || still > CURSOR_CACHE_MAX_AGE_MS) {
+        printf("cursor: ERROR: the cache either saved nothing or served a frozen cursor\n");
+        return false;
+    }
+
+    // A reader never sees the x from one update with the y from another.
+    std::atomic<bool> done{ false };
+    std::atomic<uint64_t> torn{ 0 };
+    std::thread reader([&]() {
+        uint64_t bad = 0;
+        while (!done.load(std::memory_order_relaxed)) {
+            int32_t rx, ry;
+            if (cache.lookup(rx, ry, 0, 640, 480) == e_cursorHit)
+                bad += ry != 479 - (rx % 480);
+        }
+        torn = bad;
+    });
+    for (int32_t i = 0; i < 1000000; ++i)
+        cache.update(i % 640, 479 - ((i % 640) % 480), 0);
+    done = true;
+    reader.join();
+
+    constexpr uint32_t LOOKUPS = 1000000;
+    int64_t sink = 0;
+    double elapsed = BenchMeasure([&]() {
+        for (uint32_t i = 0; i < LOOKUPS; ++i) {
+            cache.lookup(x, y, i & 15, 640, 480);
+            sink += x;
+        }
+    }, 3);
+    printf("cursor: %5.2f ns per lookup, %llu torn (%lld)\n", (elapsed * 1e9) / LOOKUPS,
+           (unsigned long long)torn.load(), (long long)(sink & 1));
+    if (torn.load() != 0) {
+        printf("cursor: ERROR: a reader saw half of an update\n");
+        return false;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+static const _Benchmark s_benchmarks[] = {
+    { "convert", BenchConvert },
+    { "region", BenchRegion },
+    { "tilehash", BenchTileHash },
+    { "triplebuffer", BenchTripleBuffer },
+    { "wakeup", BenchWakeup },
+    { "flags", BenchFlags },
+    { "scale", BenchScale },
+    { "integer", BenchInteger },
+    { "fused", BenchFused },
+    { "workers", BenchWorkers },
+    { "pipeline", BenchPipeline },
+    { "pacing", BenchPacing },
+    { "framestats", BenchFrameStats },
+    { "stages", BenchStages },
+    { "overlay", BenchOverlay },
+    { "trace", BenchTrace },
+    { "workload", BenchWorkload },
+    { "log", BenchLog },
+    { "messages", BenchMessages },
+    { "wmstats", BenchMessageStats },
+    { "view", BenchViewTransform },
+    { "cursor", BenchCursorCache },
+};
+
+// ================================================================================================
+
+int main(int argc, char** argv)
+{
+    // Run everything by default, or just the benchmarks named on the command line.
+    bool ok = true;
+    for (size_t i = 0; i < std::size(s_benchmarks); ++i) {
+        bool wanted = argc < 2;
+        for (int j = 1; j < argc; ++j)
+            wanted |= strcmp(argv[j], s_benchmarks[i].m_name) == 0;
+        if (wanted)
+            ok &= s_benchmarks[i].m_func();
+    }
+    return ok ? 0 : 1;
+}
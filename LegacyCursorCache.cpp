@@ -0,0 +1,104 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyCursorCache.h"
+
+// ================================================================================================
+
+constexpr uint64_t CURSOR_STATE_VALID = UINT64_C(1) << 63;
+constexpr uint32_t CURSOR_TIME_MASK = 0x7FFFFFFF;
+
+// ================================================================================================
+
+const char* CursorLookupName(CursorLookup lookup)
+{
+    switch (lookup) {
+    case e_cursorHit:
+        return "hit";
+    case e_cursorEmpty:
+        return "empty";
+    case e_cursorStale:
+        return "stale";
+    case e_cursorOutside:
+        return "outside";
+    default:
+        return "???";
+    }
+}
+
+// ================================================================================================
+
+void CursorCache::update(int32_t x, int32_t y, uint32_t now)
+{
+    uint64_t state = CURSOR_STATE_VALID | ((uint64_t)(now & CURSOR_TIME_MASK) << 32) |
+                     ((uint64_t)(uint16_t)y << 16) | (uint64_t)(uint16_t)x;
+    m_state.store(state, std::memory_order_relaxed);
+    m_updates.fetch_add(1, std::memory_order_relaxed);
+}
+
+// ================================================================================================
+
+CursorLookup CursorCache::lookup(int32_t& x, int32_t& y, uint32_t now, int32_t width, int32_t height)
+{
+    CursorLookup result;
+    uint64_t state = m_state.load(std::memory_order_relaxed);
+    if (!(state & CURSOR_STATE_VALID)) {
+        result = e_cursorEmpty;
+    } else {
+        // The time wraps every 24 days or so, which the masking takes care of.
+        uint32_t age = (now - (uint32_t)(state >> 32)) & CURSOR_TIME_MASK;
+        int32_t cachedX = (int16_t)(state & 0xFFFF);
+        int32_t cachedY = (int16_t)((state >> 16) & 0xFFFF);
+        if (age >= m_maxAge.load(std::memory_order_relaxed)) {
+            result = e_cursorStale;
+        } else if (cachedX < 0 || cachedY < 0 || cachedX >= width || cachedY >= height) {
+            // Mouse messages keep coming while the mouse is captured, even from outside the
+            // window, but only Windows knows where the cursor has gone since.
+            result = e_cursorOutside;
+        } else {
+            x = cachedX;
+            y = cachedY;
+            result = e_cursorHit;
+        }
+    }
+    m_lookups[result].fetch_add(1, std::memory_order_relaxed);
+    return result;
+}
+
+// ================================================================================================
+
+CursorCacheStats CursorCache::stats() const
+{
+    CursorCacheStats stats{ };
+    for (int i = 0; i < e_cursorLookupCount; ++i)
+        stats.m_lookups[i] = m_lookups[i].load(std::memory_order_relaxed);
+    stats.m_updates = m_updates.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// ================================================================================================
+
+void CursorCache::resetStats()
+{
+    for (std::atomic<uint64_t>& lookups : m_lookups)
+        lookups.store(0, std::memory_order_relaxed);
+    m_updates.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,87 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_CURSORCACHE_H
+#define __LEGACY_CURSORCACHE_H
+
+#include <atomic>
+#include <cstdint>
+
+// ================================================================================================
+
+// How old, by default, a cursor position from a mouse message may get before we go and ask
+// Windows again. Zero turns the cache off.
+constexpr uint32_t CURSOR_CACHE_MAX_AGE_MS = 50;
+
+enum CursorLookup
+{
+    e_cursorHit,
+    e_cursorEmpty,
+    e_cursorStale,
+    e_cursorOutside,
+
+    e_cursorLookupCount,
+};
+
+const char* CursorLookupName(CursorLookup lookup);
+
+struct CursorCacheStats
+{
+    uint64_t m_lookups[e_cursorLookupCount];
+    uint64_t m_updates;
+};
+
+// ================================================================================================
+
+// Where the cursor was in the client area the last time a mouse message said so. The position
+// and when it was seen are packed into a single word, so it can be kept fresh and read from any
+// thread without locking or tearing. Times are in milliseconds from whatever
+// clock the caller likes, as long as it's always the same one.
+class CursorCache
+{
+    // Bit 63 says there's anything here at all, then 31 bits of time, then y and x as 16 bits
+    // each, which is plenty for client coordinates.
+    std::atomic<uint64_t> m_state{ 0 };
+    std::atomic<uint32_t> m_maxAge{ CURSOR_CACHE_MAX_AGE_MS };
+
+    std::atomic<uint64_t> m_lookups[e_cursorLookupCount]{ };
+    std::atomic<uint64_t> m_updates{ 0 };
+
+public:
+    CursorCache() = default;
+
+    CursorCache(const CursorCache&) = delete;
+    CursorCache& operator=(const CursorCache&) = delete;
+
+    void setMaxAge(uint32_t ms) { m_maxAge.store(ms, std::memory_order_relaxed); }
+    uint32_t maxAge() const { return m_maxAge.load(std::memory_order_relaxed); }
+
+    void update(int32_t x, int32_t y, uint32_t now);
+    void invalidate() { m_state.store(0, std::memory_order_relaxed); }
+
+    // Only hits if the position is recent enough and inside a width x height client area.
+    CursorLookup lookup(int32_t& x, int32_t& y, uint32_t now, int32_t width, int32_t height);
+
+    CursorCacheStats stats() const;
+    void resetStats();
+};
+
+#endif
@@ -20,15 +20,30 @@
  */
 
 #include "LegacyWindow.h"
+#include <mmsystem.h>
 
+#include <atomic>
+#include <cstdlib>
 #include <fstream>
+#include <iomanip>
+#include <memory>
 #include <mutex>
 #include <set>
-#include <thread>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "DLL.h"
-#include "LegacyTimer.h"
+#include "LegacyFrameStats.h"
+#include "LegacyLog.h"
+#include "LegacyOverlay.h"
+#include "LegacyPipeline.h"
+#include "LegacyPresentGDI.h"
+#include "LegacyRegion.h"
+#include "LegacyScaler.h"
+#include "LegacyTrace.h"
 #include "LegacyTypedefs.h"
+#include "LegacyWorkers.h"
 #include "MinHookpp.h"
 
 // ================================================================================================
@@ -37,12 +52,13 @@ struct PrimarySurface
 {
     LPDIRECTDRAWSURFACE m_proxySurface{ 0 };
     std::recursive_mutex m_surfaceMut;
-    uint32_t m_flags{ 0 };
-    std::mutex m_flagsMut;
-    HDC m_frameDC{ 0 };
-    HBITMAP m_frameBitmap{ 0 };
-    BITMAPINFO m_bitmapInfo{ 0 };
-    HFONT m_font{ 0 };
+    DirtyRegion m_dirtyRegion{ 640, 480 };
+    Rect m_lockRect{ };
+    const uint16_t* m_lockBits{ nullptr };
+    LONG m_lockPitch{ 0 };
+    std::atomic<uint32_t> m_flags{ 0 };
+    std::atomic<ScaleFilter> m_scaleFilter{ e_scaleBilinear };
+    OverlayAtlas m_overlayAtlas;
     HWND m_bltTarget{ };
     POINT m_bltOffset{ };
 };
@@ -50,22 +66,42 @@ struct PrimarySurface
 enum
 {
     e_mainSurfaceDirty = (1<<0),
-    e_wantQuit = (1<<1),
-    e_ddrawPrimarySurfaceAcquired = (1<<2),
-    e_gdiObjectsAcquired = (1<<3),
-    e_showFps = (1<<4),
-    e_showFrameTime = (1<<5),
-    e_initComplete = (1<<6),
+    e_ddrawPrimarySurfaceAcquired = (1<<1),
+    e_gdiObjectsAcquired = (1<<2),
+    e_showFps = (1<<3),
+    e_showFrameTime = (1<<4),
+    e_initComplete = (1<<5),
+    e_forcePresent = (1<<6),
+    e_showFrameStats = (1<<7),
+
+    e_showOverlay = (e_showFps | e_showFrameTime | e_showFrameStats),
 };
 
-static void LegacyDrawThread();
+// Feeds the pipeline from the proxy surface that the game draws into.
+class _PrimarySurfaceHost : public PipelineHost
+{
+    std::atomic<float> m_lastFrameTime{ 0.f };
+    PipelineClock::time_point m_lastStageLog{ };
+
+public:
+    PipelineGrab grab(uint16_t* frame, DirtyRegion& damage, bool& force) override;
+    PipelineView view() override;
+    const OverlayAtlas* overlay(OverlayText& text) override;
+    void endPresent(const OutputFrame& frame, PipelineClock::duration frameTime) override;
+};
 
 // ================================================================================================
 
-extern std::ofstream s_log;
+extern AsyncLog s_log;
 static PrimarySurface s_primarySurface;
 static std::set<LPDIRECTDRAWSURFACE> s_ephemeralSurfaces;
-static std::thread s_drawThread;
+static _PrimarySurfaceHost s_host;
+static Pipeline s_pipeline{ s_host, s_log };
+static std::unique_ptr<PresentBackend> s_backend;
+static std::unique_ptr<WorkerPool> s_workers;
+static bool s_timerPeriod = false;
+static FrameStats s_frameStats;
+static TraceRecorder s_trace{ s_log };
 
 static MHpp_Hook<FDirectDrawCreate>* s_ddrawCreateHook = nullptr;
 
@@ -83,8 +119,6 @@ static FDirectDrawCreateSurface s_ddrawCreateSurface = nullptr;
 static FDirectDrawSetCooperativeLevel s_ddrawSetCooperativeLevel = nullptr;
 static FDirectDrawSetDisplayMode s_ddrawSetDisplayMode = nullptr;
 
-constexpr size_t PIXEL_COUNT = 640 * 480;
-
 // ================================================================================================
 
 template<typename Args>
@@ -98,6 +132,111 @@ static inline void SwapImplementation(LPVOID* vftable, size_t index, Args& origi
 
 // ================================================================================================
 
+static void LegacyMarkDirty(const Rect& rect)
+{
+    // The dirty region is protected by the surface mutex, so the caller must be holding it.
+    // We set the dirty flag while still holding it so that the draw thread can never observe
+    // the flag without the region that goes along with it.
+    s_primarySurface.m_dirtyRegion.add(rect);
+    s_primarySurface.m_flags.fetch_or(e_mainSurfaceDirty, std::memory_order_release);
+
+    // Wake the capture thread. It will have to wait for the caller to release the surface,
+    // but that's about to happen anyway.
+    s_pipeline.wake();
+}
+
+// ================================================================================================
+
+static inline Rect LegacyFullSurfaceRect()
+{
+    return { 0, 0, 640, 480 };
+}
+
+// ================================================================================================
+
+static void LegacyCreateWorkers()
+{
+    // Capture and convert share one pool so that they don't end up fighting each other for the
+    // same CPUs. LEGACY_WORKERS overrides how many helper threads there are (0 to go it alone),
+    // and LEGACY_PIN_WORKERS=1 locks each of them to a CPU.
+    int threads = -1;
+    if (const char* env = std::getenv("LEGACY_WORKERS"))
+        threads = std::atoi(env);
+    bool pin = false;
+    if (const char* env = std::getenv("LEGACY_PIN_WORKERS"))
+        pin = std::atoi(env) != 0;
+
+    s_workers.reset(new WorkerPool(threads, pin));
+    s_log << "LegacyCreateWorkers: " << std::dec << s_workers->size() << " threads"
+          << (pin ? " (pinned)" : "") << std::endl;
+}
+
+// ================================================================================================
+
+static void LegacyConfigurePacing()
+{
+    // There's no point presenting faster than the monitor can show it. LEGACY_PRESENT_HZ picks
+    // another cap, or 0 for none at all.
+    double rate = 0.0;
+    if (const char* env = std::getenv("LEGACY_PRESENT_HZ")) {
+        rate = std::atof(env);
+    } else {
+        HDC tempDC = GetDC(HWND_DESKTOP);
+        rate = GetDeviceCaps(tempDC, VREFRESH);
+        ReleaseDC(HWND_DESKTOP, tempDC);
+
+        // 0 and 1 both mean "the hardware default", whatever that is.
+        if (rate <= 1.0)
+            rate = 60.0;
+    }
+
+    // The scheduler sleeps most of the way to each deadline, which is hopeless with the
+    // default 15.6ms timer tick.
+    if (rate > 0.0 && !s_timerPeriod)
+        s_timerPeriod = timeBeginPeriod(1) == TIMERR_NOERROR;
+    s_pipeline.setPresentRate(rate);
+    s_log << "LegacyConfigurePacing: " << std::dec << rate << " Hz" << std::endl;
+}
+
+// ================================================================================================
+
+static void LegacyTraceSurface(LPDIRECTDRAWSURFACE self, TraceEvent event, Rect rect)
+{
+    // Whatever the call did is already done, so the trace has to take its own look at the
+    // result. The caller must be holding the surface mutex.
+    rect = rect.intersect(LegacyFullSurfaceRect());
+    DDSURFACEDESC desc = { 0 };
+    desc.dwSize = sizeof(desc);
+    HRESULT result = s_ddrawSurfaceLock(self, nullptr, &desc, DDLOCK_WAIT | DDLOCK_READONLY, nullptr);
+    if (FAILED(result) || rect.empty()) {
+        if (SUCCEEDED(result))
+            s_ddrawSurfaceUnlock(self, desc.lpSurface);
+        s_trace.record(event, rect);
+        return;
+    }
+
+    const uint8_t* bits = (const uint8_t*)desc.lpSurface + (rect.top * desc.lPitch) +
+                          (rect.left * sizeof(uint16_t));
+    s_trace.record(event, rect, (const uint16_t*)bits, desc.lPitch);
+    s_ddrawSurfaceUnlock(self, desc.lpSurface);
+}
+
+// ================================================================================================
+
+static void LegacyStartTrace()
+{
+    // LEGACY_TRACE=path records everything the game does to the proxy surface, so that the
+    // pipeline can be fed the same thing again later without the game.
+    const char* path = std::getenv("LEGACY_TRACE");
+    if (!path || !*path || !s_trace.open(path, PIPELINE_WIDTH, PIPELINE_HEIGHT))
+        return;
+
+    std::lock_guard<std::recursive_mutex> _(s_primarySurface.m_surfaceMut);
+    LegacyTraceSurface(s_primarySurface.m_proxySurface, e_traceSnapshot, LegacyFullSurfaceRect());
+}
+
+// ================================================================================================
+
 static HRESULT STDMETHODCALLTYPE LegacyStubSurfaceBlt(LPDIRECTDRAWSURFACE self,
                                                       LPRECT lpDestRect,
                                                       LPDIRECTDRAWSURFACE lpDDSrcSurface,
@@ -138,8 +277,8 @@ static HRESULT STDMETHODCALLTYPE LegacyProxySurfaceBltFast(LPDIRECTDRAWSURFACE s
         HDC srcDC;
         HRESULT result = lpDDSrcSurface->GetDC(&srcDC);
         if (FAILED(result)) {
-            s_log << "IDirectDrawSurface::BltFast: ERROR! lpDDSrcSurface->GetDC failed... 0x"
-                  << std::hex << result << std::endl;
+            LEGACY_LOG(s_log, "IDirectDrawSurface::BltFast: ERROR! lpDDSrcSurface->GetDC failed... 0x%x",
+                       result);
             return result;
         }
 
@@ -155,22 +294,36 @@ static HRESULT STDMETHODCALLTYPE LegacyProxySurfaceBltFast(LPDIRECTDRAWSURFACE s
 
         result = lpDDSrcSurface->ReleaseDC(srcDC);
         if (FAILED(result)) {
-            s_log << "IDirectDrawSurface::BltFast: ERROR! lpDDSrcSurface->ReleaseDC failed... 0x"
-                  << std::hex << result << std::endl;
+            LEGACY_LOG(s_log, "IDirectDrawSurface::BltFast: ERROR! lpDDSrcSurface->ReleaseDC failed... 0x%x",
+                       result);
             return result;
         }
         return DD_OK;
     } else {
-        s_primarySurface.m_surfaceMut.lock();
+        // Only the destination area of the blit needs to be redrawn. When no source rect is
+        // given, the entire source surface is blitted.
+        Rect damage = LegacyFullSurfaceRect();
+        if (lpSrcRect) {
+            damage = { (int)dwX, (int)dwY,
+                       (int)dwX + (lpSrcRect->right - lpSrcRect->left),
+                       (int)dwY + (lpSrcRect->bottom - lpSrcRect->top) };
+        } else {
+            DDSURFACEDESC srcDesc{ 0 };
+            srcDesc.dwSize = sizeof(srcDesc);
+            if (SUCCEEDED(lpDDSrcSurface->GetSurfaceDesc(&srcDesc)))
+                damage = { (int)dwX, (int)dwY, (int)(dwX + srcDesc.dwWidth), (int)(dwY + srcDesc.dwHeight) };
+        }
+
+        std::lock_guard<std::recursive_mutex> _(s_primarySurface.m_surfaceMut);
         HRESULT result = s_ddrawSurfaceBltFast(self, dwX, dwY, lpDDSrcSurface, lpSrcRect, dwTrans);
-        s_primarySurface.m_surfaceMut.unlock();
         if (FAILED(result)) {
-            s_log << "IDirectDrawSurface::BltFast: ERROR! 0x" << std::hex << result << std::endl;
+            LEGACY_LOG(s_log, "IDirectDrawSurface::BltFast: ERROR! 0x%x", result);
             return result;
         }
 
-        std::lock_guard<std::mutex> _{ s_primarySurface.m_flagsMut };
-        s_primarySurface.m_flags |= e_mainSurfaceDirty;
+        if (s_trace.recording())
+            LegacyTraceSurface(self, e_traceBltFast, damage);
+        LegacyMarkDirty(damage);
         return DD_OK;
     }
 }
@@ -183,9 +336,10 @@ static HRESULT STDMETHODCALLTYPE LegacyProxySurfaceGetDC(LPDIRECTDRAWSURFACE sel
     HRESULT result = s_ddrawSurfaceGetDC(self, lphDC);
     if (FAILED(result)) {
         s_primarySurface.m_surfaceMut.unlock();
-        s_log << "IDirectDrawSurface::Lock: Proxy surface GetDC failed 0x" << std::hex << result << std::endl;
+        LEGACY_LOG(s_log, "IDirectDrawSurface::Lock: Proxy surface GetDC failed 0x%x", result);
         return result;
     }
+    s_trace.record(e_traceGetDC, LegacyFullSurfaceRect());
 
     // Failure to release recurive mutex is intentional.
     return result;
@@ -203,10 +357,20 @@ static HRESULT STDMETHODCALLTYPE LegacyProxySurfaceLock(LPDIRECTDRAWSURFACE self
     HRESULT result = s_ddrawSurfaceLock(self, lpDestRect, lpDDSurfaceDesc, dwFlags, hEvent);
     if (FAILED(result)) {
         s_primarySurface.m_surfaceMut.unlock();
-        s_log << "IDirectDrawSurface::Lock: Proxy surface lock failed 0x" << std::hex << result << std::endl;
+        LEGACY_LOG(s_log, "IDirectDrawSurface::Lock: Proxy surface lock failed 0x%x", result);
         return result;
     }
 
+    // Remember what the game asked for so that Unlock can mark only that area as dirty.
+    if (lpDestRect)
+        s_primarySurface.m_lockRect = { lpDestRect->left, lpDestRect->top,
+                                        lpDestRect->right, lpDestRect->bottom };
+    else
+        s_primarySurface.m_lockRect = LegacyFullSurfaceRect();
+    s_primarySurface.m_lockBits = (const uint16_t*)lpDDSurfaceDesc->lpSurface;
+    s_primarySurface.m_lockPitch = lpDDSurfaceDesc->lPitch;
+    s_trace.record(e_traceLock, s_primarySurface.m_lockRect);
+
     // Failure to release recurive mutex is intentional.
     return result;
 }
@@ -217,9 +381,11 @@ static HRESULT STDMETHODCALLTYPE LegacyProxySurfaceReleaseDC(LPDIRECTDRAWSURFACE
 {
     HRESULT result = s_ddrawSurfaceReleaseDC(self, hDC);
     if (SUCCEEDED(result)) {
+        // GDI could have drawn anywhere, so assume the worst.
+        if (s_trace.recording())
+            LegacyTraceSurface(self, e_traceReleaseDC, LegacyFullSurfaceRect());
+        LegacyMarkDirty(LegacyFullSurfaceRect());
         s_primarySurface.m_surfaceMut.unlock();
-        std::lock_guard<std::mutex> _(s_primarySurface.m_flagsMut);
-        s_primarySurface.m_flags |= e_mainSurfaceDirty;
     }
     return DD_OK;
 }
@@ -229,16 +395,18 @@ static HRESULT STDMETHODCALLTYPE LegacyProxySurfaceReleaseDC(LPDIRECTDRAWSURFACE
 static HRESULT STDMETHODCALLTYPE LegacyProxySurfaceUnlock(LPDIRECTDRAWSURFACE self,
                                                           LPVOID lpSurfaceData)
 {
+    // The pointer from Lock is only good until the surface is unlocked. It points at the top
+    // left of the locked rect, not of the surface.
+    s_trace.record(e_traceUnlock, s_primarySurface.m_lockRect, s_primarySurface.m_lockBits,
+                   s_primarySurface.m_lockPitch);
     HRESULT result = s_ddrawSurfaceUnlock(self, lpSurfaceData);
     if (FAILED(result)) {
-        s_log << "IDirectDrawSurface::Unlock: Proxy surface unlock failed 0x" << std::hex
-              << result << std::endl;
+        LEGACY_LOG(s_log, "IDirectDrawSurface::Unlock: Proxy surface unlock failed 0x%x", result);
         return result;
     }
 
+    LegacyMarkDirty(s_primarySurface.m_lockRect);
     s_primarySurface.m_surfaceMut.unlock();
-    std::lock_guard<std::mutex> _(s_primarySurface.m_flagsMut);
-    s_primarySurface.m_flags |= e_mainSurfaceDirty;
     return DD_OK;
 }
 
@@ -304,19 +472,21 @@ static HRESULT STDMETHODCALLTYPE LegacyDDrawCreateSurface(LPDIRECTDRAW self, LPD
     }
 
     // Setup hooking for the primary surface (may Gawd have mercy on us)
-    std::lock_guard<std::mutex> _(s_primarySurface.m_flagsMut);
     if (want_primary) {
-        if (s_primarySurface.m_flags & e_ddrawPrimarySurfaceAcquired) {
+        if (s_primarySurface.m_flags.fetch_or(e_ddrawPrimarySurfaceAcquired) & e_ddrawPrimarySurfaceAcquired) {
             s_log << "IDirectDraw::CreateSurface: trying to create the primary surface multiple times..."
                   << "Time to crash..." << std::endl;
             return DDERR_PRIMARYSURFACEALREADYEXISTS;
         }
 
-        s_primarySurface.m_flags |= e_ddrawPrimarySurfaceAcquired;
         s_primarySurface.m_proxySurface = *lplpDDSurface;
+        s_primarySurface.m_dirtyRegion.addAll();
 
-        // Offloaded drawing to a thread due to how slow it is...
-        s_drawThread = std::thread{ LegacyDrawThread };
+        // Offloaded drawing to threads due to how slow it is...
+        LegacyCreateWorkers();
+        LegacyConfigurePacing();
+        s_backend.reset(new DIBSectionBackend);
+        s_pipeline.start(*s_backend, *s_workers);
 
         // IDirectDrawSurface VFTable
         LPVOID* vftable = (LPVOID*)((int*)*lplpDDSurface)[0];
@@ -356,6 +526,8 @@ static HRESULT STDMETHODCALLTYPE LegacyDDrawCreateSurface(LPDIRECTDRAW self, LPD
         // 33: UpdateOverlay
         // 34: UpdateOverlayDisplay
         // 35: UpdateOverlayZOrder
+
+        LegacyStartTrace();
     }
 
     // If all the main drawing surfaces have been created, this is an ephemeral surface that should
@@ -450,14 +622,8 @@ static HRESULT WINAPI LegacyDDrawCreate(GUID FAR* lpGUID, LPDIRECTDRAW FAR* lplp
 
 // ================================================================================================
 
-static void LegacyDrawThread()
+PipelineGrab _PrimarySurfaceHost::grab(uint16_t* frame, DirtyRegion& damage, bool& force)
 {
-    s_log << "LegacyDrawThread: in the saddle..." << std::endl;
-
-    Timer frame_timer;
-    uint32_t frame_count{ 0 };
-    float last_frame_time{ 0.f };
-
     // So, here's the story... The proxy surface in s_primarySurface is 16bpp -- which is required
     // by Legacy.exe. In the main game, this surface represents the screen, so no flipping or
     // anything else is required. In our case, the screen is 32bpp. We can blit the 16bpp proxy
@@ -469,195 +635,320 @@ static void LegacyDrawThread()
     //
     // So, here's the best solution I can find. We'll allow the main thread use our fake proxy
     // IDirectDrawSurface. Because there's no way to know when a "frame" is done (indeed, there
-    // is no such thing as a frame), this thread will lock the surface and copy the data out
-    // when it's detected as dirty. We'll unlock it and do the 16bpp->32bpp conversion here to
-    // prevent the main thread from stalling. We'll then use GDI to blit the resulting 32-bit
-    // bitmap onto the active window's DC.
-    uint16_t* rgb555buf = new uint16_t[PIXEL_COUNT];
-    uint32_t* rgba8888buf = new uint32_t[PIXEL_COUNT];
+    // is no such thing as a frame), the capture thread will lock the surface and copy the data
+    // out when it's detected as dirty. We'll unlock it and hand the copy off to the rest of the
+    // pipeline for the 16bpp->32bpp conversion to prevent the main thread from stalling.
+    if (!(s_primarySurface.m_flags & e_ddrawPrimarySurfaceAcquired) ||
+        !(s_primarySurface.m_flags & e_gdiObjectsAcquired) ||
+        !(s_primarySurface.m_flags & e_mainSurfaceDirty))
+        return e_grabIdle;
+
+    // We call the original Lock/Unlock here so that our own access to the surface does not get
+    // recorded as damage by the hooks.
     DDSURFACEDESC desc = { 0 };
     desc.dwSize = sizeof(desc);
+    HRESULT result;
+    {
+        // Mostly this is waiting for the game thread to get out of the way.
+        LEGACY_TIME_STAGE(s_pipeline.stageTimes(), e_stageLockWait);
+        s_primarySurface.m_surfaceMut.lock();
+        result = s_ddrawSurfaceLock(s_primarySurface.m_proxySurface, nullptr, &desc, DDLOCK_WAIT,
+                                    nullptr);
+    }
+    if (FAILED(result)) {
+        s_primarySurface.m_surfaceMut.unlock();
+        LEGACY_LOG(s_log, "LegacyCaptureThread: ERROR failed to lock proxy surface 0x%x", result);
 
-    do {
-        if (s_primarySurface.m_flags & e_wantQuit)
-            break;
-
-        if ((s_primarySurface.m_flags & e_ddrawPrimarySurfaceAcquired) &&
-            (s_primarySurface.m_flags & e_gdiObjectsAcquired) &&
-            (s_primarySurface.m_flags & e_mainSurfaceDirty)) {
-            frame_timer.start();
-
-            HRESULT result = s_primarySurface.m_proxySurface->Lock(nullptr,
-                                                                   &desc,
-                                                                   DDLOCK_WAIT,
-                                                                   nullptr);
-            if (FAILED(result)) {
-                s_log << "LegacyDrawThread: ERROR failed to lock proxy surface 0x"
-                      << std::hex << result << std::endl;
-                Sleep(5);
-                continue;
-            }
-
-            memcpy(rgb555buf, desc.lpSurface, PIXEL_COUNT * sizeof(uint16_t));
-            result = s_primarySurface.m_proxySurface->Unlock(desc.lpSurface);
-            if (FAILED(result)) {
-                s_log << "LegacyDrawThread: ERROR failed to unlock proxy surface -- potential deadlock 0x"
-                    << std::hex << result << std::endl;
-            }
-
-            s_primarySurface.m_flagsMut.lock();
-            s_primarySurface.m_flags &= ~e_mainSurfaceDirty;
-            s_primarySurface.m_flagsMut.unlock();
-
-            // Maybe at some point this should be vectorized?
-            for (size_t i = 0; i < PIXEL_COUNT; ++i) {
-                uint32_t pixel = rgb555buf[i];
-                uint32_t r = ((((pixel) & 0x1F) * 527) + 23) >> 6;
-                uint32_t g = ((((pixel >> 5) & 0x3F) * 259) + 33) >> 6;
-                uint32_t b = ((((pixel >> 11) & 0x1F) * 527) + 23) >> 6;
-                rgba8888buf[i] = ((r) | (g << 8) | (b << 16));
-            }
-
-            SetDIBits(s_primarySurface.m_frameDC, s_primarySurface.m_frameBitmap, 0, 480,
-                      rgba8888buf, &s_primarySurface.m_bitmapInfo, DIB_RGB_COLORS);
-
-            {
-                POINT resolution = Win32LockClientSize();
-                HWND wnd = Win32GetClientHWND();
-                HDC wndDC = GetDC(wnd);
-
-                // While the HALFTONE StretchBlt mode offers a slight improvement in visual
-                // quality (mostly when panning the screen), it has a slightly negative impact
-                // on performance. Perhaps it should be gated behind a flag?
-                SetStretchBltMode(wndDC, HALFTONE);
-                SetBrushOrgEx(wndDC, 0, 0, nullptr);
-
-                if (StretchBlt(wndDC, 0, 0, resolution.x, resolution.y,
-                               s_primarySurface.m_frameDC, 0, 0, 640, 480,
-                               SRCCOPY) == FALSE)
-                    s_log << "LegacyDrawThread: ERROR: StretchBlt failed!" << std::endl;
-
-                RECT text_rect{ 0, 0, resolution.x, 0 };
-                if (s_primarySurface.m_flags & e_showFrameTime) {
-                    char buf[64];
-                    int nChars = sprintf_s(buf, "FT: %.4fs", last_frame_time);
-
-                    SelectObject(wndDC, s_primarySurface.m_font);
-                    SetBkMode(wndDC, TRANSPARENT);
-                    SetTextColor(wndDC, RGB(252, 236, 3));
-                    DrawTextA(wndDC, buf, nChars, &text_rect, DT_NOCLIP | DT_LEFT);
-                }
-                if (s_primarySurface.m_flags & e_showFps) {
-                    char buf[64];
-                    unsigned fpsInst = (unsigned)(1.f / last_frame_time);
-                    unsigned fpsAvg = (unsigned)((float)frame_count / frame_timer.total());
-                    int nChars = sprintf_s(buf, "FPS: %u AVG: %u", fpsInst, fpsAvg);
-
-                    SelectObject(wndDC, s_primarySurface.m_font);
-                    SetBkMode(wndDC, TRANSPARENT);
-                    SetTextColor(wndDC, RGB(252, 236, 3));
-                    DrawTextA(wndDC, buf, nChars, &text_rect, DT_NOCLIP | DT_RIGHT);
-                }
-
-                ReleaseDC(wnd, wndDC);
-                Win32UnlockClientSize();
-            }
-
-            last_frame_time = frame_timer.end();
-            frame_count++;
-        } else {
-            // not dirty, don't thrash the CPU
-            Sleep(5);
+        // The surface is still dirty, so keep at it.
+        return e_grabRetry;
+    }
+
+    // Take ownership of everything the game has touched so far and only copy that out.
+    std::swap(damage, s_primarySurface.m_dirtyRegion);
+    s_primarySurface.m_dirtyRegion.clear();
+    uint32_t flags = s_primarySurface.m_flags.fetch_and(~(e_mainSurfaceDirty | e_forcePresent),
+                                                        std::memory_order_acq_rel);
+    force = flags & e_forcePresent;
+
+    {
+        LEGACY_TIME_STAGE(s_pipeline.stageTimes(), e_stageCopyOut);
+        for (const Rect& rect : damage)
+            PipelineCopyRect(frame, PIPELINE_WIDTH * sizeof(uint16_t), desc.lpSurface, desc.lPitch,
+                             sizeof(uint16_t), rect);
+    }
+
+    result = s_ddrawSurfaceUnlock(s_primarySurface.m_proxySurface, desc.lpSurface);
+    s_primarySurface.m_surfaceMut.unlock();
+    if (FAILED(result)) {
+        LEGACY_LOG(s_log, "LegacyCaptureThread: ERROR failed to unlock proxy surface -- potential deadlock "
+                          "0x%x", result);
+    }
+    return e_grabFrame;
+}
+
+// ================================================================================================
+
+PipelineView _PrimarySurfaceHost::view()
+{
+    PipelineView view;
+    POINT resolution = Win32GetClientSize(view.m_integerScale);
+    view.m_width = resolution.x;
+    view.m_height = resolution.y;
+    view.m_filter = s_primarySurface.m_scaleFilter.load(std::memory_order_relaxed);
+    return view;
+}
+
+// ================================================================================================
+
+static void LegacyLogStageTimes(StageTimes& times)
+{
+    // Formatted on the side so the precision doesn't stick to everything else in the log.
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1);
+    for (int i = 0; i < e_stageCount; ++i) {
+        StageSummary summary = times.summary((PipelineStage)i);
+        line << " " << StageName((PipelineStage)i) << " " << summary.m_meanUs << "/" << summary.m_maxUs;
+    }
+    s_log << "LegacyPipeline: stage times (mean/max us):" << line.str() << std::endl;
+    times.reset();
+}
+
+// ================================================================================================
+
+const OverlayAtlas* _PrimarySurfaceHost::overlay(OverlayText& text)
+{
+    uint32_t flags = s_primarySurface.m_flags;
+    if (!(flags & e_showOverlay) || !(flags & e_gdiObjectsAcquired))
+        return nullptr;
+
+    // The FT and FPS share the top row, and everything else stacks up underneath.
+    text.m_color = 0xFCEC03;
+    float frameTime = m_lastFrameTime.load(std::memory_order_relaxed);
+    int row = 1;
+    if (flags & e_showFrameTime)
+        text.print(0, e_overlayLeft, "FT: %.4fs", frameTime);
+    if (flags & e_showFps) {
+        FrameSummary lifetime = s_frameStats.lifetime();
+        unsigned fpsInst = frameTime > 0.f ? (unsigned)(1.f / frameTime) : 0;
+        unsigned fpsAvg = lifetime.m_mean ? (unsigned)(1000000 / lifetime.m_mean) : 0;
+        text.print(0, e_overlayRight, "FPS: %u AVG: %u", fpsInst, fpsAvg);
+    }
+#ifdef LEGACY_STAGE_TIMING
+    if (flags & e_showFrameTime) {
+        // Where the last frame's time went. The overlay is the one drawn last time.
+        char buf[OverlayText::MAX_CHARS];
+        int nChars = 0;
+        for (int i = 0; i < e_stageCount; ++i) {
+            StageSummary summary = s_pipeline.stageTimes().summary((PipelineStage)i);
+            nChars += sprintf_s(buf + nChars, sizeof(buf) - nChars, "%s%s: %.2f",
+                                i ? " " : "", StageName((PipelineStage)i), summary.m_lastUs / 1000.0);
         }
-    } while(1);
+        sprintf_s(buf + nChars, sizeof(buf) - nChars, " ms");
+        text.print(row++, e_overlayLeft, "%s", buf);
+    }
+#endif
+    if (flags & e_showFrameStats) {
+        // The averages hide the stutters, so show where the tail of the last few seconds is.
+        FrameSummary recent = s_frameStats.recent();
+        text.print(row++, e_overlayLeft, "p50: %.1f p90: %.1f p99: %.1f p99.9: %.1f max: %.1f ms",
+                   recent.m_p50 / 1000.f, recent.m_p90 / 1000.f, recent.m_p99 / 1000.f,
+                   recent.m_p999 / 1000.f, recent.m_max / 1000.f);
+    }
+    return &s_primarySurface.m_overlayAtlas;
+}
+
+// ================================================================================================
+
+void _PrimarySurfaceHost::endPresent(const OutputFrame& frame, PipelineClock::duration frameTime)
+{
+    PipelineClock::time_point now = PipelineClock::now();
+    m_lastFrameTime.store(std::chrono::duration<float>(frameTime).count(), std::memory_order_relaxed);
+    s_frameStats.record(frameTime, now);
+
+#ifdef LEGACY_STAGE_TIMING
+    // Nobody wants this in the log unless they're already looking at the frame times.
+    if ((s_primarySurface.m_flags & e_showFrameTime) && now - m_lastStageLog >= std::chrono::seconds(5)) {
+        LegacyLogStageTimes(s_pipeline.stageTimes());
+        m_lastStageLog = now;
+    }
+#endif
 }
 
 // ================================================================================================
 
 void DDrawForceDirty()
 {
-    s_primarySurface.m_flagsMut.lock();
-    s_primarySurface.m_flags |= e_mainSurfaceDirty;
-    s_primarySurface.m_flagsMut.unlock();
+    // The force flag goes up first so that it rides along with the damage.
+    std::lock_guard<std::recursive_mutex> _(s_primarySurface.m_surfaceMut);
+    s_primarySurface.m_flags.fetch_or(e_forcePresent, std::memory_order_release);
+    LegacyMarkDirty(LegacyFullSurfaceRect());
 }
 
 // ================================================================================================
 
 void DDrawShowFPS(bool on)
 {
-    s_primarySurface.m_flagsMut.lock();
     if (on)
-        s_primarySurface.m_flags |= e_showFps;
+        s_primarySurface.m_flags.fetch_or(e_showFps, std::memory_order_relaxed);
     else
-        s_primarySurface.m_flags &= ~e_showFps;
-    s_primarySurface.m_flags |= e_mainSurfaceDirty;
-    s_primarySurface.m_flagsMut.unlock();
+        s_primarySurface.m_flags.fetch_and(~e_showFps, std::memory_order_relaxed);
+    DDrawForceDirty();
 }
 
 // ================================================================================================
 
 void DDrawShowFrameTime(bool on)
 {
-    s_primarySurface.m_flagsMut.lock();
     if (on)
-        s_primarySurface.m_flags |= e_showFrameTime;
+        s_primarySurface.m_flags.fetch_or(e_showFrameTime, std::memory_order_relaxed);
     else
-        s_primarySurface.m_flags &= ~e_showFrameTime;
-    s_primarySurface.m_flags |= e_mainSurfaceDirty;
-    s_primarySurface.m_flagsMut.unlock();
+        s_primarySurface.m_flags.fetch_and(~e_showFrameTime, std::memory_order_relaxed);
+    DDrawForceDirty();
 }
 
 // ================================================================================================
 
-void DDrawAcquireGdiObjects()
+void DDrawShowFrameStats(bool on)
 {
-    s_primarySurface.m_frameDC = CreateCompatibleDC(nullptr);
-    s_primarySurface.m_frameBitmap = CreateBitmap(640, 480, 1, 32, nullptr);
-    SelectObject(s_primarySurface.m_frameDC, s_primarySurface.m_frameBitmap);
+    if (on)
+        s_primarySurface.m_flags.fetch_or(e_showFrameStats, std::memory_order_relaxed);
+    else
+        s_primarySurface.m_flags.fetch_and(~e_showFrameStats, std::memory_order_relaxed);
+    DDrawForceDirty();
+}
 
-    s_primarySurface.m_bitmapInfo.bmiHeader.biSize = sizeof(s_primarySurface.m_bitmapInfo.bmiHeader);
-    s_primarySurface.m_bitmapInfo.bmiHeader.biWidth = 640;
-    s_primarySurface.m_bitmapInfo.bmiHeader.biHeight = -480; // indicates top-down
-    s_primarySurface.m_bitmapInfo.bmiHeader.biPlanes = 1;
-    s_primarySurface.m_bitmapInfo.bmiHeader.biCompression = BI_RGB;
-    s_primarySurface.m_bitmapInfo.bmiHeader.biSizeImage = PIXEL_COUNT * sizeof(uint32_t);
-    s_primarySurface.m_bitmapInfo.bmiHeader.biBitCount = 32;
+// ================================================================================================
 
+bool DDrawDumpFrameStats(const char* basename)
+{
+    std::string path = basename;
+    std::ofstream csv(path + ".csv", std::ios::out);
+    std::ofstream json(path + ".json", std::ios::out);
+    if (!csv || !json) {
+        s_log << "DDrawDumpFrameStats: ERROR: could not open " << path << ".csv/.json" << std::endl;
+        return false;
+    }
+    s_frameStats.writeCSV(csv);
+    s_frameStats.writeJSON(json);
+
+    FrameSummary lifetime = s_frameStats.lifetime();
+    s_log << "DDrawDumpFrameStats: " << std::dec << lifetime.m_frames << " frames, p50 "
+          << lifetime.m_p50 << " us, p99 " << lifetime.m_p99 << " us, p99.9 " << lifetime.m_p999
+          << " us, max " << lifetime.m_max << " us" << std::endl;
+    return true;
+}
+
+// ================================================================================================
+
+static bool LegacyRasterizeFont(HFONT font, OverlayAtlas& atlas)
+{
+    HDC dc = CreateCompatibleDC(nullptr);
+    if (!dc)
+        return false;
+    HGDIOBJ oldFont = SelectObject(dc, font);
+    TEXTMETRICA metrics;
+    GetTextMetricsA(dc, &metrics);
+    int cellWidth = metrics.tmMaxCharWidth;
+    int height = metrics.tmHeight;
+
+    BITMAPINFO info{ };
+    info.bmiHeader.biSize = sizeof(info.bmiHeader);
+    info.bmiHeader.biWidth = cellWidth;
+    info.bmiHeader.biHeight = -height;
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+    void* bits = nullptr;
+    HBITMAP bitmap = CreateDIBSection(dc, &info, DIB_RGB_COLORS, &bits, nullptr, 0);
+    if (!bitmap) {
+        SelectObject(dc, oldFont);
+        DeleteDC(dc);
+        return false;
+    }
+
+    // White on black, so any one channel is the coverage.
+    HGDIOBJ oldBitmap = SelectObject(dc, bitmap);
+    SetTextColor(dc, RGB(255, 255, 255));
+    SetBkColor(dc, RGB(0, 0, 0));
+    SetBkMode(dc, OPAQUE);
+
+    atlas.reset(height);
+    std::vector<uint8_t> coverage((size_t)cellWidth * height);
+    RECT cell{ 0, 0, cellWidth, height };
+    for (char c = OverlayAtlas::FIRST_CHAR; c <= OverlayAtlas::LAST_CHAR; ++c) {
+        SIZE size;
+        GetTextExtentPoint32A(dc, &c, 1, &size);
+        ExtTextOutA(dc, 0, 0, ETO_OPAQUE, &cell, &c, 1, nullptr);
+        GdiFlush();
+        const uint32_t* pixels = (const uint32_t*)bits;
+        for (size_t i = 0; i < coverage.size(); ++i)
+            coverage[i] = (uint8_t)((pixels[i] >> 8) & 0xFF);
+        atlas.setGlyph(c, std::min<int>(size.cx, cellWidth), coverage.data(), cellWidth);
+    }
+
+    SelectObject(dc, oldBitmap);
+    SelectObject(dc, oldFont);
+    DeleteObject(bitmap);
+    DeleteDC(dc);
+    return true;
+}
+
+// ================================================================================================
+
+void DDrawAcquireGdiObjects()
+{
+    // The overlay font is only ever needed as an atlas of coverage masks, so it is rasterized
+    // once right here and the font goes away again. Grayscale antialiasing, because ClearType's
+    // colored fringes assume they'll land on whatever the window was showing at the time.
     LOGFONTA font{ 0 };
     HDC tempDC = GetDC(HWND_DESKTOP);
     font.lfHeight = -MulDiv(26, GetDeviceCaps(tempDC, LOGPIXELSY), 72);
     ReleaseDC(HWND_DESKTOP, tempDC);
     font.lfWeight = FW_BOLD;
     font.lfCharSet = ANSI_CHARSET;
-    font.lfQuality = CLEARTYPE_QUALITY;
+    font.lfQuality = ANTIALIASED_QUALITY;
     font.lfPitchAndFamily = FIXED_PITCH;
-    s_primarySurface.m_font = CreateFontIndirectA(&font);
 
-    s_primarySurface.m_flagsMut.lock();
-    s_primarySurface.m_flags |= e_gdiObjectsAcquired;
-    s_primarySurface.m_flagsMut.unlock();
+    OverlayAtlas& atlas = s_primarySurface.m_overlayAtlas;
+    if (atlas.empty()) {
+        HFONT hFont = CreateFontIndirectA(&font);
+        if (!hFont || !LegacyRasterizeFont(hFont, atlas)) {
+            s_log << "DDrawAcquireGdiObjects: failed to rasterize the overlay font, using the fallback" << std::endl;
+            atlas.buildDefault(-font.lfHeight);
+        }
+        if (hFont)
+            DeleteObject(hFont);
+    }
+
+    s_primarySurface.m_flags.fetch_or(e_gdiObjectsAcquired, std::memory_order_release);
+
+    // The game may have already drawn something that we weren't able to present.
+    s_pipeline.wake();
 }
 
 // ================================================================================================
 
 void DDrawReleaseGdiObjects()
 {
-    std::lock_guard<std::mutex> _(s_primarySurface.m_flagsMut);
-    if (s_primarySurface.m_flags & e_gdiObjectsAcquired) {
-        s_primarySurface.m_flags &= ~e_gdiObjectsAcquired;
-        DeleteObject(s_primarySurface.m_font);
-        DeleteObject(s_primarySurface.m_frameBitmap);
-        DeleteDC(s_primarySurface.m_frameDC);
-    }
+    // The atlas is kept around, since the pipeline has already been joined by now and the
+    // font isn't going to change.
+    s_primarySurface.m_flags.fetch_and(~e_gdiObjectsAcquired);
 }
 
+// ================================================================================================
+
+void DDrawSetScaleFilter(ScaleFilter filter)
+{
+    s_primarySurface.m_scaleFilter.store(filter, std::memory_order_relaxed);
+    DDrawForceDirty();
+}
+
+
 // ================================================================================================
 
 void DDrawSignalInitComplete()
 {
-    s_primarySurface.m_flagsMut.lock();
-    s_primarySurface.m_flags |= e_initComplete;
-    s_primarySurface.m_flagsMut.unlock();
+    s_primarySurface.m_flags.fetch_or(e_initComplete, std::memory_order_release);
 }
 
 // ================================================================================================
@@ -679,10 +970,18 @@ void DDrawSetBltOffset(int x, int y)
 
 void DDrawJoin()
 {
-    s_primarySurface.m_flagsMut.lock();
-    s_primarySurface.m_flags |= e_wantQuit;
-    s_primarySurface.m_flagsMut.unlock();
-    s_drawThread.join();
+    s_pipeline.stop();
+    s_trace.close();
+    if (s_frameStats.lifetime().m_frames)
+        DDrawDumpFrameStats("legacy_framestats");
+#ifdef LEGACY_STAGE_TIMING
+    LegacyLogStageTimes(s_pipeline.stageTimes());
+#endif
+    s_backend.reset();
+    s_workers.reset();
+    if (s_timerPeriod)
+        timeEndPeriod(1);
+    s_timerPeriod = false;
 }
 
 // ================================================================================================
@@ -19,59 +19,53 @@
  * THE SOFTWARE.
  */
 
-#ifndef __LEGACY_TIMER_H
-#define __LEGACY_TIMER_H
+#include "LegacyEvent.h"
 
-#include "LegacyWindow.h"
+#include <chrono>
 
 // ================================================================================================
 
-class Timer
+Event::Event()
+    : m_signaled(false)
 {
-    LARGE_INTEGER m_frequency;
-    LARGE_INTEGER m_startTime;
-    LARGE_INTEGER m_accumulator;
-
-public:
-    Timer();
-
-    void start();
-    float end();
-    float total() const;
-};
-
-// ================================================================================================
-
-Timer::Timer()
-    : m_frequency(), m_startTime(), m_accumulator()
-{
-    QueryPerformanceFrequency(&m_frequency);
 }
 
 // ================================================================================================
 
-void Timer::start()
+void Event::signal()
 {
-    QueryPerformanceCounter(&m_startTime);
+    // If it was already signaled, the waiter hasn't consumed it yet and will see it.
+    if (m_signaled.exchange(true, std::memory_order_acq_rel))
+        return;
+
+    // Taking the mutex here closes the window between the waiter checking the flag and
+    // actually going to sleep on the condition variable.
+    std::lock_guard<std::mutex> _(m_mut);
+    m_cv.notify_one();
 }
 
 // ================================================================================================
 
-float Timer::end()
+void Event::wait()
 {
-    LARGE_INTEGER endTime;
-    QueryPerformanceCounter(&endTime);
-    LONGLONG elapsed = endTime.QuadPart - m_startTime.QuadPart;
-    m_accumulator.QuadPart += elapsed;
-    m_startTime.QuadPart = 0;
-    return (double)elapsed / m_frequency.QuadPart;
+    if (m_signaled.exchange(false, std::memory_order_acq_rel))
+        return;
+
+    std::unique_lock<std::mutex> lock(m_mut);
+    m_cv.wait(lock, [this]() {
+        return m_signaled.exchange(false, std::memory_order_acq_rel);
+    });
 }
 
 // ================================================================================================
 
-float Timer::total() const
+bool Event::wait(uint32_t timeoutMs)
 {
-    return (double)m_accumulator.QuadPart / m_frequency.QuadPart;
-}
+    if (m_signaled.exchange(false, std::memory_order_acq_rel))
+        return true;
 
-#endif
+    std::unique_lock<std::mutex> lock(m_mut);
+    return m_cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this]() {
+        return m_signaled.exchange(false, std::memory_order_acq_rel);
+    });
+}
@@ -0,0 +1,58 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_EVENT_H
+#define __LEGACY_EVENT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// ================================================================================================
+
+// Auto-reset event, much like the Win32 one, but built out of the standard library so that it
+// can be exercised anywhere. Any number of threads may signal it, but only one should wait on
+// it. Signals that arrive while nobody is waiting are not lost -- the next wait returns right
+// away. Signaling an event that is already signaled is just an atomic exchange, so it is cheap
+// enough to do on every dirty rect.
+class Event
+{
+    std::mutex m_mut;
+    std::condition_variable m_cv;
+    std::atomic<bool> m_signaled;
+
+public:
+    Event();
+
+    Event(const Event&) = delete;
+    Event& operator=(const Event&) = delete;
+
+    void signal();
+
+    // Blocks until the event is signaled.
+    void wait();
+
+    // Returns false if the timeout elapsed without the event being signaled.
+    bool wait(uint32_t timeoutMs);
+};
+
+#endif
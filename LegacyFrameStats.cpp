@@ -0,0 +1,239 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyFrameStats.h"
+
+#include <algorithm>
+
+// ================================================================================================
+
+constexpr uint32_t FrameHistogram::SUB_BUCKET_BITS;
+constexpr uint32_t FrameHistogram::SUB_BUCKETS;
+constexpr size_t FrameHistogram::BUCKETS;
+constexpr size_t FrameStats::ROLLING_WINDOWS;
+constexpr std::chrono::seconds FrameStats::WINDOW_LENGTH;
+
+// ================================================================================================
+
+static inline uint32_t FrameStatsLog2(uint32_t value)
+{
+    uint32_t bits = 0;
+    while (value >>= 1)
+        bits++;
+    return bits;
+}
+
+// ================================================================================================
+
+size_t FrameHistogram::bucketOf(uint32_t us)
+{
+    // Below SUB_BUCKETS, every microsecond gets its own bucket. Above that, the top
+    // SUB_BUCKET_BITS below the leading one pick the bucket within its power of two.
+    if (us < SUB_BUCKETS)
+        return us;
+    uint32_t exponent = FrameStatsLog2(us);
+    uint32_t sub = (us >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return ((exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS) + sub;
+}
+
+// ================================================================================================
+
+uint32_t FrameHistogram::bucketLow(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return (uint32_t)bucket;
+    uint32_t exponent = (uint32_t)(bucket / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+    uint32_t sub = (uint32_t)(bucket % SUB_BUCKETS);
+    return (SUB_BUCKETS + sub) << (exponent - SUB_BUCKET_BITS);
+}
+
+// ================================================================================================
+
+uint32_t FrameHistogram::bucketHigh(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return (uint32_t)bucket;
+    uint32_t exponent = (uint32_t)(bucket / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+    return bucketLow(bucket) + ((1U << (exponent - SUB_BUCKET_BITS)) - 1);
+}
+
+// ================================================================================================
+
+void FrameHistogram::clear()
+{
+    for (std::atomic<uint32_t>& count : m_counts)
+        count.store(0, std::memory_order_relaxed);
+    m_frames.store(0, std::memory_order_relaxed);
+    m_totalUs.store(0, std::memory_order_relaxed);
+    m_maxUs.store(0, std::memory_order_relaxed);
+}
+
+// ================================================================================================
+
+void FrameHistogram::record(uint32_t us)
+{
+    m_counts[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    m_frames.fetch_add(1, std::memory_order_relaxed);
+    m_totalUs.fetch_add(us, std::memory_order_relaxed);
+
+    // There's only ever one writer, so no need for a compare-exchange loop.
+    if (us > m_maxUs.load(std::memory_order_relaxed))
+        m_maxUs.store(us, std::memory_order_relaxed);
+}
+
+// ================================================================================================
+
+static FrameSummary FrameStatsSummarize(const FrameHistogram* const* histograms, size_t count)
+{
+    FrameSummary summary{ };
+    uint32_t buckets[FrameHistogram::BUCKETS];
+    uint64_t totalUs = 0;
+    uint32_t frames = 0;
+    std::fill(std::begin(buckets), std::end(buckets), 0);
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t bucket = 0; bucket < FrameHistogram::BUCKETS; ++bucket) {
+            uint32_t n = histograms[i]->count(bucket);
+            buckets[bucket] += n;
+            frames += n;
+        }
+        totalUs += histograms[i]->totalUs();
+        summary.m_max = std::max(summary.m_max, histograms[i]->maxUs());
+    }
+
+    // The per-bucket counts are what the percentiles come from, so trust those over the frame
+    // counter if a record sneaks in while we're looking.
+    summary.m_frames = frames;
+    if (frames == 0)
+        return summary;
+    summary.m_mean = (uint32_t)(totalUs / frames);
+
+    struct { double m_fraction; uint32_t FrameSummary::* m_field; } percentiles[] = {
+        { 0.5, &FrameSummary::m_p50 },
+        { 0.9, &FrameSummary::m_p90 },
+        { 0.99, &FrameSummary::m_p99 },
+        { 0.999, &FrameSummary::m_p999 },
+    };
+    uint64_t seen = 0;
+    size_t bucket = 0;
+    for (const auto& percentile : percentiles) {
+        uint64_t wanted = std::max<uint64_t>(1, (uint64_t)(percentile.m_fraction * frames + 0.999999));
+        while (bucket < FrameHistogram::BUCKETS - 1 && seen + buckets[bucket] < wanted)
+            seen += buckets[bucket++];
+        summary.*percentile.m_field = std::min(FrameHistogram::bucketHigh(bucket), summary.m_max);
+    }
+    return summary;
+}
+
+// ================================================================================================
+
+FrameStats::FrameStats()
+    : m_current(0), m_windowStart()
+{
+}
+
+// ================================================================================================
+
+void FrameStats::record(SchedulerClock::duration frameTime, SchedulerClock::time_point now)
+{
+    // Move on to a fresh window for every WINDOW_LENGTH that has gone by. If it's been quiet
+    // for longer than all of them put together, they're all stale.
+    if (now - m_windowStart >= WINDOW_LENGTH) {
+        auto elapsed = (now - m_windowStart) / std::chrono::duration_cast<SchedulerClock::duration>(WINDOW_LENGTH);
+        size_t advance = (size_t)std::min<decltype(elapsed)>(elapsed, ROLLING_WINDOWS);
+        size_t current = m_current.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < advance; ++i) {
+            current = (current + 1) % ROLLING_WINDOWS;
+            m_windows[current].clear();
+        }
+        m_current.store(current, std::memory_order_relaxed);
+        m_windowStart = now;
+    }
+
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(frameTime).count();
+    uint32_t clamped = (uint32_t)std::min<decltype(us)>(std::max<decltype(us)>(us, 0), UINT32_MAX);
+    m_lifetime.record(clamped);
+    m_windows[m_current.load(std::memory_order_relaxed)].record(clamped);
+}
+
+// ================================================================================================
+
+FrameSummary FrameStats::lifetime() const
+{
+    const FrameHistogram* histograms[] = { &m_lifetime };
+    return FrameStatsSummarize(histograms, 1);
+}
+
+// ================================================================================================
+
+FrameSummary FrameStats::recent() const
+{
+    const FrameHistogram* histograms[ROLLING_WINDOWS];
+    for (size_t i = 0; i < ROLLING_WINDOWS; ++i)
+        histograms[i] = &m_windows[i];
+    return FrameStatsSummarize(histograms, ROLLING_WINDOWS);
+}
+
+// ================================================================================================
+
+void FrameStats::writeCSV(std::ostream& stream) const
+{
+    stream << "low_us,high_us,lifetime,recent\n";
+    for (size_t bucket = 0; bucket < FrameHistogram::BUCKETS; ++bucket) {
+        uint32_t recent = 0;
+        for (const FrameHistogram& window : m_windows)
+            recent += window.count(bucket);
+        uint32_t lifetime = m_lifetime.count(bucket);
+        if (lifetime == 0 && recent == 0)
+            continue;
+        stream << FrameHistogram::bucketLow(bucket) << ',' << FrameHistogram::bucketHigh(bucket)
+               << ',' << lifetime << ',' << recent << '\n';
+    }
+}
+
+// ================================================================================================
+
+static void FrameStatsWriteSummary(std::ostream& stream, const char* name, const FrameSummary& summary)
+{
+    stream << "  \"" << name << "\": { \"frames\": " << summary.m_frames
+           << ", \"mean_us\": " << summary.m_mean << ", \"p50_us\": " << summary.m_p50
+           << ", \"p90_us\": " << summary.m_p90 << ", \"p99_us\": " << summary.m_p99
+           << ", \"p99.9_us\": " << summary.m_p999 << ", \"max_us\": " << summary.m_max << " },\n";
+}
+
+// ================================================================================================
+
+void FrameStats::writeJSON(std::ostream& stream) const
+{
+    stream << "{\n";
+    FrameStatsWriteSummary(stream, "lifetime", lifetime());
+    FrameStatsWriteSummary(stream, "recent", recent());
+    stream << "  \"buckets\": [";
+    bool first = true;
+    for (size_t bucket = 0; bucket < FrameHistogram::BUCKETS; ++bucket) {
+        uint32_t count = m_lifetime.count(bucket);
+        if (count == 0)
+            continue;
+        stream << (first ? "\n" : ",\n") << "    { \"low_us\": " << FrameHistogram::bucketLow(bucket)
+               << ", \"high_us\": " << FrameHistogram::bucketHigh(bucket) << ", \"frames\": " << count << " }";
+        first = false;
+    }
+    stream << "\n  ]\n}\n";
+}
@@ -0,0 +1,117 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_FRAMESTATS_H
+#define __LEGACY_FRAMESTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#include "LegacyScheduler.h"
+
+// ================================================================================================
+
+// Frame times in microseconds, bucketed log-linearly: sixteen evenly spaced buckets for every
+// power of two, so any value lands in a bucket no more than 1/16th wide. Recording is a couple of
+// relaxed atomic adds and nothing here ever allocates, so it's fine to feed from the present
+// thread while somebody else reads.
+class FrameHistogram
+{
+public:
+    static constexpr uint32_t SUB_BUCKET_BITS = 4;
+    static constexpr uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKETS = (32 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static size_t bucketOf(uint32_t us);
+    static uint32_t bucketLow(size_t bucket);
+    static uint32_t bucketHigh(size_t bucket);
+
+private:
+    std::atomic<uint32_t> m_counts[BUCKETS];
+    std::atomic<uint32_t> m_frames;
+    std::atomic<uint64_t> m_totalUs;
+    std::atomic<uint32_t> m_maxUs;
+
+public:
+    FrameHistogram() { clear(); }
+
+    void clear();
+    void record(uint32_t us);
+
+    uint32_t count(size_t bucket) const { return m_counts[bucket].load(std::memory_order_relaxed); }
+    uint32_t frames() const { return m_frames.load(std::memory_order_relaxed); }
+    uint64_t totalUs() const { return m_totalUs.load(std::memory_order_relaxed); }
+    uint32_t maxUs() const { return m_maxUs.load(std::memory_order_relaxed); }
+};
+
+// ================================================================================================
+
+// All in microseconds. The percentiles are the top of the bucket they fell in, so they err on
+// the side of looking a little worse than they really were.
+struct FrameSummary
+{
+    uint32_t m_frames;
+    uint32_t m_mean;
+    uint32_t m_p50;
+    uint32_t m_p90;
+    uint32_t m_p99;
+    uint32_t m_p999;
+    uint32_t m_max;
+};
+
+// ================================================================================================
+
+// Keeps a histogram of every frame since startup, plus a handful of one second windows that
+// roll over so that the recent numbers aren't drowned out by an hour of smooth sailing. Only
+// one thread may record, but anybody may read.
+class FrameStats
+{
+public:
+    static constexpr size_t ROLLING_WINDOWS = 5;
+    static constexpr std::chrono::seconds WINDOW_LENGTH{ 1 };
+
+private:
+    FrameHistogram m_lifetime;
+    FrameHistogram m_windows[ROLLING_WINDOWS];
+    std::atomic<size_t> m_current;
+    SchedulerClock::time_point m_windowStart;
+
+public:
+    FrameStats();
+
+    void record(SchedulerClock::duration frameTime, SchedulerClock::time_point now);
+
+    FrameSummary lifetime() const;
+
+    // Covers the last ROLLING_WINDOWS * WINDOW_LENGTH or so.
+    FrameSummary recent() const;
+
+    // One row per bucket that has anything in it.
+    void writeCSV(std::ostream& stream) const;
+
+    // Both summaries and the lifetime buckets.
+    void writeJSON(std::ostream& stream) const;
+};
+
+#endif
@@ -0,0 +1,708 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyLog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+// ================================================================================================
+
+// Whatever this thread has written since its last flush, after room for the record header.
+// One per thread rather than one per stream, so a thread shouldn't leave half a message in one
+// AsyncLog and go write to another.
+static thread_local std::string s_logStaging;
+
+// Same again for LEGACY_LOG records, which can happen halfway through a stream message.
+static thread_local std::string s_logRecord;
+
+static std::atomic<LogSite*> s_logSites[LOG_MAX_SITES];
+static std::atomic<uint32_t> s_logNextSite{ e_logSiteFirst };
+
+// ================================================================================================
+
+uint64_t LogNow()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ================================================================================================
+
+template<typename T>
+static bool LogReadArg(const uint8_t*& args, const uint8_t* end, T& value)
+{
+    if ((size_t)(end - args) < sizeof(T))
+        return false;
+    memcpy(&value, args, sizeof(T));
+    args += sizeof(T);
+    return true;
+}
+
+// ================================================================================================
+
+template<typename T>
+static void LogAppendFormatted(std::string& out, const char* spec, T value)
+{
+    int length = snprintf(nullptr, 0, spec, value);
+    if (length <= 0)
+        return;
+    size_t at = out.size();
+    out.resize(at + length + 1);
+    snprintf(&out[at], length + 1, spec, value);
+    out.resize(at + length);
+}
+
+// ================================================================================================
+
+void LogFormatRecord(std::string& out, const char* format, const uint8_t* args, size_t size,
+                     uint32_t suppressed)
+{
+    const uint8_t* end = args + size;
+    char spec[32];
+    for (const char* p = format; *p; ++p) {
+        if (*p != '%') {
+            out.push_back(*p);
+            continue;
+        }
+        if (p[1] == '%') {
+            out.push_back('%');
+            ++p;
+            continue;
+        }
+
+        // Keep the flags, width and precision, but the length comes from the argument itself.
+        size_t length = 0;
+        spec[length++] = '%';
+        for (++p; *p && strchr("-+ #0123456789.", *p); ++p)
+            if (length < sizeof(spec) - 4)
+                spec[length++] = *p;
+        while (*p && strchr("hlLjzt", *p))
+            ++p;
+        char conversion = *p;
+        if (!conversion)
+            break;
+
+        uint8_t type = 0;
+        if (args < end)
+            type = *args++;
+        int64_t i64 = 0;
+        uint64_t u64 = 0;
+        double f64 = 0.0;
+        uint16_t stringLength = 0;
+        bool ok = false;
+        switch (type) {
+        case e_logArgInt32:
+            {
+                int32_t value;
+                ok = LogReadArg(args, end, value);
+                i64 = value;
+                u64 = (uint32_t)value;
+                f64 = value;
+            }
+            break;
+        case e_logArgUInt32:
+            {
+                uint32_t value;
+                ok = LogReadArg(args, end, value);
+                i64 = value;
+                u64 = value;
+                f64 = value;
+            }
+            break;
+        case e_logArgInt64:
+            ok = LogReadArg(args, end, i64);
+            u64 = (uint64_t)i64;
+            f64 = (double)i64;
+            break;
+        case e_logArgUInt64:
+        case e_logArgPointer:
+            ok = LogReadArg(args, end, u64);
+            i64 = (int64_t)u64;
+            f64 = (double)u64;
+            break;
+        case e_logArgDouble:
+            ok = LogReadArg(args, end, f64);
+            i64 = (int64_t)f64;
+            u64 = (uint64_t)f64;
+            break;
+        case e_logArgString:
+            ok = LogReadArg(args, end, stringLength) && (size_t)(end - args) >= stringLength;
+            break;
+        default:
+            break;
+        }
+        if (!ok) {
+            out += "<?>";
+            args = end;
+            continue;
+        }
+
+        if (type == e_logArgString) {
+            if (conversion == 's') {
+                spec[length++] = 's';
+                spec[length] = '\0';
+                LogAppendFormatted(out, spec, std::string((const char*)args, stringLength).c_str());
+            } else {
+                out += "<?>";
+            }
+            args += stringLength;
+            continue;
+        }
+
+        switch (conversion) {
+        case 'd':
+        case 'i':
+            spec[length++] = 'l';
+            spec[length++] = 'l';
+            spec[length++] = conversion;
+            spec[length] = '\0';
+            LogAppendFormatted(out, spec, (long long)i64);
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            spec[length++] = 'l';
+            spec[length++] = 'l';
+            spec[length++] = conversion;
+            spec[length] = '\0';
+            LogAppendFormatted(out, spec, (unsigned long long)u64);
+            break;
+        case 'c':
+            spec[length++] = 'c';
+            spec[length] = '\0';
+            LogAppendFormatted(out, spec, (int)i64);
+            break;
+        case 'p':
+            LogAppendFormatted(out, "0x%" PRIx64, u64);
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec[length++] = conversion;
+            spec[length] = '\0';
+            LogAppendFormatted(out, spec, f64);
+            break;
+        default:
+            out += "<?>";
+            break;
+        }
+    }
+
+    if (suppressed)
+        out += " (" + std::to_string(suppressed) + " more suppressed)";
+    out.push_back('\n');
+}
+
+// ================================================================================================
+
+LogSite::LogSite(const char* file, int line, uint32_t burst, uint32_t rate)
+    : m_file(file), m_line(line), m_interval(1000000000 / std::max(rate, 1u)),
+      m_depth(m_interval * std::max(burst, 1u))
+{
+    uint32_t id = s_logNextSite.fetch_add(1, std::memory_order_relaxed);
+    if (id < LOG_MAX_SITES) {
+        m_id = (uint16_t)id;
+        s_logSites[id].store(this, std::memory_order_release);
+    }
+}
+
+// ================================================================================================
+
+LogSite::~LogSite()
+{
+    if (m_id != e_logSiteText)
+        s_logSites[m_id].store(nullptr, std::memory_order_release);
+}
+
+// ================================================================================================
+
+bool LogSite::admit(const char* format, uint64_t now, uint32_t& suppressed)
+{
+    // Each call pushes the time the bucket is full again out by one interval. If that's more
+    // than a full bucket away, there are no tokens left.
+    uint64_t full = m_full.load(std::memory_order_relaxed);
+    for (;;) {
+        uint64_t from = std::max(full, now);
+        if (from + m_interval - now > m_depth) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (m_full.compare_exchange_weak(full, from + m_interval, std::memory_order_relaxed))
+            break;
+    }
+
+    if (!m_format.load(std::memory_order_relaxed))
+        m_format.store(format, std::memory_order_release);
+    suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+// ================================================================================================
+
+const LogSite* LogSite::find(uint16_t id)
+{
+    return id < LOG_MAX_SITES ? s_logSites[id].load(std::memory_order_acquire) : nullptr;
+}
+
+// ================================================================================================
+
+LogRing::LogRing()
+    : m_slots(new _Slot[LOG_SLOT_COUNT])
+{
+    static_assert((LOG_SLOT_COUNT & (LOG_SLOT_COUNT - 1)) == 0, "LOG_SLOT_COUNT must be a power of two");
+
+    // A slot is free for position p when its sequence is p, and published when it is p + 1.
+    for (size_t i = 0; i < LOG_SLOT_COUNT; ++i)
+        m_slots[i].m_sequence.store(i, std::memory_order_relaxed);
+}
+
+// ================================================================================================
+
+bool LogRing::push(const char* text, size_t length)
+{
+    length = std::min(length, LOG_SLOT_BYTES * (LOG_SLOT_COUNT / 2));
+    uint64_t count = std::max<uint64_t>((length + LOG_SLOT_BYTES - 1) / LOG_SLOT_BYTES, 1);
+
+    // Slots are only ever given back in order, so if the last one we need is free, all of the
+    // ones before it are too.
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    for (;;) {
+        uint64_t last = head + count - 1;
+        uint64_t sequence = m_slots[last & (LOG_SLOT_COUNT - 1)].m_sequence.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)(sequence - last);
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(head, head + count, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            head = m_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        _Slot& slot = m_slots[(head + i) & (LOG_SLOT_COUNT - 1)];
+        size_t chunk = std::min(length, LOG_SLOT_BYTES);
+        memcpy(slot.m_text, text, chunk);
+        slot.m_length = (uint32_t)chunk;
+        slot.m_sequence.store(head + i + 1, std::memory_order_release);
+        text += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+// ================================================================================================
+
+size_t LogRing::used() const
+{
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    return head > tail ? (size_t)(head - tail) : 0;
+}
+
+// ================================================================================================
+
+uint64_t LogRing::drain(std::string& text)
+{
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    for (;;) {
+        _Slot& slot = m_slots[tail & (LOG_SLOT_COUNT - 1)];
+        if (slot.m_sequence.load(std::memory_order_acquire) != tail + 1)
+            break;
+        text.append(slot.m_text, slot.m_length);
+        slot.m_sequence.store(tail + LOG_SLOT_COUNT, std::memory_order_release);
+        tail++;
+    }
+    m_tail.store(tail, std::memory_order_relaxed);
+    return m_dropped.exchange(0, std::memory_order_relaxed);
+}
+
+// ================================================================================================
+
+AsyncLog::_Buffer::int_type AsyncLog::_Buffer::overflow(int_type c)
+{
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        if (s_logStaging.empty())
+            s_logStaging.resize(sizeof(LogRecordHeader));
+        s_logStaging.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+}
+
+// ================================================================================================
+
+std::streamsize AsyncLog::_Buffer::xsputn(const char* s, std::streamsize count)
+{
+    if (s_logStaging.empty())
+        s_logStaging.resize(sizeof(LogRecordHeader));
+    s_logStaging.append(s, (size_t)count);
+    return count;
+}
+
+// ================================================================================================
+
+int AsyncLog::_Buffer::sync()
+{
+    if (s_logStaging.size() <= sizeof(LogRecordHeader) || !m_log.is_open())
+        return 0;
+
+    m_log.submit(s_logStaging, nullptr, 0, LogNow());
+    s_logStaging.clear();
+    return 0;
+}
+
+// ================================================================================================
+
+std::string& AsyncLog::beginRecord()
+{
+    s_logRecord.resize(sizeof(LogRecordHeader));
+    return s_logRecord;
+}
+
+// ================================================================================================
+
+void AsyncLog::submit(std::string& record, const LogSite* site, uint32_t suppressed, uint64_t time)
+{
+    // Without a site ID, there's nothing to look the format up by later, so do it now.
+    if (site && site->id() == e_logSiteText) {
+        std::string text(sizeof(LogRecordHeader), '\0');
+        LogFormatRecord(text, site->format(), (const uint8_t*)record.data() + sizeof(LogRecordHeader),
+                        record.size() - sizeof(LogRecordHeader), suppressed);
+        record.swap(text);
+        suppressed = 0;
+    }
+
+    LogRecordHeader header{ };
+    header.m_size = (uint16_t)std::min<size_t>(record.size() - sizeof(header), UINT16_MAX);
+    header.m_site = site ? site->id() : (uint16_t)e_logSiteText;
+    header.m_suppressed = suppressed;
+    header.m_time = time;
+    memcpy(&record[0], &header, sizeof(header));
+    m_ring.push(record.data(), sizeof(header) + header.m_size);
+
+    // The writer gets around to things on its own often enough, unless the ring is filling up.
+    if (m_synchronous.load(std::memory_order_relaxed))
+        write(true);
+    else if (m_ring.used() >= LOG_SLOT_COUNT / 2)
+        m_writeEvent.signal();
+}
+
+// ================================================================================================
+
+AsyncLog::AsyncLog()
+    : std::ostream(nullptr), m_buffer(*this)
+{
+    rdbuf(&m_buffer);
+}
+
+// ================================================================================================
+
+AsyncLog::~AsyncLog()
+{
+    close();
+}
+
+// ================================================================================================
+
+bool AsyncLog::open(const char* path, LogFormat format)
+{
+    close();
+    m_file.open(path, std::ios::out | std::ios::binary);
+    if (!m_file.is_open())
+        return false;
+
+    m_format = format;
+    m_batch.clear();
+    m_defined.assign(LOG_MAX_SITES, false);
+    if (m_format == e_logBinary) {
+        LogFileHeader header{ };
+        memcpy(header.m_magic, LOG_MAGIC, sizeof(header.m_magic));
+        header.m_versionMajor = LOG_VERSION_MAJOR;
+        header.m_versionMinor = LOG_VERSION_MINOR;
+        header.m_headerSize = sizeof(LogFileHeader);
+        header.m_recordHeaderSize = sizeof(LogRecordHeader);
+        header.m_start = LogNow();
+        m_file.write((const char*)&header, sizeof(header));
+    }
+
+    m_quit = false;
+    m_open = true;
+    m_writerThread = std::thread(&AsyncLog::writerThread, this);
+    return true;
+}
+
+// ================================================================================================
+
+void AsyncLog::close()
+{
+    if (!is_open())
+        return;
+
+    // Storms that never let up have nothing to report their suppressed calls with.
+    uint32_t sites = std::min<uint32_t>(s_logNextSite.load(std::memory_order_relaxed), LOG_MAX_SITES);
+    for (uint32_t i = e_logSiteFirst; i < sites; ++i) {
+        LogSite* site = s_logSites[i].load(std::memory_order_acquire);
+        uint32_t suppressed = site && site->format() ? site->takeSuppressed() : 0;
+        if (suppressed)
+            *this << "NOTICE: " << std::dec << suppressed << " more \"" << site->format() << "\" suppressed"
+                  << std::endl;
+    }
+
+    flush();
+    m_quit = true;
+    m_writeEvent.signal();
+    if (m_writerThread.joinable())
+        m_writerThread.join();
+
+    // Anything that snuck in after the writer left, or everything, if it was let go. A writer
+    // that was let go might still wake up, so the file is closed under the same lock it writes
+    // with, and it won't touch it once we're done.
+    write(true, true);
+    m_open = false;
+}
+
+// ================================================================================================
+
+void AsyncLog::detachWriter()
+{
+    if (m_writerThread.joinable())
+        m_writerThread.detach();
+}
+
+// ================================================================================================
+
+void AsyncLog::synchronous()
+{
+    m_synchronous = true;
+    flush();
+    write(true);
+}
+
+// ================================================================================================
+
+void AsyncLog::writerThread()
+{
+    while (!m_quit) {
+        m_writeEvent.wait(LOG_FLUSH_MS);
+        write(false);
+    }
+}
+
+// ================================================================================================
+
+void AsyncLog::write(bool bounded, bool last)
+{
+    // When the process is going down, whoever was writing may be the thread that crashed, so
+    // give up rather than wait forever on the mutex.
+    std::unique_lock<std::mutex> lock(m_writeMut, std::defer_lock);
+    if (bounded) {
+        for (int i = 0; i < 100 && !lock.try_lock(); ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!lock.owns_lock())
+            return;
+    } else {
+        lock.lock();
+    }
+    if (!m_open)
+        return;
+
+    // Only whole records get written. The tail of one that's still being pushed stays put
+    // until next time.
+    uint64_t dropped = m_ring.drain(m_batch);
+    size_t offset = 0;
+    while (m_batch.size() - offset >= sizeof(LogRecordHeader)) {
+        LogRecordHeader header;
+        memcpy(&header, m_batch.data() + offset, sizeof(header));
+        if (m_batch.size() - offset - sizeof(header) < header.m_size)
+            break;
+        writeRecord(header, (const uint8_t*)m_batch.data() + offset + sizeof(header));
+        offset += sizeof(header) + header.m_size;
+    }
+    m_batch.erase(0, offset);
+
+    if (dropped) {
+        std::string notice = "NOTICE: " + std::to_string(dropped) + " log messages were dropped\n";
+        LogRecordHeader header{ (uint16_t)notice.size(), e_logSiteText, 0, LogNow() };
+        writeRecord(header, (const uint8_t*)notice.data());
+    }
+    if (!m_output.empty()) {
+        m_file.write(m_output.data(), (std::streamsize)m_output.size());
+        m_file.flush();
+        m_output.clear();
+    }
+    if (last) {
+        m_file.close();
+        m_open = false;
+    }
+}
+
+// ================================================================================================
+
+void AsyncLog::writeRecord(const LogRecordHeader& header, const uint8_t* payload)
+{
+    const LogSite* site = header.m_site >= e_logSiteFirst ? LogSite::find(header.m_site) : nullptr;
+    if (m_format == e_logText) {
+        if (header.m_site == e_logSiteText)
+            m_output.append((const char*)payload, header.m_size);
+        else if (site)
+            LogFormatRecord(m_output, site->format(), payload, header.m_size, header.m_suppressed);
+        return;
+    }
+
+    if (site && !m_defined[header.m_site]) {
+        std::string definition(sizeof(LogRecordHeader), '\0');
+        uint16_t id = header.m_site;
+        uint16_t line = (uint16_t)site->line();
+        definition.append((const char*)&id, sizeof(id));
+        definition.append((const char*)&line, sizeof(line));
+        definition.append(site->file(), strlen(site->file()) + 1);
+        definition.append(site->format(), strlen(site->format()) + 1);
+        LogRecordHeader define{ (uint16_t)(definition.size() - sizeof(LogRecordHeader)), e_logSiteDefine, 0,
+                                header.m_time };
+        memcpy(&definition[0], &define, sizeof(define));
+        m_output += definition;
+        m_defined[header.m_site] = true;
+    }
+    m_output.append((const char*)&header, sizeof(header));
+    m_output.append((const char*)payload, header.m_size);
+}
+
+// ================================================================================================
+
+bool LogReader::open(const char* path)
+{
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        m_log << "LogReader: ERROR could not open " << path << std::endl;
+        return false;
+    }
+    m_data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    if (m_data.size() < sizeof(LogFileHeader)) {
+        m_log << "LogReader: ERROR " << path << " is too small to be a log" << std::endl;
+        return false;
+    }
+    memcpy(&m_header, m_data.data(), sizeof(m_header));
+    if (memcmp(m_header.m_magic, LOG_MAGIC, sizeof(m_header.m_magic)) != 0) {
+        m_log << "LogReader: ERROR " << path << " is not a binary log" << std::endl;
+        return false;
+    }
+    if (m_header.m_versionMajor != LOG_VERSION_MAJOR) {
+        m_log << "LogReader: ERROR " << path << " is version " << m_header.m_versionMajor
+              << ", but only version " << LOG_VERSION_MAJOR << " is understood" << std::endl;
+        return false;
+    }
+    if (m_header.m_headerSize < sizeof(LogFileHeader) ||
+        m_header.m_recordHeaderSize < sizeof(LogRecordHeader) ||
+        m_header.m_headerSize > m_data.size()) {
+        m_log << "LogReader: ERROR " << path << " has a bad header" << std::endl;
+        return false;
+    }
+
+    m_offset = m_header.m_headerSize;
+    m_sites.assign(LOG_MAX_SITES, _Site{ });
+    return true;
+}
+
+// ================================================================================================
+
+bool LogReader::next(LogEntry& entry)
+{
+    for (;;) {
+        if (m_data.size() - m_offset < m_header.m_recordHeaderSize)
+            return false;
+        LogRecordHeader header;
+        memcpy(&header, m_data.data() + m_offset, sizeof(header));
+        const uint8_t* payload = m_data.data() + m_offset + m_header.m_recordHeaderSize;
+        if (m_data.size() - m_offset - m_header.m_recordHeaderSize < header.m_size) {
+            m_log << "LogReader: WARNING the log ends partway through a record" << std::endl;
+            return false;
+        }
+        m_offset += m_header.m_recordHeaderSize + header.m_size;
+
+        if (header.m_site == e_logSiteDefine) {
+            uint16_t id, line;
+            const char* strings = (const char*)payload + sizeof(id) + sizeof(line);
+            const char* end = (const char*)payload + header.m_size;
+            const char* format = nullptr;
+            if (header.m_size > sizeof(id) + sizeof(line)) {
+                format = (const char*)memchr(strings, '\0', end - strings);
+                if (format && !memchr(format + 1, '\0', end - format - 1))
+                    format = nullptr;
+            }
+            if (!format) {
+                m_log << "LogReader: WARNING skipping a bad site definition" << std::endl;
+                continue;
+            }
+            format++;
+            memcpy(&id, payload, sizeof(id));
+            memcpy(&line, payload + sizeof(id), sizeof(line));
+            if (id < m_sites.size())
+                m_sites[id] = { line, strings, format, 0, 0 };
+            continue;
+        }
+
+        entry.m_site = header.m_site;
+        entry.m_suppressed = header.m_suppressed;
+        entry.m_time = header.m_time >= m_header.m_start ? header.m_time - m_header.m_start : 0;
+        entry.m_text.clear();
+        if (header.m_site == e_logSiteText) {
+            entry.m_text.assign((const char*)payload, header.m_size);
+        } else if (header.m_site < m_sites.size() && !m_sites[header.m_site].m_file.empty()) {
+            _Site& site = m_sites[header.m_site];
+            site.m_count++;
+            site.m_suppressed += header.m_suppressed;
+            LogFormatRecord(entry.m_text, site.m_format.c_str(), payload, header.m_size, header.m_suppressed);
+        } else {
+            entry.m_text = "<record from undefined site " + std::to_string(header.m_site) + ">\n";
+        }
+        return true;
+    }
+}
+
+// ================================================================================================
+
+bool LogReader::site(uint16_t id, const char*& file, int& line, const char*& format, uint64_t& count,
+                     uint64_t& suppressed) const
+{
+    if (id >= m_sites.size() || m_sites[id].m_file.empty())
+        return false;
+    const _Site& site = m_sites[id];
+    file = site.m_file.c_str();
+    line = site.m_line;
+    format = site.m_format.c_str();
+    count = site.m_count;
+    suppressed = site.m_suppressed;
+    return true;
+}
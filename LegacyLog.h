@@ -0,0 +1,396 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_LOG_H
+#define __LEGACY_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "LegacyEvent.h"
+
+// ================================================================================================
+
+constexpr size_t LOG_SLOT_BYTES = 120;
+constexpr size_t LOG_SLOT_COUNT = 8192;
+
+// How often the writer thread wakes up on its own to write out whatever has piled up.
+constexpr uint32_t LOG_FLUSH_MS = 50;
+
+// Every LEGACY_LOG call site gets a token bucket this deep, refilled this many times a second.
+constexpr uint32_t LOG_SITE_BURST = 10;
+constexpr uint32_t LOG_SITE_RATE = 1;
+constexpr size_t LOG_MAX_SITES = 1024;
+
+// ================================================================================================
+
+// Binary logs
+// -----------
+// Everything that goes through an AsyncLog is a record: a LogRecordHeader followed by m_size
+// bytes of payload, with no padding. That's also what goes on the disk when the log is opened
+// with e_logBinary, after a LogFileHeader. Everything is little endian. As with traces, readers
+// must use the header sizes stored in the file rather than their own.
+//
+// Records from the stream side (e_logSiteText) are plain text that already ends in a newline.
+// Records from LEGACY_LOG sites hold the arguments, each a LogArgType byte followed by the
+// value -- four or eight bytes for numbers, or a uint16_t length and the bytes for a string.
+// The format string only goes in the file once, in an e_logSiteDefine record written before
+// the site's first record. Its payload is the uint16_t site ID, the uint16_t line, and then the
+// source file name and the printf style format, both NUL terminated.
+//
+// The time is steady clock nanoseconds, which only mean something next to m_start. The
+// suppressed count is how many calls to the site the rate limiter threw away before this one.
+
+constexpr char LOG_MAGIC[8] = { 'L', 'G', 'C', 'Y', 'L', 'O', 'G', '\0' };
+constexpr uint16_t LOG_VERSION_MAJOR = 1;
+constexpr uint16_t LOG_VERSION_MINOR = 0;
+
+enum LogFormat
+{
+    e_logText,
+    e_logBinary,
+};
+
+enum
+{
+    e_logSiteText = 0,
+    e_logSiteDefine = 1,
+    e_logSiteFirst = 2,
+};
+
+enum LogArgType
+{
+    e_logArgInt32 = 1,
+    e_logArgUInt32 = 2,
+    e_logArgInt64 = 3,
+    e_logArgUInt64 = 4,
+    e_logArgDouble = 5,
+    e_logArgPointer = 6,
+    e_logArgString = 7,
+};
+
+struct LogFileHeader
+{
+    char m_magic[8];
+    uint16_t m_versionMajor;
+    uint16_t m_versionMinor;
+    uint16_t m_headerSize;
+    uint16_t m_recordHeaderSize;
+    uint64_t m_start;
+};
+static_assert(sizeof(LogFileHeader) == 24, "LogFileHeader must be 24 bytes");
+
+struct LogRecordHeader
+{
+    uint16_t m_size;
+    uint16_t m_site;
+    uint32_t m_suppressed;
+    uint64_t m_time;
+};
+static_assert(sizeof(LogRecordHeader) == 16, "LogRecordHeader must be 16 bytes");
+
+uint64_t LogNow();
+
+// Runs printf style format over the encoded arguments of a record and appends the result, plus
+// a note about any suppressed calls and a newline.
+void LogFormatRecord(std::string& out, const char* format, const uint8_t* args, size_t size,
+                     uint32_t suppressed);
+
+// ================================================================================================
+
+// One LEGACY_LOG call site. Sites are numbered as they are first hit, and the numbers are only
+// good for the life of the process, which is why the binary log carries its own definitions.
+class LogSite
+{
+    const char* m_file;
+    int m_line;
+    std::atomic<const char*> m_format{ nullptr };
+    uint16_t m_id{ e_logSiteText };
+
+    // Generic cell rate algorithm, which is a token bucket that only needs the one atomic: the
+    // time the bucket will be full again.
+    uint64_t m_interval;
+    uint64_t m_depth;
+    std::atomic<uint64_t> m_full{ 0 };
+    std::atomic<uint32_t> m_suppressed{ 0 };
+
+public:
+    LogSite(const char* file, int line, uint32_t burst = LOG_SITE_BURST, uint32_t rate = LOG_SITE_RATE);
+    ~LogSite();
+
+    LogSite(const LogSite&) = delete;
+    LogSite& operator=(const LogSite&) = delete;
+
+    // Returns false if the call should be dropped. Otherwise, suppressed is how many were
+    // dropped since the last one that wasn't.
+    bool admit(const char* format, uint64_t now, uint32_t& suppressed);
+
+    // Zero if the site table was full, in which case the site's records are formatted up front
+    // and go out as text.
+    uint16_t id() const { return m_id; }
+
+    // Calls thrown away that no later call has owned up to yet.
+    uint32_t takeSuppressed() { return m_suppressed.exchange(0, std::memory_order_relaxed); }
+
+    const char* file() const { return m_file; }
+    int line() const { return m_line; }
+    const char* format() const { return m_format.load(std::memory_order_acquire); }
+
+    static const LogSite* find(uint16_t id);
+};
+
+// ================================================================================================
+
+inline void LogEncodeArg(std::string& out, LogArgType type, const void* value, size_t size)
+{
+    out.push_back((char)type);
+    out.append((const char*)value, size);
+}
+
+inline void LogEncodeArg(std::string& out, const char* value)
+{
+    if (!value)
+        value = "(null)";
+    uint16_t length = (uint16_t)std::min<size_t>(strlen(value), UINT16_MAX);
+    LogEncodeArg(out, e_logArgString, &length, sizeof(length));
+    out.append(value, length);
+}
+
+inline void LogEncodeArg(std::string& out, const std::string& value) { LogEncodeArg(out, value.c_str()); }
+
+template<typename T>
+inline void LogEncodeArg(std::string& out, T* value)
+{
+    uint64_t pointer = (uint64_t)(uintptr_t)value;
+    LogEncodeArg(out, e_logArgPointer, &pointer, sizeof(pointer));
+}
+
+template<typename T>
+inline std::enable_if_t<std::is_arithmetic_v<T> || std::is_enum_v<T>> LogEncodeArg(std::string& out, T value)
+{
+    if constexpr (std::is_floating_point_v<T>) {
+        double number = value;
+        LogEncodeArg(out, e_logArgDouble, &number, sizeof(number));
+    } else if constexpr (std::is_enum_v<T>) {
+        LogEncodeArg(out, (std::underlying_type_t<T>)value);
+    } else if constexpr (sizeof(T) <= sizeof(uint32_t)) {
+        if constexpr (std::is_signed_v<T>) {
+            int32_t number = value;
+            LogEncodeArg(out, e_logArgInt32, &number, sizeof(number));
+        } else {
+            uint32_t number = value;
+            LogEncodeArg(out, e_logArgUInt32, &number, sizeof(number));
+        }
+    } else {
+        if constexpr (std::is_signed_v<T>) {
+            int64_t number = value;
+            LogEncodeArg(out, e_logArgInt64, &number, sizeof(number));
+        } else {
+            uint64_t number = value;
+            LogEncodeArg(out, e_logArgUInt64, &number, sizeof(number));
+        }
+    }
+}
+
+// ================================================================================================
+
+// Bounded ring of log records that any number of threads can push to without locking and that
+// one thread drains. Each record is copied into however many fixed size slots it needs, and
+// those are reserved together, so records never interleave. When there isn't room, the record
+// is dropped and counted rather than making the game wait on the disk.
+class LogRing
+{
+    struct _Slot
+    {
+        std::atomic<uint64_t> m_sequence;
+        uint32_t m_length;
+        char m_text[LOG_SLOT_BYTES];
+    };
+
+    std::unique_ptr<_Slot[]> m_slots;
+    alignas(64) std::atomic<uint64_t> m_head{ 0 };
+    alignas(64) std::atomic<uint64_t> m_tail{ 0 };
+    std::atomic<uint64_t> m_dropped{ 0 };
+
+public:
+    LogRing();
+
+    LogRing(const LogRing&) = delete;
+    LogRing& operator=(const LogRing&) = delete;
+
+    // Returns false if the message was dropped. Messages too big for half the ring are cut off.
+    bool push(const char* text, size_t length);
+
+    // Slots in use, as of the last push or drain.
+    size_t used() const;
+
+    // Only one thread may drain at a time. Appends everything published so far to text and
+    // returns the number of messages that have been dropped since the last call. A record that
+    // is still being pushed may be cut off at the end, and the rest comes with the next drain.
+    uint64_t drain(std::string& text);
+};
+
+// ================================================================================================
+
+// A std::ostream that hands each message off to a LogRing instead of writing it out. Text is
+// gathered per thread until the stream is flushed, which std::endl and std::flush already do,
+// so the existing `s_log << ... << std::endl` lines each become one message. LEGACY_LOG sites
+// skip the formatting entirely and only queue their arguments. A background thread writes
+// the ring out to the file in batches, either as text or as-is for legacy_logdecode.
+class AsyncLog : public std::ostream
+{
+    class _Buffer : public std::streambuf
+    {
+        AsyncLog& m_log;
+
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char* s, std::streamsize count) override;
+        int sync() override;
+
+    public:
+        _Buffer(AsyncLog& log) : m_log(log) { }
+    };
+
+    _Buffer m_buffer;
+    LogRing m_ring;
+    LogFormat m_format{ e_logText };
+    std::ofstream m_file;
+    std::atomic<bool> m_open{ false };
+    std::atomic<bool> m_synchronous{ false };
+
+    // Only touched by whoever holds m_writeMut.
+    std::mutex m_writeMut;
+    std::string m_batch;
+    std::string m_output;
+    std::vector<bool> m_defined;
+
+    Event m_writeEvent;
+    std::atomic<bool> m_quit{ false };
+    std::thread m_writerThread;
+
+    void writerThread();
+    void write(bool bounded, bool last = false);
+    void writeRecord(const LogRecordHeader& header, const uint8_t* payload);
+    void submit(std::string& record, const LogSite* site, uint32_t suppressed, uint64_t time);
+
+    static std::string& beginRecord();
+
+public:
+    AsyncLog();
+    ~AsyncLog();
+
+    AsyncLog(const AsyncLog&) = delete;
+    AsyncLog& operator=(const AsyncLog&) = delete;
+
+    bool open(const char* path, LogFormat format = e_logText);
+    void close();
+    bool is_open() const { return m_open.load(std::memory_order_relaxed); }
+
+    // Lets the writer thread go without joining it, for DllMain when the process is exiting and
+    // the thread is already gone. Whatever is left gets written out by close().
+    void detachWriter();
+
+    // For when the process is going down and there may not be a later. Writes out everything
+    // queued so far, and from then on every flush goes straight to the disk.
+    void synchronous();
+
+    // Use LEGACY_LOG rather than calling this directly.
+    template<typename... Args>
+    void print(LogSite& site, const char* format, const Args&... args)
+    {
+        uint64_t now = LogNow();
+        uint32_t suppressed;
+        if (!is_open() || !site.admit(format, now, suppressed))
+            return;
+        std::string& record = beginRecord();
+        (LogEncodeArg(record, args), ...);
+        submit(record, &site, suppressed, now);
+    }
+
+    const LogRing& ring() const { return m_ring; }
+};
+
+// Logs a printf style message without formatting anything on the calling thread, and without
+// letting the same line flood the log. Meant for errors that can repeat every frame.
+#define LEGACY_LOG(log, ...) \
+    do { \
+        static LogSite _logSite{ __FILE__, __LINE__ }; \
+        (log).print(_logSite, __VA_ARGS__); \
+    } while (0)
+
+// ================================================================================================
+
+struct LogEntry
+{
+    uint16_t m_site;
+    uint32_t m_suppressed;
+
+    // Nanoseconds since the log was opened.
+    uint64_t m_time;
+    std::string m_text;
+};
+
+// Reads back a log written with e_logBinary.
+class LogReader
+{
+    struct _Site
+    {
+        uint16_t m_line;
+        std::string m_file;
+        std::string m_format;
+        uint64_t m_count;
+        uint64_t m_suppressed;
+    };
+
+    std::ostream& m_log;
+    std::vector<uint8_t> m_data;
+    LogFileHeader m_header{ };
+    size_t m_offset{ 0 };
+    std::vector<_Site> m_sites;
+
+public:
+    LogReader(std::ostream& log) : m_log(log) { }
+
+    bool open(const char* path);
+
+    // Returns false at the end of the log, or if the rest of it is garbage.
+    bool next(LogEntry& entry);
+
+    // Call sites defined so far, and how often each has been read.
+    size_t sites() const { return m_sites.size(); }
+    bool site(uint16_t id, const char*& file, int& line, const char*& format, uint64_t& count,
+              uint64_t& suppressed) const;
+};
+
+#endif
@@ -0,0 +1,108 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "LegacyLog.h"
+
+// ================================================================================================
+
+struct _DecodeOptions
+{
+    const char* m_path{ nullptr };
+    bool m_times{ false };
+    bool m_sites{ false };
+};
+
+// ================================================================================================
+
+static void DecodeUsage()
+{
+    printf("usage: legacy_logdecode <log> [options]\n"
+           "  --time          put the seconds since the log was opened in front of every line\n"
+           "  --sites         finish up with how often each call site logged\n");
+}
+
+// ================================================================================================
+
+static bool DecodeParseOptions(int argc, char** argv, _DecodeOptions& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--time") == 0) {
+            options.m_times = true;
+        } else if (strcmp(arg, "--sites") == 0) {
+            options.m_sites = true;
+        } else if (strncmp(arg, "--", 2) == 0 || options.m_path) {
+            printf("legacy_logdecode: unexpected \"%s\"\n", arg);
+            return false;
+        } else {
+            options.m_path = arg;
+        }
+    }
+    return options.m_path != nullptr;
+}
+
+// ================================================================================================
+
+int main(int argc, char** argv)
+{
+    _DecodeOptions options;
+    if (!DecodeParseOptions(argc, argv, options)) {
+        DecodeUsage();
+        return 2;
+    }
+
+    LogReader reader{ std::cerr };
+    if (!reader.open(options.m_path))
+        return 1;
+
+    LogEntry entry;
+    while (reader.next(entry)) {
+        // Stream messages can span several lines, and each of them gets the time.
+        const char* text = entry.m_text.c_str();
+        while (*text) {
+            const char* end = strchr(text, '\n');
+            size_t length = end ? (size_t)(end - text) + 1 : strlen(text);
+            if (options.m_times)
+                printf("[%12.6f] ", entry.m_time / 1e9);
+            fwrite(text, 1, length, stdout);
+            text += length;
+        }
+    }
+
+    if (options.m_sites) {
+        printf("\n%6s %10s %10s  %s\n", "site", "logged", "suppressed", "where");
+        for (size_t i = e_logSiteFirst; i < reader.sites(); ++i) {
+            const char* file;
+            const char* format;
+            int line;
+            uint64_t count, suppressed;
+            if (reader.site((uint16_t)i, file, line, format, count, suppressed))
+                printf("%6zu %10" PRIu64 " %10" PRIu64 "  %s:%d \"%s\"\n", i, count, suppressed, file, line,
+                       format);
+        }
+    }
+    return 0;
+}
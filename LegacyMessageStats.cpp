@@ -0,0 +1,231 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyMessageStats.h"
+
+#include <algorithm>
+#include <cstdio>
+
+// ================================================================================================
+
+size_t MessageStatsSlot(uint32_t message)
+{
+    if (message < MESSAGE_STATS_DIRECT)
+        return message;
+    if (message < 0x8000)
+        return e_messageRangeUser;
+    if (message < 0xC000)
+        return e_messageRangeApp;
+    if (message <= 0xFFFF)
+        return e_messageRangeRegistered;
+    return e_messageRangeOther;
+}
+
+// ================================================================================================
+
+const char* MessageStatsRangeName(size_t slot)
+{
+    switch (slot) {
+    case e_messageRangeUser:
+        return "WM_USER+";
+    case e_messageRangeApp:
+        return "WM_APP+";
+    case e_messageRangeRegistered:
+        return "(registered)";
+    case e_messageRangeOther:
+        return "(other)";
+    default:
+        return nullptr;
+    }
+}
+
+// ================================================================================================
+
+size_t MessageStats::bucketOf(uint64_t cycles)
+{
+    // Bucket zero is for nothing at all, and everything else goes one past its leading bit.
+    size_t bucket = 0;
+    for (uint32_t shift = 32; shift; shift >>= 1) {
+        if (cycles >> shift) {
+            cycles >>= shift;
+            bucket += shift;
+        }
+    }
+    bucket += (size_t)cycles;
+    return std::min(bucket, MESSAGE_STATS_BUCKETS - 1);
+}
+
+// ================================================================================================
+
+MessageStats::MessageStats()
+    : m_slots(new _Slot[MESSAGE_STATS_SLOTS]()),
+      m_calibrationCycles(StageReadCycles()), m_calibrationTime(std::chrono::steady_clock::now())
+{
+}
+
+// ================================================================================================
+
+bool MessageStats::checkStall(_Slot& slot, uint64_t cycles)
+{
+    // Until the counter has been calibrated, everything ends up here, so being early just
+    // means we can't say yet.
+    double scale = cyclesPerMicrosecond();
+    if (scale == 0.0)
+        return false;
+
+    // Leave a little room under the threshold in case the calibration is still settling.
+    uint32_t thresholdUs = m_stallUs.load(std::memory_order_relaxed);
+    m_stallCycles.store((uint64_t)(thresholdUs * scale * 15.0 / 16.0), std::memory_order_relaxed);
+    if (cycles / scale < thresholdUs)
+        return false;
+
+    slot.m_stalls.store(slot.m_stalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_stalls.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// ================================================================================================
+
+void MessageStats::setStallThreshold(uint32_t ms)
+{
+    m_stallUs.store(ms * 1000, std::memory_order_relaxed);
+    m_stallCycles.store(0, std::memory_order_relaxed);
+}
+
+// ================================================================================================
+
+double MessageStats::cyclesPerMicrosecond() const
+{
+#ifdef LEGACY_PIXELS_X86
+    uint64_t cycles = StageReadCycles() - m_calibrationCycles;
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - m_calibrationTime;
+    if (elapsed.count() < 1000.0 || cycles == 0)
+        return 0.0;
+    return cycles / elapsed.count();
+#else
+    typedef std::chrono::steady_clock::period Period;
+    return (double)Period::den / (Period::num * 1e6);
+#endif
+}
+
+// ================================================================================================
+
+MessageSummary MessageStats::summary(size_t slot) const
+{
+    const _Slot& s = m_slots[slot];
+    MessageSummary summary{ };
+    summary.m_slot = slot;
+    summary.m_calls = s.m_calls.load(std::memory_order_relaxed);
+    summary.m_stalls = s.m_stalls.load(std::memory_order_relaxed);
+
+    double scale = cyclesPerMicrosecond();
+    if (scale == 0.0 || summary.m_calls == 0)
+        return summary;
+    summary.m_totalUs = s.m_cycles.load(std::memory_order_relaxed) / scale;
+    summary.m_meanUs = summary.m_totalUs / summary.m_calls;
+    summary.m_maxUs = s.m_max.load(std::memory_order_relaxed) / scale;
+
+    // The buckets might not quite add up to the number of calls if one is being recorded right
+    // now, so rank against what the buckets say.
+    uint32_t counts[MESSAGE_STATS_BUCKETS];
+    uint64_t total = 0;
+    for (size_t i = 0; i < MESSAGE_STATS_BUCKETS; ++i) {
+        counts[i] = s.m_buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    auto percentile = [&](double p) -> double {
+        uint64_t rank = std::max<uint64_t>((uint64_t)(total * p + 0.5), 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < MESSAGE_STATS_BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min((double)(UINT64_C(1) << i) / scale, summary.m_maxUs);
+        }
+        return summary.m_maxUs;
+    };
+    summary.m_p50Us = percentile(0.50);
+    summary.m_p99Us = percentile(0.99);
+    return summary;
+}
+
+// ================================================================================================
+
+std::vector<MessageSummary> MessageStats::top(size_t count) const
+{
+    std::vector<MessageSummary> summaries;
+    for (size_t i = 0; i < MESSAGE_STATS_SLOTS; ++i) {
+        if (m_slots[i].m_calls.load(std::memory_order_relaxed) != 0)
+            summaries.push_back(summary(i));
+    }
+
+    count = std::min(count, summaries.size());
+    std::partial_sort(summaries.begin(), summaries.begin() + count, summaries.end(),
+                      [](const MessageSummary& a, const MessageSummary& b) {
+                          return a.m_totalUs > b.m_totalUs;
+                      });
+    summaries.resize(count);
+    return summaries;
+}
+
+// ================================================================================================
+
+size_t MessageStats::write(std::ostream& out, NameFunc name, size_t count) const
+{
+    std::vector<MessageSummary> summaries = top(count);
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-24s %10s %12s %10s %10s %10s %10s %8s", "message", "calls",
+             "total ms", "mean us", "p50 us", "p99 us", "max us", "stalls");
+    out << line << '\n';
+    for (const MessageSummary& summary : summaries) {
+        const char* message = MessageStatsRangeName(summary.m_slot);
+        if (!message && name)
+            message = name((uint32_t)summary.m_slot);
+        char unknown[16];
+        if (!message) {
+            snprintf(unknown, sizeof(unknown), "0x%04x", (uint32_t)summary.m_slot);
+            message = unknown;
+        }
+        snprintf(line, sizeof(line), "%-24s %10llu %12.3f %10.1f %10.1f %10.1f %10.1f %8llu", message,
+                 (unsigned long long)summary.m_calls, summary.m_totalUs / 1000.0, summary.m_meanUs,
+                 summary.m_p50Us, summary.m_p99Us, summary.m_maxUs, (unsigned long long)summary.m_stalls);
+        out << line << '\n';
+    }
+    out.flush();
+    return summaries.size();
+}
+
+// ================================================================================================
+
+void MessageStats::reset()
+{
+    for (size_t i = 0; i < MESSAGE_STATS_SLOTS; ++i) {
+        _Slot& s = m_slots[i];
+        s.m_calls.store(0, std::memory_order_relaxed);
+        s.m_cycles.store(0, std::memory_order_relaxed);
+        s.m_max.store(0, std::memory_order_relaxed);
+        s.m_stalls.store(0, std::memory_order_relaxed);
+        for (std::atomic<uint32_t>& bucket : s.m_buckets)
+            bucket.store(0, std::memory_order_relaxed);
+    }
+    m_stalls.store(0, std::memory_order_relaxed);
+}
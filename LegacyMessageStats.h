@@ -0,0 +1,147 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_MESSAGESTATS_H
+#define __LEGACY_MESSAGESTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "LegacyStageTiming.h"
+
+// ================================================================================================
+
+// Every message below WM_USER gets a slot of its own. Above that, IDs are private to whoever
+// made them up, so they are only counted by range.
+constexpr uint32_t MESSAGE_STATS_DIRECT = 0x0400;
+
+enum MessageStatsRange
+{
+    e_messageRangeUser = MESSAGE_STATS_DIRECT,
+    e_messageRangeApp,
+    e_messageRangeRegistered,
+    e_messageRangeOther,
+
+    e_messageRangeEnd,
+};
+
+constexpr size_t MESSAGE_STATS_SLOTS = e_messageRangeEnd;
+
+// Timings are bucketed by the power of two of their cycle count, which is plenty to tell a
+// microsecond from a millisecond from a second.
+constexpr size_t MESSAGE_STATS_BUCKETS = 48;
+
+// How long a message may take, by default, before we call it a stall.
+constexpr uint32_t MESSAGE_STATS_STALL_MS = 50;
+
+size_t MessageStatsSlot(uint32_t message);
+const char* MessageStatsRangeName(size_t slot);
+
+// All times in microseconds. The percentiles are the top of the bucket they fell in, so they are
+// only good to within a factor of two.
+struct MessageSummary
+{
+    size_t m_slot;
+    uint64_t m_calls;
+    uint64_t m_stalls;
+    double m_totalUs;
+    double m_meanUs;
+    double m_p50Us;
+    double m_p99Us;
+    double m_maxUs;
+};
+
+// ================================================================================================
+
+// Call counts and timings for every window message, in a fixed array indexed by message ID. A
+// slot is only ever written by the thread that owns the window, so recording is a handful of
+// relaxed atomic stores and an add, and anybody may read along.
+class MessageStats
+{
+    struct _Slot
+    {
+        std::atomic<uint64_t> m_calls{ 0 };
+        std::atomic<uint64_t> m_cycles{ 0 };
+        std::atomic<uint64_t> m_max{ 0 };
+        std::atomic<uint64_t> m_stalls{ 0 };
+        std::atomic<uint32_t> m_buckets[MESSAGE_STATS_BUCKETS]{ };
+    };
+
+    std::unique_ptr<_Slot[]> m_slots;
+    std::atomic<uint64_t> m_stalls{ 0 };
+
+    // Same trick as StageTimes, comparing the counter against the clock since we started.
+    uint64_t m_calibrationCycles;
+    std::chrono::steady_clock::time_point m_calibrationTime;
+
+    // Anything shorter than m_stallCycles can't be a stall, so only those that get past it need
+    // their cycles turned into time. It's refreshed as the calibration gets better.
+    std::atomic<uint32_t> m_stallUs{ MESSAGE_STATS_STALL_MS * 1000 };
+    std::atomic<uint64_t> m_stallCycles{ 0 };
+
+    bool checkStall(_Slot& slot, uint64_t cycles);
+
+public:
+    MessageStats();
+
+    MessageStats(const MessageStats&) = delete;
+    MessageStats& operator=(const MessageStats&) = delete;
+
+    // Returns true if the message took longer than the stall threshold.
+    bool record(uint32_t message, uint64_t cycles)
+    {
+        _Slot& slot = m_slots[MessageStatsSlot(message)];
+        slot.m_calls.store(slot.m_calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        slot.m_cycles.store(slot.m_cycles.load(std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
+        if (cycles > slot.m_max.load(std::memory_order_relaxed))
+            slot.m_max.store(cycles, std::memory_order_relaxed);
+        slot.m_buckets[bucketOf(cycles)].fetch_add(1, std::memory_order_relaxed);
+
+        if (cycles < m_stallCycles.load(std::memory_order_relaxed))
+            return false;
+        return checkStall(slot, cycles);
+    }
+
+    static size_t bucketOf(uint64_t cycles);
+
+    void setStallThreshold(uint32_t ms);
+    uint32_t stallThreshold() const { return m_stallUs.load(std::memory_order_relaxed) / 1000; }
+    uint64_t stalls() const { return m_stalls.load(std::memory_order_relaxed); }
+
+    double cyclesPerMicrosecond() const;
+    MessageSummary summary(size_t slot) const;
+
+    // The slots that have seen any messages, most total time first.
+    std::vector<MessageSummary> top(size_t count) const;
+
+    // A table of the top offenders, looking the names up as it goes.
+    using NameFunc = const char* (*)(uint32_t message);
+    size_t write(std::ostream& out, NameFunc name, size_t count) const;
+
+    void reset();
+};
+
+#endif
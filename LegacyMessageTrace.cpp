@@ -0,0 +1,171 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyMessageTrace.h"
+#include "LegacyLog.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+// ================================================================================================
+
+static std::atomic<uint64_t> s_messageTraceInstances{ 0 };
+
+// Which ring this thread records into, and for which trace.
+struct _MessageTraceCache
+{
+    uint64_t m_instance;
+    void* m_ring;
+};
+static thread_local _MessageTraceCache s_messageTraceCache{ UINT64_MAX, nullptr };
+
+// ================================================================================================
+
+MessageTrace::MessageTrace()
+    : m_instance(s_messageTraceInstances.fetch_add(1, std::memory_order_relaxed))
+{
+}
+
+// ================================================================================================
+
+void MessageTrace::enable(size_t records)
+{
+    size_t expected = 0;
+    m_capacity.compare_exchange_strong(expected, std::max(records, MESSAGE_TRACE_MIN_RECORDS),
+                                       std::memory_order_relaxed);
+}
+
+// ================================================================================================
+
+MessageTrace::_Ring* MessageTrace::ring()
+{
+    if (s_messageTraceCache.m_instance == m_instance)
+        return (_Ring*)s_messageTraceCache.m_ring;
+
+    // First message on this thread. Rings stick around until the trace goes away, so they can
+    // still be dumped after their thread has exited. There's one spare slot for the record
+    // that's being written while a snapshot is taken.
+    std::lock_guard<std::mutex> _(m_ringsMut);
+    std::unique_ptr<_Ring> ring = std::make_unique<_Ring>();
+    ring->m_records.reset(new MessageRecord[m_capacity.load(std::memory_order_relaxed) + 1]);
+    ring->m_thread = (uint16_t)m_rings.size();
+    m_rings.push_back(std::move(ring));
+    s_messageTraceCache = { m_instance, m_rings.back().get() };
+    return m_rings.back().get();
+}
+
+// ================================================================================================
+
+void MessageTrace::record(MessageSource source, uint32_t message, uint64_t wParam, uint64_t lParam,
+                          uint64_t result)
+{
+    size_t capacity = m_capacity.load(std::memory_order_relaxed);
+    if (capacity == 0)
+        return;
+
+    _Ring* ring = this->ring();
+    uint64_t count = ring->m_count.load(std::memory_order_relaxed);
+    MessageRecord& record = ring->m_records[count % (capacity + 1)];
+    record.m_time = LogNow();
+    record.m_wParam = wParam;
+    record.m_lParam = lParam;
+    record.m_result = result;
+    record.m_message = message;
+    record.m_source = (uint16_t)source;
+    record.m_thread = ring->m_thread;
+    ring->m_count.store(count + 1, std::memory_order_release);
+}
+
+// ================================================================================================
+
+std::vector<MessageRecord> MessageTrace::snapshot() const
+{
+    std::vector<MessageRecord> records;
+    size_t capacity = m_capacity.load(std::memory_order_relaxed);
+    if (capacity == 0)
+        return records;
+
+    std::lock_guard<std::mutex> _(m_ringsMut);
+    for (const std::unique_ptr<_Ring>& ring : m_rings) {
+        uint64_t end = ring->m_count.load(std::memory_order_acquire);
+        uint64_t begin = end > capacity ? end - capacity : 0;
+        size_t first = records.size();
+        for (uint64_t i = begin; i < end; ++i)
+            records.push_back(ring->m_records[i % (capacity + 1)]);
+
+        // Anything the thread lapped while we were copying is garbage, including the one it may
+        // be in the middle of writing.
+        uint64_t now = ring->m_count.load(std::memory_order_acquire);
+        uint64_t lost = now > begin + capacity ? std::min(now - (begin + capacity), end - begin) : 0;
+        records.erase(records.begin() + first, records.begin() + first + (size_t)lost);
+    }
+
+    std::stable_sort(records.begin(), records.end(), [](const MessageRecord& a, const MessageRecord& b) {
+        return a.m_time < b.m_time;
+    });
+    return records;
+}
+
+// ================================================================================================
+
+size_t MessageTrace::dump(std::ostream& out, NameFunc name) const
+{
+    static const char* sources[] = { "?", "forwarded", "peeked", "removed" };
+
+    std::vector<MessageRecord> records = snapshot();
+    if (records.empty())
+        return 0;
+
+    char line[256];
+    uint64_t start = records.front().m_time;
+    for (const MessageRecord& record : records) {
+        const char* message = name ? name(record.m_message) : nullptr;
+        char unknown[16];
+        if (!message) {
+            snprintf(unknown, sizeof(unknown), "0x%04x", record.m_message);
+            message = unknown;
+        }
+        const char* source = record.m_source < std::size(sources) ? sources[record.m_source] : sources[0];
+        int length = snprintf(line, sizeof(line),
+                              "%12.3f ms thread %u %-9s %-24s wParam: 0x%" PRIx64 " lParam: 0x%" PRIx64,
+                              (record.m_time - start) / 1e6, record.m_thread, source, message,
+                              record.m_wParam, record.m_lParam);
+        if (record.m_source == e_messageWndProc && length > 0 && (size_t)length < sizeof(line))
+            snprintf(line + length, sizeof(line) - length, " result: 0x%" PRIx64, record.m_result);
+        out << line << '\n';
+    }
+    out.flush();
+    return records.size();
+}
+
+// ================================================================================================
+
+bool MessageTrace::dump(const char* path, NameFunc name) const
+{
+    std::ofstream file(path, std::ios::out);
+    if (!file.is_open())
+        return false;
+    dump(file, name);
+    return file.good();
+}
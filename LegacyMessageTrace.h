@@ -0,0 +1,151 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_MESSAGETRACE_H
+#define __LEGACY_MESSAGETRACE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// ================================================================================================
+
+// Anything smaller than this is taken to mean "on" rather than an actual size.
+constexpr size_t MESSAGE_TRACE_MIN_RECORDS = 1024;
+
+struct MessageName
+{
+    uint32_t m_id;
+    const char* m_name;
+};
+
+// Message IDs to names, sorted at compile time so that a lookup is a binary search instead of
+// a couple hundred case switch.
+template<size_t N>
+class MessageNames
+{
+    std::array<MessageName, N> m_names;
+
+public:
+    constexpr MessageNames(const std::array<MessageName, N>& names)
+        : m_names(names)
+    {
+        for (size_t i = 1; i < N; ++i) {
+            MessageName name = m_names[i];
+            size_t j = i;
+            for (; j > 0 && m_names[j - 1].m_id > name.m_id; --j)
+                m_names[j] = m_names[j - 1];
+            m_names[j] = name;
+        }
+    }
+
+    constexpr const char* find(uint32_t id) const
+    {
+        size_t lo = 0, hi = N;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (m_names[mid].m_id < id)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return (lo < N && m_names[lo].m_id == id) ? m_names[lo].m_name : nullptr;
+    }
+
+    constexpr bool unique() const
+    {
+        for (size_t i = 1; i < N; ++i)
+            if (m_names[i - 1].m_id == m_names[i].m_id)
+                return false;
+        return true;
+    }
+
+    constexpr size_t size() const { return N; }
+};
+
+// ================================================================================================
+
+enum MessageSource
+{
+    e_messageWndProc = 1,
+    e_messagePeeked = 2,
+    e_messageRemoved = 3,
+};
+
+struct MessageRecord
+{
+    uint64_t m_time;
+    uint64_t m_wParam;
+    uint64_t m_lParam;
+    uint64_t m_result;
+    uint32_t m_message;
+    uint16_t m_source;
+    uint16_t m_thread;
+};
+static_assert(sizeof(MessageRecord) == 40, "MessageRecord must be 40 bytes");
+
+// A flight recorder for window messages. Each thread gets its own ring, so recording is a few
+// stores with nobody to contend with, and nothing gets formatted until the trace is dumped.
+class MessageTrace
+{
+    struct _Ring
+    {
+        std::unique_ptr<MessageRecord[]> m_records;
+        std::atomic<uint64_t> m_count{ 0 };
+        uint16_t m_thread;
+    };
+
+    uint64_t m_instance;
+    std::atomic<size_t> m_capacity{ 0 };
+    mutable std::mutex m_ringsMut;
+    std::vector<std::unique_ptr<_Ring>> m_rings;
+
+    _Ring* ring();
+
+public:
+    MessageTrace();
+
+    MessageTrace(const MessageTrace&) = delete;
+    MessageTrace& operator=(const MessageTrace&) = delete;
+
+    // Keeps the last records messages on each thread. Can only be done once.
+    void enable(size_t records);
+    bool enabled() const { return m_capacity.load(std::memory_order_relaxed) != 0; }
+
+    void record(MessageSource source, uint32_t message, uint64_t wParam, uint64_t lParam,
+                uint64_t result = 0);
+
+    // Everything still in the rings, oldest first. Threads may keep recording while this runs,
+    // and whatever they overwrite in the meantime is left out.
+    std::vector<MessageRecord> snapshot() const;
+
+    // Writes the snapshot out a line at a time, looking the names up as it goes.
+    using NameFunc = const char* (*)(uint32_t message);
+    size_t dump(std::ostream& out, NameFunc name) const;
+    bool dump(const char* path, NameFunc name) const;
+};
+
+#endif
@@ -0,0 +1,420 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyOverlay.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+#ifdef LEGACY_PIXELS_X86
+#   include <immintrin.h>
+#endif
+
+// ================================================================================================
+
+// A plain 5x7 font in the spirit of the old character LCDs. Each row is five bits, leftmost
+// pixel in bit 4. Lowercase descenders get squashed into the last row or two.
+struct _DefaultGlyph
+{
+    char m_char;
+    uint8_t m_rows[7];
+};
+
+static const _DefaultGlyph s_defaultFont[] = {
+    { ' ', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 } },
+    { '%', { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 } },
+    { '(', { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 } },
+    { ')', { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 } },
+    { '+', { 0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00 } },
+    { '-', { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 } },
+    { '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C } },
+    { '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+    { '0', { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E } },
+    { '1', { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+    { '2', { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F } },
+    { '3', { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E } },
+    { '4', { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 } },
+    { '5', { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E } },
+    { '6', { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E } },
+    { '7', { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+    { '8', { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E } },
+    { '9', { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C } },
+    { ':', { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 } },
+    { 'A', { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 } },
+    { 'B', { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E } },
+    { 'C', { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E } },
+    { 'D', { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C } },
+    { 'E', { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F } },
+    { 'F', { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 } },
+    { 'G', { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F } },
+    { 'H', { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 } },
+    { 'I', { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+    { 'J', { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C } },
+    { 'K', { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 } },
+    { 'L', { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F } },
+    { 'M', { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 } },
+    { 'N', { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 } },
+    { 'O', { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E } },
+    { 'P', { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 } },
+    { 'Q', { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D } },
+    { 'R', { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 } },
+    { 'S', { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E } },
+    { 'T', { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+    { 'U', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E } },
+    { 'V', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 } },
+    { 'W', { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A } },
+    { 'X', { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 } },
+    { 'Y', { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 } },
+    { 'Z', { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F } },
+    { 'a', { 0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F } },
+    { 'b', { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E } },
+    { 'c', { 0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E } },
+    { 'd', { 0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F } },
+    { 'e', { 0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E } },
+    { 'f', { 0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08 } },
+    { 'g', { 0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E } },
+    { 'h', { 0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11 } },
+    { 'i', { 0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E } },
+    { 'j', { 0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C } },
+    { 'k', { 0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12 } },
+    { 'l', { 0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E } },
+    { 'm', { 0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11 } },
+    { 'n', { 0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11 } },
+    { 'o', { 0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E } },
+    { 'p', { 0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10 } },
+    { 'q', { 0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01 } },
+    { 'r', { 0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10 } },
+    { 's', { 0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E } },
+    { 't', { 0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06 } },
+    { 'u', { 0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D } },
+    { 'v', { 0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04 } },
+    { 'w', { 0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A } },
+    { 'x', { 0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11 } },
+    { 'y', { 0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E } },
+    { 'z', { 0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F } },
+};
+
+// Each glyph sits in a 6x8 cell, which leaves a column and a row of space around it.
+constexpr int DEFAULT_CELL_WIDTH = 6;
+constexpr int DEFAULT_CELL_HEIGHT = 8;
+constexpr int DEFAULT_SUPERSAMPLE = 4;
+
+// ================================================================================================
+
+static inline uint32_t OverlayBlendOne(uint32_t dst, uint32_t color, uint32_t alpha)
+{
+    // (x + (x >> 8)) >> 8 is an exact, rounded division by 255 for everything that can show up
+    // here, and it's cheap enough to do the same way in 16-bit SIMD lanes.
+    uint32_t result = 0;
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+        uint32_t d = (dst >> shift) & 0xFF;
+        uint32_t c = (color >> shift) & 0xFF;
+        uint32_t t = (d * (255 - alpha)) + (c * alpha) + 128;
+        result |= ((t + (t >> 8)) >> 8) << shift;
+    }
+    return result;
+}
+
+// ================================================================================================
+
+void OverlayBlendScalar(uint32_t* dst, const uint8_t* alpha, size_t count, uint32_t color)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (alpha[i] == 0)
+            continue;
+        if (alpha[i] == 255)
+            dst[i] = color;
+        else
+            dst[i] = OverlayBlendOne(dst[i], color, alpha[i]);
+    }
+}
+
+#ifdef LEGACY_PIXELS_X86
+
+// ================================================================================================
+
+PIXELS_TARGET("sse2")
+void OverlayBlendSSE2(uint32_t* dst, const uint8_t* alpha, size_t count, uint32_t color)
+{
+    // Four pixels at a time, widened out to 16-bit lanes. The largest intermediate value is
+    // 255 * 255 + 128 + 254, which just barely fits.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i color16 = _mm_unpacklo_epi8(_mm_set1_epi32((int)color), zero);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // Most of any glyph is empty space.
+        uint32_t coverage;
+        memcpy(&coverage, alpha + i, sizeof(coverage));
+        if (coverage == 0)
+            continue;
+
+        // Spread each pixel's coverage across all four of its channels.
+        __m128i a = _mm_cvtsi32_si128((int)coverage);
+        a = _mm_unpacklo_epi8(a, a);
+        a = _mm_unpacklo_epi16(a, a);
+        __m128i aLo = _mm_unpacklo_epi8(a, zero);
+        __m128i aHi = _mm_unpackhi_epi8(a, zero);
+
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i dLo = _mm_unpacklo_epi8(d, zero);
+        __m128i dHi = _mm_unpackhi_epi8(d, zero);
+
+        __m128i tLo = _mm_add_epi16(_mm_mullo_epi16(dLo, _mm_sub_epi16(full, aLo)),
+                                    _mm_add_epi16(_mm_mullo_epi16(color16, aLo), half));
+        __m128i tHi = _mm_add_epi16(_mm_mullo_epi16(dHi, _mm_sub_epi16(full, aHi)),
+                                    _mm_add_epi16(_mm_mullo_epi16(color16, aHi), half));
+        tLo = _mm_srli_epi16(_mm_add_epi16(tLo, _mm_srli_epi16(tLo, 8)), 8);
+        tHi = _mm_srli_epi16(_mm_add_epi16(tHi, _mm_srli_epi16(tHi, 8)), 8);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(tLo, tHi));
+    }
+    OverlayBlendScalar(dst + i, alpha + i, count - i, color);
+}
+
+#endif
+
+// ================================================================================================
+
+FOverlayBlend OverlaySelectBlend()
+{
+#ifdef LEGACY_PIXELS_X86
+    if (PixelsDetectCPU() & e_cpuSSE2)
+        return OverlayBlendSSE2;
+#endif
+    return OverlayBlendScalar;
+}
+
+// ================================================================================================
+
+void OverlayAtlas::reset(int height)
+{
+    for (_Glyph& glyph : m_glyphs)
+        glyph = { 0, 0 };
+    m_coverage.clear();
+    m_height = std::max(height, 0);
+}
+
+// ================================================================================================
+
+void OverlayAtlas::setGlyph(char c, int width, const uint8_t* coverage, size_t pitch)
+{
+    if (c < FIRST_CHAR || c > LAST_CHAR || width <= 0)
+        return;
+
+    // Every glyph is packed tightly, so its pitch is just its width.
+    _Glyph& glyph = m_glyphs[c - FIRST_CHAR];
+    glyph.m_offset = (int)m_coverage.size();
+    glyph.m_width = width;
+    for (int y = 0; y < m_height; ++y)
+        m_coverage.insert(m_coverage.end(), coverage + (y * pitch), coverage + (y * pitch) + width);
+}
+
+// ================================================================================================
+
+void OverlayAtlas::buildDefault(int height)
+{
+    reset(height);
+    if (m_height == 0)
+        return;
+
+    // Scaling a bitmap font up this far gets blocky, so each pixel is supersampled to get some
+    // antialiasing on the diagonals.
+    int width = std::max(((DEFAULT_CELL_WIDTH * m_height) + (DEFAULT_CELL_HEIGHT / 2)) / DEFAULT_CELL_HEIGHT, 1);
+    constexpr int SAMPLES = DEFAULT_SUPERSAMPLE * DEFAULT_SUPERSAMPLE;
+    std::vector<uint8_t> coverage((size_t)width * m_height);
+    for (const _DefaultGlyph& glyph : s_defaultFont) {
+        for (int y = 0; y < m_height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int lit = 0;
+                for (int sy = 0; sy < DEFAULT_SUPERSAMPLE; ++sy) {
+                    int row = (((y * DEFAULT_SUPERSAMPLE) + sy) * DEFAULT_CELL_HEIGHT) / (m_height * DEFAULT_SUPERSAMPLE);
+                    if (row >= 7)
+                        continue;
+                    for (int sx = 0; sx < DEFAULT_SUPERSAMPLE; ++sx) {
+                        int col = (((x * DEFAULT_SUPERSAMPLE) + sx) * DEFAULT_CELL_WIDTH) / (width * DEFAULT_SUPERSAMPLE);
+                        if (col < 5 && (glyph.m_rows[row] & (0x10 >> col)))
+                            lit++;
+                    }
+                }
+                coverage[(y * width) + x] = (uint8_t)(((lit * 255) + (SAMPLES / 2)) / SAMPLES);
+            }
+        }
+        setGlyph(glyph.m_char, width, coverage.data(), width);
+    }
+}
+
+// ================================================================================================
+
+int OverlayAtlas::advance(char c) const
+{
+    if (c >= FIRST_CHAR && c <= LAST_CHAR && m_glyphs[c - FIRST_CHAR].m_width)
+        return m_glyphs[c - FIRST_CHAR].m_width;
+    return m_glyphs[0].m_width;
+}
+
+// ================================================================================================
+
+const uint8_t* OverlayAtlas::coverage(char c, int& width, size_t& pitch) const
+{
+    const _Glyph* glyph = &m_glyphs[0];
+    if (c >= FIRST_CHAR && c <= LAST_CHAR && m_glyphs[c - FIRST_CHAR].m_width)
+        glyph = &m_glyphs[c - FIRST_CHAR];
+    width = glyph->m_width;
+    pitch = (size_t)glyph->m_width;
+    return width ? m_coverage.data() + glyph->m_offset : nullptr;
+}
+
+// ================================================================================================
+
+int OverlayAtlas::measure(const char* text) const
+{
+    int width = 0;
+    for (; *text; ++text)
+        width += advance(*text);
+    return width;
+}
+
+// ================================================================================================
+
+void OverlayText::print(int row, OverlayAlign align, const char* fmt, ...)
+{
+    if (m_count == MAX_LINES)
+        return;
+
+    Line& line = m_lines[m_count++];
+    line.m_row = row;
+    line.m_align = align;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line.m_text, sizeof(line.m_text), fmt, args);
+    va_end(args);
+}
+
+// ================================================================================================
+
+OverlayCompositor::OverlayCompositor()
+    : m_blend(OverlaySelectBlend())
+{
+}
+
+// ================================================================================================
+
+void OverlayCompositor::save(_Slot& slot, const uint32_t* pixels, int width, const Rect& rect)
+{
+    slot.m_rects.push_back(rect);
+    for (int y = rect.top; y < rect.bottom; ++y) {
+        const uint32_t* row = pixels + ((size_t)y * width);
+        slot.m_saved.insert(slot.m_saved.end(), row + rect.left, row + rect.right);
+    }
+}
+
+// ================================================================================================
+
+void OverlayCompositor::forget(size_t slot)
+{
+    if (slot < m_slots.size()) {
+        m_slots[slot].m_rects.clear();
+        m_slots[slot].m_saved.clear();
+    }
+}
+
+// ================================================================================================
+
+void OverlayCompositor::restore(size_t slot, uint32_t* pixels, int width)
+{
+    if (slot >= m_slots.size())
+        return;
+
+    // Backwards, so that where two lines overlapped the pixels saved first (which were the
+    // frame's own) are the ones that stick.
+    _Slot& saved = m_slots[slot];
+    size_t end = saved.m_saved.size();
+    for (auto it = saved.m_rects.rbegin(); it != saved.m_rects.rend(); ++it) {
+        const Rect& rect = *it;
+        end -= rect.area();
+        const uint32_t* src = saved.m_saved.data() + end;
+        for (int y = rect.top; y < rect.bottom; ++y) {
+            memcpy(pixels + ((size_t)y * width) + rect.left, src, rect.width() * sizeof(uint32_t));
+            src += rect.width();
+        }
+    }
+    saved.m_rects.clear();
+    saved.m_saved.clear();
+}
+
+// ================================================================================================
+
+void OverlayCompositor::draw(size_t slot, const OverlayAtlas* atlas, const OverlayText& text,
+                             uint32_t* pixels, int width, int height, bool previousPending,
+                             DirtyRegion& damage)
+{
+    if (slot >= m_slots.size())
+        m_slots.resize(slot + 1);
+    _Slot& saved = m_slots[slot];
+
+    // The last overlay stays on the screen until this frame goes out over the top of it.
+    Rect bounds{ 0, 0, width, height };
+    for (const Rect& rect : m_onScreen) {
+        Rect clipped = rect.intersect(bounds);
+        if (!clipped.empty())
+            damage.add(clipped);
+    }
+    if (!previousPending)
+        m_onScreen.clear();
+
+    if (!atlas || atlas->empty())
+        return;
+
+    for (size_t i = 0; i < text.m_count; ++i) {
+        const OverlayText::Line& line = text.m_lines[i];
+        int lineWidth = atlas->measure(line.m_text);
+        int left = (line.m_align == e_overlayRight) ? width - lineWidth : 0;
+        int top = line.m_row * atlas->height();
+        Rect rect = Rect{ left, top, left + lineWidth, top + atlas->height() }.intersect(bounds);
+        if (rect.empty())
+            continue;
+
+        save(saved, pixels, width, rect);
+        damage.add(rect);
+        if (std::find_if(m_onScreen.begin(), m_onScreen.end(),
+                         [&rect](const Rect& r) { return r.contains(rect); }) == m_onScreen.end())
+            m_onScreen.push_back(rect);
+
+        int x = left;
+        for (const char* c = line.m_text; *c && x < rect.right; ++c) {
+            int glyphWidth;
+            size_t pitch;
+            const uint8_t* coverage = atlas->coverage(*c, glyphWidth, pitch);
+            int from = std::max(x, rect.left);
+            int to = std::min(x + glyphWidth, rect.right);
+            if (coverage && from < to) {
+                for (int y = rect.top; y < rect.bottom; ++y)
+                    m_blend(pixels + ((size_t)y * width) + from, coverage + ((y - top) * pitch) + (from - x),
+                            to - from, text.m_color);
+            }
+            x += glyphWidth;
+        }
+    }
+}
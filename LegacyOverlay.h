@@ -0,0 +1,160 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_OVERLAY_H
+#define __LEGACY_OVERLAY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "LegacyPixels.h"
+#include "LegacyRegion.h"
+
+// ================================================================================================
+
+// Blends color over count pixels of dst, using each byte of alpha as the coverage of the pixel
+// underneath it. Every kernel must produce exactly what OverlayBlendScalar does.
+typedef void(*FOverlayBlend)(uint32_t* dst, const uint8_t* alpha, size_t count, uint32_t color);
+
+void OverlayBlendScalar(uint32_t* dst, const uint8_t* alpha, size_t count, uint32_t color);
+#ifdef LEGACY_PIXELS_X86
+void OverlayBlendSSE2(uint32_t* dst, const uint8_t* alpha, size_t count, uint32_t color);
+#endif
+
+FOverlayBlend OverlaySelectBlend();
+
+// ================================================================================================
+
+// Coverage masks for the printable ASCII characters, all the same height and laid side by side
+// in one strip. These are rasterized once up front so that drawing text is nothing but blending.
+class OverlayAtlas
+{
+public:
+    static constexpr char FIRST_CHAR = ' ';
+    static constexpr char LAST_CHAR = '~';
+
+private:
+    struct _Glyph
+    {
+        int m_offset;
+        int m_width;
+    };
+
+    _Glyph m_glyphs[LAST_CHAR - FIRST_CHAR + 1];
+    std::vector<uint8_t> m_coverage;
+    int m_height{ 0 };
+    int m_pitch{ 0 };
+
+public:
+    OverlayAtlas() { reset(0); }
+
+    // Throws away all of the glyphs and starts over with cells that are height pixels tall.
+    void reset(int height);
+
+    // Copies in the coverage of one glyph. The advance is the glyph's width, so any spacing has
+    // to be part of the mask.
+    void setGlyph(char c, int width, const uint8_t* coverage, size_t pitch);
+
+    // Rasterizes our own little 5x7 font at the given height. This is always available, even
+    // where there's no system font to borrow.
+    void buildDefault(int height);
+
+    int height() const { return m_height; }
+    bool empty() const { return m_height == 0; }
+
+    // Characters that aren't in the atlas are drawn as a space.
+    int advance(char c) const;
+    const uint8_t* coverage(char c, int& width, size_t& pitch) const;
+    int measure(const char* text) const;
+};
+
+// ================================================================================================
+
+enum OverlayAlign
+{
+    e_overlayLeft,
+    e_overlayRight,
+};
+
+// What the host wants drawn over the frame. Lines are placed by row, counting down from the top
+// of the frame in multiples of the atlas height.
+struct OverlayText
+{
+    static constexpr size_t MAX_LINES = 8;
+    static constexpr size_t MAX_CHARS = 128;
+
+    struct Line
+    {
+        char m_text[MAX_CHARS];
+        int m_row;
+        OverlayAlign m_align;
+    };
+
+    uint32_t m_color{ 0 };
+    size_t m_count{ 0 };
+    Line m_lines[MAX_LINES];
+
+    void clear() { m_count = 0; }
+    bool empty() const { return m_count == 0; }
+
+    // Silently drops anything past MAX_LINES or MAX_CHARS.
+    void print(int row, OverlayAlign align, const char* fmt, ...);
+};
+
+// ================================================================================================
+
+// Draws the overlay into the output slots. Blending destroys whatever was underneath, so the
+// pixels under the text are saved off first and put back the next time the same slot comes up.
+// That way the scaler never has to know about the overlay, and the cost only depends on how
+// much text there is, not how big the window is.
+class OverlayCompositor
+{
+    struct _Slot
+    {
+        std::vector<Rect> m_rects;
+        std::vector<uint32_t> m_saved;
+    };
+
+    std::vector<_Slot> m_slots;
+    std::vector<Rect> m_onScreen;
+    FOverlayBlend m_blend;
+
+    void save(_Slot& saved, const uint32_t* pixels, int width, const Rect& rect);
+
+public:
+    OverlayCompositor();
+
+    // The slot's storage was thrown away, so there's nothing to put back.
+    void forget(size_t slot);
+
+    // Must be called before anything else draws into the slot.
+    void restore(size_t slot, uint32_t* pixels, int width);
+
+    // Draws text over the slot, which has just been brought up to date, and grows damage to
+    // cover both this overlay and whatever older ones might still be on the screen. If the
+    // previous frame is still pending, it will be dropped, so the one before it is what has to
+    // be cleaned up after. A null atlas or empty text just clears the old overlay away.
+    void draw(size_t slot, const OverlayAtlas* atlas, const OverlayText& text, uint32_t* pixels,
+              int width, int height, bool previousPending, DirtyRegion& damage);
+};
+
+#endif
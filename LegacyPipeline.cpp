@@ -0,0 +1,372 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyPipeline.h"
+#include "LegacyOverlay.h"
+#include "LegacyPixels.h"
+#include "LegacyPresent.h"
+#include "LegacyTileHash.h"
+#include "LegacyWorkers.h"
+
+#include <algorithm>
+#include <cstring>
+
+// ================================================================================================
+
+//#define LEGACY_PIPELINE_STATS
+
+#ifdef LEGACY_PIPELINE_STATS
+struct _StageStats
+{
+    const char* m_name;
+    PipelineClock::time_point m_windowStart{ };
+    PipelineClock::duration m_busy{ 0 };
+    uint32_t m_frames{ 0 };
+    uint32_t m_dropped{ 0 };
+};
+
+// ================================================================================================
+
+static PipelineClock::time_point PipelineStageBegin(_StageStats& stats)
+{
+    PipelineClock::time_point start = PipelineClock::now();
+    if (stats.m_windowStart == PipelineClock::time_point{})
+        stats.m_windowStart = start;
+    return start;
+}
+
+// ================================================================================================
+
+static bool PipelineStageEnd(std::ostream& log, _StageStats& stats,
+                             PipelineClock::time_point start, bool dropped)
+{
+    PipelineClock::time_point now = PipelineClock::now();
+    stats.m_busy += now - start;
+    stats.m_frames++;
+    if (dropped)
+        stats.m_dropped++;
+
+    // Report every five seconds or so.
+    std::chrono::duration<double> window = now - stats.m_windowStart;
+    if (window.count() >= 5.0) {
+        std::chrono::duration<double> busy = stats.m_busy;
+        log << "LegacyPipeline: " << stats.m_name << ": " << std::dec
+            << (stats.m_frames / window.count()) << " fps, "
+            << ((busy.count() * 100.0) / window.count()) << "% busy, "
+            << stats.m_dropped << " dropped" << std::endl;
+        stats.m_windowStart = now;
+        stats.m_busy = PipelineClock::duration{ 0 };
+        stats.m_frames = 0;
+        stats.m_dropped = 0;
+        return true;
+    }
+    return false;
+}
+#endif
+
+// ================================================================================================
+
+void PipelineCopyRect(void* dst, size_t dstPitch, const void* src, size_t srcPitch, size_t bpp,
+                      const Rect& rect)
+{
+    // Pitches are in bytes, just like DDSURFACEDESC::lPitch.
+    uint8_t* dstRow = (uint8_t*)dst + (rect.top * dstPitch) + (rect.left * bpp);
+    const uint8_t* srcRow = (const uint8_t*)src + (rect.top * srcPitch) + (rect.left * bpp);
+    for (int y = rect.top; y < rect.bottom; ++y, dstRow += dstPitch, srcRow += srcPitch)
+        memcpy(dstRow, srcRow, rect.width() * bpp);
+}
+
+// ================================================================================================
+
+Pipeline::Pipeline(PipelineHost& host, std::ostream& log)
+    : m_host(host), m_log(log), m_backend(nullptr), m_workers(nullptr), m_quit(false),
+      m_presentRate(0.0)
+{ }
+
+// ================================================================================================
+
+void Pipeline::start(PresentBackend& backend, WorkerPool& workers)
+{
+    m_backend = &backend;
+    m_workers = &workers;
+    m_quit = false;
+    m_log << "LegacyPipeline: presenting with the " << backend.name() << " backend on "
+          << std::dec << workers.size() << " threads" << std::endl;
+
+    m_captureThread = std::thread(&Pipeline::captureThread, this);
+    m_convertThread = std::thread(&Pipeline::convertThread, this);
+    m_presentThread = std::thread(&Pipeline::presentThread, this);
+}
+
+// ================================================================================================
+
+void Pipeline::stop()
+{
+    m_quit = true;
+
+    // Kick all of the stages so they notice we're leaving.
+    m_captureEvent.signal();
+    m_convertEvent.signal();
+    m_presentEvent.signal();
+
+    if (m_captureThread.joinable())
+        m_captureThread.join();
+    if (m_convertThread.joinable())
+        m_convertThread.join();
+    if (m_presentThread.joinable())
+        m_presentThread.join();
+}
+
+// ================================================================================================
+
+bool Pipeline::waitStage(Event& event)
+{
+    event.wait();
+    return !m_quit;
+}
+
+// ================================================================================================
+
+void Pipeline::captureThread()
+{
+    m_log << "LegacyCaptureThread: in the saddle..." << std::endl;
+
+    // The host only copies out what changed, so this has to hang on to everything else.
+    std::unique_ptr<uint16_t[]> shadow{ new uint16_t[PIPELINE_PIXELS] };
+    DirtyRegion damage{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    DirtyRegion redraw{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    TileHasher hasher{ PIPELINE_WIDTH, PIPELINE_HEIGHT, 64 };
+    BufferedDamage bufferedDamage{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    uint32_t sequence = 0;
+    FrameScheduler scheduler;
+    double appliedRate = 0.0;
+#ifdef LEGACY_PIPELINE_STATS
+    _StageStats stats{ "capture" };
+#endif
+
+    while (!m_quit) {
+        // The scheduler rounds the interval to whole clock ticks, so what it hands back from
+        // rate() never quite matches what was asked for. Compare against what we asked for.
+        double rate = m_presentRate.load(std::memory_order_relaxed);
+        if (rate != appliedRate) {
+            appliedRate = rate;
+            scheduler.setRate(rate);
+            if (rate > 0.0)
+                m_log << "LegacyCaptureThread: presenting at most " << rate << " times a second" << std::endl;
+        }
+
+        // Hold off until the next frame is due. Anything the game draws in the meantime piles
+        // up in the host and goes out together. Wakeups from new damage just cut the sleep
+        // short. There's nothing to do about them until the deadline anyway.
+        bool waited = !scheduler.due(PipelineClock::now());
+        if (waited) {
+            auto sleep = [this](PipelineClock::duration timeout) {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(timeout);
+                m_captureEvent.wait((uint32_t)std::max<std::chrono::milliseconds::rep>(ms.count(), 1));
+                return !m_quit;
+            };
+            if (!SchedulerWaitUntil(scheduler, PipelineClock::now, sleep))
+                break;
+        }
+
+        PipelineClock::time_point captureStart = PipelineClock::now();
+        bool forcePresent = false;
+        PipelineGrab grab = m_host.grab(shadow.get(), damage, forcePresent);
+        if (grab == e_grabIdle) {
+            m_captureEvent.wait();
+            continue;
+        }
+        if (grab == e_grabRetry) {
+            // Try again shortly unless something else comes along first.
+            m_captureEvent.wait(5);
+            continue;
+        }
+
+        scheduler.frameStarted(captureStart, waited);
+#ifdef LEGACY_PIPELINE_STATS
+        PipelineStageBegin(stats);
+#endif
+
+        // The game loves to redraw things that have not changed. Only tiles whose contents
+        // actually differ from the last time we saw them need to go any further. If we were
+        // asked to redraw no matter what, the hasher passes everything through.
+        if (forcePresent)
+            hasher.invalidate();
+        {
+            LEGACY_TIME_STAGE(m_stageTimes, e_stageHash);
+            hasher.filter(shadow.get(), PIPELINE_WIDTH, damage, m_workers);
+        }
+        if (damage.empty())
+            continue;
+
+        // The slot we get back may be a few frames old, so bring all of it up to date.
+        CapturedFrame& frame = m_capturedFrames.back();
+        bufferedDamage.prepare(m_capturedFrames.backIndex(), damage, redraw);
+        for (const Rect& rect : redraw)
+            PipelineCopyRect(frame.m_pixels.get(), PIPELINE_WIDTH * sizeof(uint16_t), shadow.get(),
+                             PIPELINE_WIDTH * sizeof(uint16_t), sizeof(uint16_t), rect);
+        bufferedDamage.publish(m_capturedFrames.pending(), damage, frame.m_damage);
+        frame.m_captureStart = captureStart;
+        frame.m_sequence = ++sequence;
+
+        bool dropped = m_capturedFrames.publish();
+        m_convertEvent.signal();
+#ifdef LEGACY_PIPELINE_STATS
+        if (PipelineStageEnd(m_log, stats, captureStart, dropped) && scheduler.capped()) {
+            const SchedulerStats& pacing = scheduler.stats();
+            std::chrono::duration<double, std::micro> total = pacing.m_totalJitter;
+            std::chrono::duration<double, std::micro> worst = pacing.m_maxJitter;
+            m_log << "LegacyPipeline: pacing: " << std::dec << pacing.m_pacedFrames << " of "
+                  << pacing.m_frames << " frames held back, jitter "
+                  << (pacing.m_pacedFrames ? total.count() / pacing.m_pacedFrames : 0.0)
+                  << " us mean, " << worst.count() << " us max" << std::endl;
+            scheduler.resetStats();
+        }
+#else
+        (void)dropped;
+#endif
+    }
+}
+
+// ================================================================================================
+
+void Pipeline::convertThread()
+{
+    m_log << "LegacyConvertThread: in the saddle..." << std::endl;
+
+    const PixelConverter& converter = PixelsSelectConverter();
+    m_log << "LegacyConvertThread: using " << converter.m_name << " pixel converter" << std::endl;
+
+    // The captured frame is converted to 32bpp a row at a time as the scaler asks for it, so
+    // only the parts of the output that sample the damage are ever touched.
+    Scaler scaler;
+    DirtyRegion redraw{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    DirtyRegion frameDamage{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    BufferedDamage bufferedDamage{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    OverlayCompositor overlay;
+    OverlayText overlayText;
+#ifdef LEGACY_PIPELINE_STATS
+    _StageStats stats{ "convert" };
+#endif
+
+    while (waitStage(m_convertEvent)) {
+        if (!m_capturedFrames.take())
+            continue;
+
+#ifdef LEGACY_PIPELINE_STATS
+        PipelineClock::time_point start = PipelineStageBegin(stats);
+#endif
+
+        CapturedFrame& src = m_capturedFrames.front();
+
+        // If the window size or the filter changed, every frame we have is useless.
+        PipelineView view = m_host.view();
+        if (scaler.configure(PIPELINE_WIDTH, PIPELINE_HEIGHT, view.m_width, view.m_height,
+                             view.m_filter, view.m_integerScale)) {
+            m_log << "LegacyConvertThread: scaling to " << std::dec << view.m_width << "x"
+                  << view.m_height << " (";
+            if (view.m_integerScale)
+                m_log << view.m_integerScale << "x replication";
+            else
+                m_log << ScaleFilterName(view.m_filter);
+            m_log << ")" << std::endl;
+            bufferedDamage = BufferedDamage{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+            src.m_damage.addAll();
+        }
+
+        // The backend only throws a slot away when the size changes, and that always comes
+        // along with a new scaler configuration, so the slot is already marked as stale.
+        size_t slot = m_outputFrames.backIndex();
+        OutputFrame& dst = m_outputFrames.back();
+        if (m_backend->resize(slot, view.m_width, view.m_height))
+            overlay.forget(slot);
+        dst.m_width = view.m_width;
+        dst.m_height = view.m_height;
+        uint32_t* pixels = m_backend->pixels(slot);
+
+        bufferedDamage.prepare(slot, src.m_damage, redraw);
+        {
+            LEGACY_TIME_STAGE(m_stageTimes, e_stageScale);
+
+            // Put back what the overlay covered the last time around before the damage goes
+            // over the top of it.
+            overlay.restore(slot, pixels, dst.m_width);
+            for (const Rect& rect : redraw)
+                scaler.scale(pixels, dst.m_width, src.m_pixels.get(), PIPELINE_WIDTH, converter.m_convert,
+                             scaler.mapRect(rect), *m_workers);
+        }
+        bufferedDamage.publish(m_outputFrames.pending(), src.m_damage, frameDamage);
+
+        dst.m_damage = DirtyRegion{ dst.m_width, dst.m_height };
+        for (const Rect& rect : frameDamage)
+            dst.m_damage.add(scaler.mapRect(rect));
+        {
+            LEGACY_TIME_STAGE(m_stageTimes, e_stageOverlay);
+            overlayText.clear();
+            const OverlayAtlas* atlas = m_host.overlay(overlayText);
+            overlay.draw(slot, atlas, overlayText, pixels, dst.m_width, dst.m_height,
+                         m_outputFrames.pending(), dst.m_damage);
+        }
+        dst.m_captureStart = src.m_captureStart;
+        dst.m_sequence = src.m_sequence;
+
+        bool dropped = m_outputFrames.publish();
+        m_presentEvent.signal();
+#ifdef LEGACY_PIPELINE_STATS
+        PipelineStageEnd(m_log, stats, start, dropped);
+#else
+        (void)dropped;
+#endif
+    }
+}
+
+// ================================================================================================
+
+void Pipeline::presentThread()
+{
+    m_log << "LegacyPresentThread: in the saddle..." << std::endl;
+
+#ifdef LEGACY_PIPELINE_STATS
+    _StageStats stats{ "present" };
+#endif
+
+    while (waitStage(m_presentEvent)) {
+        if (!m_outputFrames.take())
+            continue;
+
+#ifdef LEGACY_PIPELINE_STATS
+        PipelineClock::time_point start = PipelineStageBegin(stats);
+#endif
+
+        OutputFrame& frame = m_outputFrames.front();
+        m_host.beginPresent(frame);
+        {
+            LEGACY_TIME_STAGE(m_stageTimes, e_stagePresent);
+            m_backend->present(m_outputFrames.frontIndex(), frame.m_damage);
+        }
+
+        // The frame time covers everything from the capture to the frame hitting the backend.
+        m_host.endPresent(frame, PipelineClock::now() - frame.m_captureStart);
+#ifdef LEGACY_PIPELINE_STATS
+        PipelineStageEnd(m_log, stats, start, false);
+#endif
+    }
+}
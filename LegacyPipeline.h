@@ -0,0 +1,177 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_PIPELINE_H
+#define __LEGACY_PIPELINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <thread>
+
+#include "LegacyEvent.h"
+#include "LegacyRegion.h"
+#include "LegacyScaler.h"
+#include "LegacyScheduler.h"
+#include "LegacyStageTiming.h"
+#include "LegacyTripleBuffer.h"
+
+class OverlayAtlas;
+class PresentBackend;
+class WorkerPool;
+struct OverlayText;
+
+// ================================================================================================
+
+// The game always draws 640x480 at 16bpp.
+constexpr int PIPELINE_WIDTH = 640;
+constexpr int PIPELINE_HEIGHT = 480;
+constexpr size_t PIPELINE_PIXELS = PIPELINE_WIDTH * PIPELINE_HEIGHT;
+
+typedef SchedulerClock PipelineClock;
+
+enum PipelineGrab
+{
+    // Nothing to capture, so sleep until somebody calls Pipeline::wake().
+    e_grabIdle,
+
+    // There is something to capture, but it can't be had right now.
+    e_grabRetry,
+
+    // The damage was copied out.
+    e_grabFrame,
+};
+
+// Where the window currently stands. Read by the convert stage once per frame.
+struct PipelineView
+{
+    int m_width;
+    int m_height;
+    ScaleFilter m_filter;
+    int m_integerScale;
+};
+
+struct CapturedFrame
+{
+    std::unique_ptr<uint16_t[]> m_pixels{ new uint16_t[PIPELINE_PIXELS] };
+    DirtyRegion m_damage{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    PipelineClock::time_point m_captureStart{ };
+    uint32_t m_sequence{ 0 };
+};
+
+// The pixels live in the PresentBackend slot with the same index.
+struct OutputFrame
+{
+    int m_width{ 0 };
+    int m_height{ 0 };
+    DirtyRegion m_damage{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    PipelineClock::time_point m_captureStart{ };
+    uint32_t m_sequence{ 0 };
+};
+
+// ================================================================================================
+
+void PipelineCopyRect(void* dst, size_t dstPitch, const void* src, size_t srcPitch, size_t bpp,
+                      const Rect& rect);
+
+// ================================================================================================
+
+// Everything the pipeline needs from whoever is feeding it -- the DirectDraw hooks in the game,
+// or something synthetic in the benchmarks.
+class PipelineHost
+{
+public:
+    virtual ~PipelineHost() { }
+
+    // Copies everything that changed since last time into frame, which is a PIPELINE_WIDTH
+    // pitch 16bpp buffer that the capture stage keeps around, and sets damage to what was
+    // copied. Setting force sends the frame on even if none of the pixels actually changed.
+    virtual PipelineGrab grab(uint16_t* frame, DirtyRegion& damage, bool& force) = 0;
+
+    virtual PipelineView view() = 0;
+
+    // Called on the convert thread once the frame is scaled. Fill in text with anything that
+    // should be drawn over the top of the frame and return the atlas to draw it with, or
+    // nullptr if there's nothing to show.
+    virtual const OverlayAtlas* overlay(OverlayText& /*text*/) { return nullptr; }
+
+    // Called on the present thread around handing the frame to the backend. The damage may
+    // be grown before presenting to refresh anything that gets drawn over the top afterwards.
+    virtual void beginPresent(OutputFrame& /*frame*/) { }
+    virtual void endPresent(const OutputFrame& /*frame*/, PipelineClock::duration /*frameTime*/) { }
+};
+
+// ================================================================================================
+
+// The draw pipeline is split into three threads: capture copies damage out of the host, convert
+// turns it into 32bpp and scales it to the window size, and present pushes it to the backend.
+// Each hands the newest frame to the next through a triple buffer, so a slow present never
+// holds up the next capture.
+class Pipeline
+{
+    PipelineHost& m_host;
+    std::ostream& m_log;
+    PresentBackend* m_backend;
+    WorkerPool* m_workers;
+
+    std::thread m_captureThread;
+    std::thread m_convertThread;
+    std::thread m_presentThread;
+    TripleBuffer<CapturedFrame> m_capturedFrames;
+    TripleBuffer<OutputFrame> m_outputFrames;
+    Event m_captureEvent;
+    Event m_convertEvent;
+    Event m_presentEvent;
+    std::atomic<bool> m_quit;
+    std::atomic<double> m_presentRate;
+    StageTimes m_stageTimes;
+
+    bool waitStage(Event& event);
+    void captureThread();
+    void convertThread();
+    void presentThread();
+
+public:
+    Pipeline(PipelineHost& host, std::ostream& log);
+    ~Pipeline() { stop(); }
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // The backend and the pool must outlive the pipeline, or at least the next stop().
+    void start(PresentBackend& backend, WorkerPool& workers);
+    void stop();
+
+    // Lets the capture stage know that there may be something new to grab.
+    void wake() { m_captureEvent.signal(); }
+
+    // Caps how often frames are captured, and so presented. Any damage that shows up in
+    // between is held back and goes out with the next frame. Zero means no cap.
+    void setPresentRate(double hz) { m_presentRate.store(hz, std::memory_order_relaxed); }
+
+    // The host is welcome to time its own stages in here too.
+    StageTimes& stageTimes() { return m_stageTimes; }
+};
+
+#endif
@@ -0,0 +1,422 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyPixels.h"
+
+#include <chrono>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#ifdef LEGACY_PIXELS_X86
+#   include <immintrin.h>
+#   ifdef _MSC_VER
+#       include <intrin.h>
+#   else
+#       include <cpuid.h>
+#   endif
+#endif
+
+// ================================================================================================
+
+struct _ExpandTables
+{
+    alignas(16) uint8_t m_expand5[32];
+    alignas(16) uint8_t m_expand6[64];
+};
+
+static constexpr _ExpandTables MakeExpandTables()
+{
+    _ExpandTables tables{ };
+    for (uint32_t i = 0; i < 32; ++i)
+        tables.m_expand5[i] = (uint8_t)(((i * 527) + 23) >> 6);
+    for (uint32_t i = 0; i < 64; ++i)
+        tables.m_expand6[i] = (uint8_t)(((i * 259) + 33) >> 6);
+    return tables;
+}
+
+static constexpr _ExpandTables s_expandTables = MakeExpandTables();
+
+// ================================================================================================
+
+struct _SplitTables
+{
+    uint32_t m_low[256];
+    uint32_t m_high[256];
+    uint32_t m_green[64];
+};
+
+static constexpr _SplitTables MakeSplitTables()
+{
+    // Red lives entirely in the low byte and blue entirely in the high byte, but green straddles
+    // the two. The *259+33>>6 expansion can't be split across that boundary and still be exact,
+    // so each table contributes its raw green bits and a tiny third table expands the result.
+    _SplitTables tables{ };
+    for (uint32_t i = 0; i < 256; ++i) {
+        tables.m_low[i] = (PixelsConvertOne(i) & 0x0000FF) | ((i >> 5) << 8);
+        tables.m_high[i] = (PixelsConvertOne(i << 8) & 0xFF0000) | ((i & 0x07) << 11);
+    }
+    for (uint32_t i = 0; i < 64; ++i)
+        tables.m_green[i] = PixelsConvertOne(i << 5);
+    return tables;
+}
+
+static constexpr _SplitTables s_splitTables = MakeSplitTables();
+
+// ================================================================================================
+
+void PixelsConvertScalar(uint32_t* dst, const uint16_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = PixelsConvertOne(src[i]);
+}
+
+// ================================================================================================
+
+static const uint32_t* PixelsGetFullTable()
+{
+    // 256KiB is a bit much for the data segment, so only build this if someone asks for it.
+    static const std::unique_ptr<uint32_t[]> s_table = []() {
+        std::unique_ptr<uint32_t[]> table(new uint32_t[65536]);
+        for (uint32_t i = 0; i < 65536; ++i)
+            table[i] = PixelsConvertOne(i);
+        return table;
+    }();
+    return s_table.get();
+}
+
+// ================================================================================================
+
+void PixelsConvertLUT(uint32_t* dst, const uint16_t* src, size_t count)
+{
+    const uint32_t* table = PixelsGetFullTable();
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = table[src[i]];
+}
+
+// ================================================================================================
+
+void PixelsConvertSplitLUT(uint32_t* dst, const uint16_t* src, size_t count)
+{
+    // All three tables add up to about 2KiB, so they should never leave L1.
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t pixel = src[i];
+        uint32_t value = s_splitTables.m_low[pixel & 0xFF] | s_splitTables.m_high[pixel >> 8];
+        dst[i] = (value & 0xFF00FF) | s_splitTables.m_green[(value >> 8) & 0x3F];
+    }
+}
+
+#ifdef LEGACY_PIXELS_X86
+
+// ================================================================================================
+
+PIXELS_TARGET("sse2")
+void PixelsConvertSSE2(uint32_t* dst, const uint16_t* src, size_t count)
+{
+    // Same math as the scalar version, just eight pixels at a time. The largest intermediate
+    // value is 63 * 259 + 33, which comfortably fits in a 16-bit lane.
+    const __m128i mask5 = _mm_set1_epi16(0x1F);
+    const __m128i mask6 = _mm_set1_epi16(0x3F);
+    const __m128i mul5 = _mm_set1_epi16(527);
+    const __m128i add5 = _mm_set1_epi16(23);
+    const __m128i mul6 = _mm_set1_epi16(259);
+    const __m128i add6 = _mm_set1_epi16(33);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(src + i));
+
+        __m128i r = _mm_and_si128(pixels, mask5);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(pixels, 5), mask6);
+        __m128i b = _mm_srli_epi16(pixels, 11);
+        r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(r, mul5), add5), 6);
+        g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(g, mul6), add6), 6);
+        b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(b, mul5), add5), 6);
+
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(rg, b));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(rg, b));
+    }
+
+    PixelsConvertScalar(dst + i, src + i, count - i);
+}
+
+// ================================================================================================
+
+PIXELS_TARGET("ssse3")
+static inline __m128i PixelsLookup16(__m128i table, __m128i index, __m128i base)
+{
+    // pshufb only has 16 entries, so look up the slice of the table starting at base. Indices
+    // below the slice wrap around to 0xC0 or above and anything past it lands at 0x80 or above
+    // after the saturating add. Either way, bit 7 is set and pshufb gives us a zero.
+    __m128i slice = _mm_adds_epu8(_mm_sub_epi8(index, base), _mm_set1_epi8(0x70));
+    return _mm_shuffle_epi8(table, slice);
+}
+
+// ================================================================================================
+
+PIXELS_TARGET("ssse3")
+void PixelsConvertSSSE3(uint32_t* dst, const uint16_t* src, size_t count)
+{
+    // Rather than multiplying, we split sixteen pixels into their low and high bytes and expand
+    // each channel with in-register table lookups. The tables are generated from the exact same
+    // formula as the scalar code, so the results are identical.
+    const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+                                               1, 3, 5, 7, 9, 11, 13, 15);
+    const __m128i expand5lo = _mm_load_si128((const __m128i*)&s_expandTables.m_expand5[0]);
+    const __m128i expand5hi = _mm_load_si128((const __m128i*)&s_expandTables.m_expand5[16]);
+    const __m128i expand6[] = {
+        _mm_load_si128((const __m128i*)&s_expandTables.m_expand6[0]),
+        _mm_load_si128((const __m128i*)&s_expandTables.m_expand6[16]),
+        _mm_load_si128((const __m128i*)&s_expandTables.m_expand6[32]),
+        _mm_load_si128((const __m128i*)&s_expandTables.m_expand6[48]),
+    };
+    const __m128i mask5 = _mm_set1_epi8(0x1F);
+    const __m128i mask3 = _mm_set1_epi8(0x07);
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i)), deinterleave);
+        __m128i c = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + i + 8)), deinterleave);
+        __m128i lo = _mm_unpacklo_epi64(a, c);
+        __m128i hi = _mm_unpackhi_epi64(a, c);
+
+        // There are no byte shifts, so shift words and mask off whatever leaked in.
+        __m128i r5 = _mm_and_si128(lo, mask5);
+        __m128i b5 = _mm_and_si128(_mm_srli_epi16(hi, 3), mask5);
+        __m128i g6 = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(lo, 5), mask3),
+                                  _mm_slli_epi16(_mm_and_si128(hi, mask3), 3));
+
+        __m128i r = _mm_or_si128(PixelsLookup16(expand5lo, r5, zero),
+                                 PixelsLookup16(expand5hi, r5, _mm_set1_epi8(16)));
+        __m128i b = _mm_or_si128(PixelsLookup16(expand5lo, b5, zero),
+                                 PixelsLookup16(expand5hi, b5, _mm_set1_epi8(16)));
+        __m128i g = _mm_or_si128(
+            _mm_or_si128(PixelsLookup16(expand6[0], g6, zero),
+                         PixelsLookup16(expand6[1], g6, _mm_set1_epi8(16))),
+            _mm_or_si128(PixelsLookup16(expand6[2], g6, _mm_set1_epi8(32)),
+                         PixelsLookup16(expand6[3], g6, _mm_set1_epi8(48))));
+
+        __m128i rg0 = _mm_unpacklo_epi8(r, g);
+        __m128i rg1 = _mm_unpackhi_epi8(r, g);
+        __m128i b0 = _mm_unpacklo_epi8(b, zero);
+        __m128i b1 = _mm_unpackhi_epi8(b, zero);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(rg0, b0));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(rg0, b0));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), _mm_unpacklo_epi16(rg1, b1));
+        _mm_storeu_si128((__m128i*)(dst + i + 12), _mm_unpackhi_epi16(rg1, b1));
+    }
+
+    PixelsConvertScalar(dst + i, src + i, count - i);
+}
+
+// ================================================================================================
+
+PIXELS_TARGET("avx2")
+void PixelsConvertAVX2(uint32_t* dst, const uint16_t* src, size_t count)
+{
+    const __m256i mask5 = _mm256_set1_epi16(0x1F);
+    const __m256i mask6 = _mm256_set1_epi16(0x3F);
+    const __m256i mul5 = _mm256_set1_epi16(527);
+    const __m256i add5 = _mm256_set1_epi16(23);
+    const __m256i mul6 = _mm256_set1_epi16(259);
+    const __m256i add6 = _mm256_set1_epi16(33);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)(src + i));
+
+        __m256i r = _mm256_and_si256(pixels, mask5);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(pixels, 5), mask6);
+        __m256i b = _mm256_srli_epi16(pixels, 11);
+        r = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, mul5), add5), 6);
+        g = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(g, mul6), add6), 6);
+        b = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(b, mul5), add5), 6);
+
+        // The unpacks operate within each 128-bit lane, so we get pixels 0-3 and 8-11 in one
+        // register and 4-7 and 12-15 in the other. Swizzle the lanes back into order.
+        __m256i rg = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+        __m256i lo = _mm256_unpacklo_epi16(rg, b);
+        __m256i hi = _mm256_unpackhi_epi16(rg, b);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    PixelsConvertSSE2(dst + i, src + i, count - i);
+}
+
+#endif // LEGACY_PIXELS_X86
+
+// ================================================================================================
+
+void PixelsConvertRect(FConvertPixels convert, uint32_t* dst, size_t dstPitch,
+                       const uint16_t* src, size_t srcPitch, const Rect& rect)
+{
+    // Pitches are in pixels, not bytes. A rect spanning whole rows of a tightly packed buffer
+    // is one long span, which lets the vector kernels skip all the per-row tails.
+    if (rect.empty())
+        return;
+    size_t width = (size_t)rect.width();
+    if (width == dstPitch && width == srcPitch) {
+        convert(dst + rect.top * dstPitch, src + rect.top * srcPitch, width * rect.height());
+        return;
+    }
+    for (int y = rect.top; y < rect.bottom; ++y)
+        convert(dst + y * dstPitch + rect.left, src + y * srcPitch + rect.left, width);
+}
+
+// ================================================================================================
+
+#ifdef LEGACY_PIXELS_X86
+static void PixelsCPUID(int leaf, int subleaf, int regs[4])
+{
+#ifdef _MSC_VER
+    __cpuidex(regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// ================================================================================================
+
+static uint64_t PixelsXGETBV()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+#endif
+
+// ================================================================================================
+
+uint32_t PixelsDetectCPU()
+{
+    uint32_t result = 0;
+#ifdef LEGACY_PIXELS_X86
+    int regs[4];
+    PixelsCPUID(0, 0, regs);
+    int maxLeaf = regs[0];
+
+    PixelsCPUID(1, 0, regs);
+    if (regs[3] & (1<<26))
+        result |= e_cpuSSE2;
+    if (regs[2] & (1<<9))
+        result |= e_cpuSSSE3;
+
+    // AVX2 is only usable if the OS saves the YMM registers on context switches.
+    bool osxsave = (regs[2] & (1<<27)) && (regs[2] & (1<<28));
+    if (osxsave && (PixelsXGETBV() & 0x6) == 0x6 && maxLeaf >= 7) {
+        PixelsCPUID(7, 0, regs);
+        if (regs[1] & (1<<5))
+            result |= e_cpuAVX2;
+    }
+#endif
+    return result;
+}
+
+// ================================================================================================
+
+static const PixelConverter s_pixelConverters[] = {
+    { "scalar", PixelsConvertScalar, 0 },
+    { "lut", PixelsConvertLUT, 0 },
+    { "splitlut", PixelsConvertSplitLUT, 0 },
+#ifdef LEGACY_PIXELS_X86
+    { "sse2", PixelsConvertSSE2, e_cpuSSE2 },
+    { "ssse3", PixelsConvertSSSE3, e_cpuSSSE3 },
+    { "avx2", PixelsConvertAVX2, e_cpuAVX2 | e_cpuSSE2 },
+#endif
+};
+
+// ================================================================================================
+
+const PixelConverter* PixelsGetConverters(size_t& count)
+{
+    // Only hand out the converters this CPU can actually run.
+    static const std::vector<PixelConverter> s_usable = []() {
+        uint32_t cpu = PixelsDetectCPU();
+        std::vector<PixelConverter> usable;
+        for (size_t i = 0; i < std::size(s_pixelConverters); ++i) {
+            if ((s_pixelConverters[i].m_requiredCPU & cpu) == s_pixelConverters[i].m_requiredCPU)
+                usable.push_back(s_pixelConverters[i]);
+        }
+        return usable;
+    }();
+
+    count = s_usable.size();
+    return s_usable.data();
+}
+
+// ================================================================================================
+
+double PixelsMeasureConverter(const PixelConverter& converter)
+{
+    // Whether the tables beat the arithmetic depends heavily on the cache hierarchy, so the only
+    // honest answer is to try it. Use something that looks vaguely like a real frame: long runs
+    // of similar colors with some noise.
+    constexpr size_t count = 640 * 480;
+    std::unique_ptr<uint16_t[]> src(new uint16_t[count]);
+    std::unique_ptr<uint32_t[]> dst(new uint32_t[count]);
+    uint32_t seed = 0x2545F491;
+    for (size_t i = 0; i < count; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        src[i] = (uint16_t)((i / 7) ^ (seed >> 28));
+    }
+
+    // Warm up the caches (and build any tables) before timing.
+    converter.m_convert(dst.get(), src.get(), count);
+
+    double best = 1e30;
+    for (int i = 0; i < 8; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        converter.m_convert(dst.get(), src.get(), count);
+        auto end = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(end - start).count();
+        if (elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+// ================================================================================================
+
+const PixelConverter& PixelsSelectConverter()
+{
+    static const PixelConverter* s_selected = []() {
+        size_t count;
+        const PixelConverter* converters = PixelsGetConverters(count);
+        const PixelConverter* best = &converters[0];
+        double bestTime = PixelsMeasureConverter(*best);
+        for (size_t i = 1; i < count; ++i) {
+            double time = PixelsMeasureConverter(converters[i]);
+            if (time < bestTime) {
+                best = &converters[i];
+                bestTime = time;
+            }
+        }
+        return best;
+    }();
+    return *s_selected;
+}
@@ -0,0 +1,92 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_PIXELS_H
+#define __LEGACY_PIXELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "LegacyRegion.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#   define LEGACY_PIXELS_X86
+#endif
+
+// MSVC lets us use any intrinsic anywhere, but GCC and clang need to be told which functions
+// are allowed to emit the newer instructions. The dispatchers make sure we never call them on
+// a CPU that can't handle it.
+#if defined(__GNUC__) || defined(__clang__)
+#   define PIXELS_TARGET(x) __attribute__((target(x)))
+#else
+#   define PIXELS_TARGET(x)
+#endif
+
+// ================================================================================================
+
+typedef void(*FConvertPixels)(uint32_t* dst, const uint16_t* src, size_t count);
+
+struct PixelConverter
+{
+    const char* m_name;
+    FConvertPixels m_convert;
+    uint32_t m_requiredCPU;
+};
+
+enum
+{
+    e_cpuSSE2 = (1<<0),
+    e_cpuSSSE3 = (1<<1),
+    e_cpuAVX2 = (1<<2),
+};
+
+// ================================================================================================
+
+// This is the reference conversion from the proxy surface's 16bpp format to the 32bpp format
+// of our frame bitmap. Every kernel below must produce exactly this for every input pixel.
+static inline constexpr uint32_t PixelsConvertOne(uint32_t pixel)
+{
+    uint32_t r = ((((pixel) & 0x1F) * 527) + 23) >> 6;
+    uint32_t g = ((((pixel >> 5) & 0x3F) * 259) + 33) >> 6;
+    uint32_t b = ((((pixel >> 11) & 0x1F) * 527) + 23) >> 6;
+    return ((r) | (g << 8) | (b << 16));
+}
+
+// ================================================================================================
+
+void PixelsConvertScalar(uint32_t* dst, const uint16_t* src, size_t count);
+void PixelsConvertLUT(uint32_t* dst, const uint16_t* src, size_t count);
+void PixelsConvertSplitLUT(uint32_t* dst, const uint16_t* src, size_t count);
+#ifdef LEGACY_PIXELS_X86
+void PixelsConvertSSE2(uint32_t* dst, const uint16_t* src, size_t count);
+void PixelsConvertSSSE3(uint32_t* dst, const uint16_t* src, size_t count);
+void PixelsConvertAVX2(uint32_t* dst, const uint16_t* src, size_t count);
+#endif
+
+void PixelsConvertRect(FConvertPixels convert, uint32_t* dst, size_t dstPitch,
+                       const uint16_t* src, size_t srcPitch, const Rect& rect);
+
+uint32_t PixelsDetectCPU();
+const PixelConverter* PixelsGetConverters(size_t& count);
+double PixelsMeasureConverter(const PixelConverter& converter);
+const PixelConverter& PixelsSelectConverter();
+
+#endif
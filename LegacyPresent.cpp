@@ -0,0 +1,74 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyPresent.h"
+
+#include <cstring>
+
+// ================================================================================================
+
+MemoryBackend::MemoryBackend()
+    : m_frames(0), m_pixelsPresented(0)
+{ }
+
+// ================================================================================================
+
+bool MemoryBackend::resize(size_t slot, int width, int height)
+{
+    _Slot& s = m_slots[slot];
+    if (s.m_width == width && s.m_height == height)
+        return false;
+    s.m_pixels.resize((size_t)width * height);
+    s.m_width = width;
+    s.m_height = height;
+    return true;
+}
+
+// ================================================================================================
+
+void MemoryBackend::present(size_t slot, const DirtyRegion& damage)
+{
+    // The screen takes on the size of whatever is presented, just like the window would have
+    // by the time a frame that size showed up.
+    const _Slot& src = m_slots[slot];
+    if (m_screen.m_width != src.m_width || m_screen.m_height != src.m_height) {
+        m_screen.m_pixels.assign((size_t)src.m_width * src.m_height, 0);
+        m_screen.m_width = src.m_width;
+        m_screen.m_height = src.m_height;
+    }
+
+    uint64_t npixels = 0;
+    Rect bounds{ 0, 0, src.m_width, src.m_height };
+    for (const Rect& damaged : damage) {
+        Rect rect = damaged.intersect(bounds);
+        if (rect.empty())
+            continue;
+        for (int y = rect.top; y < rect.bottom; ++y) {
+            size_t offset = ((size_t)y * src.m_width) + rect.left;
+            memcpy(m_screen.m_pixels.data() + offset, src.m_pixels.data() + offset,
+                   rect.width() * sizeof(uint32_t));
+        }
+        npixels += rect.area();
+    }
+
+    m_pixelsPresented.fetch_add(npixels, std::memory_order_relaxed);
+    m_frames.fetch_add(1, std::memory_order_release);
+}
@@ -0,0 +1,94 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_PRESENT_H
+#define __LEGACY_PRESENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "LegacyRegion.h"
+
+// ================================================================================================
+
+// One for every slot of the TripleBuffer between the convert and present stages.
+constexpr size_t PRESENT_SLOTS = 3;
+
+// Where finished frames go. The backend owns the memory that the convert stage scales into, so
+// that a backend which can hand its pixels straight to the window never has to copy them. The
+// convert stage only ever touches the slot it is producing and the present stage only ever
+// touches the slot it is consuming, so a backend has nothing to lock as long as it keeps the
+// slots separate.
+class PresentBackend
+{
+public:
+    virtual ~PresentBackend() { }
+
+    virtual const char* name() const = 0;
+
+    // Makes the slot the given size. Returns true if the old contents were thrown away.
+    virtual bool resize(size_t slot, int width, int height) = 0;
+
+    // Top-down 32bpp pixels, exactly as wide as the slot.
+    virtual uint32_t* pixels(size_t slot) = 0;
+
+    // Pushes the damaged parts of the slot to the screen.
+    virtual void present(size_t slot, const DirtyRegion& damage) = 0;
+};
+
+// ================================================================================================
+
+// Presents into a plain buffer standing in for the window. This lets the whole pipeline run
+// somewhere that has no window system, like the benchmarks.
+class MemoryBackend : public PresentBackend
+{
+    struct _Slot
+    {
+        std::vector<uint32_t> m_pixels;
+        int m_width{ 0 };
+        int m_height{ 0 };
+    };
+
+    _Slot m_slots[PRESENT_SLOTS];
+    _Slot m_screen;
+    std::atomic<uint64_t> m_frames;
+    std::atomic<uint64_t> m_pixelsPresented;
+
+public:
+    MemoryBackend();
+
+    const char* name() const override { return "memory"; }
+    bool resize(size_t slot, int width, int height) override;
+    uint32_t* pixels(size_t slot) override { return m_slots[slot].m_pixels.data(); }
+    void present(size_t slot, const DirtyRegion& damage) override;
+
+    // Only safe to look at while the pipeline is idle.
+    const uint32_t* screen() const { return m_screen.m_pixels.data(); }
+    int screenWidth() const { return m_screen.m_width; }
+    int screenHeight() const { return m_screen.m_height; }
+
+    uint64_t framesPresented() const { return m_frames.load(std::memory_order_acquire); }
+    uint64_t pixelsPresented() const { return m_pixelsPresented.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -0,0 +1,107 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyPresentGDI.h"
+
+#include "DLL.h"
+#include "LegacyLog.h"
+
+// ================================================================================================
+
+extern AsyncLog s_log;
+
+// ================================================================================================
+
+DIBSectionBackend::DIBSectionBackend()
+    : m_memDC(CreateCompatibleDC(nullptr))
+{ }
+
+// ================================================================================================
+
+DIBSectionBackend::~DIBSectionBackend()
+{
+    for (_Slot& slot : m_slots) {
+        if (slot.m_bitmap)
+            DeleteObject(slot.m_bitmap);
+    }
+    DeleteDC(m_memDC);
+}
+
+// ================================================================================================
+
+bool DIBSectionBackend::resize(size_t idx, int width, int height)
+{
+    _Slot& slot = m_slots[idx];
+    if (slot.m_width == width && slot.m_height == height)
+        return false;
+
+    // present() never leaves a bitmap selected into the memory DC, so this is free to go.
+    if (slot.m_bitmap)
+        DeleteObject(slot.m_bitmap);
+
+    BITMAPINFO info{ 0 };
+    info.bmiHeader.biSize = sizeof(info.bmiHeader);
+    info.bmiHeader.biWidth = width;
+    info.bmiHeader.biHeight = -height; // indicates top-down
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+
+    void* bits = nullptr;
+    slot.m_bitmap = CreateDIBSection(nullptr, &info, DIB_RGB_COLORS, &bits, nullptr, 0);
+    if (!slot.m_bitmap) {
+        // Hand out something to scale into anyway so that nobody has to check for this.
+        s_log << "DIBSectionBackend: ERROR: CreateDIBSection failed for " << std::dec << width
+              << "x" << height << std::endl;
+        slot.m_fallback.resize((size_t)width * height);
+        bits = slot.m_fallback.data();
+    } else {
+        slot.m_fallback = std::vector<uint32_t>();
+    }
+    slot.m_pixels = (uint32_t*)bits;
+    slot.m_width = width;
+    slot.m_height = height;
+    return true;
+}
+
+// ================================================================================================
+
+void DIBSectionBackend::present(size_t idx, const DirtyRegion& damage)
+{
+    _Slot& slot = m_slots[idx];
+    if (!slot.m_bitmap)
+        return;
+
+    HWND wnd = Win32GetClientHWND();
+    HDC wndDC = GetDC(wnd);
+    HGDIOBJ prevBitmap = SelectObject(m_memDC, slot.m_bitmap);
+    for (const Rect& rect : damage) {
+        if (!BitBlt(wndDC, rect.left, rect.top, rect.width(), rect.height(), m_memDC,
+                    rect.left, rect.top, SRCCOPY))
+            LEGACY_LOG(s_log, "DIBSectionBackend: ERROR: BitBlt failed!");
+    }
+    SelectObject(m_memDC, prevBitmap);
+    ReleaseDC(wnd, wndDC);
+
+    // GDI may batch up the blits, and the convert stage is about to start scribbling on this
+    // slot again as soon as we give it back.
+    GdiFlush();
+}
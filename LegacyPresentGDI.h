@@ -0,0 +1,58 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_PRESENTGDI_H
+#define __LEGACY_PRESENTGDI_H
+
+#include <vector>
+
+#include "LegacyWindow.h"
+#include "LegacyPresent.h"
+
+// ================================================================================================
+
+// Each slot is a DIB section, so the convert stage scales straight into memory that GDI can
+// blit from. No SetDIBits, no StretchBlt, no extra copy of the frame.
+class DIBSectionBackend : public PresentBackend
+{
+    struct _Slot
+    {
+        HBITMAP m_bitmap{ 0 };
+        uint32_t* m_pixels{ nullptr };
+        int m_width{ 0 };
+        int m_height{ 0 };
+        std::vector<uint32_t> m_fallback;
+    };
+
+    _Slot m_slots[PRESENT_SLOTS];
+    HDC m_memDC;
+
+public:
+    DIBSectionBackend();
+    ~DIBSectionBackend();
+
+    const char* name() const override { return "DIB section"; }
+    bool resize(size_t slot, int width, int height) override;
+    uint32_t* pixels(size_t slot) override { return m_slots[slot].m_pixels; }
+    void present(size_t slot, const DirtyRegion& damage) override;
+};
+
+#endif
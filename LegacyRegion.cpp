@@ -0,0 +1,165 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyRegion.h"
+
+// ================================================================================================
+
+// Merging two rects is worth it when the union doesn't cover much that neither rect did. Each
+// extra rect costs a row loop setup per scanline plus a StretchBlt call, so a small amount of
+// waste is cheaper than keeping them separate.
+static bool RegionShouldMerge(const Rect& a, const Rect& b)
+{
+    uint32_t covered = a.area() + b.area() - a.intersect(b).area();
+    uint32_t waste = a.unite(b).area() - covered;
+    return waste <= (covered / 4) + 256;
+}
+
+// ================================================================================================
+
+DirtyRegion::DirtyRegion(int width, int height)
+    : m_bounds{ 0, 0, width, height }, m_rects(), m_count()
+{
+}
+
+// ================================================================================================
+
+void DirtyRegion::remove(size_t idx)
+{
+    m_rects[idx] = m_rects[--m_count];
+}
+
+// ================================================================================================
+
+void DirtyRegion::insert(Rect rect)
+{
+    // Keep folding the new rect into its neighbors until nothing else wants to merge. A merge
+    // grows the rect, which may make it swallow something we already looked at, hence the
+    // restart.
+    for (size_t i = 0; i < m_count;) {
+        if (m_rects[i].contains(rect))
+            return;
+        if (rect.contains(m_rects[i]) || RegionShouldMerge(rect, m_rects[i])) {
+            rect = rect.unite(m_rects[i]);
+            remove(i);
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (m_count == MAX_RECTS) {
+        // Out of room. Grow whichever rect absorbs the new one with the least added area.
+        size_t best = 0;
+        uint32_t bestGrowth = UINT32_MAX;
+        for (size_t i = 0; i < m_count; ++i) {
+            uint32_t growth = m_rects[i].unite(rect).area() - m_rects[i].area();
+            if (growth < bestGrowth) {
+                best = i;
+                bestGrowth = growth;
+            }
+        }
+        rect = rect.unite(m_rects[best]);
+        remove(best);
+        insert(rect);
+        return;
+    }
+
+    m_rects[m_count++] = rect;
+}
+
+// ================================================================================================
+
+void DirtyRegion::add(const Rect& rect)
+{
+    Rect clipped = rect.intersect(m_bounds);
+    if (!clipped.empty())
+        insert(clipped);
+}
+
+// ================================================================================================
+
+void DirtyRegion::add(const DirtyRegion& region)
+{
+    for (const Rect& rect : region)
+        add(rect);
+}
+
+// ================================================================================================
+
+uint32_t DirtyRegion::area() const
+{
+    // This is an upper bound -- overlapping rects that were not worth merging count twice.
+    uint32_t result = 0;
+    for (size_t i = 0; i < m_count; ++i)
+        result += m_rects[i].area();
+    return result;
+}
+
+// ================================================================================================
+
+Rect DirtyRegion::bounds() const
+{
+    if (m_count == 0)
+        return { 0, 0, 0, 0 };
+    Rect result = m_rects[0];
+    for (size_t i = 1; i < m_count; ++i)
+        result = result.unite(m_rects[i]);
+    return result;
+}
+
+// ================================================================================================
+
+BufferedDamage::BufferedDamage(int width, int height)
+    : m_stale{ { width, height }, { width, height }, { width, height } },
+      m_published(width, height)
+{
+    // Nothing has ever been drawn into any of the slots.
+    for (DirtyRegion& stale : m_stale)
+        stale.addAll();
+}
+
+// ================================================================================================
+
+void BufferedDamage::prepare(size_t slot, const DirtyRegion& damage, DirtyRegion& redraw)
+{
+    redraw = m_stale[slot];
+    redraw.add(damage);
+    for (size_t i = 0; i < 3; ++i) {
+        if (i == slot)
+            m_stale[i].clear();
+        else
+            m_stale[i].add(damage);
+    }
+}
+
+// ================================================================================================
+
+void BufferedDamage::publish(bool previousPending, const DirtyRegion& damage,
+                             DirtyRegion& frameDamage)
+{
+    // If the consumer grabs the previous frame between now and the actual publish, we end up
+    // reporting a little too much damage. That's harmless, reporting too little is not.
+    frameDamage = damage;
+    if (previousPending)
+        frameDamage.add(m_published);
+    m_published = frameDamage;
+}
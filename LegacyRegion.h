@@ -0,0 +1,125 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_REGION_H
+#define __LEGACY_REGION_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// ================================================================================================
+
+// Laid out just like a Win32 RECT so the hooks can copy straight across, but this needs to
+// build in places where Windows.h does not exist.
+struct Rect
+{
+    int left;
+    int top;
+    int right;
+    int bottom;
+
+    int width() const { return right - left; }
+    int height() const { return bottom - top; }
+    bool empty() const { return left >= right || top >= bottom; }
+    uint32_t area() const { return empty() ? 0 : (uint32_t)width() * (uint32_t)height(); }
+
+    bool contains(const Rect& r) const
+    {
+        return r.left >= left && r.top >= top && r.right <= right && r.bottom <= bottom;
+    }
+
+    Rect unite(const Rect& r) const
+    {
+        return { std::min(left, r.left), std::min(top, r.top),
+                 std::max(right, r.right), std::max(bottom, r.bottom) };
+    }
+
+    Rect intersect(const Rect& r) const
+    {
+        return { std::max(left, r.left), std::max(top, r.top),
+                 std::min(right, r.right), std::min(bottom, r.bottom) };
+    }
+};
+
+// ================================================================================================
+
+// Tracks the parts of the proxy surface that the game has touched since the draw thread last
+// looked. This is a fixed-size list of rectangles -- adding a rect merges it with anything it
+// would cheaply combine with, and if we run out of room, the least wasteful pair is merged.
+// The result always covers everything that was added, but may cover a little more.
+class DirtyRegion
+{
+public:
+    static constexpr size_t MAX_RECTS = 16;
+
+private:
+    Rect m_bounds;
+    Rect m_rects[MAX_RECTS];
+    size_t m_count;
+
+    void remove(size_t idx);
+    void insert(Rect rect);
+
+public:
+    DirtyRegion(int width, int height);
+
+    void add(const Rect& rect);
+    void add(const DirtyRegion& region);
+    void addAll() { clear(); m_rects[0] = m_bounds; m_count = 1; }
+    void clear() { m_count = 0; }
+
+    bool empty() const { return m_count == 0; }
+    bool full() const { return m_count == 1 && m_rects[0].contains(m_bounds); }
+    size_t size() const { return m_count; }
+    uint32_t area() const;
+    Rect bounds() const;
+    const Rect& extent() const { return m_bounds; }
+
+    const Rect* begin() const { return m_rects; }
+    const Rect* end() const { return m_rects + m_count; }
+    const Rect& operator[](size_t idx) const { return m_rects[idx]; }
+};
+
+// ================================================================================================
+
+// Bookkeeping for a pipeline stage that renders into the slots of a TripleBuffer. A slot that
+// comes back to the producer can be a couple of frames behind, and the consumer may have
+// skipped frames, so this keeps track of both what each slot is missing and what the consumer
+// has not yet seen.
+class BufferedDamage
+{
+    DirtyRegion m_stale[3];
+    DirtyRegion m_published;
+
+public:
+    BufferedDamage(int width, int height);
+
+    // Computes everything that must be redrawn into the slot to bring it up to date with
+    // the latest damage, and marks it as current.
+    void prepare(size_t slot, const DirtyRegion& damage, DirtyRegion& redraw);
+
+    // Computes the damage to hand to the consumer along with the frame. If the previous frame
+    // is still pending, it will be dropped, so its damage must be carried forward.
+    void publish(bool previousPending, const DirtyRegion& damage, DirtyRegion& frameDamage);
+};
+
+#endif
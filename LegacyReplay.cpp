@@ -0,0 +1,237 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <ostream>
+
+#include "LegacyOverlay.h"
+#include "LegacyPipeline.h"
+#include "LegacyPresent.h"
+#include "LegacyStageTiming.h"
+#include "LegacySurfaceHost.h"
+#include "LegacyTrace.h"
+#include "LegacyWorkers.h"
+#include "LegacyWorkload.h"
+
+// ================================================================================================
+
+struct _ReplayOptions
+{
+    const char* m_path{ nullptr };
+    const char* m_scenario{ nullptr };
+    double m_seconds{ 10.0 };
+    PipelineView m_view{ 1920, 1440, e_scaleBilinear, 0 };
+    double m_presentRate{ 60.0 };
+    double m_speed{ 1.0 };
+    int m_workers{ -1 };
+    int m_loops{ 1 };
+    bool m_overlay{ false };
+    bool m_verbose{ false };
+};
+
+// ================================================================================================
+
+static void ReplayUsage()
+{
+    printf("usage: legacy_replay <trace> [options]\n"
+           "       legacy_replay --scenario NAME [options]\n"
+           "  --scenario NAME play a synthetic workload instead of a trace: idle, cursor, sprites,\n"
+           "                  background or video\n"
+           "  --seconds N     how long to play the scenario for (default 10)\n"
+           "  --size WxH      window size to scale to (default 1920x1440)\n"
+           "  --filter NAME   nearest, bilinear or sharp (default bilinear)\n"
+           "  --integer N     replicate every pixel N times instead of filtering\n"
+           "  --hz RATE       present at most RATE times a second, 0 for no cap (default 60)\n"
+           "  --speed X       play the trace X times as fast, 0 for no waiting at all (default 1)\n"
+           "  --workers N     helper threads in the worker pool (default one per CPU)\n"
+           "  --loops N       play the trace or scenario N times over (default 1)\n"
+           "  --overlay       draw the FPS and frame time overlay\n"
+           "  --verbose       show the pipeline's own log\n");
+}
+
+// ================================================================================================
+
+static bool ReplayParseOptions(int argc, char** argv, _ReplayOptions& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (strcmp(arg, "--overlay") == 0) {
+            options.m_overlay = true;
+        } else if (strcmp(arg, "--verbose") == 0) {
+            options.m_verbose = true;
+        } else if (strncmp(arg, "--", 2) == 0 && !value) {
+            printf("legacy_replay: %s needs a value\n", arg);
+            return false;
+        } else if (strcmp(arg, "--size") == 0) {
+            if (sscanf(value, "%dx%d", &options.m_view.m_width, &options.m_view.m_height) != 2 ||
+                options.m_view.m_width <= 0 || options.m_view.m_height <= 0) {
+                printf("legacy_replay: bad size \"%s\"\n", value);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--filter") == 0) {
+            if (strcmp(value, "nearest") == 0) {
+                options.m_view.m_filter = e_scaleNearest;
+            } else if (strcmp(value, "bilinear") == 0) {
+                options.m_view.m_filter = e_scaleBilinear;
+            } else if (strcmp(value, "sharp") == 0) {
+                options.m_view.m_filter = e_scaleSharpBilinear;
+            } else {
+                printf("legacy_replay: unknown filter \"%s\"\n", value);
+                return false;
+            }
+            i++;
+        } else if (strcmp(arg, "--integer") == 0) {
+            options.m_view.m_integerScale = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--hz") == 0) {
+            options.m_presentRate = atof(value);
+            i++;
+        } else if (strcmp(arg, "--speed") == 0) {
+            options.m_speed = atof(value);
+            i++;
+        } else if (strcmp(arg, "--workers") == 0) {
+            options.m_workers = atoi(value);
+            i++;
+        } else if (strcmp(arg, "--scenario") == 0) {
+            WorkloadScenario scenario;
+            if (!WorkloadFromName(value, scenario)) {
+                printf("legacy_replay: unknown scenario \"%s\"\n", value);
+                return false;
+            }
+            options.m_scenario = value;
+            i++;
+        } else if (strcmp(arg, "--seconds") == 0) {
+            options.m_seconds = atof(value);
+            i++;
+        } else if (strcmp(arg, "--loops") == 0) {
+            options.m_loops = std::max(atoi(value), 1);
+            i++;
+        } else if (strncmp(arg, "--", 2) == 0 || options.m_path || options.m_scenario) {
+            printf("legacy_replay: unexpected \"%s\"\n", arg);
+            return false;
+        } else {
+            options.m_path = arg;
+        }
+    }
+    if (options.m_path && options.m_scenario) {
+        printf("legacy_replay: a trace and a scenario can't be played at the same time\n");
+        return false;
+    }
+    return options.m_path != nullptr || options.m_scenario != nullptr;
+}
+
+// ================================================================================================
+
+int main(int argc, char** argv)
+{
+    _ReplayOptions options;
+    if (!ReplayParseOptions(argc, argv, options)) {
+        ReplayUsage();
+        return 2;
+    }
+
+    std::ostream nullLog{ nullptr };
+    std::ostream& log = options.m_verbose ? std::cerr : nullLog;
+    TraceReader reader{ std::cerr };
+    if (options.m_path && !reader.open(options.m_path))
+        return 1;
+    if (options.m_path && (reader.width() != PIPELINE_WIDTH || reader.height() != PIPELINE_HEIGHT)) {
+        printf("legacy_replay: %s is %dx%d, but the pipeline only does %dx%d\n", options.m_path,
+               reader.width(), reader.height(), PIPELINE_WIDTH, PIPELINE_HEIGHT);
+        return 1;
+    }
+
+    OverlayAtlas atlas;
+    if (options.m_overlay)
+        atlas.buildDefault(std::max(options.m_view.m_height / 40, 8));
+
+    SurfaceHost host{ options.m_view };
+    host.setOverlay(options.m_overlay ? &atlas : nullptr);
+    WorkerPool workers{ options.m_workers };
+    MemoryBackend backend;
+    Pipeline pipeline{ host, log };
+    host.attach(&pipeline);
+    pipeline.setPresentRate(options.m_presentRate);
+    pipeline.start(backend, workers);
+
+    uint32_t counts[e_traceBltFast + 1] = { 0 };
+    WorkloadScenario scenario = e_workloadIdle;
+    if (options.m_scenario)
+        WorkloadFromName(options.m_scenario, scenario);
+    WorkloadGenerator workload{ host, scenario };
+    std::clock_t cpuStart = std::clock();
+    auto wallStart = std::chrono::steady_clock::now();
+    for (int loop = 0; loop < options.m_loops; ++loop) {
+        if (options.m_scenario) {
+            workload.run(std::chrono::duration<double>(options.m_seconds));
+        } else {
+            reader.rewind();
+            SurfaceHostReplay(reader, host, options.m_speed, counts);
+        }
+    }
+    host.waitIdle(100);
+    pipeline.stop();
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wallStart;
+    double cpu = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    // Everything below is over the whole run, so the quiet period at the end is included.
+    const char* filter = options.m_view.m_integerScale ? "integer" : ScaleFilterName(options.m_view.m_filter);
+    if (options.m_scenario) {
+        printf("replay: %s scenario, %d loop(s) of %.1f s, %dx%d %s, %.0f Hz cap, %zu threads\n",
+               options.m_scenario, options.m_loops, options.m_seconds, options.m_view.m_width,
+               options.m_view.m_height, filter, options.m_presentRate, workers.size());
+        printf("replay: %llu surface calls, %.1f Mpx written\n", (unsigned long long)workload.calls(),
+               workload.pixels() / 1e6);
+    } else {
+        printf("replay: %s, %d loop(s) at %.2fx speed, %dx%d %s, %.0f Hz cap, %zu threads\n",
+               options.m_path, options.m_loops, options.m_speed, options.m_view.m_width,
+               options.m_view.m_height, filter, options.m_presentRate, workers.size());
+        printf("replay: %u snapshot, %u lock, %u unlock, %u getdc, %u releasedc, %u bltfast\n",
+               counts[e_traceSnapshot], counts[e_traceLock], counts[e_traceUnlock], counts[e_traceGetDC],
+               counts[e_traceReleaseDC], counts[e_traceBltFast]);
+    }
+
+    FrameSummary frames = host.frameStats().lifetime();
+    printf("replay: %u frames presented in %.2f s, %.1f fps, %.1f Mpx presented\n", frames.m_frames,
+           wall.count(), frames.m_frames / wall.count(), backend.pixelsPresented() / 1e6);
+    printf("replay: latency mean %.2f ms, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n",
+           frames.m_mean / 1000.0, frames.m_p50 / 1000.0, frames.m_p90 / 1000.0, frames.m_p99 / 1000.0,
+           frames.m_p999 / 1000.0, frames.m_max / 1000.0);
+
+    printf("replay: %-8s %8s %10s %10s %10s %7s\n", "stage", "samples", "mean us", "max us", "total ms", "wall");
+    for (int i = 0; i < e_stageCount; ++i) {
+        StageSummary summary = pipeline.stageTimes().summary((PipelineStage)i);
+        double total = summary.m_meanUs * summary.m_samples / 1000.0;
+        printf("replay: %-8s %8llu %10.1f %10.1f %10.1f %6.2f%%\n", StageName((PipelineStage)i),
+               (unsigned long long)summary.m_samples, summary.m_meanUs, summary.m_maxUs, total,
+               100.0 * total / (wall.count() * 1000.0));
+    }
+    printf("replay: process CPU time %.2f s, %.1f%% of one core\n", cpu, 100.0 * cpu / wall.count());
+    return 0;
+}
@@ -0,0 +1,597 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyScaler.h"
+#include "LegacyWorkers.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef LEGACY_PIXELS_X86
+#   include <immintrin.h>
+#endif
+
+// ================================================================================================
+
+// Blends two pixels, two channels at a time. Each channel gets sixteen bits of room, and
+// 255 * 256 never carries into the neighbor, so this is exact.
+static inline uint32_t ScaleBlendOne(uint32_t a, uint32_t b, uint32_t weight)
+{
+    uint32_t inverse = 256 - weight;
+    uint32_t rb = ((((a & 0xFF00FF) * inverse) + ((b & 0xFF00FF) * weight)) >> 8) & 0xFF00FF;
+    uint32_t ag = ((((a >> 8) & 0xFF00FF) * inverse) + (((b >> 8) & 0xFF00FF) * weight)) & 0xFF00FF00;
+    return rb | ag;
+}
+
+// ================================================================================================
+
+void ScaleBlendRowsScalar(uint32_t* dst, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                          size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        dst[i] = ScaleBlendOne(a[i], b[i], weight);
+}
+
+#ifdef LEGACY_PIXELS_X86
+
+// ================================================================================================
+
+PIXELS_TARGET("sse2")
+void ScaleBlendRowsSSE2(uint32_t* dst, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                        size_t count)
+{
+    // Same math as the scalar version, but with every channel widened to 16 bits. The products
+    // top out at 65280, so the low half of the multiply is all we need.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w = _mm_set1_epi16((short)weight);
+    const __m128i iw = _mm_set1_epi16((short)(256 - weight));
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i pa = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i pb = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pa, zero), iw),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(pb, zero), w));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pa, zero), iw),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(pb, zero), w));
+        __m128i result = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+        _mm_storeu_si128((__m128i*)(dst + i), result);
+    }
+    for (; i < count; ++i)
+        dst[i] = ScaleBlendOne(a[i], b[i], weight);
+}
+
+// ================================================================================================
+
+PIXELS_TARGET("avx2")
+void ScaleBlendRowsAVX2(uint32_t* dst, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                        size_t count)
+{
+    // The unpacks and the pack both work within 128-bit lanes, so they undo each other
+    // and the pixels come back out in order.
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i w = _mm256_set1_epi16((short)weight);
+    const __m256i iw = _mm256_set1_epi16((short)(256 - weight));
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i pa = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i pb = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(pa, zero), iw),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(pb, zero), w));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(pa, zero), iw),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(pb, zero), w));
+        __m256i result = _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8));
+        _mm256_storeu_si256((__m256i*)(dst + i), result);
+    }
+    for (; i < count; ++i)
+        dst[i] = ScaleBlendOne(a[i], b[i], weight);
+}
+
+#endif // LEGACY_PIXELS_X86
+
+// ================================================================================================
+
+void ScaleReplicateRowScalar(uint32_t* dst, const uint32_t* src, size_t count, int factor)
+{
+    if (factor == 1) {
+        memcpy(dst, src, count * sizeof(uint32_t));
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        for (int j = 0; j < factor; ++j)
+            *dst++ = src[i];
+    }
+}
+
+// ================================================================================================
+
+void ScaleStreamRowScalar(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    memcpy(dst, src, count * sizeof(uint32_t));
+}
+
+#ifdef LEGACY_PIXELS_X86
+
+// ================================================================================================
+
+PIXELS_TARGET("sse2")
+void ScaleReplicateRowSSE2(uint32_t* dst, const uint32_t* src, size_t count, int factor)
+{
+    // Four source pixels at a time, shuffled out into factor registers' worth of output.
+    size_t i = 0;
+    switch (factor) {
+    case 2:
+        for (; i + 4 <= count; i += 4, dst += 8) {
+            __m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + 0), _mm_unpacklo_epi32(p, p));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_unpackhi_epi32(p, p));
+        }
+        break;
+    case 3:
+        for (; i + 4 <= count; i += 4, dst += 12) {
+            __m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + 0), _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 0, 0, 0)));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 1, 1)));
+            _mm_storeu_si128((__m128i*)(dst + 8), _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 2)));
+        }
+        break;
+    case 4:
+        for (; i + 4 <= count; i += 4, dst += 16) {
+            __m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + 0), _mm_shuffle_epi32(p, _MM_SHUFFLE(0, 0, 0, 0)));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 1, 1, 1)));
+            _mm_storeu_si128((__m128i*)(dst + 8), _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 2, 2)));
+            _mm_storeu_si128((__m128i*)(dst + 12), _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+        break;
+    case 5:
+        for (; i + 4 <= count; i += 4, dst += 20) {
+            __m128i p = _mm_loadu_si128((const __m128i*)(src + i));
+            _mm_storeu_si128((__m128i*)(dst + 0), _mm_shuffle_epi32(p, _MM_SHUFFLE(0, 0, 0, 0)));
+            _mm_storeu_si128((__m128i*)(dst + 4), _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 1, 1, 0)));
+            _mm_storeu_si128((__m128i*)(dst + 8), _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 1, 1)));
+            _mm_storeu_si128((__m128i*)(dst + 12), _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 2, 2, 2)));
+            _mm_storeu_si128((__m128i*)(dst + 16), _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+        break;
+    }
+    ScaleReplicateRowScalar(dst, src + i, count - i, factor);
+}
+
+// ================================================================================================
+
+PIXELS_TARGET("sse2")
+void ScaleStreamRowSSE2(uint32_t* dst, const uint32_t* src, size_t count)
+{
+    // Non-temporal stores have to be aligned, so trickle in until they are.
+    size_t i = 0;
+    for (; i < count && ((uintptr_t)(dst + i) & 0xF); ++i)
+        dst[i] = src[i];
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i + 0));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+        __m128i c = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + i + 12));
+        _mm_stream_si128((__m128i*)(dst + i + 0), a);
+        _mm_stream_si128((__m128i*)(dst + i + 4), b);
+        _mm_stream_si128((__m128i*)(dst + i + 8), c);
+        _mm_stream_si128((__m128i*)(dst + i + 12), d);
+    }
+    for (; i + 4 <= count; i += 4)
+        _mm_stream_si128((__m128i*)(dst + i), _mm_loadu_si128((const __m128i*)(src + i)));
+    for (; i < count; ++i)
+        dst[i] = src[i];
+
+    // Make sure the other threads see these before they see anything we do later.
+    _mm_sfence();
+}
+
+#endif // LEGACY_PIXELS_X86
+
+// ================================================================================================
+
+FReplicateRow ScaleSelectReplicate()
+{
+#ifdef LEGACY_PIXELS_X86
+    if (PixelsDetectCPU() & e_cpuSSE2)
+        return ScaleReplicateRowSSE2;
+#endif
+    return ScaleReplicateRowScalar;
+}
+
+// ================================================================================================
+
+FStreamRow ScaleSelectStream()
+{
+#ifdef LEGACY_PIXELS_X86
+    if (PixelsDetectCPU() & e_cpuSSE2)
+        return ScaleStreamRowSSE2;
+#endif
+    return ScaleStreamRowScalar;
+}
+
+// ================================================================================================
+
+int ScaleIntegerFactor(int srcWidth, int srcHeight, int dstWidth, int dstHeight)
+{
+    int factor = std::min(dstWidth / srcWidth, dstHeight / srcHeight);
+    if (factor < 1 || factor > 5)
+        return 0;
+
+    // A thin border is fine (1280x980 is 2x with ten pixels top and bottom), but anything more
+    // than about 3% of the window looks like a mistake.
+    int spareX = dstWidth - (srcWidth * factor);
+    int spareY = dstHeight - (srcHeight * factor);
+    if (spareX > dstWidth / 32 || spareY > dstHeight / 32)
+        return 0;
+    return factor;
+}
+
+// ================================================================================================
+
+FBlendRows ScaleSelectBlend()
+{
+#ifdef LEGACY_PIXELS_X86
+    uint32_t cpu = PixelsDetectCPU();
+    if (cpu & e_cpuAVX2)
+        return ScaleBlendRowsAVX2;
+    if (cpu & e_cpuSSE2)
+        return ScaleBlendRowsSSE2;
+#endif
+    return ScaleBlendRowsScalar;
+}
+
+// ================================================================================================
+
+const char* ScaleFilterName(ScaleFilter filter)
+{
+    switch (filter) {
+    case e_scaleNearest:
+        return "Nearest";
+    case e_scaleBilinear:
+        return "Bilinear";
+    case e_scaleSharpBilinear:
+        return "Sharp Bilinear";
+    default:
+        return "???";
+    }
+}
+
+// ================================================================================================
+
+Scaler::Scaler()
+    : m_blend(ScaleSelectBlend()), m_replicate(ScaleSelectReplicate()),
+      m_stream(ScaleSelectStream()), m_filter(e_scaleNearest), m_integerScale(), m_offsetX(),
+      m_offsetY(), m_srcWidth(), m_srcHeight(), m_dstWidth(), m_dstHeight(),
+      m_tileWidth(DEFAULT_TILE_WIDTH), m_tileHeight(DEFAULT_TILE_HEIGHT)
+{
+}
+
+// ================================================================================================
+
+void Scaler::buildTaps(std::vector<ScaleTap>& taps, int src, int dst) const
+{
+    taps.resize(dst);
+
+    // Sharp bilinear is plain bilinear on top of the largest integer nearest neighbor upscale
+    // that fits. Inside each fat pixel nothing gets blended at all, only the seams between them.
+    int64_t prescale = 1;
+    if (m_filter == e_scaleSharpBilinear)
+        prescale = std::max(1, dst / src);
+    int64_t size = src * prescale;
+
+    for (int x = 0; x < dst; ++x) {
+        ScaleTap& tap = taps[x];
+        if (m_filter == e_scaleNearest) {
+            tap.m_index0 = (int)(((2 * x + 1) * (int64_t)src) / (2 * dst));
+            tap.m_index1 = tap.m_index0;
+            tap.m_weight = 0;
+            continue;
+        }
+
+        // Pixel centers line up, so the sample position is ((x + 0.5) * size / dst) - 0.5, in
+        // 24.8 fixed point.
+        int64_t pos = (((2 * x + 1) * size * 256) - (dst * 256)) / (2 * dst);
+        pos = std::max<int64_t>(pos, 0);
+        int64_t i0 = std::min(pos >> 8, size - 1);
+        int64_t i1 = std::min(i0 + 1, size - 1);
+        tap.m_index0 = (int)(i0 / prescale);
+        tap.m_index1 = (int)(i1 / prescale);
+        tap.m_weight = (uint32_t)(pos & 0xFF);
+        if (tap.m_index0 == tap.m_index1 || tap.m_weight == 0) {
+            tap.m_index1 = tap.m_index0;
+            tap.m_weight = 0;
+        }
+    }
+}
+
+// ================================================================================================
+
+bool Scaler::configure(int srcWidth, int srcHeight, int dstWidth, int dstHeight, ScaleFilter filter,
+                       int integerScale)
+{
+    if (m_srcWidth == srcWidth && m_srcHeight == srcHeight && m_dstWidth == dstWidth &&
+        m_dstHeight == dstHeight && m_filter == filter && m_integerScale == integerScale)
+        return false;
+
+    m_filter = filter;
+    m_integerScale = integerScale;
+    m_offsetX = (dstWidth - (srcWidth * integerScale)) / 2;
+    m_offsetY = (dstHeight - (srcHeight * integerScale)) / 2;
+    m_srcWidth = srcWidth;
+    m_srcHeight = srcHeight;
+    m_dstWidth = dstWidth;
+    m_dstHeight = dstHeight;
+    buildTaps(m_columns, srcWidth, dstWidth);
+    buildTaps(m_rows, srcHeight, dstHeight);
+    return true;
+}
+
+// ================================================================================================
+
+static void ScaleMapSpan(const std::vector<ScaleTap>& taps, int begin, int end, int& outBegin,
+                         int& outEnd)
+{
+    // Both indices only ever go up, so the affected outputs are one contiguous run.
+    auto first = std::lower_bound(taps.begin(), taps.end(), begin,
+                                  [](const ScaleTap& tap, int idx) { return tap.m_index1 < idx; });
+    auto last = std::upper_bound(taps.begin(), taps.end(), end - 1,
+                                 [](int idx, const ScaleTap& tap) { return idx < tap.m_index0; });
+    outBegin = (int)(first - taps.begin());
+    outEnd = (int)(last - taps.begin());
+}
+
+// ================================================================================================
+
+Rect Scaler::mapRect(const Rect& rect) const
+{
+    Rect clipped = rect.intersect({ 0, 0, m_srcWidth, m_srcHeight });
+    if (clipped.empty())
+        return { };
+
+    // All of the source means all of the output, letterbox bars included. Nothing else ever
+    // touches the bars, so this is the only time they get drawn.
+    if (clipped.left == 0 && clipped.top == 0 && clipped.right == m_srcWidth && clipped.bottom == m_srcHeight)
+        return { 0, 0, m_dstWidth, m_dstHeight };
+
+    if (m_integerScale) {
+        int k = m_integerScale;
+        return { m_offsetX + (clipped.left * k), m_offsetY + (clipped.top * k),
+                 m_offsetX + (clipped.right * k), m_offsetY + (clipped.bottom * k) };
+    }
+
+    Rect result;
+    ScaleMapSpan(m_columns, clipped.left, clipped.right, result.left, result.right);
+    ScaleMapSpan(m_rows, clipped.top, clipped.bottom, result.top, result.bottom);
+    if (result.empty())
+        return { };
+    return result;
+}
+
+// ================================================================================================
+
+void Scaler::scaleRow(uint32_t* dst, const uint32_t* src, int srcFirst, int left, int right) const
+{
+    const ScaleTap* tap = m_columns.data() + left;
+    for (int x = left; x < right; ++x, ++tap) {
+        if (tap->m_weight == 0)
+            *dst++ = src[tap->m_index0 - srcFirst];
+        else
+            *dst++ = ScaleBlendOne(src[tap->m_index0 - srcFirst], src[tap->m_index1 - srcFirst], tap->m_weight);
+    }
+}
+
+// ================================================================================================
+
+// Hands out source rows as 32bpp pixels. Calling fetch(row, first, last) returns a pointer to
+// pixel first of that row, and everything up to last is valid until the next call.
+struct _Fetch32
+{
+    const uint32_t* m_src;
+    size_t m_pitch;
+
+    const uint32_t* operator()(int row, int first, int /*last*/) const
+    {
+        return m_src + (row * m_pitch) + first;
+    }
+};
+
+// Same thing, but converts the 16bpp pixels on the fly. Only the part of the row that the
+// current tile needs gets converted, into a scratch buffer small enough to stay in L1.
+struct _Fetch16
+{
+    const uint16_t* m_src;
+    size_t m_pitch;
+    FConvertPixels m_convert;
+
+    const uint32_t* operator()(int row, int first, int last) const
+    {
+        thread_local std::vector<uint32_t> s_converted;
+        if (s_converted.size() < (size_t)(last - first))
+            s_converted.resize(last - first);
+        m_convert(s_converted.data(), m_src + (row * m_pitch) + first, last - first);
+        return s_converted.data();
+    }
+};
+
+// ================================================================================================
+
+template<typename Fetch>
+void Scaler::scaleInteger(uint32_t* dst, size_t dstPitch, const Rect& rect, Fetch fetch) const
+{
+    int k = m_integerScale;
+    Rect image{ m_offsetX, m_offsetY, m_offsetX + (m_srcWidth * k), m_offsetY + (m_srcHeight * k) };
+    Rect inner = rect.intersect(image);
+    thread_local std::vector<uint32_t> s_rowBuffer;
+
+    // Only the first output row of each source row is actually built. The rest are copies of
+    // it that go straight out to memory.
+    const uint32_t* built = nullptr;
+    uint32_t* dstRow = dst + (rect.top * dstPitch);
+    for (int y = rect.top; y < rect.bottom; ++y, dstRow += dstPitch) {
+        if (inner.empty() || y < inner.top || y >= inner.bottom) {
+            std::fill(dstRow + rect.left, dstRow + rect.right, 0);
+            continue;
+        }
+
+        std::fill(dstRow + rect.left, dstRow + inner.left, 0);
+        std::fill(dstRow + inner.right, dstRow + rect.right, 0);
+
+        int sy = (y - m_offsetY) / k;
+        if (built && (y - m_offsetY) % k != 0) {
+            m_stream(dstRow + inner.left, built, inner.width());
+            continue;
+        }
+
+        int sx0 = (inner.left - m_offsetX) / k;
+        int sx1 = (inner.right - m_offsetX + k - 1) / k;
+        const uint32_t* srcRow = fetch(sy, sx0, sx1);
+        if ((inner.left - m_offsetX) % k == 0 && (inner.right - m_offsetX) % k == 0) {
+            m_replicate(dstRow + inner.left, srcRow, sx1 - sx0, k);
+        } else {
+            // The rect cuts through the middle of a fat pixel, so build the whole thing on the
+            // side and copy out the part we want.
+            s_rowBuffer.resize((sx1 - sx0) * k);
+            m_replicate(s_rowBuffer.data(), srcRow, sx1 - sx0, k);
+            int skip = (inner.left - m_offsetX) - (sx0 * k);
+            memcpy(dstRow + inner.left, s_rowBuffer.data() + skip, inner.width() * sizeof(uint32_t));
+        }
+        built = dstRow + inner.left;
+    }
+}
+
+// ================================================================================================
+
+template<typename Fetch>
+void Scaler::scaleTile(uint32_t* dst, size_t dstPitch, const Rect& rect, Fetch fetch) const
+{
+    // Each source row is scaled horizontally once and then reused for every output row that
+    // needs it, which is a lot of them when upscaling. Rows are always needed in pairs of
+    // neighbors, so odd and even rows get their own slot and can never evict each other.
+    int width = rect.width();
+    thread_local std::vector<uint32_t> s_rowBuffers[2];
+    int cachedRows[2] = { -1, -1 };
+    for (std::vector<uint32_t>& buffer : s_rowBuffers) {
+        if (buffer.size() < (size_t)width)
+            buffer.resize(width);
+    }
+
+    int srcFirst = m_columns[rect.left].m_index0;
+    int srcLast = m_columns[rect.right - 1].m_index1 + 1;
+    auto horizontal = [&](int idx) -> const uint32_t* {
+        int slot = idx & 1;
+        if (cachedRows[slot] != idx) {
+            scaleRow(s_rowBuffers[slot].data(), fetch(idx, srcFirst, srcLast), srcFirst,
+                     rect.left, rect.right);
+            cachedRows[slot] = idx;
+        }
+        return s_rowBuffers[slot].data();
+    };
+
+    uint32_t* dstRow = dst + (rect.top * dstPitch) + rect.left;
+    for (int y = rect.top; y < rect.bottom; ++y, dstRow += dstPitch) {
+        const ScaleTap& tap = m_rows[y];
+        const uint32_t* row0 = horizontal(tap.m_index0);
+        if (tap.m_weight == 0)
+            memcpy(dstRow, row0, width * sizeof(uint32_t));
+        else
+            m_blend(dstRow, row0, horizontal(tap.m_index1), tap.m_weight, width);
+    }
+}
+
+// ================================================================================================
+
+template<typename Fetch>
+void Scaler::scaleRect(uint32_t* dst, size_t dstPitch, const Rect& dstRect, Fetch fetch) const
+{
+    Rect rect = dstRect.intersect({ 0, 0, m_dstWidth, m_dstHeight });
+    if (rect.empty())
+        return;
+
+    if (m_integerScale) {
+        scaleInteger(dst, dstPitch, rect, fetch);
+        return;
+    }
+
+    // Wide outputs are done in tiles so that the scaled rows we keep around stay in L1.
+    for (int top = rect.top; top < rect.bottom; top += m_tileHeight) {
+        for (int left = rect.left; left < rect.right; left += m_tileWidth) {
+            Rect tile{ left, top, std::min(rect.right, left + m_tileWidth),
+                       std::min(rect.bottom, top + m_tileHeight) };
+            scaleTile(dst, dstPitch, tile, fetch);
+        }
+    }
+}
+
+// ================================================================================================
+
+template<typename Fetch>
+void Scaler::scaleBands(uint32_t* dst, size_t dstPitch, const Rect& dstRect, Fetch fetch,
+                        WorkerPool& workers) const
+{
+    Rect rect = dstRect.intersect({ 0, 0, m_dstWidth, m_dstHeight });
+    if (rect.empty())
+        return;
+
+    // A couple of bands per thread evens things out if one of them gets preempted. Every band
+    // has to redo the horizontal pass for its first row, so don't make them too thin.
+    int bandHeight = std::max(16, (int)((rect.height() + (workers.size() * 2) - 1) / (workers.size() * 2)));
+    size_t bands = (rect.height() + bandHeight - 1) / bandHeight;
+    workers.run(bands, [&](size_t i) {
+        Rect band = rect;
+        band.top = rect.top + ((int)i * bandHeight);
+        band.bottom = std::min(rect.bottom, band.top + bandHeight);
+        scaleRect(dst, dstPitch, band, fetch);
+    });
+}
+
+// ================================================================================================
+
+void Scaler::scale(uint32_t* dst, size_t dstPitch, const uint32_t* src, size_t srcPitch,
+                   const Rect& dstRect) const
+{
+    scaleRect(dst, dstPitch, dstRect, _Fetch32{ src, srcPitch });
+}
+
+// ================================================================================================
+
+void Scaler::scale(uint32_t* dst, size_t dstPitch, const uint32_t* src, size_t srcPitch,
+                   const Rect& dstRect, WorkerPool& workers) const
+{
+    scaleBands(dst, dstPitch, dstRect, _Fetch32{ src, srcPitch }, workers);
+}
+
+// ================================================================================================
+
+void Scaler::scale(uint32_t* dst, size_t dstPitch, const uint16_t* src, size_t srcPitch,
+                   FConvertPixels convert, const Rect& dstRect) const
+{
+    scaleRect(dst, dstPitch, dstRect, _Fetch16{ src, srcPitch, convert });
+}
+
+// ================================================================================================
+
+void Scaler::scale(uint32_t* dst, size_t dstPitch, const uint16_t* src, size_t srcPitch,
+                   FConvertPixels convert, const Rect& dstRect, WorkerPool& workers) const
+{
+    scaleBands(dst, dstPitch, dstRect, _Fetch16{ src, srcPitch, convert }, workers);
+}
@@ -0,0 +1,165 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_SCALER_H
+#define __LEGACY_SCALER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "LegacyPixels.h"
+#include "LegacyRegion.h"
+
+class WorkerPool;
+
+// ================================================================================================
+
+enum ScaleFilter
+{
+    e_scaleNearest,
+    e_scaleBilinear,
+    e_scaleSharpBilinear,
+    e_scaleFilterCount,
+};
+
+// Blends two rows of 32bpp pixels channel by channel. The weight is how much of b to take, out
+// of 256. Every implementation produces exactly the same output.
+typedef void(*FBlendRows)(uint32_t* dst, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                          size_t count);
+
+void ScaleBlendRowsScalar(uint32_t* dst, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                          size_t count);
+#ifdef LEGACY_PIXELS_X86
+void ScaleBlendRowsSSE2(uint32_t* dst, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                        size_t count);
+void ScaleBlendRowsAVX2(uint32_t* dst, const uint32_t* a, const uint32_t* b, uint32_t weight,
+                        size_t count);
+#endif
+
+FBlendRows ScaleSelectBlend();
+const char* ScaleFilterName(ScaleFilter filter);
+
+// Writes every source pixel factor times in a row. Factors of 2 through 5 have fast paths.
+typedef void(*FReplicateRow)(uint32_t* dst, const uint32_t* src, size_t count, int factor);
+
+// Copies a row that won't be read again any time soon, so there's no sense in dragging it
+// through the cache.
+typedef void(*FStreamRow)(uint32_t* dst, const uint32_t* src, size_t count);
+
+void ScaleReplicateRowScalar(uint32_t* dst, const uint32_t* src, size_t count, int factor);
+void ScaleStreamRowScalar(uint32_t* dst, const uint32_t* src, size_t count);
+#ifdef LEGACY_PIXELS_X86
+void ScaleReplicateRowSSE2(uint32_t* dst, const uint32_t* src, size_t count, int factor);
+void ScaleStreamRowSSE2(uint32_t* dst, const uint32_t* src, size_t count);
+#endif
+
+FReplicateRow ScaleSelectReplicate();
+FStreamRow ScaleSelectStream();
+
+// Returns the integer factor to scale by if the output is an exact multiple of the source, or
+// close enough that letterboxing the difference won't be noticed. Returns 0 otherwise.
+int ScaleIntegerFactor(int srcWidth, int srcHeight, int dstWidth, int dstHeight);
+
+// ================================================================================================
+
+// Which two source pixels an output pixel is made of, and how much of the second one to take.
+struct ScaleTap
+{
+    int m_index0;
+    int m_index1;
+    uint32_t m_weight;
+};
+
+// Scales a 32bpp image to the final output size. Everything that depends on the sizes and the
+// filter is worked out ahead of time in configure(), so scaling is just table lookups and blends.
+class Scaler
+{
+    FBlendRows m_blend;
+    FReplicateRow m_replicate;
+    FStreamRow m_stream;
+    ScaleFilter m_filter;
+    int m_integerScale;
+    int m_offsetX;
+    int m_offsetY;
+    int m_srcWidth;
+    int m_srcHeight;
+    int m_dstWidth;
+    int m_dstHeight;
+    std::vector<ScaleTap> m_columns;
+    std::vector<ScaleTap> m_rows;
+    int m_tileWidth;
+    int m_tileHeight;
+
+    void buildTaps(std::vector<ScaleTap>& taps, int src, int dst) const;
+    void scaleRow(uint32_t* dst, const uint32_t* src, int srcFirst, int left, int right) const;
+
+    template<typename Fetch>
+    void scaleInteger(uint32_t* dst, size_t dstPitch, const Rect& rect, Fetch fetch) const;
+    template<typename Fetch>
+    void scaleTile(uint32_t* dst, size_t dstPitch, const Rect& rect, Fetch fetch) const;
+    template<typename Fetch>
+    void scaleRect(uint32_t* dst, size_t dstPitch, const Rect& dstRect, Fetch fetch) const;
+    template<typename Fetch>
+    void scaleBands(uint32_t* dst, size_t dstPitch, const Rect& dstRect, Fetch fetch,
+                    WorkerPool& workers) const;
+
+public:
+    // Two scaled rows of even the widest output fit in L2, and splitting rows up into columns
+    // costs more in scattered writes than it saves, so by default a tile is a band of rows.
+    enum { DEFAULT_TILE_WIDTH = 4096, DEFAULT_TILE_HEIGHT = 64 };
+
+    Scaler();
+
+    // Returns true if anything actually changed. A nonzero integer scale ignores the filter and
+    // replicates pixels instead, centering the image and letterboxing whatever is left over.
+    bool configure(int srcWidth, int srcHeight, int dstWidth, int dstHeight, ScaleFilter filter,
+                   int integerScale = 0);
+
+    ScaleFilter filter() const { return m_filter; }
+    int integerScale() const { return m_integerScale; }
+    int tileWidth() const { return m_tileWidth; }
+    int tileHeight() const { return m_tileHeight; }
+    void setTileSize(int width, int height) { m_tileWidth = width; m_tileHeight = height; }
+    int dstWidth() const { return m_dstWidth; }
+    int dstHeight() const { return m_dstHeight; }
+    const std::vector<ScaleTap>& columns() const { return m_columns; }
+    const std::vector<ScaleTap>& rows() const { return m_rows; }
+
+    // The part of the output that samples anything inside of the source rect. The whole
+    // source maps to the whole output, including any letterboxing.
+    Rect mapRect(const Rect& rect) const;
+
+    // Fills in dstRect of the output. Pitches are in pixels.
+    void scale(uint32_t* dst, size_t dstPitch, const uint32_t* src, size_t srcPitch,
+               const Rect& dstRect) const;
+    void scale(uint32_t* dst, size_t dstPitch, const uint32_t* src, size_t srcPitch,
+               const Rect& dstRect, WorkerPool& workers) const;
+
+    // Same, but straight from 16bpp. Source rows are converted a tile's width at a time as they
+    // are needed, so there is never a full 32bpp copy of the source frame.
+    void scale(uint32_t* dst, size_t dstPitch, const uint16_t* src, size_t srcPitch,
+               FConvertPixels convert, const Rect& dstRect) const;
+    void scale(uint32_t* dst, size_t dstPitch, const uint16_t* src, size_t srcPitch,
+               FConvertPixels convert, const Rect& dstRect, WorkerPool& workers) const;
+};
+
+#endif
@@ -0,0 +1,95 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyScheduler.h"
+
+#include <algorithm>
+
+// ================================================================================================
+
+constexpr std::chrono::microseconds FrameScheduler::DEFAULT_SPIN_MARGIN;
+
+// ================================================================================================
+
+FrameScheduler::FrameScheduler()
+    : m_interval(0), m_spinMargin(DEFAULT_SPIN_MARGIN), m_deadline(), m_stats()
+{
+}
+
+// ================================================================================================
+
+void FrameScheduler::setRate(double hz)
+{
+    SchedulerClock::duration interval{ 0 };
+    if (hz > 0.0)
+        interval = std::chrono::duration_cast<SchedulerClock::duration>(std::chrono::duration<double>(1.0 / hz));
+
+    // Keep the phase of the old rate, but don't make anybody wait longer than the new one.
+    if (interval < m_interval)
+        m_deadline -= m_interval - interval;
+    m_interval = interval;
+}
+
+// ================================================================================================
+
+double FrameScheduler::rate() const
+{
+    if (m_interval.count() == 0)
+        return 0.0;
+    return 1.0 / std::chrono::duration<double>(m_interval).count();
+}
+
+// ================================================================================================
+
+SchedulerClock::duration FrameScheduler::sleepTime(SchedulerClock::time_point now) const
+{
+    SchedulerClock::duration remaining = m_deadline - now;
+    if (remaining <= m_spinMargin)
+        return SchedulerClock::duration{ 0 };
+    return remaining - m_spinMargin;
+}
+
+// ================================================================================================
+
+void FrameScheduler::frameStarted(SchedulerClock::time_point now, bool waited)
+{
+    m_stats.m_frames++;
+    if (waited) {
+        SchedulerClock::duration jitter = now > m_deadline ? now - m_deadline : m_deadline - now;
+        m_stats.m_pacedFrames++;
+        m_stats.m_totalJitter += jitter;
+        m_stats.m_maxJitter = std::max(m_stats.m_maxJitter, jitter);
+    }
+
+    // Stay locked to the grid of deadlines while we keep up. If we fell behind (or nothing
+    // happened for a while), start a new grid from now rather than letting a burst of frames
+    // through to catch up.
+    m_deadline += m_interval;
+    if (m_deadline <= now)
+        m_deadline = now + m_interval;
+}
+
+// ================================================================================================
+
+void FrameScheduler::resetStats()
+{
+    m_stats = SchedulerStats();
+}
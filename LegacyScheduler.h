@@ -0,0 +1,102 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_SCHEDULER_H
+#define __LEGACY_SCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+// ================================================================================================
+
+typedef std::chrono::steady_clock SchedulerClock;
+
+struct SchedulerStats
+{
+    uint32_t m_frames;
+    uint32_t m_pacedFrames;
+    SchedulerClock::duration m_totalJitter;
+    SchedulerClock::duration m_maxJitter;
+};
+
+// ================================================================================================
+
+// Decides when the next frame may go out so that bursts of damage get coalesced into no more
+// than one frame per interval. This never looks at a clock itself -- the caller passes in the
+// time -- so it can be driven by a fake clock just as easily as a real one.
+class FrameScheduler
+{
+    SchedulerClock::duration m_interval;
+    SchedulerClock::duration m_spinMargin;
+    SchedulerClock::time_point m_deadline;
+    SchedulerStats m_stats;
+
+public:
+    // How close to the deadline we stop trusting the OS to wake us up on time and spin instead.
+    static constexpr std::chrono::microseconds DEFAULT_SPIN_MARGIN{ 2000 };
+
+    FrameScheduler();
+
+    // A rate of zero lets every frame through as soon as it's ready.
+    void setRate(double hz);
+    double rate() const;
+    bool capped() const { return m_interval.count() != 0; }
+
+    void setSpinMargin(SchedulerClock::duration margin) { m_spinMargin = margin; }
+
+    SchedulerClock::time_point deadline() const { return m_deadline; }
+    bool due(SchedulerClock::time_point now) const { return now >= m_deadline; }
+
+    // How long the caller may sleep before it has to start spinning for the deadline.
+    SchedulerClock::duration sleepTime(SchedulerClock::time_point now) const;
+
+    // A frame went out at now. If the caller had to wait for the deadline, waited should be
+    // set so that how far off we were counts towards the jitter.
+    void frameStarted(SchedulerClock::time_point now, bool waited);
+
+    const SchedulerStats& stats() const { return m_stats; }
+    void resetStats();
+};
+
+// ================================================================================================
+
+// Waits until the deadline by sleeping through most of it and spinning through the rest. The
+// sleep function is handed the longest it may sleep and may come back early. Returns false if
+// the sleep function asked to give up.
+template<typename Now, typename Sleep>
+bool SchedulerWaitUntil(const FrameScheduler& scheduler, Now now, Sleep sleep)
+{
+    SchedulerClock::time_point t = now();
+    while (!scheduler.due(t)) {
+        SchedulerClock::duration coarse = scheduler.sleepTime(t);
+        if (coarse.count() > 0) {
+            if (!sleep(coarse))
+                return false;
+        } else {
+            std::this_thread::yield();
+        }
+        t = now();
+    }
+    return true;
+}
+
+#endif
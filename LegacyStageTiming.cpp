@@ -0,0 +1,111 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyStageTiming.h"
+
+#include <algorithm>
+
+// ================================================================================================
+
+const char* StageName(PipelineStage stage)
+{
+    switch (stage) {
+    case e_stageLockWait:
+        return "lock";
+    case e_stageCopyOut:
+        return "copy";
+    case e_stageHash:
+        return "hash";
+    case e_stageScale:
+        return "scale";
+    case e_stagePresent:
+        return "present";
+    case e_stageOverlay:
+        return "overlay";
+    default:
+        return "???";
+    }
+}
+
+// ================================================================================================
+
+StageTimes::StageTimes()
+    : m_calibrationCycles(StageReadCycles()), m_calibrationTime(std::chrono::steady_clock::now())
+{
+}
+
+// ================================================================================================
+
+void StageTimes::add(PipelineStage stage, uint64_t cycles)
+{
+    _Stage& s = m_stages[stage];
+    s.m_samples.store(s.m_samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    s.m_cycles.store(s.m_cycles.load(std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
+    s.m_last.store(cycles, std::memory_order_relaxed);
+    if (cycles > s.m_max.load(std::memory_order_relaxed))
+        s.m_max.store(cycles, std::memory_order_relaxed);
+}
+
+// ================================================================================================
+
+double StageTimes::cyclesPerMicrosecond() const
+{
+#ifdef LEGACY_PIXELS_X86
+    uint64_t cycles = StageReadCycles() - m_calibrationCycles;
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - m_calibrationTime;
+    if (elapsed.count() < 1000.0 || cycles == 0)
+        return 0.0;
+    return cycles / elapsed.count();
+#else
+    typedef std::chrono::steady_clock::period Period;
+    return (double)Period::den / (Period::num * 1e6);
+#endif
+}
+
+// ================================================================================================
+
+StageSummary StageTimes::summary(PipelineStage stage) const
+{
+    const _Stage& s = m_stages[stage];
+    StageSummary summary{ };
+    summary.m_samples = s.m_samples.load(std::memory_order_relaxed);
+
+    // Too early to know how fast the counter goes, so there's nothing useful to say yet.
+    double scale = cyclesPerMicrosecond();
+    if (scale == 0.0)
+        return summary;
+    summary.m_lastUs = s.m_last.load(std::memory_order_relaxed) / scale;
+    summary.m_maxUs = s.m_max.load(std::memory_order_relaxed) / scale;
+    if (summary.m_samples)
+        summary.m_meanUs = (s.m_cycles.load(std::memory_order_relaxed) / scale) / summary.m_samples;
+    return summary;
+}
+
+// ================================================================================================
+
+void StageTimes::reset()
+{
+    for (_Stage& s : m_stages) {
+        s.m_samples.store(0, std::memory_order_relaxed);
+        s.m_cycles.store(0, std::memory_order_relaxed);
+        s.m_max.store(0, std::memory_order_relaxed);
+    }
+}
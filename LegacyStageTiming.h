@@ -0,0 +1,139 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_STAGETIMING_H
+#define __LEGACY_STAGETIMING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "LegacyPixels.h"
+
+#ifdef LEGACY_PIXELS_X86
+#   ifdef _MSC_VER
+#       include <intrin.h>
+#   else
+#       include <x86intrin.h>
+#   endif
+#endif
+
+// Comment this out to compile every stage timer out of the pipeline entirely.
+#define LEGACY_STAGE_TIMING
+
+// ================================================================================================
+
+enum PipelineStage
+{
+    e_stageLockWait,
+    e_stageCopyOut,
+    e_stageHash,
+    e_stageScale,
+    e_stagePresent,
+    e_stageOverlay,
+
+    e_stageCount,
+};
+
+const char* StageName(PipelineStage stage);
+
+// The TSC where we have one. It's a couple dozen cycles to read and runs at a constant rate on
+// anything from the last decade or so.
+static inline uint64_t StageReadCycles()
+{
+#ifdef LEGACY_PIXELS_X86
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+struct StageSummary
+{
+    uint64_t m_samples;
+    double m_lastUs;
+    double m_meanUs;
+    double m_maxUs;
+};
+
+// ================================================================================================
+
+// Per-stage totals. Every stage is only ever timed from one thread, so adding is just a few
+// relaxed atomic stores. Anybody may read, and a reader might see a stage half-updated, which
+// is fine for numbers nobody is going to do accounting with.
+class StageTimes
+{
+    struct _Stage
+    {
+        std::atomic<uint64_t> m_samples{ 0 };
+        std::atomic<uint64_t> m_cycles{ 0 };
+        std::atomic<uint64_t> m_last{ 0 };
+        std::atomic<uint64_t> m_max{ 0 };
+    };
+
+    _Stage m_stages[e_stageCount];
+
+    // Cycles are turned into time by comparing how far the counter and the clock have gone
+    // since we started, which gets more accurate the longer we run.
+    uint64_t m_calibrationCycles;
+    std::chrono::steady_clock::time_point m_calibrationTime;
+
+public:
+    StageTimes();
+
+    void add(PipelineStage stage, uint64_t cycles);
+
+    double cyclesPerMicrosecond() const;
+    StageSummary summary(PipelineStage stage) const;
+
+    // Starts the means and maximums over, but keeps the last sample around.
+    void reset();
+};
+
+// ================================================================================================
+
+class StageTimer
+{
+    StageTimes& m_times;
+    PipelineStage m_stage;
+    uint64_t m_start;
+
+public:
+    StageTimer(StageTimes& times, PipelineStage stage)
+        : m_times(times), m_stage(stage), m_start(StageReadCycles())
+    { }
+
+    ~StageTimer() { m_times.add(m_stage, StageReadCycles() - m_start); }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+};
+
+#ifdef LEGACY_STAGE_TIMING
+#   define LEGACY_STAGE_CONCAT_(a, b) a##b
+#   define LEGACY_STAGE_CONCAT(a, b) LEGACY_STAGE_CONCAT_(a, b)
+#   define LEGACY_TIME_STAGE(times, stage) StageTimer LEGACY_STAGE_CONCAT(_stageTimer, __LINE__){ times, stage }
+#else
+#   define LEGACY_TIME_STAGE(times, stage)
+#endif
+
+#endif
@@ -0,0 +1,261 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacySurfaceHost.h"
+#include "LegacyOverlay.h"
+#include "LegacyTrace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+// ================================================================================================
+
+enum
+{
+    e_surfaceDirty = (1<<0),
+    e_surfaceForcePresent = (1<<1),
+};
+
+// ================================================================================================
+
+SurfaceHost::SurfaceHost(const PipelineView& view)
+    : m_pixels(new uint16_t[PIPELINE_PIXELS]()), m_view(view)
+{
+    m_dirtyRegion.addAll();
+    m_flags = e_surfaceDirty;
+}
+
+// ================================================================================================
+
+void SurfaceHost::markDirty(const Rect& rect)
+{
+    // Same rules as LegacyMarkDirty: the caller holds the surface mutex, and the flag goes up
+    // while it still does.
+    m_dirtyRegion.add(rect.intersect({ 0, 0, PIPELINE_WIDTH, PIPELINE_HEIGHT }));
+    m_flags.fetch_or(e_surfaceDirty, std::memory_order_release);
+    if (m_pipeline)
+        m_pipeline->wake();
+}
+
+// ================================================================================================
+
+uint16_t* SurfaceHost::lock(const Rect* rect)
+{
+    m_surfaceMut.lock();
+    m_lockRect = rect ? *rect : Rect{ 0, 0, PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    return m_pixels.get() + (m_lockRect.top * PIPELINE_WIDTH) + m_lockRect.left;
+}
+
+// ================================================================================================
+
+void SurfaceHost::unlock()
+{
+    markDirty(m_lockRect);
+    m_surfaceMut.unlock();
+}
+
+// ================================================================================================
+
+uint16_t* SurfaceHost::getDC()
+{
+    m_surfaceMut.lock();
+    return m_pixels.get();
+}
+
+// ================================================================================================
+
+void SurfaceHost::releaseDC()
+{
+    markDirty({ 0, 0, PIPELINE_WIDTH, PIPELINE_HEIGHT });
+    m_surfaceMut.unlock();
+}
+
+// ================================================================================================
+
+void SurfaceHost::bltFast(int x, int y, const uint16_t* src, size_t srcPitch, int width, int height)
+{
+    Rect rect = Rect{ x, y, x + width, y + height }.intersect({ 0, 0, PIPELINE_WIDTH, PIPELINE_HEIGHT });
+    if (rect.empty())
+        return;
+
+    std::lock_guard<std::recursive_mutex> _(m_surfaceMut);
+    const uint16_t* from = (const uint16_t*)((const uint8_t*)src + ((rect.top - y) * srcPitch)) + (rect.left - x);
+    PipelineCopyRect(m_pixels.get() + (rect.top * PIPELINE_WIDTH) + rect.left, surfacePitch(), from,
+                     srcPitch, sizeof(uint16_t), { 0, 0, rect.width(), rect.height() });
+    markDirty(rect);
+}
+
+// ================================================================================================
+
+void SurfaceHost::forceDirty()
+{
+    std::lock_guard<std::recursive_mutex> _(m_surfaceMut);
+    m_flags.fetch_or(e_surfaceForcePresent, std::memory_order_relaxed);
+    markDirty({ 0, 0, PIPELINE_WIDTH, PIPELINE_HEIGHT });
+}
+
+// ================================================================================================
+
+PipelineGrab SurfaceHost::grab(uint16_t* frame, DirtyRegion& damage, bool& force)
+{
+    if (!(m_flags & e_surfaceDirty))
+        return e_grabIdle;
+
+    {
+        LEGACY_TIME_STAGE(m_pipeline->stageTimes(), e_stageLockWait);
+        m_surfaceMut.lock();
+    }
+
+    std::swap(damage, m_dirtyRegion);
+    m_dirtyRegion.clear();
+    uint32_t flags = m_flags.fetch_and(~(e_surfaceDirty | e_surfaceForcePresent),
+                                       std::memory_order_acq_rel);
+    force = flags & e_surfaceForcePresent;
+
+    {
+        LEGACY_TIME_STAGE(m_pipeline->stageTimes(), e_stageCopyOut);
+        for (const Rect& rect : damage)
+            PipelineCopyRect(frame, PIPELINE_WIDTH * sizeof(uint16_t), m_pixels.get(), surfacePitch(),
+                             sizeof(uint16_t), rect);
+    }
+
+    m_surfaceMut.unlock();
+    return e_grabFrame;
+}
+
+// ================================================================================================
+
+const OverlayAtlas* SurfaceHost::overlay(OverlayText& text)
+{
+    const OverlayAtlas* atlas = m_overlay;
+    if (!atlas)
+        return nullptr;
+
+    // The same two lines the game gets with FPS and frame time percentiles turned on.
+    text.m_color = 0xFCEC03;
+    float frameTime = m_lastFrameTime.load(std::memory_order_relaxed);
+    FrameSummary lifetime = m_frameStats.lifetime();
+    FrameSummary recent = m_frameStats.recent();
+    text.print(0, e_overlayLeft, "FT: %.4fs", frameTime);
+    text.print(0, e_overlayRight, "FPS: %u AVG: %u", frameTime > 0.f ? (unsigned)(1.f / frameTime) : 0,
+               lifetime.m_mean ? (unsigned)(1000000 / lifetime.m_mean) : 0);
+    text.print(1, e_overlayLeft, "p50: %.1f p90: %.1f p99: %.1f p99.9: %.1f max: %.1f ms",
+               recent.m_p50 / 1000.f, recent.m_p90 / 1000.f, recent.m_p99 / 1000.f,
+               recent.m_p999 / 1000.f, recent.m_max / 1000.f);
+    return atlas;
+}
+
+// ================================================================================================
+
+void SurfaceHost::endPresent(const OutputFrame& /*frame*/, PipelineClock::duration frameTime)
+{
+    m_lastFrameTime.store(std::chrono::duration<float>(frameTime).count(), std::memory_order_relaxed);
+    m_frameStats.record(frameTime, PipelineClock::now());
+    m_presented.fetch_add(1, std::memory_order_relaxed);
+    m_presentedEvent.signal();
+}
+
+// ================================================================================================
+
+void SurfaceHost::waitIdle(uint32_t quietMs)
+{
+    // Anything still dirty is going to be presented sooner or later, even if the pipeline is
+    // holding it back for pacing.
+    for (;;) {
+        bool presented = m_presentedEvent.wait(quietMs);
+        if (!presented && !(m_flags & e_surfaceDirty))
+            return;
+    }
+}
+
+// ================================================================================================
+
+void SurfaceHostReplay(TraceReader& reader, SurfaceHost& host, double speed, uint32_t* counts)
+{
+    using Clock = std::chrono::steady_clock;
+
+    const uint16_t* surface = reader.surface();
+    int width = reader.width();
+    uint16_t* locked = nullptr;
+    Rect lockRect{ };
+    uint16_t* dc = nullptr;
+    auto copyOut = [&](uint16_t* dst, const Rect& dstRect, const Rect& rect) {
+        uint16_t* at = dst + ((rect.top - dstRect.top) * PIPELINE_WIDTH) + (rect.left - dstRect.left);
+        PipelineCopyRect(at, SurfaceHost::surfacePitch(), surface + (rect.top * width) + rect.left,
+                         width * sizeof(uint16_t), sizeof(uint16_t), { 0, 0, rect.width(), rect.height() });
+    };
+
+    Clock::time_point origin = Clock::now();
+    TraceRecord record;
+    while (reader.next(record)) {
+        if (speed > 0.0)
+            std::this_thread::sleep_until(origin + std::chrono::duration_cast<Clock::duration>(record.m_time / speed));
+        if (counts && record.m_event <= e_traceBltFast)
+            counts[record.m_event]++;
+
+        const Rect& rect = record.m_rect;
+        switch (record.m_event) {
+        case e_traceSnapshot:
+            host.bltFast(0, 0, surface, width * sizeof(uint16_t), width, reader.height());
+            break;
+        case e_traceLock:
+            lockRect = rect;
+            locked = host.lock(&lockRect);
+            break;
+        case e_traceUnlock:
+            if (locked) {
+                if (record.m_pixels)
+                    copyOut(locked, lockRect, rect);
+                host.unlock();
+                locked = nullptr;
+            } else if (record.m_pixels) {
+                host.bltFast(rect.left, rect.top, surface + (rect.top * width) + rect.left,
+                             width * sizeof(uint16_t), rect.width(), rect.height());
+            }
+            break;
+        case e_traceGetDC:
+            dc = host.getDC();
+            break;
+        case e_traceReleaseDC:
+            if (dc) {
+                if (record.m_pixels)
+                    copyOut(dc, { 0, 0, PIPELINE_WIDTH, PIPELINE_HEIGHT }, rect);
+                host.releaseDC();
+                dc = nullptr;
+            }
+            break;
+        case e_traceBltFast:
+            if (record.m_pixels)
+                host.bltFast(rect.left, rect.top, surface + (rect.top * width) + rect.left,
+                             width * sizeof(uint16_t), rect.width(), rect.height());
+            break;
+        default:
+            break;
+        }
+    }
+
+    // A trace cut off in the middle of a call would otherwise leave the surface locked forever.
+    if (locked)
+        host.unlock();
+    if (dc)
+        host.releaseDC();
+}
@@ -0,0 +1,104 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_SURFACEHOST_H
+#define __LEGACY_SURFACEHOST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "LegacyEvent.h"
+#include "LegacyFrameStats.h"
+#include "LegacyPipeline.h"
+#include "LegacyRegion.h"
+
+class OverlayAtlas;
+class TraceReader;
+
+// ================================================================================================
+
+// A stand-in for the proxy surface that the DDraw hooks hand to the game, for feeding the
+// pipeline anywhere. The game side calls mirror what the hooks do around the real surface --
+// same mutex, same damage tracking, same wakeups -- and the pipeline side grabs frames the
+// same way _PrimarySurfaceHost does.
+class SurfaceHost : public PipelineHost
+{
+    std::unique_ptr<uint16_t[]> m_pixels;
+    std::recursive_mutex m_surfaceMut;
+    DirtyRegion m_dirtyRegion{ PIPELINE_WIDTH, PIPELINE_HEIGHT };
+    Rect m_lockRect{ };
+    std::atomic<uint32_t> m_flags{ 0 };
+    Pipeline* m_pipeline{ nullptr };
+
+    PipelineView m_view;
+    std::atomic<const OverlayAtlas*> m_overlay{ nullptr };
+    std::atomic<float> m_lastFrameTime{ 0.f };
+    FrameStats m_frameStats;
+    std::atomic<uint32_t> m_presented{ 0 };
+    Event m_presentedEvent;
+
+    void markDirty(const Rect& rect);
+
+public:
+    SurfaceHost(const PipelineView& view);
+
+    SurfaceHost(const SurfaceHost&) = delete;
+    SurfaceHost& operator=(const SurfaceHost&) = delete;
+
+    // The pipeline is woken up whenever the surface gets dirty.
+    void attach(Pipeline* pipeline) { m_pipeline = pipeline; }
+    void setOverlay(const OverlayAtlas* atlas) { m_overlay = atlas; }
+
+    // Game side. Like IDirectDrawSurface::Lock, the pointer is to the top left of the rect, or
+    // of the whole surface if there isn't one, and the pitch is surfacePitch().
+    uint16_t* lock(const Rect* rect = nullptr);
+    void unlock();
+    uint16_t* getDC();
+    void releaseDC();
+    void bltFast(int x, int y, const uint16_t* src, size_t srcPitch, int width, int height);
+    void forceDirty();
+
+    static constexpr size_t surfacePitch() { return PIPELINE_WIDTH * sizeof(uint16_t); }
+
+    // Pipeline side.
+    PipelineGrab grab(uint16_t* frame, DirtyRegion& damage, bool& force) override;
+    PipelineView view() override { return m_view; }
+    const OverlayAtlas* overlay(OverlayText& text) override;
+    void endPresent(const OutputFrame& frame, PipelineClock::duration frameTime) override;
+
+    const FrameStats& frameStats() const { return m_frameStats; }
+    uint32_t presented() const { return m_presented.load(std::memory_order_relaxed); }
+
+    // Waits until nothing is dirty and nothing has been presented for a while.
+    void waitIdle(uint32_t quietMs);
+};
+
+// ================================================================================================
+
+// Plays a trace into the host the way the game played it into the hooks, holding the surface
+// locked for as long as the game did. The speed scales the recorded timing, and zero means
+// don't wait at all. If counts isn't null, it's indexed by TraceEvent and counts the calls.
+void SurfaceHostReplay(TraceReader& reader, SurfaceHost& host, double speed, uint32_t* counts);
+
+#endif
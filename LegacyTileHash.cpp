@@ -0,0 +1,288 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyTileHash.h"
+#include "LegacyWorkers.h"
+
+#include <algorithm>
+
+#ifdef LEGACY_PIXELS_X86
+#   include <immintrin.h>
+#endif
+
+// ================================================================================================
+
+// This is basically xxHash32 spread across eight lanes. Each lane eats one 32-bit word out of
+// every 32 bytes, which lines up exactly with an AVX2 register (or two SSE2 registers). A single
+// set of lanes would spend all of its time waiting on the multiplies, so consecutive rows are
+// fed to four independent sets. Every implementation produces the same hash, so they can be
+// mixed freely.
+constexpr uint32_t HASH_PRIME1 = 2654435761U;
+constexpr uint32_t HASH_PRIME2 = 2246822519U;
+constexpr uint32_t HASH_PRIME3 = 3266489917U;
+constexpr uint32_t HASH_PRIME4 = 668265263U;
+constexpr uint32_t HASH_PRIME5 = 374761393U;
+constexpr size_t HASH_LANES = 8;
+constexpr size_t HASH_SETS = 4;
+
+static inline uint32_t TileHashRotl(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// ================================================================================================
+
+static inline uint32_t TileHashAvalanche(uint32_t h)
+{
+    h ^= h >> 15;
+    h *= HASH_PRIME2;
+    h ^= h >> 13;
+    h *= HASH_PRIME3;
+    h ^= h >> 16;
+    return h;
+}
+
+// ================================================================================================
+
+static inline void TileHashInit(uint32_t (&lanes)[HASH_SETS][HASH_LANES])
+{
+    for (size_t set = 0; set < HASH_SETS; ++set)
+        for (size_t i = 0; i < HASH_LANES; ++i)
+            lanes[set][i] = HASH_PRIME1 * (uint32_t)((set * HASH_LANES) + i + 1);
+}
+
+// ================================================================================================
+
+static inline uint64_t TileHashFinish(const uint32_t (&lanes)[HASH_SETS][HASH_LANES], int width,
+                                      int height)
+{
+    uint32_t merged[HASH_LANES];
+    for (size_t i = 0; i < HASH_LANES; ++i) {
+        merged[i] = TileHashRotl(lanes[0][i], 1) + TileHashRotl(lanes[1][i], 7) +
+                    TileHashRotl(lanes[2][i], 12) + TileHashRotl(lanes[3][i], 18);
+    }
+
+    uint32_t lo = TileHashRotl(merged[0], 1) + TileHashRotl(merged[1], 7) +
+                  TileHashRotl(merged[2], 12) + TileHashRotl(merged[3], 18);
+    uint32_t hi = TileHashRotl(merged[4], 1) + TileHashRotl(merged[5], 7) +
+                  TileHashRotl(merged[6], 12) + TileHashRotl(merged[7], 18);
+    lo = TileHashAvalanche(lo + (uint32_t)width * HASH_PRIME5);
+    hi = TileHashAvalanche(hi + (uint32_t)height * HASH_PRIME4);
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// ================================================================================================
+
+uint64_t TileHashScalar(const uint16_t* src, size_t pitch, int width, int height)
+{
+    uint32_t lanes[HASH_SETS][HASH_LANES];
+    TileHashInit(lanes);
+
+    for (int y = 0; y < height; ++y) {
+        const uint16_t* row = src + (y * pitch);
+        uint32_t (&set)[HASH_LANES] = lanes[y % HASH_SETS];
+        for (int x = 0; x < width; x += 16) {
+            for (size_t i = 0; i < HASH_LANES; ++i) {
+                uint32_t word = (uint32_t)row[x + (i * 2)] | ((uint32_t)row[x + (i * 2) + 1] << 16);
+                set[i] = TileHashRotl(set[i] + (word * HASH_PRIME2), 13) * HASH_PRIME1;
+            }
+        }
+    }
+
+    return TileHashFinish(lanes, width, height);
+}
+
+#ifdef LEGACY_PIXELS_X86
+
+// ================================================================================================
+
+PIXELS_TARGET("sse2")
+static inline __m128i TileHashMul32SSE2(__m128i a, __m128i b)
+{
+    // No pmulld until SSE4.1, so multiply the even and odd lanes separately and stitch the low
+    // halves back together.
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// ================================================================================================
+
+PIXELS_TARGET("sse2")
+static inline __m128i TileHashRoundSSE2(__m128i lanes, __m128i data)
+{
+    const __m128i prime1 = _mm_set1_epi32((int)HASH_PRIME1);
+    const __m128i prime2 = _mm_set1_epi32((int)HASH_PRIME2);
+    lanes = _mm_add_epi32(lanes, TileHashMul32SSE2(data, prime2));
+    lanes = _mm_or_si128(_mm_slli_epi32(lanes, 13), _mm_srli_epi32(lanes, 19));
+    return TileHashMul32SSE2(lanes, prime1);
+}
+
+// ================================================================================================
+
+PIXELS_TARGET("sse2")
+uint64_t TileHashSSE2(const uint16_t* src, size_t pitch, int width, int height)
+{
+    alignas(16) uint32_t lanes[HASH_SETS][HASH_LANES];
+    TileHashInit(lanes);
+    __m128i state[HASH_SETS][2];
+    for (size_t set = 0; set < HASH_SETS; ++set) {
+        state[set][0] = _mm_load_si128((const __m128i*)&lanes[set][0]);
+        state[set][1] = _mm_load_si128((const __m128i*)&lanes[set][4]);
+    }
+
+    for (int y = 0; y < height; ++y) {
+        const uint16_t* row = src + (y * pitch);
+        __m128i (&set)[2] = state[y % HASH_SETS];
+        for (int x = 0; x < width; x += 16) {
+            set[0] = TileHashRoundSSE2(set[0], _mm_loadu_si128((const __m128i*)(row + x)));
+            set[1] = TileHashRoundSSE2(set[1], _mm_loadu_si128((const __m128i*)(row + x + 8)));
+        }
+    }
+
+    for (size_t set = 0; set < HASH_SETS; ++set) {
+        _mm_store_si128((__m128i*)&lanes[set][0], state[set][0]);
+        _mm_store_si128((__m128i*)&lanes[set][4], state[set][1]);
+    }
+    return TileHashFinish(lanes, width, height);
+}
+
+// ================================================================================================
+
+PIXELS_TARGET("avx2")
+uint64_t TileHashAVX2(const uint16_t* src, size_t pitch, int width, int height)
+{
+    alignas(32) uint32_t lanes[HASH_SETS][HASH_LANES];
+    TileHashInit(lanes);
+    __m256i state[HASH_SETS];
+    for (size_t set = 0; set < HASH_SETS; ++set)
+        state[set] = _mm256_load_si256((const __m256i*)lanes[set]);
+    const __m256i prime1 = _mm256_set1_epi32((int)HASH_PRIME1);
+    const __m256i prime2 = _mm256_set1_epi32((int)HASH_PRIME2);
+
+    for (int y = 0; y < height; ++y) {
+        const uint16_t* row = src + (y * pitch);
+        __m256i& set = state[y % HASH_SETS];
+        for (int x = 0; x < width; x += 16) {
+            __m256i data = _mm256_loadu_si256((const __m256i*)(row + x));
+            set = _mm256_add_epi32(set, _mm256_mullo_epi32(data, prime2));
+            set = _mm256_or_si256(_mm256_slli_epi32(set, 13), _mm256_srli_epi32(set, 19));
+            set = _mm256_mullo_epi32(set, prime1);
+        }
+    }
+
+    for (size_t set = 0; set < HASH_SETS; ++set)
+        _mm256_store_si256((__m256i*)lanes[set], state[set]);
+    return TileHashFinish(lanes, width, height);
+}
+
+#endif // LEGACY_PIXELS_X86
+
+// ================================================================================================
+
+FHashTile TileHashSelect()
+{
+#ifdef LEGACY_PIXELS_X86
+    uint32_t cpu = PixelsDetectCPU();
+    if (cpu & e_cpuAVX2)
+        return TileHashAVX2;
+    if (cpu & e_cpuSSE2)
+        return TileHashSSE2;
+#endif
+    return TileHashScalar;
+}
+
+// ================================================================================================
+
+TileHasher::TileHasher(int width, int height, int tileSize)
+    : m_hash(TileHashSelect()), m_width(width), m_height(height), m_tileSize(tileSize),
+      m_tilesX((width + tileSize - 1) / tileSize), m_tilesY((height + tileSize - 1) / tileSize),
+      m_valid(false)
+{
+    m_hashes.resize(m_tilesX * m_tilesY);
+    m_touched.resize(m_tilesX * m_tilesY);
+    m_newHashes.resize(m_tilesX * m_tilesY);
+}
+
+// ================================================================================================
+
+size_t TileHasher::filter(const uint16_t* frame, size_t pitch, DirtyRegion& damage, WorkerPool* workers)
+{
+    // Figure out which tiles the damage touches. If the damage was a bit sloppy, that's fine,
+    // we'll only end up hashing a few more tiles than we strictly needed to.
+    std::fill(m_touched.begin(), m_touched.end(), 0);
+    for (const Rect& rect : damage) {
+        for (int ty = rect.top / m_tileSize; ty <= (rect.bottom - 1) / m_tileSize; ++ty)
+            for (int tx = rect.left / m_tileSize; tx <= (rect.right - 1) / m_tileSize; ++tx)
+                m_touched[ty * m_tilesX + tx] = 1;
+    }
+
+    // Hashing is the expensive part, and every tile is independent, so that can be spread out.
+    // Comparing and building runs is cheap and has to happen in order anyway.
+    auto hashRow = [&](size_t ty) {
+        for (int tx = 0; tx < m_tilesX; ++tx) {
+            size_t idx = (ty * m_tilesX) + tx;
+            if (!m_touched[idx])
+                continue;
+            int x = tx * m_tileSize;
+            int y = (int)ty * m_tileSize;
+            m_newHashes[idx] = m_hash(frame + (y * pitch) + x, pitch, std::min(m_tileSize, m_width - x),
+                                      std::min(m_tileSize, m_height - y));
+        }
+    };
+    if (workers)
+        workers->run(m_tilesY, hashRow);
+    else
+        for (int ty = 0; ty < m_tilesY; ++ty)
+            hashRow(ty);
+
+    size_t nhashed = 0;
+    DirtyRegion changed{ m_width, m_height };
+    for (int ty = 0; ty < m_tilesY; ++ty) {
+        // Coalesce horizontal runs of changed tiles so the region doesn't have to.
+        int runStart = -1;
+        for (int tx = 0; tx <= m_tilesX; ++tx) {
+            bool isChanged = false;
+            if (tx < m_tilesX && m_touched[ty * m_tilesX + tx]) {
+                size_t idx = (ty * m_tilesX) + tx;
+                isChanged = !m_valid || m_newHashes[idx] != m_hashes[idx];
+                m_hashes[idx] = m_newHashes[idx];
+                nhashed++;
+            }
+
+            if (isChanged && runStart == -1) {
+                runStart = tx;
+            } else if (!isChanged && runStart != -1) {
+                changed.add({ runStart * m_tileSize, ty * m_tileSize, tx * m_tileSize,
+                              (ty + 1) * m_tileSize });
+                runStart = -1;
+            }
+        }
+    }
+
+    // Tiles that weren't hashed this time still have stale hashes if we were invalid, so only
+    // trust the table once everything has been seen.
+    if (!m_valid && damage.full())
+        m_valid = true;
+    damage = changed;
+    return nhashed;
+}
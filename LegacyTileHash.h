@@ -0,0 +1,80 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_TILEHASH_H
+#define __LEGACY_TILEHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "LegacyPixels.h"
+#include "LegacyRegion.h"
+
+class WorkerPool;
+
+// ================================================================================================
+
+typedef uint64_t(*FHashTile)(const uint16_t* src, size_t pitch, int width, int height);
+
+uint64_t TileHashScalar(const uint16_t* src, size_t pitch, int width, int height);
+#ifdef LEGACY_PIXELS_X86
+uint64_t TileHashSSE2(const uint16_t* src, size_t pitch, int width, int height);
+uint64_t TileHashAVX2(const uint16_t* src, size_t pitch, int width, int height);
+#endif
+FHashTile TileHashSelect();
+
+// ================================================================================================
+
+// The game likes to redraw things that haven't actually changed -- idle menus and repeated
+// BltFast calls of the same background are the big offenders. This splits the frame into
+// fixed tiles and remembers a hash of each, so that we can throw away damage that did not
+// actually change any pixels.
+class TileHasher
+{
+    FHashTile m_hash;
+    int m_width;
+    int m_height;
+    int m_tileSize;
+    int m_tilesX;
+    int m_tilesY;
+    std::vector<uint64_t> m_hashes;
+    std::vector<uint8_t> m_touched;
+    std::vector<uint64_t> m_newHashes;
+    bool m_valid;
+
+public:
+    // The tile size must be a multiple of 16 pixels.
+    TileHasher(int width, int height, int tileSize);
+
+    int tileSize() const { return m_tileSize; }
+
+    // Forget everything we know, so that the next filter passes all damage through.
+    void invalidate() { m_valid = false; }
+
+    // Rehashes every tile touched by damage and replaces damage with the tiles that changed.
+    // Returns the number of tiles that were hashed. If a worker pool is given, each row of tiles
+    // is hashed on whichever thread gets to it first.
+    size_t filter(const uint16_t* frame, size_t pitch, DirtyRegion& damage,
+                  WorkerPool* workers = nullptr);
+};
+
+#endif
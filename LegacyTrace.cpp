@@ -0,0 +1,560 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyTrace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <Windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+// ================================================================================================
+
+// The file is mapped a window at a time, so that long traces don't eat up the address space of
+// a 32-bit game. Windows can only map on 64KiB boundaries, which is a multiple of every page
+// size we care about.
+constexpr size_t TRACE_WINDOW_SIZE = 16 * 1024 * 1024;
+constexpr size_t TRACE_MAP_ALIGNMENT = 64 * 1024;
+constexpr size_t TRACE_RECORD_ALIGNMENT = 8;
+
+// ================================================================================================
+
+struct _TraceFile
+{
+#ifdef _WIN32
+    HANDLE m_file{ INVALID_HANDLE_VALUE };
+    HANDLE m_mapping{ nullptr };
+#else
+    int m_fd{ -1 };
+#endif
+    uint8_t* m_view{ nullptr };
+    uint64_t m_viewStart{ 0 };
+    size_t m_viewSize{ 0 };
+    uint64_t m_size{ 0 };
+
+    ~_TraceFile() { close(); }
+
+    bool open(const char* path);
+    bool map(uint64_t start, size_t size);
+    void unmap();
+    bool writeAt(uint64_t offset, const void* data, size_t size);
+    bool close();
+
+    // Returns somewhere to put the next size bytes, moving the window along if need be.
+    uint8_t* append(size_t size);
+};
+
+// ================================================================================================
+
+bool _TraceFile::open(const char* path)
+{
+#ifdef _WIN32
+    m_file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                         CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    return m_file != INVALID_HANDLE_VALUE;
+#else
+    m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    return m_fd != -1;
+#endif
+}
+
+// ================================================================================================
+
+bool _TraceFile::map(uint64_t start, size_t size)
+{
+    // Mapping past the end of the file grows it to fit. It gets cut back down on close.
+    uint64_t end = start + size;
+#ifdef _WIN32
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE, (DWORD)(end >> 32),
+                                   (DWORD)end, nullptr);
+    if (!m_mapping)
+        return false;
+    m_view = (uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_WRITE, (DWORD)(start >> 32),
+                                     (DWORD)start, size);
+    if (!m_view) {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+        return false;
+    }
+#else
+    if (ftruncate(m_fd, (off_t)end) != 0)
+        return false;
+    void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, (off_t)start);
+    if (view == MAP_FAILED)
+        return false;
+    m_view = (uint8_t*)view;
+#endif
+    m_viewStart = start;
+    m_viewSize = size;
+    return true;
+}
+
+// ================================================================================================
+
+void _TraceFile::unmap()
+{
+    if (!m_view)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(m_view);
+    CloseHandle(m_mapping);
+    m_mapping = nullptr;
+#else
+    munmap(m_view, m_viewSize);
+#endif
+    m_view = nullptr;
+    m_viewSize = 0;
+}
+
+// ================================================================================================
+
+bool _TraceFile::writeAt(uint64_t offset, const void* data, size_t size)
+{
+#ifdef _WIN32
+    LARGE_INTEGER position;
+    position.QuadPart = (LONGLONG)offset;
+    DWORD written = 0;
+    return SetFilePointerEx(m_file, position, nullptr, FILE_BEGIN) &&
+           WriteFile(m_file, data, (DWORD)size, &written, nullptr) && written == size;
+#else
+    return pwrite(m_fd, data, size, (off_t)offset) == (ssize_t)size;
+#endif
+}
+
+// ================================================================================================
+
+bool _TraceFile::close()
+{
+    // The mapping always runs past the end of what was written, so trim off the slack.
+    bool result = true;
+    unmap();
+#ifdef _WIN32
+    if (m_file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER size;
+        size.QuadPart = (LONGLONG)m_size;
+        result = SetFilePointerEx(m_file, size, nullptr, FILE_BEGIN) && SetEndOfFile(m_file);
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_fd != -1) {
+        result = ftruncate(m_fd, (off_t)m_size) == 0;
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#endif
+    return result;
+}
+
+// ================================================================================================
+
+uint8_t* _TraceFile::append(size_t size)
+{
+    if (!m_view || m_size + size > m_viewStart + m_viewSize) {
+        unmap();
+        uint64_t start = m_size - (m_size % TRACE_MAP_ALIGNMENT);
+        size_t window = std::max(TRACE_WINDOW_SIZE, (size_t)(m_size - start) + size);
+        window = ((window + TRACE_MAP_ALIGNMENT - 1) / TRACE_MAP_ALIGNMENT) * TRACE_MAP_ALIGNMENT;
+        if (!map(start, window))
+            return nullptr;
+    }
+
+    uint8_t* result = m_view + (m_size - m_viewStart);
+    m_size += size;
+    return result;
+}
+
+// ================================================================================================
+
+const char* TraceEventName(TraceEvent event)
+{
+    switch (event) {
+    case e_traceSnapshot:
+        return "snapshot";
+    case e_traceLock:
+        return "lock";
+    case e_traceUnlock:
+        return "unlock";
+    case e_traceGetDC:
+        return "getdc";
+    case e_traceReleaseDC:
+        return "releasedc";
+    case e_traceBltFast:
+        return "bltfast";
+    default:
+        return "unknown";
+    }
+}
+
+// ================================================================================================
+
+static inline size_t TracePadding(size_t size)
+{
+    return (TRACE_RECORD_ALIGNMENT - (size % TRACE_RECORD_ALIGNMENT)) % TRACE_RECORD_ALIGNMENT;
+}
+
+// ================================================================================================
+
+TraceRecorder::TraceRecorder(std::ostream& log)
+    : m_log(log)
+{
+}
+
+// ================================================================================================
+
+TraceRecorder::~TraceRecorder()
+{
+    close();
+}
+
+// ================================================================================================
+
+bool TraceRecorder::open(const char* path, int width, int height)
+{
+    close();
+
+    std::unique_ptr<_TraceFile> file{ new _TraceFile };
+    if (!file->open(path)) {
+        m_log << "TraceRecorder: ERROR failed to create " << path << std::endl;
+        return false;
+    }
+
+    TraceFileHeader header{ };
+    memcpy(header.m_magic, TRACE_MAGIC, sizeof(header.m_magic));
+    header.m_versionMajor = TRACE_VERSION_MAJOR;
+    header.m_versionMinor = TRACE_VERSION_MINOR;
+    header.m_headerSize = sizeof(TraceFileHeader);
+    header.m_recordHeaderSize = sizeof(TraceRecordHeader);
+    header.m_width = (uint16_t)width;
+    header.m_height = (uint16_t)height;
+    header.m_format = e_traceFormatRGB565;
+    uint8_t* dst = file->append(sizeof(header));
+    if (!dst) {
+        m_log << "TraceRecorder: ERROR failed to map " << path << std::endl;
+        return false;
+    }
+    memcpy(dst, &header, sizeof(header));
+
+    m_file = std::move(file);
+    m_width = width;
+    m_height = height;
+    m_shadow.assign((size_t)width * height, 0);
+    m_records = 0;
+    m_rawBytes = 0;
+    m_fileBytes = sizeof(header);
+    m_start = std::chrono::steady_clock::now();
+    m_quit = false;
+    m_writerThread = std::thread(&TraceRecorder::writerThread, this);
+    m_recording = true;
+    m_log << "TraceRecorder: recording " << width << "x" << height << " to " << path << std::endl;
+    return true;
+}
+
+// ================================================================================================
+
+void TraceRecorder::close()
+{
+    if (!m_writerThread.joinable())
+        return;
+
+    m_recording = false;
+    m_quit = true;
+    m_queueEvent.signal();
+    m_writerThread.join();
+
+    // The record count is the only thing that can't be known up front.
+    m_file->unmap();
+    uint32_t records = m_records;
+    if (!m_file->writeAt(offsetof(TraceFileHeader, m_records), &records, sizeof(records)) ||
+        !m_file->close())
+        m_log << "TraceRecorder: ERROR failed to finish the trace" << std::endl;
+    m_file.reset();
+
+    m_log << "TraceRecorder: " << std::dec << records << " records, " << rawBytes()
+          << " bytes of pixels down to " << fileBytes() << " bytes" << std::endl;
+}
+
+// ================================================================================================
+
+void TraceRecorder::record(TraceEvent event, const Rect& rect, const uint16_t* pixels, size_t pitch)
+{
+    if (!recording())
+        return;
+
+    Rect clipped = rect.intersect({ 0, 0, m_width, m_height });
+    if (clipped.empty())
+        clipped = { 0, 0, 0, 0 };
+    else if (pixels)
+        pixels = (const uint16_t*)((const uint8_t*)pixels + ((clipped.top - rect.top) * pitch)) +
+                 (clipped.left - rect.left);
+
+    TraceRecordHeader header{ };
+    header.m_event = (uint8_t)event;
+    header.m_encoding = (pixels && !clipped.empty()) ? e_traceDeltaRLE : e_traceNoPixels;
+    header.m_time = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - m_start).count();
+    header.m_left = (int16_t)clipped.left;
+    header.m_top = (int16_t)clipped.top;
+    header.m_right = (int16_t)clipped.right;
+    header.m_bottom = (int16_t)clipped.bottom;
+
+    // The raw pixels tag along right behind the header. The writer thread turns them into
+    // deltas and fixes up the size.
+    {
+        std::lock_guard<std::mutex> _(m_queueMut);
+        const uint8_t* bytes = (const uint8_t*)&header;
+        m_queue.insert(m_queue.end(), bytes, bytes + sizeof(header));
+        if (header.m_encoding != e_traceNoPixels) {
+            for (int y = 0; y < clipped.height(); ++y) {
+                const uint8_t* row = (const uint8_t*)pixels + (y * pitch);
+                m_queue.insert(m_queue.end(), row, row + (clipped.width() * sizeof(uint16_t)));
+            }
+        }
+    }
+    m_queueEvent.signal();
+}
+
+// ================================================================================================
+
+void TraceRecorder::writerThread()
+{
+    bool ok = true;
+    while (ok) {
+        m_queueEvent.wait();
+        bool quit = m_quit;
+        {
+            std::lock_guard<std::mutex> _(m_queueMut);
+            std::swap(m_queue, m_draining);
+        }
+        ok = writeRecords();
+        m_draining.clear();
+        if (quit)
+            break;
+    }
+
+    if (!ok) {
+        m_recording = false;
+        m_log << "TraceRecorder: ERROR ran out of room for the trace, giving up" << std::endl;
+    }
+}
+
+// ================================================================================================
+
+bool TraceRecorder::writeRecords()
+{
+    size_t offset = 0;
+    while (offset < m_draining.size()) {
+        TraceRecordHeader header;
+        memcpy(&header, m_draining.data() + offset, sizeof(header));
+        offset += sizeof(header);
+
+        Rect rect{ header.m_left, header.m_top, header.m_right, header.m_bottom };
+        m_encoded.clear();
+        if (header.m_encoding != e_traceNoPixels) {
+            encode(rect, (const uint16_t*)(m_draining.data() + offset));
+            offset += rect.area() * sizeof(uint16_t);
+            m_rawBytes.fetch_add(rect.area() * sizeof(uint16_t), std::memory_order_relaxed);
+        }
+
+        header.m_size = (uint32_t)(m_encoded.size() * sizeof(uint16_t));
+        size_t padding = TracePadding(sizeof(header) + header.m_size);
+        size_t total = sizeof(header) + header.m_size + padding;
+        uint8_t* dst = m_file->append(total);
+        if (!dst)
+            return false;
+        memcpy(dst, &header, sizeof(header));
+        memcpy(dst + sizeof(header), m_encoded.data(), header.m_size);
+        memset(dst + sizeof(header) + header.m_size, 0, padding);
+
+        m_records.fetch_add(1, std::memory_order_relaxed);
+        m_fileBytes.fetch_add(total, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+// ================================================================================================
+
+void TraceRecorder::encode(const Rect& rect, const uint16_t* pixels)
+{
+    // Most writes only change a few of the pixels they cover, and the ones that do change tend
+    // to come in clumps. A lone unchanged pixel in the middle of a clump is cheaper to keep as
+    // a zero delta than to start a new run for.
+    size_t count = rect.area();
+    size_t width = rect.width();
+    auto delta = [&](size_t i) -> uint16_t {
+        size_t y = rect.top + (i / width);
+        size_t x = rect.left + (i % width);
+        return pixels[i] ^ m_shadow[(y * m_width) + x];
+    };
+
+    size_t i = 0;
+    while (i < count) {
+        size_t unchanged = 0;
+        while (i < count && unchanged < UINT16_MAX && delta(i) == 0) {
+            unchanged++;
+            i++;
+        }
+        if (i == count)
+            break;
+
+        size_t runStart = m_encoded.size();
+        m_encoded.push_back((uint16_t)unchanged);
+        m_encoded.push_back(0);
+        size_t changed = 0;
+        while (i < count && changed < UINT16_MAX) {
+            uint16_t d = delta(i);
+            if (d == 0 && (i + 1 == count || delta(i + 1) == 0))
+                break;
+            m_encoded.push_back(d);
+            changed++;
+            i++;
+        }
+        m_encoded[runStart + 1] = (uint16_t)changed;
+    }
+
+    // Now the shadow can catch up.
+    for (int y = rect.top; y < rect.bottom; ++y)
+        memcpy(&m_shadow[(y * m_width) + rect.left], pixels + ((y - rect.top) * width),
+               width * sizeof(uint16_t));
+}
+
+// ================================================================================================
+
+bool TraceReader::open(const char* path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream) {
+        m_log << "TraceReader: ERROR failed to open " << path << std::endl;
+        return false;
+    }
+    m_data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+
+    if (m_data.size() < sizeof(TraceFileHeader)) {
+        m_log << "TraceReader: ERROR " << path << " is too short to be a trace" << std::endl;
+        return false;
+    }
+    memcpy(&m_header, m_data.data(), sizeof(m_header));
+    if (memcmp(m_header.m_magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        m_log << "TraceReader: ERROR " << path << " is not a trace" << std::endl;
+        return false;
+    }
+    if (m_header.m_versionMajor != TRACE_VERSION_MAJOR) {
+        m_log << "TraceReader: ERROR " << path << " is version " << m_header.m_versionMajor
+              << "." << m_header.m_versionMinor << ", but we only understand "
+              << TRACE_VERSION_MAJOR << ".x" << std::endl;
+        return false;
+    }
+    if (m_header.m_headerSize < sizeof(TraceFileHeader) ||
+        m_header.m_recordHeaderSize < sizeof(TraceRecordHeader) ||
+        m_header.m_format != e_traceFormatRGB565) {
+        m_log << "TraceReader: ERROR " << path << " has a header we don't understand" << std::endl;
+        return false;
+    }
+    if (!m_header.m_records)
+        m_log << "TraceReader: WARNING " << path << " was never closed and may be truncated" << std::endl;
+
+    rewind();
+    return true;
+}
+
+// ================================================================================================
+
+void TraceReader::rewind()
+{
+    m_offset = m_header.m_headerSize;
+    m_surface.assign((size_t)m_header.m_width * m_header.m_height, 0);
+}
+
+// ================================================================================================
+
+bool TraceReader::next(TraceRecord& record)
+{
+    if (m_offset + m_header.m_recordHeaderSize > m_data.size())
+        return false;
+
+    TraceRecordHeader header;
+    memcpy(&header, m_data.data() + m_offset, sizeof(header));
+    size_t payload = m_offset + m_header.m_recordHeaderSize;
+    if (payload + header.m_size > m_data.size())
+        return false;
+
+    record.m_event = (TraceEvent)header.m_event;
+    record.m_rect = { header.m_left, header.m_top, header.m_right, header.m_bottom };
+    record.m_time = std::chrono::nanoseconds(header.m_time);
+    record.m_pixels = header.m_encoding == e_traceDeltaRLE;
+    if (!record.m_rect.empty() && !Rect{ 0, 0, width(), height() }.contains(record.m_rect)) {
+        m_log << "TraceReader: ERROR record at " << m_offset << " is off the surface" << std::endl;
+        return false;
+    }
+    if (!decode(header, m_data.data() + payload)) {
+        m_log << "TraceReader: ERROR record at " << m_offset << " is corrupt" << std::endl;
+        return false;
+    }
+
+    size_t size = m_header.m_recordHeaderSize + header.m_size;
+    m_offset += size + TracePadding(size);
+    return true;
+}
+
+// ================================================================================================
+
+bool TraceReader::decode(const TraceRecordHeader& header, const uint8_t* payload)
+{
+    if (header.m_encoding == e_traceNoPixels)
+        return true;
+    if (header.m_encoding != e_traceDeltaRLE || header.m_size % sizeof(uint16_t))
+        return false;
+
+    Rect rect{ header.m_left, header.m_top, header.m_right, header.m_bottom };
+    size_t count = rect.area();
+    size_t width = rect.width();
+    size_t words = header.m_size / sizeof(uint16_t);
+    size_t w = 0;
+    size_t i = 0;
+    auto word = [payload](size_t idx) {
+        uint16_t value;
+        memcpy(&value, payload + (idx * sizeof(uint16_t)), sizeof(value));
+        return value;
+    };
+    while (w + 2 <= words) {
+        i += word(w);
+        size_t changed = word(w + 1);
+        w += 2;
+        if (i + changed > count || w + changed > words)
+            return false;
+        for (size_t j = 0; j < changed; ++j, ++i, ++w) {
+            size_t y = rect.top + (i / width);
+            size_t x = rect.left + (i % width);
+            m_surface[(y * m_header.m_width) + x] ^= word(w);
+        }
+    }
+    return w == words;
+}
@@ -0,0 +1,223 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_TRACE_H
+#define __LEGACY_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "LegacyEvent.h"
+#include "LegacyRegion.h"
+
+// ================================================================================================
+
+// Surface access traces
+// ---------------------
+// A trace is everything the game did to the proxy surface, in order, with enough of the pixels
+// to rebuild the surface as it was after every step. Everything is little endian.
+//
+// The file starts with a TraceFileHeader. The major version changes whenever an old reader
+// would misunderstand a new file, and the minor version when things were only added. Readers
+// must use the header sizes stored in the file rather than their own, so that fields can be
+// tacked onto the end of either header without breaking anybody.
+//
+// After the file header come the records, one per surface call. Each one is a TraceRecordHeader
+// followed by m_size bytes of payload, padded out to a multiple of eight bytes. The rect is the
+// area the call covered, already clipped to the surface. The time is nanoseconds since the
+// trace started, and records are always in time order.
+//
+// Calls that write to the surface carry the new contents of their rect, XORed against what was
+// there before and run-length encoded (e_traceDeltaRLE). The payload is a series of runs, each
+// a uint16_t count of unchanged pixels, a uint16_t count of changed pixels and then that many
+// uint16_t XOR deltas, walking the rect a row at a time. Anything past the last run is
+// unchanged. The first record is always an e_traceSnapshot of the whole surface, which is
+// XORed against all zeroes.
+
+constexpr char TRACE_MAGIC[8] = { 'L', 'G', 'C', 'Y', 'T', 'R', 'C', '\0' };
+constexpr uint16_t TRACE_VERSION_MAJOR = 1;
+constexpr uint16_t TRACE_VERSION_MINOR = 0;
+
+enum TraceEvent
+{
+    e_traceSnapshot = 1,
+    e_traceLock = 2,
+    e_traceUnlock = 3,
+    e_traceGetDC = 4,
+    e_traceReleaseDC = 5,
+    e_traceBltFast = 6,
+};
+
+enum TraceEncoding
+{
+    e_traceNoPixels = 0,
+    e_traceDeltaRLE = 1,
+};
+
+// The surface is always RGB565.
+enum TraceFormat
+{
+    e_traceFormatRGB565 = 1,
+};
+
+struct TraceFileHeader
+{
+    char m_magic[8];
+    uint16_t m_versionMajor;
+    uint16_t m_versionMinor;
+    uint16_t m_headerSize;
+    uint16_t m_recordHeaderSize;
+    uint16_t m_width;
+    uint16_t m_height;
+    uint32_t m_format;
+
+    // Filled in when the trace is closed. Zero means that never happened, and the trace ends
+    // wherever the last complete record does.
+    uint32_t m_records;
+    uint32_t m_reserved;
+};
+static_assert(sizeof(TraceFileHeader) == 32, "TraceFileHeader must be 32 bytes");
+
+struct TraceRecordHeader
+{
+    uint8_t m_event;
+    uint8_t m_encoding;
+    uint16_t m_reserved;
+    uint32_t m_size;
+    uint64_t m_time;
+    int16_t m_left;
+    int16_t m_top;
+    int16_t m_right;
+    int16_t m_bottom;
+};
+static_assert(sizeof(TraceRecordHeader) == 24, "TraceRecordHeader must be 24 bytes");
+
+const char* TraceEventName(TraceEvent event);
+
+// ================================================================================================
+
+struct _TraceFile;
+
+// Writes a trace. Recording only copies the pixels out, and everything else happens on a
+// background thread, so the caller is held up about as long as a memcpy of the rect takes.
+// The file is memory mapped and grows as needed.
+class TraceRecorder
+{
+    std::ostream& m_log;
+    int m_width{ 0 };
+    int m_height{ 0 };
+    std::chrono::steady_clock::time_point m_start{ };
+    std::atomic<bool> m_recording{ false };
+
+    // Filled by whoever is recording and swapped out wholesale by the writer thread, so
+    // neither side ever waits on the other for longer than the copy.
+    std::mutex m_queueMut;
+    std::vector<uint8_t> m_queue;
+    Event m_queueEvent;
+    std::atomic<bool> m_quit{ false };
+    std::thread m_writerThread;
+
+    // Only touched by the writer thread.
+    std::unique_ptr<_TraceFile> m_file;
+    std::vector<uint8_t> m_draining;
+    std::vector<uint16_t> m_shadow;
+    std::vector<uint16_t> m_encoded;
+
+    std::atomic<uint32_t> m_records{ 0 };
+    std::atomic<uint64_t> m_rawBytes{ 0 };
+    std::atomic<uint64_t> m_fileBytes{ 0 };
+
+    void writerThread();
+    bool writeRecords();
+    void encode(const Rect& rect, const uint16_t* pixels);
+
+public:
+    TraceRecorder(std::ostream& log);
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    bool open(const char* path, int width, int height);
+    void close();
+
+    bool recording() const { return m_recording.load(std::memory_order_relaxed); }
+
+    // May be called from any thread, but the calls must be serialized, which the surface lock
+    // already takes care of. If the call wrote to the surface, pixels points at the top left
+    // of the rect as it is now, and pitch is in bytes.
+    void record(TraceEvent event, const Rect& rect, const uint16_t* pixels = nullptr,
+                size_t pitch = 0);
+
+    // How far the writer thread has gotten, which only settles once the trace is closed.
+    uint32_t records() const { return m_records.load(std::memory_order_relaxed); }
+    uint64_t rawBytes() const { return m_rawBytes.load(std::memory_order_relaxed); }
+    uint64_t fileBytes() const { return m_fileBytes.load(std::memory_order_relaxed); }
+};
+
+// ================================================================================================
+
+struct TraceRecord
+{
+    TraceEvent m_event;
+    Rect m_rect;
+    std::chrono::nanoseconds m_time;
+
+    // Whether the surface changed.
+    bool m_pixels;
+};
+
+// Reads a trace back one record at a time, rebuilding the surface as it goes.
+class TraceReader
+{
+    std::ostream& m_log;
+    std::vector<uint8_t> m_data;
+    TraceFileHeader m_header{ };
+    size_t m_offset{ 0 };
+    std::vector<uint16_t> m_surface;
+
+    bool decode(const TraceRecordHeader& header, const uint8_t* payload);
+
+public:
+    TraceReader(std::ostream& log) : m_log(log) { }
+
+    bool open(const char* path);
+    void rewind();
+
+    int width() const { return m_header.m_width; }
+    int height() const { return m_header.m_height; }
+    uint32_t records() const { return m_header.m_records; }
+
+    // Returns false at the end of the trace, or if the rest of it is garbage.
+    bool next(TraceRecord& record);
+
+    // The surface as of the last record read, with a pitch of width() pixels.
+    const uint16_t* surface() const { return m_surface.data(); }
+};
+
+#endif
@@ -0,0 +1,93 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_TRIPLEBUFFER_H
+#define __LEGACY_TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// ================================================================================================
+
+// Lock-free handoff between exactly one producer and one consumer. The producer always has a
+// back buffer to write into and the consumer always has a front buffer to read from, so neither
+// ever waits on the other. The third buffer sits in the middle. Publishing swaps the back buffer
+// into the middle and taking a frame swaps the middle into the front. If the producer publishes
+// twice before the consumer looks, the older frame is simply overwritten -- frames are dropped,
+// never queued.
+template<typename T>
+class TripleBuffer
+{
+    enum
+    {
+        e_indexMask = 0x3,
+        e_fresh = 0x4,
+    };
+
+    T m_buffers[3];
+    std::atomic<uint8_t> m_middle;
+    uint8_t m_back;
+    uint8_t m_front;
+
+public:
+    TripleBuffer()
+        : m_middle(1), m_back(0), m_front(2)
+    { }
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Producer side
+    T& back() { return m_buffers[m_back]; }
+    size_t backIndex() const { return m_back; }
+
+    // Returns true if the frame that was published before this one was never picked up.
+    bool publish()
+    {
+        uint8_t prev = m_middle.exchange(m_back | e_fresh, std::memory_order_acq_rel);
+        m_back = prev & e_indexMask;
+        return (prev & e_fresh) != 0;
+    }
+
+    // Whether the most recently published frame is still waiting for the consumer. This can
+    // flip from true to false at any time, but never the other way around.
+    bool pending() const { return (m_middle.load(std::memory_order_acquire) & e_fresh) != 0; }
+
+    // Consumer side
+    T& front() { return m_buffers[m_front]; }
+    size_t frontIndex() const { return m_front; }
+
+    // Returns true if a new frame was moved to the front.
+    bool take()
+    {
+        if (!pending())
+            return false;
+        uint8_t prev = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = prev & e_indexMask;
+        return true;
+    }
+
+    // Only safe when neither side is running.
+    T& operator[](size_t idx) { return m_buffers[idx]; }
+};
+
+#endif
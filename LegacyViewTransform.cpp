@@ -0,0 +1,81 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyViewTransform.h"
+
+// ================================================================================================
+
+ViewTransform ViewTransform::make(int32_t width, int32_t height, int32_t integerScale)
+{
+    ViewTransform view;
+    view.m_width = width;
+    view.m_height = height;
+    view.m_integerScale = integerScale;
+    view.m_toGameX = (((uint64_t)VIEW_GAME_WIDTH << 32) / (uint32_t)width) + 1;
+    view.m_toGameY = (((uint64_t)VIEW_GAME_HEIGHT << 32) / (uint32_t)height) + 1;
+    return view;
+}
+
+// ================================================================================================
+
+ViewTransformCell::ViewTransformCell(const ViewTransform& view)
+    : m_width(view.m_width), m_height(view.m_height), m_integerScale(view.m_integerScale),
+      m_toGameX(view.m_toGameX), m_toGameY(view.m_toGameY)
+{
+}
+
+// ================================================================================================
+
+void ViewTransformCell::publish(const ViewTransform& view)
+{
+    // Odd means a write is in progress. The fence keeps the stores below from being seen
+    // before the sequence says so.
+    uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+    m_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    m_width.store(view.m_width, std::memory_order_relaxed);
+    m_height.store(view.m_height, std::memory_order_relaxed);
+    m_integerScale.store(view.m_integerScale, std::memory_order_relaxed);
+    m_toGameX.store(view.m_toGameX, std::memory_order_relaxed);
+    m_toGameY.store(view.m_toGameY, std::memory_order_relaxed);
+
+    m_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// ================================================================================================
+
+ViewTransform ViewTransformCell::load() const
+{
+    ViewTransform view;
+    uint32_t before, after;
+    do {
+        before = m_sequence.load(std::memory_order_acquire);
+        view.m_width = m_width.load(std::memory_order_relaxed);
+        view.m_height = m_height.load(std::memory_order_relaxed);
+        view.m_integerScale = m_integerScale.load(std::memory_order_relaxed);
+        view.m_toGameX = m_toGameX.load(std::memory_order_relaxed);
+        view.m_toGameY = m_toGameY.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = m_sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return view;
+}
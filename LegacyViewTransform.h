@@ -0,0 +1,90 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_VIEWTRANSFORM_H
+#define __LEGACY_VIEWTRANSFORM_H
+
+#include <atomic>
+#include <cstdint>
+
+// ================================================================================================
+
+// The size Legacy.exe thinks its window is, no matter how big it really is.
+constexpr int32_t VIEW_GAME_WIDTH = 640;
+constexpr int32_t VIEW_GAME_HEIGHT = 480;
+
+// How big the client area is, how the game gets scaled up to fill it, and how to get from there
+// back to the game's 640x480. The factors are 32.32 fixed point, rounded up just far enough that
+// multiplying and shifting comes out the same as the integer division did for anything the size
+// of a screen. The integer scale is zero when the picture gets filtered instead.
+struct ViewTransform
+{
+    int32_t m_width;
+    int32_t m_height;
+    int32_t m_integerScale;
+    uint64_t m_toGameX;
+    uint64_t m_toGameY;
+
+    static ViewTransform make(int32_t width, int32_t height, int32_t integerScale = 0);
+
+    static int32_t scale(int32_t value, uint64_t factor)
+    {
+        // Division truncates toward zero, so negatives (the cursor left of or above the window)
+        // are scaled as positives to match.
+        if (value < 0)
+            return -(int32_t)(((uint64_t)-(int64_t)value * factor) >> 32);
+        return (int32_t)(((uint64_t)value * factor) >> 32);
+    }
+
+    int32_t toGameX(int32_t x) const { return scale(x, m_toGameX); }
+    int32_t toGameY(int32_t y) const { return scale(y, m_toGameY); }
+};
+
+// ================================================================================================
+
+// A seqlock around the current view transform. Resolution changes come from the window thread
+// and are rare, so readers never wait on anything and only go around again if they happened to
+// catch a change halfway through. Everything is an atomic so that a torn read is merely thrown
+// away instead of being undefined.
+class ViewTransformCell
+{
+    std::atomic<uint32_t> m_sequence{ 0 };
+    std::atomic<int32_t> m_width;
+    std::atomic<int32_t> m_height;
+    std::atomic<int32_t> m_integerScale;
+    std::atomic<uint64_t> m_toGameX;
+    std::atomic<uint64_t> m_toGameY;
+
+public:
+    ViewTransformCell(const ViewTransform& view);
+
+    ViewTransformCell(const ViewTransformCell&) = delete;
+    ViewTransformCell& operator=(const ViewTransformCell&) = delete;
+
+    // Only one thread may publish at a time.
+    void publish(const ViewTransform& view);
+    ViewTransform load() const;
+
+    // Bumped twice per publish, so this is how many there have been.
+    uint32_t version() const { return m_sequence.load(std::memory_order_acquire) / 2; }
+};
+
+#endif
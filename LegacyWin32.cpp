@@ -21,12 +21,18 @@
 
 #include "LegacyWindow.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cstdlib>
 #include <iterator>
-#include <mutex>
+#include <sstream>
 
 #include "DLL.h"
+#include "LegacyCursorCache.h"
+#include "LegacyLog.h"
+#include "LegacyMessageStats.h"
+#include "LegacyMessageTrace.h"
 #include "LegacyTypedefs.h"
+#include "LegacyViewTransform.h"
 #include "MinHookpp.h"
 
 // ================================================================================================
@@ -36,11 +42,15 @@ enum
     e_overrideWindowRect = (1<<0),
     e_leftMouseDown = (1<<1),
     e_mouseDragging = (1<<2),
+    e_mouseTracked = (1<<3),
 };
 
 #define IDM_RESOLUTION_START 0x1000
 #define IDM_SHOW_FPS 0x1100
 #define IDM_SHOW_FRAMETIME 0x1101
+#define IDM_SHOW_FRAMESTATS 0x1102
+#define IDM_SAVE_FRAMESTATS 0x1103
+#define IDM_SCALE_FILTER_START 0x1200
 
 struct _DialogWndData
 {
@@ -53,7 +63,7 @@ struct _DialogWndData
 
 // ================================================================================================
 
-extern std::ofstream s_log;
+extern AsyncLog s_log;
 
 static WNDPROC s_legacyWndProc{ };
 static HWND s_legacyHWND{ };
@@ -72,9 +82,14 @@ static POINT s_gameResolutionOptions[] {
     { 2048, 1536 },
     { 3200, 2400 },
 };
-static std::mutex s_gameResolutionLock;
+// s_gameResolution belongs to the window thread. Everybody else goes by this.
+static ViewTransformCell s_viewTransform{ ViewTransform::make(640, 480) };
 static POINT s_lastLmbDown{ 0 };
 static uint32_t s_flags{ 0 };
+static MessageTrace s_messageTrace;
+static MessageStats s_hookStats;
+static MessageStats s_gameStats;
+static CursorCache s_cursorCache;
 
 static MHpp_Hook<FRegisterClassExA>* s_registerClassHook = nullptr;
 static MHpp_Hook<FCreateWindowExA>* s_createWindowHook = nullptr;
@@ -121,8 +136,70 @@ static void LegacyHandleLMB(HWND wnd, bool down, int x, int y)
 
 // ================================================================================================
 
+static void LegacyUpdateCursorCache(HWND wnd, UINT msg, LPARAM lParam, DWORD time)
+{
+    // Ask to hear about the cursor leaving, since there might not be any nonclient area to cross
+    // on the way out. It's a one-shot, so it has to be asked again after every leave.
+    if (msg == WM_MOUSEMOVE && !(s_flags & e_mouseTracked)) {
+        TRACKMOUSEEVENT track{ sizeof(track), TME_LEAVE, wnd, 0 };
+        if (TrackMouseEvent(&track))
+            s_flags |= e_mouseTracked;
+    }
+
+    switch (msg) {
+    // These all carry the cursor position in client coordinates as of when they were posted,
+    // which may have been a while ago if the game was busy.
+    case WM_MOUSEMOVE:
+    case WM_LBUTTONDOWN:
+    case WM_LBUTTONUP:
+    case WM_LBUTTONDBLCLK:
+    case WM_RBUTTONDOWN:
+    case WM_RBUTTONUP:
+    case WM_RBUTTONDBLCLK:
+    case WM_MBUTTONDOWN:
+    case WM_MBUTTONUP:
+    case WM_MBUTTONDBLCLK:
+        s_cursorCache.update(GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam), time);
+        break;
+
+    // And after any of these, the cursor is somewhere else or the client area is.
+    case WM_MOUSELEAVE:
+        s_flags &= ~e_mouseTracked;
+        s_cursorCache.invalidate();
+        break;
+    case WM_NCMOUSEMOVE:
+    case WM_CAPTURECHANGED:
+    case WM_KILLFOCUS:
+    case WM_WINDOWPOSCHANGED:
+    case WM_SIZE:
+        s_cursorCache.invalidate();
+        break;
+    }
+}
+
+// ================================================================================================
+
+static void LegacyLogCursorCache()
+{
+    CursorCacheStats stats = s_cursorCache.stats();
+    s_log << "LegacyGetCursorPos: " << std::dec << stats.m_updates << " cursor cache update(s),";
+    for (int i = 0; i < e_cursorLookupCount; ++i)
+        s_log << " " << CursorLookupName((CursorLookup)i) << ": " << stats.m_lookups[i];
+    s_log << std::endl;
+}
+
+// ================================================================================================
+
 static void LegacyResizeGame()
 {
+    // Exact (or nearly exact) multiples of the game's size don't need any filtering at all, so
+    // just blow the pixels up and letterbox whatever is left. The factor goes out along with
+    // the size so the draw thread never sees one without the other.
+    int factor = ScaleIntegerFactor(640, 480, s_gameResolution.x, s_gameResolution.y);
+    if (factor)
+        s_log << "LegacyResizeGame: using " << std::dec << factor << "x integer scaling" << std::endl;
+    s_viewTransform.publish(ViewTransform::make(s_gameResolution.x, s_gameResolution.y, factor));
+
     // Resize game window for the requested game resolution + nonclient area
     RECT window_rect{ 0, 0, s_gameResolution.x, s_gameResolution.y };
     AdjustWindowRect(&window_rect, GetWindowLongA(s_legacyHWND, GWL_STYLE), TRUE);
@@ -161,40 +238,56 @@ static void LegacyResizeGame()
 
 // ================================================================================================
 
-static LRESULT WINAPI WndProcDebug(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
+static constexpr size_t Win32CountMessages()
 {
-#define DECLARE_WM(x) \
-    case x: \
-        s_log << #x << " "; \
-        break;
+    size_t count = 0;
+#define DECLARE_WM(x) count++
+#include "WM.inl"
+#undef DECLARE_WM
+    return count;
+}
 
-    LRESULT result = CallWindowProcA(s_legacyWndProc, wnd, msg, wParam, lParam);
+// ================================================================================================
 
-    s_log << "WndProc: Forwarded ";
-    switch (msg) {
+static constexpr MessageNames<Win32CountMessages()> Win32BuildMessageNames()
+{
+    std::array<MessageName, Win32CountMessages()> names{ };
+    size_t i = 0;
+#define DECLARE_WM(x) names[i++] = { x, #x }
 #include "WM.inl"
-    default:
-        s_log << "0x" << std::hex << msg << " ";
-        break;
-    }
+#undef DECLARE_WM
+    return names;
+}
 
-    s_log << std::hex << "wParam: 0x" << wParam << " lParam: 0x" << lParam << " Result: 0x"
-          << result << std::endl;
-    return result;
+static constexpr auto s_messageNames = Win32BuildMessageNames();
+static_assert(s_messageNames.unique(), "WM.inl has the same message in it more than once");
 
-#undef DECLARE_WM
+// ================================================================================================
+
+static const char* Win32MessageName(uint32_t msg)
+{
+    return s_messageNames.find(msg);
+}
+
+// ================================================================================================
+
+static LRESULT WINAPI WndProcGame(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    uint64_t start = StageReadCycles();
+    LRESULT result = CallWindowProcA(s_legacyWndProc, wnd, msg, wParam, lParam);
+    s_gameStats.record(msg, StageReadCycles() - start);
+    if (s_messageTrace.enabled())
+        s_messageTrace.record(e_messageWndProc, msg, wParam, lParam, result);
+    return result;
 }
 
 // ================================================================================================
 
 static LRESULT WINAPI LegacyWndProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
-//#define LEGACY_WM_DEBUG_LOG
-#ifdef LEGACY_WM_DEBUG_LOG
-    WNDPROC BaseWndProc = &WndProcDebug;
-#else
-    WNDPROC BaseWndProc = s_legacyWndProc;
-#endif
+    WNDPROC BaseWndProc = &WndProcGame;
+    if (wnd == s_legacyHWND)
+        LegacyUpdateCursorCache(wnd, msg, lParam, (DWORD)GetMessageTime());
 
     switch (msg) {
     case WM_CREATE: {
@@ -233,12 +326,12 @@ static LRESULT WINAPI LegacyWndProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lP
         LegacyHandleLMB(wnd, (wParam & MK_LBUTTON), x, y);
 
         // Translate mouse coordinates to the new window size.
-        x = (x * 640) / s_gameResolution.x;
-        y = (y * 480) / s_gameResolution.y;
+        ViewTransform view = s_viewTransform.load();
+        x = view.toGameX(x);
+        y = view.toGameY(y);
         LPARAM cursorPos = ((y & 0xFFFF) << 16 | (x & 0xFFFF));
 
-        // WM_MOUSEMOVE is spammy, so no debug logging.
-        return CallWindowProcA(s_legacyWndProc, wnd, msg, wParam, cursorPos);
+        return CallWindowProcA(BaseWndProc, wnd, msg, wParam, cursorPos);
     }
     case WM_CAPTURECHANGED: {
         ClipCursor(nullptr);
@@ -267,12 +360,22 @@ static LRESULT WINAPI LegacyWndProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lP
                 size_t idx = menuid - IDM_RESOLUTION_START;
                 if (s_gameResolution.x != s_gameResolutionOptions[idx].x &&
                     s_gameResolution.y != s_gameResolutionOptions[idx].y) {
-                    std::lock_guard<std::mutex> _(s_gameResolutionLock);
                     s_gameResolution = s_gameResolutionOptions[idx];
                     LegacyResizeGame();
                 }
                 return 0;
-            } else if (menuid == IDM_SHOW_FPS || menuid == IDM_SHOW_FRAMETIME) {
+            } else if (menuid >= IDM_SCALE_FILTER_START &&
+                       menuid < IDM_SCALE_FILTER_START + e_scaleFilterCount) {
+                CheckMenuRadioItem(s_hookMenu, IDM_SCALE_FILTER_START,
+                                   IDM_SCALE_FILTER_START + e_scaleFilterCount - 1, menuid,
+                                   MF_BYCOMMAND);
+                DDrawSetScaleFilter((ScaleFilter)(menuid - IDM_SCALE_FILTER_START));
+                return 0;
+            } else if (menuid == IDM_SAVE_FRAMESTATS) {
+                DDrawDumpFrameStats("legacy_framestats");
+                return 0;
+            } else if (menuid == IDM_SHOW_FPS || menuid == IDM_SHOW_FRAMETIME ||
+                       menuid == IDM_SHOW_FRAMESTATS) {
                 MENUITEMINFOA info{ 0 };
                 info.cbSize = sizeof(info);
                 info.fMask = MIIM_STATE;
@@ -288,8 +391,10 @@ static LRESULT WINAPI LegacyWndProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lP
 
                 if (menuid == IDM_SHOW_FPS)
                     DDrawShowFPS(toggle);
-                else
+                else if (menuid == IDM_SHOW_FRAMETIME)
                     DDrawShowFrameTime(toggle);
+                else
+                    DDrawShowFrameStats(toggle);
                 return 0;
             }
         }
@@ -298,19 +403,14 @@ static LRESULT WINAPI LegacyWndProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lP
 
     case WM_DESTROY: {
         DDrawJoin();
+        Win32DumpMessageTrace();
+        Win32DumpMessageStats();
+        LegacyLogCursorCache();
         LRESULT result = CallWindowProcA(BaseWndProc, wnd, msg, wParam, lParam);
         DDrawReleaseGdiObjects();
         return result;
     }
 
-#ifdef LEGACY_WM_DEBUG_LOG
-    // These are called so frequently the log is useless.
-    case WM_NCHITTEST:
-    case WM_SETCURSOR:
-    case WM_ENTERIDLE:
-        return CallWindowProcA(s_legacyWndProc, wnd, msg, wParam, lParam);
-#endif
-
     default:
         return CallWindowProcA(BaseWndProc, wnd, msg, wParam, lParam);
     }
@@ -318,6 +418,22 @@ static LRESULT WINAPI LegacyWndProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lP
 
 // ================================================================================================
 
+static LRESULT WINAPI LegacyWndProcTimed(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+    // Everything, including our own hacks, so it can be held up against what the game does.
+    uint64_t start = StageReadCycles();
+    LRESULT result = LegacyWndProc(wnd, msg, wParam, lParam);
+    uint64_t cycles = StageReadCycles() - start;
+    if (s_hookStats.record(msg, cycles)) {
+        const char* name = Win32MessageName(msg);
+        LEGACY_LOG(s_log, "LegacyWndProc: STALL: %s (0x%04x) took %.1f ms", name ? name : "?", msg,
+                   cycles / (s_hookStats.cyclesPerMicrosecond() * 1000.0));
+    }
+    return result;
+}
+
+// ================================================================================================
+
 static ATOM WINAPI LegacyRegisterClass(_In_ CONST WNDCLASSEXA* wndclass)
 {
     s_log << "RegisterClassExA: original WndProc " << std::hex << wndclass->lpfnWndProc << std::endl;
@@ -328,7 +444,7 @@ static ATOM WINAPI LegacyRegisterClass(_In_ CONST WNDCLASSEXA* wndclass)
 #endif
 
     // Naughty touching
-    const_cast<WNDCLASSEXA*>(wndclass)->lpfnWndProc = &LegacyWndProc;
+    const_cast<WNDCLASSEXA*>(wndclass)->lpfnWndProc = &LegacyWndProcTimed;
     return s_registerClassHook->original()(wndclass);
 }
 
@@ -374,9 +490,20 @@ static void LegacyFixMenu(HMENU menu)
         InsertMenuItemA(hmResolution, i, TRUE, &info);
     }
 
+    // Scaling filter menu
+    HMENU hmScaleFilter = CreateMenu();
+    AppendMenuA(s_hookMenu, MF_POPUP, (UINT_PTR)hmScaleFilter, "Scaling");
+    for (int i = 0; i < e_scaleFilterCount; ++i)
+        AppendMenuA(hmScaleFilter, MF_STRING, IDM_SCALE_FILTER_START + i, ScaleFilterName((ScaleFilter)i));
+    CheckMenuRadioItem(hmScaleFilter, IDM_SCALE_FILTER_START,
+                       IDM_SCALE_FILTER_START + e_scaleFilterCount - 1,
+                       IDM_SCALE_FILTER_START + e_scaleBilinear, MF_BYCOMMAND);
+
     AppendMenuA(s_hookMenu, MF_SEPARATOR, 0, nullptr);
     AppendMenuA(s_hookMenu, MF_STRING, IDM_SHOW_FPS, "Show FPS");
     AppendMenuA(s_hookMenu, MF_STRING, IDM_SHOW_FRAMETIME, "Show Frame Time");
+    AppendMenuA(s_hookMenu, MF_STRING, IDM_SHOW_FRAMESTATS, "Show Frame Time Percentiles");
+    AppendMenuA(s_hookMenu, MF_STRING, IDM_SAVE_FRAMESTATS, "Save Frame Statistics");
 }
 
 // ================================================================================================
@@ -481,15 +608,24 @@ static BOOL WINAPI LegacyGetClientRect(_In_ HWND hWnd, _Out_ LPRECT lpRect)
 
 static BOOL WINAPI LegacyGetCursorPos(_Out_ LPPOINT lpPoint)
 {
+    // Legacy.exe asks for the cursor constantly while panning, but the mouse messages we've
+    // already seen usually know the answer without two trips into the kernel. What Windows
+    // says isn't cached, since the game may well keep polling without pumping any messages.
+    ViewTransform view = s_viewTransform.load();
+    int32_t x, y;
     POINT pos{ 0 };
-    if (s_getCursorPosHook->original()(&pos) == FALSE)
-        return FALSE;
-    if (s_screenToClientHook->original()(s_legacyHWND, &pos) == FALSE)
-        return FALSE;
+    if (s_cursorCache.lookup(x, y, GetTickCount(), view.m_width, view.m_height) == e_cursorHit) {
+        pos = { x, y };
+    } else {
+        if (s_getCursorPosHook->original()(&pos) == FALSE)
+            return FALSE;
+        if (s_screenToClientHook->original()(s_legacyHWND, &pos) == FALSE)
+            return FALSE;
+    }
 
     // Legacy.exe operates at 640x480, so we need to translate our coordinates to that...
-    pos.x = (pos.x * 640) / s_gameResolution.x;
-    pos.y = (pos.y * 480) / s_gameResolution.y;
+    pos.x = view.toGameX(pos.x);
+    pos.y = view.toGameY(pos.y);
 
     *lpPoint = pos;
     return TRUE;
@@ -557,33 +693,6 @@ static int WINAPI LegacyGetSystemMetrics(_In_ int nIndex)
 
 // ================================================================================================
 
-static void PeekMessageDebug(LPMSG lpMsg, UINT wMsgFilterMin, UINT wMsgFilterMax, UINT wRemoveMsg)
-{
-    if (wRemoveMsg & PM_REMOVE)
-        s_log << "PeekMessageA: removed";
-    else
-        s_log << "PeekMessageA: peeked";
-    s_log << " wMsgFilterMin: 0x" << std::hex << wMsgFilterMin << " wMsgFilterMax: 0x"
-          << wMsgFilterMax << " msg: ";
-
-#define DECLARE_WM(x) \
-    case x: \
-        s_log << #x << " "; \
-        break;
-
-    switch (lpMsg->message) {
-#include "WM.inl"
-    default:
-        s_log << "0x" << std::hex << lpMsg->message << " ";
-        break;
-    }
-#undef DECLARE_WM
-
-    s_log << std::hex << "wParam: 0x" << lpMsg->wParam << " lParam: 0x" << lpMsg->lParam << std::endl;
-}
-
-// ================================================================================================
-
 static BOOL WINAPI LegacyPeekMessage(_Out_ LPMSG lpMsg, _In_opt_ HWND hWnd, _In_ UINT wMsgFilterMin,
                                      _In_ UINT wMsgFilterMax, _In_ UINT wRemoveMsg)
 {
@@ -591,11 +700,12 @@ static BOOL WINAPI LegacyPeekMessage(_Out_ LPMSG lpMsg, _In_opt_ HWND hWnd, _In_
     if (result == FALSE)
         return FALSE;
 
-//#define LEGACY_PEEKMSG_LOG
-//#define LEGACY_PEEKMSG_LOG_VERBOSE
-#if defined(LEGACY_PEEKMSG_LOG) && defined(LEGACY_PEEKMSG_LOG_VERBOSE)
-    PeekMessageDebug(lpMsg, wMsgFilterMin, wMsgFilterMax, wRemoveMsg);
-#endif
+    s_messageTrace.record((wRemoveMsg & PM_REMOVE) ? e_messageRemoved : e_messagePeeked, lpMsg->message,
+                          lpMsg->wParam, lpMsg->lParam);
+
+    // Anything only peeked at is still waiting behind whatever the WndProc is doing.
+    if ((wRemoveMsg & PM_REMOVE) && lpMsg->hwnd == s_legacyHWND && s_legacyHWND)
+        LegacyUpdateCursorCache(lpMsg->hwnd, lpMsg->message, lpMsg->lParam, lpMsg->time);
 
     if (!(wRemoveMsg & PM_REMOVE))
         return result;
@@ -609,12 +719,6 @@ static BOOL WINAPI LegacyPeekMessage(_Out_ LPMSG lpMsg, _In_opt_ HWND hWnd, _In_
         LegacyHandleLMB(hWnd, down, GET_X_LPARAM(lpMsg->lParam), GET_Y_LPARAM(lpMsg->lParam));
         break;
     }
-
-#if defined(LEGACY_PEEKMSG_LOG) && !defined(LEGACY_PEEKMSG_LOG_VERBOSE)
-    default:
-        PeekMessageDebug(lpMsg, wMsgFilterMin, wMsgFilterMax, wRemoveMsg);
-        break;
-#endif
     }
 
     return result;
@@ -695,24 +799,46 @@ static VOID WINAPI LegacyOutputDebugString(_In_opt_ LPCSTR lpOutputString)
 
 // ================================================================================================
 
-HWND Win32GetClientHWND()
+void Win32DumpMessageTrace()
 {
-    return s_legacyHWND;
+    if (!s_messageTrace.enabled())
+        return;
+
+    if (s_messageTrace.dump("legacy_window_messages.log", Win32MessageName))
+        s_log << "Win32DumpMessageTrace: wrote legacy_window_messages.log" << std::endl;
+    else
+        s_log << "Win32DumpMessageTrace: ERROR: could not write legacy_window_messages.log" << std::endl;
 }
 
 // ================================================================================================
 
-POINT Win32LockClientSize()
+void Win32DumpMessageStats()
 {
-    s_gameResolutionLock.lock();
-    return s_gameResolution;
+    std::ostringstream table;
+    s_hookStats.write(table, Win32MessageName, 10);
+    s_log << "Win32DumpMessageStats: LegacyWndProc, " << std::dec << s_hookStats.stalls()
+          << " stall(s) over " << s_hookStats.stallThreshold() << " ms\n" << table.str() << std::flush;
+
+    table.str("");
+    s_gameStats.write(table, Win32MessageName, 10);
+    s_log << "Win32DumpMessageStats: Legacy.exe WndProc, " << s_gameStats.stalls() << " stall(s)\n"
+          << table.str() << std::flush;
 }
 
 // ================================================================================================
 
-void Win32UnlockClientSize()
+HWND Win32GetClientHWND()
 {
-    s_gameResolutionLock.unlock();
+    return s_legacyHWND;
+}
+
+// ================================================================================================
+
+POINT Win32GetClientSize(int& integerScale)
+{
+    ViewTransform view = s_viewTransform.load();
+    integerScale = view.m_integerScale;
+    return { view.m_width, view.m_height };
 }
 
 // ================================================================================================
@@ -763,6 +889,26 @@ bool Win32SetThreadCount(int nthreads)
 
 bool Win32InitHooks()
 {
+    // Window message tracing is cheap enough to leave on, but it isn't free, so only if asked.
+    // The value is how many messages to keep per thread.
+    if (const char* env = std::getenv("LEGACY_WM_TRACE")) {
+        s_messageTrace.enable(std::max(atoi(env), 0));
+        s_log << "Win32InitHooks: tracing window messages" << std::endl;
+    }
+
+    // How old a cursor position from a mouse message may be and still be handed to the game.
+    if (const char* env = std::getenv("LEGACY_CURSOR_CACHE_MS")) {
+        s_cursorCache.setMaxAge(std::max(atoi(env), 0));
+        s_log << "Win32InitHooks: cursor cache max age " << std::dec << s_cursorCache.maxAge() << " ms"
+              << std::endl;
+    }
+
+    // How long a message may keep the WndProc busy before it gets logged.
+    if (const char* env = std::getenv("LEGACY_WM_STALL_MS")) {
+        s_hookStats.setStallThreshold(std::max(atoi(env), 1));
+        s_gameStats.setStallThreshold(std::max(atoi(env), 1));
+    }
+
     MAKE_HOOK(L"User32.dll", "RegisterClassExA", LegacyRegisterClass, s_registerClassHook);
     MAKE_HOOK(L"User32.dll", "CreateWindowExA", LegacyCreateWindow, s_createWindowHook);
     MAKE_HOOK(L"User32.dll", "GetWindowRect", LegacyGetWindowRect, s_getWindowRectHook);
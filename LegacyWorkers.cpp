@@ -0,0 +1,229 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyWorkers.h"
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <Windows.h>
+#else
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+// ================================================================================================
+
+struct _WorkerBatch
+{
+    std::atomic<size_t> m_remaining;
+    bool m_finished;
+};
+
+// ================================================================================================
+
+static std::vector<size_t> WorkersGetCPUs()
+{
+    std::vector<size_t> cpus;
+#ifdef _WIN32
+    DWORD_PTR paff, saff;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &paff, &saff)) {
+        for (size_t i = 0; i < sizeof(DWORD_PTR) * 8; ++i) {
+            if (paff & ((DWORD_PTR)1 << i))
+                cpus.push_back(i);
+        }
+    }
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (size_t i = 0; i < CPU_SETSIZE; ++i) {
+            if (CPU_ISSET(i, &set))
+                cpus.push_back(i);
+        }
+    }
+#endif
+    return cpus;
+}
+
+// ================================================================================================
+
+static void WorkersPinThread(std::thread& thread, size_t cpu)
+{
+#ifdef _WIN32
+    SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << cpu);
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+}
+
+// ================================================================================================
+
+size_t WorkersAvailableCPUs()
+{
+    size_t ncpus = WorkersGetCPUs().size();
+    if (ncpus == 0)
+        ncpus = std::thread::hardware_concurrency();
+    return ncpus ? ncpus : 1;
+}
+
+// ================================================================================================
+
+WorkerPool::WorkerPool(int nthreads, bool pin)
+    : m_queued(0), m_nextVictim(0), m_quit(false)
+{
+    size_t threads = nthreads < 0 ? WorkersAvailableCPUs() - 1 : (size_t)nthreads;
+
+    m_workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        m_workers.emplace_back(new _Worker);
+
+    // Everything has to exist before anybody starts stealing from their neighbors.
+    std::vector<size_t> cpus = WorkersGetCPUs();
+    for (size_t i = 0; i < threads; ++i) {
+        m_workers[i]->m_thread = std::thread(&WorkerPool::workerThread, this, i);
+
+        // Leave the first CPU for whoever is handing out the work.
+        if (pin && !cpus.empty())
+            WorkersPinThread(m_workers[i]->m_thread, cpus[(i + 1) % cpus.size()]);
+    }
+}
+
+// ================================================================================================
+
+WorkerPool::~WorkerPool()
+{
+    m_quit = true;
+    for (std::unique_ptr<_Worker>& worker : m_workers)
+        worker->m_wake.signal();
+    for (std::unique_ptr<_Worker>& worker : m_workers)
+        worker->m_thread.join();
+}
+
+// ================================================================================================
+
+bool WorkerPool::popTask(size_t idx, _WorkerTask& task)
+{
+    _Worker& worker = *m_workers[idx];
+    std::lock_guard<std::mutex> _(worker.m_mut);
+    if (worker.m_tasks.empty())
+        return false;
+    task = worker.m_tasks.back();
+    worker.m_tasks.pop_back();
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+// ================================================================================================
+
+bool WorkerPool::stealTask(size_t first, _WorkerTask& task)
+{
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        if (m_queued.load(std::memory_order_relaxed) == 0)
+            return false;
+
+        _Worker& victim = *m_workers[(first + i) % m_workers.size()];
+        std::lock_guard<std::mutex> _(victim.m_mut);
+        if (victim.m_tasks.empty())
+            continue;
+        task = victim.m_tasks.front();
+        victim.m_tasks.pop_front();
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+// ================================================================================================
+
+void WorkerPool::runTask(const _WorkerTask& task)
+{
+    (*task.m_job)(task.m_index);
+
+    // The batch lives on the stack of whoever called run(), and they're allowed to leave the
+    // moment m_finished goes up. So, that has to be the very last thing we touch.
+    if (task.m_batch->m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> _(m_doneMut);
+        task.m_batch->m_finished = true;
+        m_doneCv.notify_all();
+    }
+}
+
+// ================================================================================================
+
+void WorkerPool::workerThread(size_t idx)
+{
+    _Worker& self = *m_workers[idx];
+    _WorkerTask task;
+    while (!m_quit) {
+        if (popTask(idx, task) || stealTask(idx + 1, task))
+            runTask(task);
+        else
+            self.m_wake.wait();
+    }
+}
+
+// ================================================================================================
+
+void WorkerPool::run(size_t count, const FWorkerJob& job)
+{
+    if (count == 0)
+        return;
+
+    // Not worth waking anybody up for.
+    if (count == 1 || m_workers.empty()) {
+        for (size_t i = 0; i < count; ++i)
+            job(i);
+        return;
+    }
+
+    _WorkerBatch batch;
+    batch.m_remaining = count;
+    batch.m_finished = false;
+
+    // Deal out contiguous chunks so that neighboring bands tend to end up on the same thread.
+    // Whoever finishes first will come and steal the rest.
+    size_t nworkers = std::min(m_workers.size(), count);
+    size_t first = m_nextVictim.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < nworkers; ++i) {
+        _Worker& worker = *m_workers[(first + i) % m_workers.size()];
+        size_t begin = (count * i) / nworkers;
+        size_t end = (count * (i + 1)) / nworkers;
+        {
+            std::lock_guard<std::mutex> _(worker.m_mut);
+            for (size_t j = end; j > begin; --j)
+                worker.m_tasks.push_back({ &job, j - 1, &batch });
+            m_queued.fetch_add(end - begin, std::memory_order_relaxed);
+        }
+        worker.m_wake.signal();
+    }
+
+    // Help out until there's nothing left to take, then wait for the stragglers.
+    _WorkerTask task;
+    while (batch.m_remaining.load(std::memory_order_acquire) != 0 && stealTask(first, task))
+        runTask(task);
+
+    std::unique_lock<std::mutex> lock(m_doneMut);
+    m_doneCv.wait(lock, [&batch]() { return batch.m_finished; });
+}
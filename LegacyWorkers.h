@@ -0,0 +1,98 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_WORKERS_H
+#define __LEGACY_WORKERS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "LegacyEvent.h"
+
+// ================================================================================================
+
+typedef std::function<void(size_t)> FWorkerJob;
+
+struct _WorkerBatch;
+
+struct _WorkerTask
+{
+    const FWorkerJob* m_job;
+    size_t m_index;
+    _WorkerBatch* m_batch;
+};
+
+// The CPUs this process is allowed to run on, which may be fewer than the machine has.
+size_t WorkersAvailableCPUs();
+
+// A handful of threads that sit around waiting to help chew through a frame. Every worker has
+// its own deque of tasks. Workers take from the back of their own and steal from the front of
+// everyone else's once they run dry. run() may be called from several threads at once. The
+// caller pitches in until its own jobs are done, so the job is free to reference things on the
+// caller's stack.
+class WorkerPool
+{
+    struct _Worker
+    {
+        std::thread m_thread;
+        std::mutex m_mut;
+        std::deque<_WorkerTask> m_tasks;
+        Event m_wake;
+    };
+
+    std::vector<std::unique_ptr<_Worker>> m_workers;
+    std::mutex m_doneMut;
+    std::condition_variable m_doneCv;
+    std::atomic<size_t> m_queued;
+    std::atomic<size_t> m_nextVictim;
+    std::atomic<bool> m_quit;
+
+    void workerThread(size_t idx);
+    bool popTask(size_t idx, _WorkerTask& task);
+    bool stealTask(size_t first, _WorkerTask& task);
+    void runTask(const _WorkerTask& task);
+
+public:
+    // The number of helper threads, not counting the caller. Negative means one fewer than the
+    // number of available CPUs, since the caller pitches in too. Pinning locks each helper to a
+    // CPU of its own.
+    explicit WorkerPool(int threads = -1, bool pin = false);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // The number of threads that can be working at once, including the caller.
+    size_t size() const { return m_workers.size() + 1; }
+
+    void run(size_t count, const FWorkerJob& job);
+};
+
+#endif
@@ -0,0 +1,236 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "LegacyWorkload.h"
+#include "LegacySurfaceHost.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <thread>
+
+// ================================================================================================
+
+static const char* s_workloadNames[] = {
+    "idle",
+    "cursor",
+    "sprites",
+    "background",
+    "video",
+};
+static_assert(std::size(s_workloadNames) == e_workloadCount, "a workload is missing its name");
+
+const char* WorkloadName(WorkloadScenario scenario)
+{
+    return scenario < e_workloadCount ? s_workloadNames[scenario] : "?";
+}
+
+// ================================================================================================
+
+bool WorkloadFromName(const char* name, WorkloadScenario& scenario)
+{
+    for (int i = 0; i < e_workloadCount; ++i) {
+        if (strcmp(name, s_workloadNames[i]) == 0) {
+            scenario = (WorkloadScenario)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ================================================================================================
+
+WorkloadGenerator::WorkloadGenerator(SurfaceHost& host, WorkloadScenario scenario,
+                                     const WorkloadParams& params)
+    : m_host(host), m_scenario(scenario), m_params(params), m_random(params.m_seed | 1)
+{
+    // The background is wider than the screen so the scrolling scenario has somewhere to go.
+    // Blocky noise rather than pure noise, since the real art has flat-ish areas in it.
+    m_backgroundWidth = PIPELINE_WIDTH * 2;
+    fill(m_background, m_backgroundWidth, PIPELINE_HEIGHT, 8);
+
+    int sprite = std::clamp(m_params.m_spriteSize, 1, PIPELINE_HEIGHT);
+    fill(m_sprite, sprite, sprite, 4);
+    int cursor = std::clamp(m_params.m_cursorSize, 1, PIPELINE_HEIGHT);
+    fill(m_cursor, cursor, cursor, 2);
+
+    auto addMover = [this](int size, int speed) {
+        int x = (int)(random() % (uint32_t)(PIPELINE_WIDTH - size + 1));
+        int y = (int)(random() % (uint32_t)(PIPELINE_HEIGHT - size + 1));
+        int dx = (int)(random() % (uint32_t)speed) + 1;
+        int dy = (int)(random() % (uint32_t)speed) + 1;
+        m_movers.push_back({ { x, y, x + size, y + size }, (random() & 1) ? dx : -dx, (random() & 1) ? dy : -dy });
+    };
+    if (m_scenario == e_workloadCursor)
+        addMover(cursor, 12);
+    else if (m_scenario == e_workloadSprites)
+        for (int i = 0; i < m_params.m_sprites; ++i)
+            addMover(sprite, 6);
+}
+
+// ================================================================================================
+
+uint32_t WorkloadGenerator::random()
+{
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    return m_random;
+}
+
+// ================================================================================================
+
+void WorkloadGenerator::fill(std::vector<uint16_t>& image, int width, int height, int blockSize)
+{
+    image.resize((size_t)width * height);
+    std::vector<uint16_t> blocks((width + blockSize - 1) / blockSize);
+    for (int y = 0; y < height; ++y) {
+        if ((y % blockSize) == 0)
+            for (uint16_t& block : blocks)
+                block = (uint16_t)random();
+        for (int x = 0; x < width; ++x)
+            image[(size_t)y * width + x] = blocks[x / blockSize] ^ (uint16_t)(x & 3);
+    }
+}
+
+// ================================================================================================
+
+void WorkloadGenerator::blit(const Rect& rect, const uint16_t* src, size_t srcPitch)
+{
+    m_host.bltFast(rect.left, rect.top, src, srcPitch, rect.width(), rect.height());
+    m_calls++;
+    m_pixels += rect.area();
+}
+
+// ================================================================================================
+
+void WorkloadGenerator::restore(const Rect& rect)
+{
+    blit(rect, m_background.data() + (size_t)rect.top * m_backgroundWidth + rect.left,
+         m_backgroundWidth * sizeof(uint16_t));
+}
+
+// ================================================================================================
+
+void WorkloadGenerator::move(_Mover& mover)
+{
+    Rect& r = mover.m_rect;
+    int size = r.width();
+    if (r.left + mover.m_dx < 0 || r.right + mover.m_dx > PIPELINE_WIDTH)
+        mover.m_dx = -mover.m_dx;
+    if (r.top + mover.m_dy < 0 || r.bottom + mover.m_dy > PIPELINE_HEIGHT)
+        mover.m_dy = -mover.m_dy;
+    r.left = std::clamp(r.left + mover.m_dx, 0, PIPELINE_WIDTH - size);
+    r.top = std::clamp(r.top + mover.m_dy, 0, PIPELINE_HEIGHT - size);
+    r.right = r.left + size;
+    r.bottom = r.top + size;
+}
+
+// ================================================================================================
+
+void WorkloadGenerator::drawVideoFrame(int64_t frame)
+{
+    // The movie decoder locks the whole surface and writes every pixel, whether or not they
+    // changed. Most of them do in a real movie, so slide the background under a per-frame tint.
+    uint16_t* pixels = m_host.lock();
+    size_t pitch = SurfaceHost::surfacePitch() / sizeof(uint16_t);
+    int offset = (int)((frame * 4) % PIPELINE_WIDTH);
+    uint16_t tint = (uint16_t)(frame * 0x0841);
+    for (int y = 0; y < PIPELINE_HEIGHT; ++y) {
+        const uint16_t* src = m_background.data() + (size_t)y * m_backgroundWidth + offset;
+        uint16_t* dst = pixels + y * pitch;
+        for (int x = 0; x < PIPELINE_WIDTH; ++x)
+            dst[x] = src[x] ^ tint;
+    }
+    m_host.unlock();
+    m_calls++;
+    m_pixels += PIPELINE_PIXELS;
+}
+
+// ================================================================================================
+
+void WorkloadGenerator::begin()
+{
+    restore({ 0, 0, PIPELINE_WIDTH, PIPELINE_HEIGHT });
+    const uint16_t* image = m_scenario == e_workloadCursor ? m_cursor.data() : m_sprite.data();
+    for (const _Mover& mover : m_movers)
+        blit(mover.m_rect, image, mover.m_rect.width() * sizeof(uint16_t));
+    m_videoFrame = -1;
+}
+
+// ================================================================================================
+
+void WorkloadGenerator::step(uint64_t tick)
+{
+    switch (m_scenario) {
+    case e_workloadCursor:
+    case e_workloadSprites:
+        {
+            // Erase-and-redraw, same as the game's sprite code. Everything gets erased before
+            // anything is drawn, or sprites that overlap would erase each other.
+            const uint16_t* image = m_scenario == e_workloadCursor ? m_cursor.data() : m_sprite.data();
+            for (_Mover& mover : m_movers) {
+                restore(mover.m_rect);
+                move(mover);
+            }
+            for (const _Mover& mover : m_movers)
+                blit(mover.m_rect, image, mover.m_rect.width() * sizeof(uint16_t));
+        }
+        break;
+    case e_workloadBackground:
+        {
+            int offset = (int)((tick * 4) % PIPELINE_WIDTH);
+            blit({ 0, 0, PIPELINE_WIDTH, PIPELINE_HEIGHT }, m_background.data() + offset,
+                 m_backgroundWidth * sizeof(uint16_t));
+        }
+        break;
+    case e_workloadVideo:
+        {
+            // The movie runs on its own clock, so most game ticks don't have a new frame.
+            int64_t frame = (int64_t)((double)tick * m_params.m_videoRate / m_params.m_tickRate);
+            if (frame != m_videoFrame) {
+                drawVideoFrame(frame);
+                m_videoFrame = frame;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// ================================================================================================
+
+void WorkloadGenerator::run(std::chrono::duration<double> length)
+{
+    using Clock = std::chrono::steady_clock;
+
+    begin();
+    Clock::time_point origin = Clock::now();
+    Clock::duration end = std::chrono::duration_cast<Clock::duration>(length);
+    for (uint64_t tick = 1; ; ++tick) {
+        auto due = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(tick / m_params.m_tickRate));
+        if (due >= end)
+            break;
+        std::this_thread::sleep_until(origin + due);
+        step(tick);
+    }
+}
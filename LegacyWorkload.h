@@ -0,0 +1,125 @@
+/* Copyright (C) 2019 Adam Johnson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __LEGACY_WORKLOAD_H
+#define __LEGACY_WORKLOAD_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "LegacyRegion.h"
+
+class SurfaceHost;
+
+// ================================================================================================
+
+// The kinds of things the game does to the proxy surface, boiled down into something that can
+// be generated without any game assets.
+enum WorkloadScenario
+{
+    // Nothing changes at all, like a menu waiting for input.
+    e_workloadIdle,
+
+    // Only the cursor moves, blitted over the background and then erased again.
+    e_workloadCursor,
+
+    // A handful of small sprites move around over a static background.
+    e_workloadSprites,
+
+    // The whole screen is redrawn with a BltFast every tick, like a scrolling map.
+    e_workloadBackground,
+
+    // Full frame Lock/Unlock at 15 fps, the way QuickTime plays the cutscenes.
+    e_workloadVideo,
+
+    e_workloadCount,
+};
+
+const char* WorkloadName(WorkloadScenario scenario);
+bool WorkloadFromName(const char* name, WorkloadScenario& scenario);
+
+struct WorkloadParams
+{
+    // How often the game goes around its loop.
+    double m_tickRate{ 60.0 };
+    double m_videoRate{ 15.0 };
+    int m_sprites{ 8 };
+    int m_spriteSize{ 48 };
+    int m_cursorSize{ 32 };
+    uint32_t m_seed{ 0x1E6AC1 };
+};
+
+// ================================================================================================
+
+// Plays a scenario into a SurfaceHost from whatever thread calls run(), which stands in for the
+// game thread. Everything goes through the same calls the hooks make, so the pipeline can't tell
+// the difference.
+class WorkloadGenerator
+{
+    SurfaceHost& m_host;
+    WorkloadScenario m_scenario;
+    WorkloadParams m_params;
+    uint32_t m_random;
+
+    std::vector<uint16_t> m_background;
+    int m_backgroundWidth{ 0 };
+    std::vector<uint16_t> m_sprite;
+    std::vector<uint16_t> m_cursor;
+
+    struct _Mover
+    {
+        Rect m_rect;
+        int m_dx;
+        int m_dy;
+    };
+    std::vector<_Mover> m_movers;
+    int64_t m_videoFrame{ -1 };
+
+    uint64_t m_calls{ 0 };
+    uint64_t m_pixels{ 0 };
+
+    uint32_t random();
+    void fill(std::vector<uint16_t>& image, int width, int height, int blockSize);
+    void blit(const Rect& rect, const uint16_t* src, size_t srcPitch);
+    void restore(const Rect& rect);
+    void move(_Mover& mover);
+    void drawVideoFrame(int64_t frame);
+
+public:
+    WorkloadGenerator(SurfaceHost& host, WorkloadScenario scenario,
+                      const WorkloadParams& params = WorkloadParams{ });
+
+    // Puts the starting screen up. Called by run(), but handy when stepping by hand.
+    void begin();
+
+    // One trip around the game loop.
+    void step(uint64_t tick);
+
+    // Steps at the tick rate until length has gone by.
+    void run(std::chrono::duration<double> length);
+
+    uint64_t calls() const { return m_calls; }
+    uint64_t pixels() const { return m_pixels; }
+};
+
+#endif